@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include <etna/GpuWorkCount.hpp>
+
+#include "StateTracking.hpp"
+
+
+// Compares looking tracked states up by dense ids with looking them up by handles.
+// Every access is a read that was already seen, so no barriers are recorded and
+// nothing reaches the GPU.
+
+static constexpr std::size_t BUFFER_COUNT = 100'000;
+static constexpr int ROUNDS = 20;
+
+template <class F>
+static double ns_per_access(const std::vector<std::uint32_t>& order, F&& access)
+{
+  const auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < ROUNDS; ++round)
+    for (const std::uint32_t i : order)
+      access(i);
+  const std::chrono::duration<double, std::nano> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return elapsed.count() / static_cast<double>(ROUNDS * order.size());
+}
+
+int main()
+{
+  etna::GpuWorkCount workCount{1};
+  etna::ResourceStates tracker{vk::Device{}, workCount, 0, false};
+  const vk::CommandBuffer cmd{};
+
+  std::vector<vk::Buffer> handles;
+  std::vector<etna::TrackedBufferId> ids;
+  handles.reserve(BUFFER_COUNT);
+  ids.reserve(BUFFER_COUNT);
+  for (std::size_t i = 0; i < BUFFER_COUNT; ++i)
+  {
+    handles.push_back(vk::Buffer(std::bit_cast<VkBuffer>(std::uint64_t{i + 1})));
+    ids.push_back(tracker.registerBuffer(handles.back(), 1024, "benchmark buffer"));
+  }
+
+  // Frames touch resources in no particular order
+  std::vector<std::uint32_t> order(BUFFER_COUNT);
+  std::iota(order.begin(), order.end(), 0u);
+  std::shuffle(order.begin(), order.end(), std::mt19937{42});
+
+  const auto stage = vk::PipelineStageFlagBits2::eComputeShader;
+  const auto access = vk::AccessFlagBits2::eShaderStorageRead;
+  const auto byHandle = [&](std::uint32_t i) {
+    tracker.setBufferState(cmd, handles[i], stage, access, 0, vk::WholeSize);
+  };
+  const auto byId = [&](std::uint32_t i) {
+    tracker.setBufferState(cmd, ids[i], handles[i], stage, access, 0, vk::WholeSize);
+  };
+
+  // Warms the states up, the first read of every buffer is the only one that changes them
+  ns_per_access(order, byHandle);
+
+  const double handleNs = ns_per_access(order, byHandle);
+  const double idNs = ns_per_access(order, byId);
+  std::printf("%zu buffers, %d rounds\n", BUFFER_COUNT, ROUNDS);
+  std::printf("by handle: %.1f ns per set_state\n", handleNs);
+  std::printf("by id:     %.1f ns per set_state\n", idNs);
+  std::printf("speedup:   %.2fx\n", handleNs / idNs);
+  return 0;
+}
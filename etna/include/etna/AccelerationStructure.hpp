@@ -0,0 +1,222 @@
+#pragma once
+#ifndef ETNA_ACCELERATION_STRUCTURE_HPP_INCLUDED
+#define ETNA_ACCELERATION_STRUCTURE_HPP_INCLUDED
+
+#include <array>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include <etna/Vulkan.hpp>
+#include <etna/Buffer.hpp>
+#include <etna/BindingItems.hpp>
+#include <etna/Forward.hpp>
+#include <etna/GpuSharedResource.hpp>
+
+
+namespace etna
+{
+
+class DeletionQueue;
+
+class AccelerationStructure
+{
+public:
+  AccelerationStructure() = default;
+  AccelerationStructure(
+    vk::Device device,
+    vk::AccelerationStructureTypeKHR type,
+    vk::DeviceSize in_size,
+    std::string_view name);
+
+  [[nodiscard]] vk::AccelerationStructureKHR get() const { return handle.get(); }
+  [[nodiscard]] vk::DeviceAddress getDeviceAddress() const { return address; }
+  [[nodiscard]] vk::DeviceSize getSize() const { return size; }
+
+  AccelerationStructureBinding genBinding() const { return {handle.get()}; }
+
+private:
+  // The handle has to be destroyed before the memory it lives in
+  Buffer storage;
+  vk::UniqueAccelerationStructureKHR handle;
+  vk::DeviceAddress address = 0;
+  vk::DeviceSize size = 0;
+};
+
+// Triangle geometry of a BLAS, all data is read by the GPU when the build is executed
+struct BlasTriangles
+{
+  vk::DeviceAddress vertexData;
+  vk::Format vertexFormat = vk::Format::eR32G32B32Sfloat;
+  vk::DeviceSize vertexStride = 3 * sizeof(float);
+  uint32_t maxVertex;
+  // Leave zero for non-indexed geometry
+  vk::DeviceAddress indexData = 0;
+  vk::IndexType indexType = vk::IndexType::eUint32;
+  uint32_t triangleCount;
+  // Optional vk::TransformMatrixKHR applied to the vertices
+  vk::DeviceAddress transformData = 0;
+  vk::GeometryFlagsKHR flags = vk::GeometryFlagBitsKHR::eOpaque;
+};
+
+// Procedural geometry of a BLAS made of vk::AabbPositionsKHR boxes
+struct BlasAabbs
+{
+  vk::DeviceAddress data;
+  vk::DeviceSize stride = sizeof(vk::AabbPositionsKHR);
+  uint32_t count;
+  vk::GeometryFlagsKHR flags = vk::GeometryFlagBitsKHR::eOpaque;
+};
+
+struct BlasCreateInfo
+{
+  std::vector<std::variant<BlasTriangles, BlasAabbs>> geometries;
+  vk::BuildAccelerationStructureFlagsKHR flags =
+    vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
+  // Copy the BLAS into a tightly sized one once the GPU reports how much memory it really needs
+  bool allowCompaction = true;
+  std::string name;
+};
+
+struct TlasCreateInfo
+{
+  uint32_t maxInstances;
+  // eAllowUpdate enables refitting instead of rebuilding when only transforms change
+  vk::BuildAccelerationStructureFlagsKHR flags =
+    vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace |
+    vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
+  // Refits make the tree worse as instances move, so it is rebuilt from scratch after this many
+  uint32_t maxConsecutiveRefits = 16;
+  std::string name;
+};
+
+struct TlasInstance
+{
+  BlasId blas;
+  // Rows of a 3x4 object to world matrix
+  std::array<float, 12> transform = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0};
+  // Only the lower 24 bits are available in shaders
+  uint32_t customIndex = 0;
+  uint8_t mask = 0xff;
+  uint32_t shaderBindingTableOffset = 0;
+  vk::GeometryInstanceFlagsKHR flags = {};
+};
+
+/**
+ * Owns bottom and top level acceleration structures and records their builds.
+ * BLAS builds are batched into a single command, and BLASes are compacted a
+ * few frames later when the GPU reports their compacted sizes, which usually
+ * cuts their memory in half. BLAS device addresses change on compaction, so
+ * TLASes are meant to be built every frame with buildTlas, which refits them
+ * instead of rebuilding when the set of instances did not change.
+ * Scratch memory comes from a per-frame pool that is recycled after the frame finishes.
+ */
+class AccelerationStructureManager
+{
+public:
+  AccelerationStructureManager(
+    vk::PhysicalDevice physical_device,
+    vk::Device dev,
+    const GpuWorkCount& work_count,
+    DeletionQueue& deletion_queue);
+
+  // The BLAS is built on the next build() call
+  BlasId createBlas(BlasCreateInfo info);
+  void destroyBlas(BlasId id);
+  bool isBlasBuilt(BlasId id) const;
+  const AccelerationStructure& getBlas(BlasId id) const;
+
+  TlasId createTlas(TlasCreateInfo info);
+  void destroyTlas(TlasId id);
+  const AccelerationStructure& getTlas(TlasId id) const;
+
+  // Records compactions of BLASes with known compacted sizes and builds of new BLASes.
+  // Call it before building TLASes every frame.
+  void build(vk::CommandBuffer cmd);
+
+  // Writes the instances and rebuilds or refits the TLAS. All BLASes must be built already.
+  void buildTlas(vk::CommandBuffer cmd, TlasId id, std::span<TlasInstance const> instances);
+
+  struct CompactionStats
+  {
+    uint32_t compactedCount = 0;
+    vk::DeviceSize sizeBefore = 0;
+    vk::DeviceSize sizeAfter = 0;
+  };
+  const CompactionStats& getCompactionStats() const { return compactionStats; }
+
+  AccelerationStructureManager(const AccelerationStructureManager&) = delete;
+  AccelerationStructureManager& operator=(const AccelerationStructureManager&) = delete;
+
+private:
+  // Bump allocator over per-frame scratch buffers, reset when its frame comes around again
+  struct ScratchBuffer
+  {
+    Buffer buffer;
+    vk::DeviceSize size;
+    vk::DeviceAddress address;
+  };
+
+  struct ScratchArena
+  {
+    std::vector<ScratchBuffer> buffers;
+    std::size_t current = 0;
+    vk::DeviceSize offset = 0;
+    std::uint64_t batch = 0;
+  };
+
+  struct Blas
+  {
+    // Empty until built and after being destroyed
+    std::optional<AccelerationStructure> structure;
+    std::string name;
+  };
+
+  struct Tlas
+  {
+    TlasCreateInfo info;
+    AccelerationStructure structure;
+    GpuSharedResource<Buffer> instances;
+    vk::DeviceSize buildScratchSize;
+    vk::DeviceSize updateScratchSize;
+    // BLAS addresses the TLAS was last built with, refits are only possible when they match
+    std::vector<vk::DeviceAddress> builtWith;
+    uint32_t refits = 0;
+    bool built = false;
+  };
+
+  struct PendingCompaction
+  {
+    // Batch the sizes were queried in, results are read once it is finished
+    std::uint64_t batch;
+    vk::UniqueQueryPool queries;
+    std::vector<BlasId> blases;
+  };
+
+  vk::Device device;
+  const GpuWorkCount& workCount;
+  DeletionQueue& deletionQueue;
+  vk::DeviceSize scratchAlignment;
+
+  std::vector<Blas> blases;
+  std::vector<std::pair<BlasId, BlasCreateInfo>> pendingBuilds;
+  std::vector<PendingCompaction> pendingCompactions;
+  std::vector<std::unique_ptr<Tlas>> tlases;
+  GpuSharedResource<ScratchArena> scratch;
+  CompactionStats compactionStats;
+
+  vk::DeviceAddress allocateScratch(vk::DeviceSize size);
+  void compactBuilt(vk::CommandBuffer cmd);
+  void buildPending(vk::CommandBuffer cmd);
+  Blas& getBlasSlot(BlasId id);
+  const Blas& getBlasSlot(BlasId id) const;
+  Tlas& getTlasSlot(TlasId id);
+  const Tlas& getTlasSlot(TlasId id) const;
+};
+
+} // namespace etna
+
+#endif // ETNA_ACCELERATION_STRUCTURE_HPP_INCLUDED
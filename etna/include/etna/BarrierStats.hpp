@@ -0,0 +1,49 @@
+#pragma once
+#ifndef ETNA_BARRIER_STATS_HPP_INCLUDED
+#define ETNA_BARRIER_STATS_HPP_INCLUDED
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+
+namespace etna
+{
+
+/**
+ * Barriers recorded by the resource tracker during a single frame.
+ * Counting mergeable barriers and the breakdowns require looking up
+ * resource names, so they are only done when InitParams::collectBarrierStats is set.
+ */
+struct BarrierStats
+{
+  // Batch index of GpuWorkCount the barriers were recorded in
+  std::uint64_t frame = 0;
+
+  // vkCmdPipelineBarrier2 calls made by flush_barriers, empty flushes are not counted
+  std::uint32_t flushes = 0;
+  std::uint32_t maxBarriersPerFlush = 0;
+  // vkCmdSetEvent2 calls made by release_state
+  std::uint32_t splitBarriers = 0;
+
+  std::uint32_t imageBarriers = 0;
+  std::uint32_t bufferBarriers = 0;
+
+  // Read to read barriers which keep the layout. Besides ForceSetState::eTrue, these are
+  // placed for reads in stages that a previous transition into a read-only layout was
+  // not made for, which have to wait for it. A high count still points at redundant
+  // set_state calls, but not every one of these barriers can be removed.
+  std::uint32_t avoidableBarriers = 0;
+  // Barriers for a resource which already had one in the same command,
+  // e.g. for neighbouring mip levels, which could have been a single barrier
+  std::uint32_t mergeableBarriers = 0;
+
+  // Keyed by "OldLayout -> NewLayout", buffer barriers are not included
+  std::map<std::string, std::uint32_t> byLayoutTransition;
+  // Keyed by debug names of images and buffers, or by handles for resources not created by Etna
+  std::map<std::string, std::uint32_t> byResource;
+};
+
+} // namespace etna
+
+#endif // ETNA_BARRIER_STATS_HPP_INCLUDED
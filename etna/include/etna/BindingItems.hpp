@@ -21,6 +21,14 @@ struct ImageBinding
 {
   const Image* image;
   vk::DescriptorImageInfo descriptor_info;
+  // Mip levels and layers seen through the view, only these get barriers
+  vk::ImageSubresourceRange subresource_range{
+    .aspectMask = {},
+    .baseMipLevel = 0,
+    .levelCount = vk::RemainingMipLevels,
+    .baseArrayLayer = 0,
+    .layerCount = vk::RemainingArrayLayers,
+  };
 };
 
 struct SamplerBinding
@@ -28,6 +36,11 @@ struct SamplerBinding
   vk::DescriptorImageInfo descriptor_info;
 };
 
+struct AccelerationStructureBinding
+{
+  vk::AccelerationStructureKHR acceleration_structure;
+};
+
 } // namespace etna
 
 #endif // ETNA_BINDING_ITEMS_HPP_INCLUDED
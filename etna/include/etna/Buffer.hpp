@@ -2,10 +2,12 @@
 #ifndef ETNA_BUFFER_HPP_INCLUDED
 #define ETNA_BUFFER_HPP_INCLUDED
 
+#include <span>
 #include <string_view>
 
 #include <etna/Vulkan.hpp>
 #include <etna/BindingItems.hpp>
+#include <etna/Forward.hpp>
 #include <vk_mem_alloc.h>
 
 
@@ -14,6 +16,8 @@ namespace etna
 
 class Buffer
 {
+  friend class ResourceStates;
+
 public:
   Buffer() = default;
 
@@ -41,6 +45,10 @@ public:
 
     // Name of the image for debugging tools
     std::string_view name;
+
+    // Queue families that access the buffer concurrently, which spares ownership
+    // transfers between them. Fewer than two families mean exclusive sharing.
+    std::span<const uint32_t> concurrentQueueFamilies = {};
   };
 
   Buffer(VmaAllocator alloc, CreateInfo info);
@@ -53,8 +61,12 @@ public:
   Buffer& operator=(Buffer&&) noexcept;
 
   [[nodiscard]] vk::Buffer get() const { return buffer; }
+  [[nodiscard]] vk::DeviceSize getSize() const { return size; }
   [[nodiscard]] std::byte* data() { return mapped; }
 
+  // Requires eShaderDeviceAddress usage and the bufferDeviceAddress feature
+  [[nodiscard]] vk::DeviceAddress getDeviceAddress() const;
+
   BufferBinding genBinding(vk::DeviceSize offset = 0, vk::DeviceSize range = vk::WholeSize) const;
 
   // If the buffer is in CPU_TO_GPU or GPU_TO_CPU memory, returns a CPU-accessible
@@ -73,7 +85,9 @@ private:
 
   VmaAllocation allocation{};
   vk::Buffer buffer{};
+  vk::DeviceSize size{};
   std::byte* mapped{};
+  TrackedBufferId trackingId = TrackedBufferId::Invalid;
 };
 
 } // namespace etna
@@ -0,0 +1,92 @@
+#pragma once
+#ifndef ETNA_COMMAND_BUFFER_STATES_HPP_INCLUDED
+#define ETNA_COMMAND_BUFFER_STATES_HPP_INCLUDED
+
+#include <memory>
+
+#include <etna/Vulkan.hpp>
+#include <etna/Image.hpp>
+#include <etna/Buffer.hpp>
+
+
+namespace etna
+{
+
+/**
+ * Tracks resource states inside a single command buffer without touching the global
+ * tracker, so that command buffers can be recorded on several threads at once.
+ * The first use of every resource is only remembered and no barrier is recorded for it.
+ * Once recording is done, etna::resolve_states records the barriers the first uses
+ * need into a prologue command buffer and commits the final states to the global tracker.
+ * Resources have to stay alive until the states are resolved.
+ *
+ *   // on a worker thread
+ *   etna::CommandBufferStates states(cmd);
+ *   states.setState(image, stages, access, layout);
+ *   states.flushBarriers();
+ *   // on the thread that submits, in submission order
+ *   auto prologue = etna::resolve_states(states);
+ */
+class CommandBufferStates
+{
+  friend class ResourceStates;
+
+public:
+  explicit CommandBufferStates(vk::CommandBuffer cmd);
+  ~CommandBufferStates();
+
+  CommandBufferStates(const CommandBufferStates&) = delete;
+  CommandBufferStates& operator=(const CommandBufferStates&) = delete;
+  CommandBufferStates(CommandBufferStates&&) noexcept;
+  CommandBufferStates& operator=(CommandBufferStates&&) noexcept;
+
+  vk::CommandBuffer getCommandBuffer() const;
+
+  // All aspects, mip levels and layers of the image
+  void setState(
+    const Image& image,
+    vk::PipelineStageFlags2 pipeline_stage_flags,
+    vk::AccessFlags2 access_flags,
+    vk::ImageLayout layout);
+
+  void setState(
+    const Image& image,
+    vk::PipelineStageFlags2 pipeline_stage_flags,
+    vk::AccessFlags2 access_flags,
+    vk::ImageLayout layout,
+    vk::ImageSubresourceRange range);
+
+  // For images not created by Etna, e.g. swapchain images, which are tracked as a whole
+  void setState(
+    vk::Image image,
+    vk::PipelineStageFlags2 pipeline_stage_flags,
+    vk::AccessFlags2 access_flags,
+    vk::ImageLayout layout,
+    vk::ImageAspectFlags aspect_flags);
+
+  // Size may be VK_WHOLE_SIZE. Buffers not created by Etna are tracked as a whole.
+  void setState(
+    vk::Buffer buffer,
+    vk::PipelineStageFlags2 pipeline_stage_flags,
+    vk::AccessFlags2 access_flags,
+    vk::DeviceSize offset = 0,
+    vk::DeviceSize size = vk::WholeSize);
+
+  void setState(
+    const Buffer& buffer,
+    vk::PipelineStageFlags2 pipeline_stage_flags,
+    vk::AccessFlags2 access_flags,
+    vk::DeviceSize offset = 0,
+    vk::DeviceSize size = vk::WholeSize);
+
+  // Records barriers between uses inside the command buffer
+  void flushBarriers();
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+} // namespace etna
+
+#endif // ETNA_COMMAND_BUFFER_STATES_HPP_INCLUDED
@@ -2,9 +2,13 @@
 #ifndef ETNA_COMPUTE_PIPELINE_HPP_INCLUDED
 #define ETNA_COMPUTE_PIPELINE_HPP_INCLUDED
 
+#include <array>
+#include <optional>
+
 #include <etna/Vulkan.hpp>
 #include <etna/VertexInput.hpp>
 #include <etna/PipelineBase.hpp>
+#include <etna/SpecializationConstants.hpp>
 
 
 namespace etna
@@ -25,7 +29,34 @@ public:
   ComputePipeline() = default;
   struct CreateInfo
   {
+    // Other combinations can be requested later with getVkPipeline(overrides)
+    SpecializationConstants specConstants = {};
+
+    // Overrides the workgroup size of shaders that declare it with local_size_x_id and friends.
+    // Dimensions declared with constant sizes must keep them.
+    std::optional<std::array<uint32_t, 3>> workgroupSize = std::nullopt;
+
+    // Pins the subgroup size instead of letting the driver choose it. Requires the
+    // subgroupSizeControl feature and compute in requiredSubgroupSizeStages.
+    std::optional<uint32_t> requiredSubgroupSize = std::nullopt;
+    // Makes all subgroups of a workgroup full, requires the computeFullSubgroups feature.
+    // The workgroup X size must be a multiple of the subgroup size then, which is the
+    // maxSubgroupSize limit unless requiredSubgroupSize is set.
+    bool requireFullSubgroups = false;
   };
+
+  // Workgroup size the pipeline was compiled with, or of the permutation bound with
+  // getVkPipeline(overrides) if overrides are given
+  std::array<uint32_t, 3> getWorkgroupSize(const SpecializationConstants& overrides = {}) const;
+
+  // Dispatches enough workgroups to run at least one invocation per element of the problem.
+  // Pass the same overrides as to getVkPipeline when a permutation is bound.
+  void dispatchThreads(
+    vk::CommandBuffer cmd,
+    uint32_t size_x,
+    uint32_t size_y = 1,
+    uint32_t size_z = 1,
+    const SpecializationConstants& overrides = {}) const;
 };
 
 } // namespace etna
@@ -0,0 +1,85 @@
+#pragma once
+#ifndef ETNA_DELETION_QUEUE_HPP_INCLUDED
+#define ETNA_DELETION_QUEUE_HPP_INCLUDED
+
+#include <deque>
+#include <memory>
+#include <type_traits>
+
+#include <etna/GpuWorkCount.hpp>
+
+
+namespace etna
+{
+
+/**
+ * Keeps objects that might still be used by in-flight GPU work alive until
+ * the GPU is guaranteed to be done with them. Any RAII object can be retired,
+ * e.g. vk::UniquePipeline or std::unique_ptr<ShaderModule>; raw handles
+ * should be wrapped into their vk::Unique counterparts first.
+ */
+class DeletionQueue
+{
+public:
+  explicit DeletionQueue(const GpuWorkCount& work_count)
+    : workCount{&work_count}
+  {
+  }
+
+  template <class T>
+  void retire(T&& object)
+  {
+    using Stored = std::remove_cvref_t<T>;
+    entries.push_back(Entry{
+      .batch = workCount->batchIndex(),
+      .object = std::make_unique<Holder<Stored>>(std::forward<T>(object)),
+    });
+  }
+
+  /// Destroys objects retired at least multiBufferingCount() batches ago.
+  /// Must be called when a new batch starts, i.e. the oldest batch is known to be finished.
+  void collect()
+  {
+    const auto inflight = static_cast<std::uint64_t>(workCount->multiBufferingCount());
+    while (!entries.empty() && entries.front().batch + inflight <= workCount->batchIndex())
+      entries.pop_front();
+  }
+
+  /// Destroys everything right away, the GPU must be idle.
+  void flush() { entries.clear(); }
+
+  std::size_t size() const { return entries.size(); }
+
+  DeletionQueue(const DeletionQueue&) = delete;
+  DeletionQueue& operator=(const DeletionQueue&) = delete;
+
+private:
+  struct HolderBase
+  {
+    virtual ~HolderBase() = default;
+  };
+
+  template <class T>
+  struct Holder final : HolderBase
+  {
+    explicit Holder(T&& in_value)
+      : value{std::move(in_value)}
+    {
+    }
+
+    T value;
+  };
+
+  struct Entry
+  {
+    std::uint64_t batch;
+    std::unique_ptr<HolderBase> object;
+  };
+
+  const GpuWorkCount* workCount;
+  std::deque<Entry> entries;
+};
+
+} // namespace etna
+
+#endif // ETNA_DELETION_QUEUE_HPP_INCLUDED
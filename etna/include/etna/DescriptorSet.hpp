@@ -37,10 +37,18 @@ struct Binding
     , resources{sampler_info}
   {
   }
+  Binding(
+    uint32_t rbinding, const AccelerationStructureBinding& as_info, uint32_t array_index = 0)
+    : binding{rbinding}
+    , arrayElem{array_index}
+    , resources{as_info}
+  {
+  }
 
   uint32_t binding;
   uint32_t arrayElem;
-  std::variant<ImageBinding, BufferBinding, SamplerBinding> resources;
+  std::variant<ImageBinding, BufferBinding, SamplerBinding, AccelerationStructureBinding>
+    resources;
 };
 
 /*Maybe we need a hierarchy of descriptor sets*/
@@ -129,7 +137,8 @@ private:
  */
 struct DynamicDescriptorPool
 {
-  DynamicDescriptorPool(vk::Device dev, const GpuWorkCount& work_count);
+  DynamicDescriptorPool(
+    vk::Device dev, const GpuWorkCount& work_count, bool acceleration_structures = false);
 
   void beginFrame();
   void destroyAllocatedSets();
@@ -161,7 +170,7 @@ private:
  */
 struct PersistentDescriptorPool
 {
-  explicit PersistentDescriptorPool(vk::Device dev);
+  explicit PersistentDescriptorPool(vk::Device dev, bool acceleration_structures = false);
 
   PersistentDescriptorSet allocateSet(
     DescriptorLayoutId layout_id, std::vector<Binding> bindings, bool allow_unbound_slots = false);
@@ -4,6 +4,7 @@
 
 #include <array>
 #include <bitset>
+#include <span>
 #include <vector>
 #include <unordered_map>
 
@@ -20,6 +21,7 @@ constexpr uint32_t MAX_DESCRIPTOR_BINDINGS =
   32u; /*If you are out of bindings, try using arrays of images/samplers*/
 
 struct DescriptorSetLayoutHash;
+class DeletionQueue;
 
 struct DescriptorSetInfo
 {
@@ -85,6 +87,12 @@ struct DescriptorSetLayoutHash
 
 using DescriptorLayoutId = uint32_t;
 
+/**
+ * Layout ids are content-addressed: the same DescriptorSetInfo always maps
+ * to the same id for the lifetime of the cache, even across shader reloads.
+ * Hence descriptor sets allocated for a layout stay valid as long as some
+ * program still uses a layout with identical contents.
+ */
 struct DescriptorSetLayoutCache
 {
   DescriptorSetLayoutCache() {}
@@ -93,12 +101,24 @@ struct DescriptorSetLayoutCache
     // make device global and call clear hear
   }
 
+  // Layouts registered explicitly are never garbage collected
   DescriptorLayoutId registerLayout(vk::Device device, const DescriptorSetInfo& info);
   void clear(vk::Device device);
 
+  // Retires vulkan layouts which are neither in alive_ids nor registered explicitly.
+  // Ids of retired layouts stay reserved and get the layout recreated on next use.
+  void collectGarbage(
+    vk::Device device,
+    std::span<DescriptorLayoutId const> alive_ids,
+    DeletionQueue& deletion_queue);
+
   const DescriptorSetInfo& getLayoutInfo(DescriptorLayoutId id) const { return descriptors.at(id); }
 
-  vk::DescriptorSetLayout getVkLayout(DescriptorLayoutId id) const { return vkLayouts.at(id); }
+  vk::DescriptorSetLayout getVkLayout(DescriptorLayoutId id) const
+  {
+    ETNA_VERIFYF(vkLayouts.at(id), "Descriptor set layout #{} was garbage collected", id);
+    return vkLayouts[id];
+  }
 
   std::pair<DescriptorLayoutId, vk::DescriptorSetLayout> get(
     vk::Device device, const DescriptorSetInfo& info);
@@ -110,6 +130,50 @@ private:
   std::unordered_map<DescriptorSetInfo, DescriptorLayoutId, DescriptorSetLayoutHash> map;
   std::vector<DescriptorSetInfo> descriptors;
   std::vector<vk::DescriptorSetLayout> vkLayouts;
+  std::vector<bool> pinned;
+};
+
+struct PipelineLayoutKey
+{
+  std::array<DescriptorLayoutId, MAX_PROGRAM_DESCRIPTORS> setLayouts{};
+  uint32_t setLayoutCount = 0;
+  vk::PushConstantRange pushConst{};
+
+  bool operator==(const PipelineLayoutKey& rhs) const = default;
+};
+
+struct PipelineLayoutKeyHash
+{
+  std::size_t operator()(const PipelineLayoutKey& key) const;
+};
+
+/**
+ * Programs with identical set layouts and push constants share a single
+ * pipeline layout, which makes their pipelines layout-compatible, i.e.
+ * bound descriptor sets survive switching between such pipelines.
+ */
+struct PipelineLayoutCache
+{
+  PipelineLayoutCache() {}
+
+  vk::PipelineLayout get(
+    vk::Device device,
+    const DescriptorSetLayoutCache& set_layouts,
+    std::span<DescriptorLayoutId const> set_layout_ids,
+    vk::PushConstantRange push_const);
+
+  // Retires all pipeline layouts not present in alive_layouts
+  void collectGarbage(
+    vk::Device device,
+    std::span<vk::PipelineLayout const> alive_layouts,
+    DeletionQueue& deletion_queue);
+  void clear(vk::Device device);
+
+  PipelineLayoutCache(const PipelineLayoutCache&) = delete;
+  PipelineLayoutCache& operator=(const PipelineLayoutCache&) = delete;
+
+private:
+  std::unordered_map<PipelineLayoutKey, vk::PipelineLayout, PipelineLayoutKeyHash> map;
 };
 
 } // namespace etna
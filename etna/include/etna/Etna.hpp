@@ -8,9 +8,13 @@
 
 #include <etna/Vulkan.hpp>
 #include <etna/ShaderProgram.hpp>
+#include <etna/ShaderVariants.hpp>
 #include <etna/DescriptorSet.hpp>
 #include <etna/Image.hpp>
+#include <etna/Buffer.hpp>
 #include <etna/BarrierBehavior.hpp>
+#include <etna/BarrierStats.hpp>
+#include <etna/CommandBufferStates.hpp>
 
 namespace etna
 {
@@ -43,6 +47,39 @@ struct InitParams
 
   /// Whether things like createDescriptorSet or renderTarget should auto-create barriers
   bool generateBarriersAutomatically = true;
+
+  /// File to cache SPIR-V reflection results in between runs, no caching if not provided
+  std::optional<std::filesystem::path> shaderReflectionCachePath = std::nullopt;
+
+  /// Shader bundle created with pack_shader_bundle. Shaders found in it are
+  /// loaded from the bundle instead of separate files on disk.
+  std::optional<std::filesystem::path> shaderBundlePath = std::nullopt;
+  /// Directory that create_program paths are made relative to before being looked up in the bundle
+  std::filesystem::path shaderBundleRoot = {};
+
+  /// Watch files of loaded shaders for modifications, see reload_changed_shaders
+  bool watchShaderFiles = false;
+
+  /// spirv-opt passes to run on shaders before handing them to the driver, for instance
+  /// default_spirv_optimizer_passes(). Requires building etna with ETNA_SPIRV_OPTIMIZER.
+  std::vector<std::string> shaderOptimizerPasses = {};
+  /// File to cache optimized shaders in between runs, keyed by shader contents and passes
+  std::optional<std::filesystem::path> optimizedShaderCachePath = std::nullopt;
+
+  /// Enable VK_EXT_shader_object if the device supports it, see ShaderObjectManager
+  bool enableShaderObjects = false;
+
+  /// Enable task and mesh shaders (VK_EXT_mesh_shader) if the device supports them,
+  /// see PipelineManager::createMeshPipeline
+  bool enableMeshShaders = false;
+
+  /// Enable ray tracing pipelines and acceleration structures (VK_KHR_ray_tracing_pipeline,
+  /// VK_KHR_acceleration_structure) if the device supports them. This also enables
+  /// bufferDeviceAddress, see GlobalContext::getAccelerationStructures
+  bool enableRayTracing = false;
+
+  /// Break barrier statistics down by layout transitions and resources, see get_barrier_stats
+  bool collectBarrierStats = false;
 };
 
 bool is_initilized();
@@ -63,16 +100,59 @@ void end_frame();
 ShaderProgramId create_program(
   const char* name, std::initializer_list<std::filesystem::path> shaders_path);
 
+/**
+ * \brief Creates several shader programs at once. Shader modules are read,
+ * reflected and created on multiple threads, modules shared between programs
+ * are loaded only once. IDs are assigned exactly as if create_program was
+ * called for every program in order.
+ *
+ * \return IDs of the newly created shader programs, in the order of \p programs.
+ */
+std::vector<ShaderProgramId> create_programs(std::span<ShaderProgramCreateInfo const> programs);
+std::vector<ShaderProgramId> create_programs(
+  std::initializer_list<ShaderProgramCreateInfo> programs);
+
 ShaderProgramId get_program_id(const char* name);
 
 /**
  * \brief Reload shader files.
  * \warning
  * 1) This function must be called from gpu idle state
- * 2) All descriptor sets become invalid after calling this function
+ * 2) All non-persistent descriptor sets become invalid after calling this function
+ * \note Descriptor layout ids are stable: a persistent descriptor set stays valid
+ * as long as the reloaded shaders declare the exact same set layout.
  */
 void reload_shaders();
 
+/**
+ * \brief Reloads shader modules which were modified on disk since the last call,
+ * together with the programs and pipelines using them. Does not require the GPU
+ * to be idle: replaced vulkan objects are destroyed once in-flight frames finish.
+ * Requires InitParams::watchShaderFiles, call it outside of command buffer recording.
+ * \note Shaders loaded from a shader bundle are reloaded from the bundle.
+ * \return Whether any shader was reloaded.
+ */
+bool reload_changed_shaders();
+
+/**
+ * \brief Declares a family of shader programs parametrized by keywords.
+ * Programs for keyword combinations are only created when requested by get_shader_variant.
+ */
+ShaderVariantsId declare_shader_variants(ShaderVariantsCreateInfo info);
+
+/**
+ * \brief Mask bits for a single keyword value. Combine bits of all keywords with
+ * bitwise OR, keywords that are not mentioned in a mask have the value 0.
+ */
+ShaderVariantMask get_shader_keyword_bits(
+  ShaderVariantsId id, ShaderNameHash keyword, uint32_t value);
+
+/**
+ * \brief Resolves a keyword combination to a shader program and specialization
+ * constants to create pipelines with, loading the program on first use.
+ */
+const ShaderVariant& get_shader_variant(ShaderVariantsId id, ShaderVariantMask mask);
+
 // Access information required for executing a pipeline.
 ShaderProgramInfo get_shader_program(ShaderProgramId id);
 
@@ -141,6 +221,44 @@ void set_state(
   vk::ImageAspectFlags aspect_flags,
   ForceSetState force = ForceSetState::eFalse);
 
+/**
+ * \brief Sets the state of some mip levels and layers of an image,
+ * the rest of the image keeps its state. Useful for mip chain generation
+ * and rendering into separate layers.
+ *
+ * \param range Which subresources of the image will be used?
+ */
+void set_state(
+  vk::CommandBuffer com_buffer,
+  vk::Image image,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout layout,
+  vk::ImageSubresourceRange range,
+  ForceSetState force = ForceSetState::eFalse);
+
+/**
+ * \brief Overloads for images created by Etna, which are tracked without
+ * looking their handles up. Without a range, all aspects, mip levels and
+ * layers of the image are used.
+ */
+void set_state(
+  vk::CommandBuffer com_buffer,
+  const Image& image,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout layout,
+  ForceSetState force = ForceSetState::eFalse);
+
+void set_state(
+  vk::CommandBuffer com_buffer,
+  const Image& image,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout layout,
+  vk::ImageSubresourceRange range,
+  ForceSetState force = ForceSetState::eFalse);
+
 /**
  * \brief Sets the state of a buffer before using it in a certain way.
  * Note that Etna calls this automatically in some cases.
@@ -157,6 +275,42 @@ void set_state(
   vk::AccessFlags2 access_flags,
   ForceSetState force = ForceSetState::eFalse);
 
+/**
+ * \brief Sets the state of a range of a buffer, the rest of the buffer keeps
+ * its state. Useful when unrelated data is suballocated from a single buffer.
+ *
+ * \param offset Where the used range starts, in bytes.
+ * \param size Size of the used range in bytes, may be VK_WHOLE_SIZE.
+ */
+void set_state(
+  vk::CommandBuffer com_buffer,
+  vk::Buffer buffer,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::DeviceSize offset,
+  vk::DeviceSize size,
+  ForceSetState force = ForceSetState::eFalse);
+
+/**
+ * \brief Overloads for buffers created by Etna, which are tracked without
+ * looking their handles up.
+ */
+void set_state(
+  vk::CommandBuffer com_buffer,
+  const Buffer& buffer,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  ForceSetState force = ForceSetState::eFalse);
+
+void set_state(
+  vk::CommandBuffer com_buffer,
+  const Buffer& buffer,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::DeviceSize offset,
+  vk::DeviceSize size,
+  ForceSetState force = ForceSetState::eFalse);
+
 /**
  * \brief Flushes all barriers resulting from set_state calls.
  * \note Remember to call this before any draw/dispatch/transfer commands!
@@ -167,6 +321,85 @@ void flush_barriers(vk::CommandBuffer com_buffer);
 
 void finish_frame(vk::CommandBuffer com_buffer);
 
+/**
+ * \brief Starts a split barrier: transitions the image into the given state
+ * with vkCmdSetEvent2 right after its last write, so that the GPU may execute
+ * unrelated work until etna::acquire_state waits for the transition. The image
+ * must not be used until it is acquired, which must happen in the same frame.
+ * Parameters are the same as for etna::set_state.
+ */
+void release_state(
+  vk::CommandBuffer com_buffer,
+  vk::Image image,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout layout,
+  vk::ImageSubresourceRange range);
+
+void release_state(
+  vk::CommandBuffer com_buffer,
+  vk::Buffer buffer,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags);
+
+/**
+ * \brief Finishes a split barrier started with etna::release_state, call it
+ * right before the first use of the resource. Does nothing if the release
+ * did not need a barrier.
+ */
+void acquire_state(vk::CommandBuffer com_buffer, vk::Image image);
+void acquire_state(vk::CommandBuffer com_buffer, vk::Buffer buffer);
+
+/**
+ * \brief Merges states of a command buffer recorded with its own CommandBufferStates,
+ * possibly on another thread, into the global tracker. Call it on the thread that records
+ * barriers with etna::set_state, in the order the command buffers are submitted.
+ * \return Prologue command buffer with the barriers the first uses of resources need,
+ * submit it right before the recorded one. A null handle if no barriers were needed.
+ */
+vk::CommandBuffer resolve_states(CommandBufferStates& states);
+
+/**
+ * \brief Tells the tracker which queue family a command buffer allocated by hand
+ * belongs to, command buffers of Etna's managers are registered automatically.
+ * Others are assumed to run on the universal queue. Register the command buffer
+ * again if its handle may have been reused by one from another pool.
+ */
+void set_queue_family(vk::CommandBuffer com_buffer, uint32_t queue_family);
+
+/**
+ * \brief Exclusive resources used in command buffers of another queue family than
+ * the last time change owners: set_state records the acquire half of the transfer,
+ * while the release half is recorded by this function.
+ * \return Command buffer to submit on a queue of the family giving resources away,
+ * after the work that used them last. Submissions acquiring the resources have to
+ * wait for it with a semaphore. A null handle if nothing was released.
+ */
+vk::CommandBuffer record_queue_releases(uint32_t queue_family);
+
+// Number of images and buffers whose states are currently tracked for barriers.
+// Useful for catching resources that are never destroyed.
+struct TrackedResourceCounts
+{
+  std::size_t images;
+  std::size_t buffers;
+};
+TrackedResourceCounts get_tracked_resource_counts();
+
+/**
+ * \brief Barriers recorded during the previous frame. The counts are also
+ * sent to Tracy as plots. Set InitParams::collectBarrierStats to get them
+ * broken down by layout transitions and resources.
+ */
+const BarrierStats& get_barrier_stats();
+
+/**
+ * \brief Writes every barrier recorded during the next frame into a JSON file,
+ * in the order they were recorded. The file is written by the begin_frame call
+ * that follows the frame, or when etna is shut down during it.
+ */
+void capture_barrier_trace(std::filesystem::path path);
+
 } // namespace etna
 
 #endif // ETNA_ETNA_HPP_INCLUDED
@@ -20,6 +20,48 @@ enum class ShaderProgramId : std::uint32_t
   Invalid = ~std::uint32_t{0}
 };
 
+class ShaderObjectManager;
+enum class ShaderObjectProgramId : std::uint32_t
+{
+  Invalid = ~std::uint32_t{0}
+};
+
+class ShaderVariantManager;
+enum class ShaderVariantsId : std::uint32_t
+{
+  Invalid = ~std::uint32_t{0}
+};
+
+class AccelerationStructureManager;
+enum class BlasId : std::uint32_t
+{
+  Invalid = ~std::uint32_t{0}
+};
+enum class TlasId : std::uint32_t
+{
+  Invalid = ~std::uint32_t{0}
+};
+
+class ResourceStates;
+enum class TrackedImageId : std::uint32_t
+{
+  Invalid = ~std::uint32_t{0}
+};
+enum class TrackedBufferId : std::uint32_t
+{
+  Invalid = ~std::uint32_t{0}
+};
+
+class RenderGraph;
+enum class GraphImageId : std::uint32_t
+{
+  Invalid = ~std::uint32_t{0}
+};
+enum class GraphBufferId : std::uint32_t
+{
+  Invalid = ~std::uint32_t{0}
+};
+
 } // namespace etna
 
 
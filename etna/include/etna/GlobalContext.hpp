@@ -18,13 +18,18 @@ namespace etna
 {
 
 struct DescriptorSetLayoutCache;
+struct PipelineLayoutCache;
 struct ShaderProgramManager;
+class ShaderVariantManager;
 class PipelineManager;
+class ShaderObjectManager;
 struct DynamicDescriptorPool;
 struct PersistentDescriptorPool;
 class ResourceStates;
 class PerFrameCmdMgr;
 class OneShotCmdMgr;
+class DeletionQueue;
+class AccelerationStructureManager;
 
 class GlobalContext
 {
@@ -45,13 +50,32 @@ public:
   vk::Instance getInstance() const { return vkInstance.get(); }
   vk::Queue getQueue() const { return universalQueue; }
   uint32_t getQueueFamilyIdx() const { return universalQueueFamilyIdx; }
+  // For memory that is allocated by hand, e.g. shared between several images
+  VmaAllocator getAllocator() const { return vmaAllocator.get(); }
 
   ShaderProgramManager& getShaderManager();
+  ShaderVariantManager& getShaderVariants();
   PipelineManager& getPipelineManager();
+  // Only available if shader objects were requested and are supported by the device
+  ShaderObjectManager& getShaderObjectManager();
+  bool hasShaderObjects() const { return shaderObjectManager != nullptr; }
+  // Whether VK_EXT_mesh_shader was requested and is supported by the device
+  bool hasMeshShaders() const { return meshShadersEnabled; }
+  // Whether ray tracing pipelines and acceleration structures were requested and are supported
+  bool hasRayTracing() const { return rayTracingEnabled; }
+  // Subgroup size control features that the application enabled in InitParams::features
+  const vk::PhysicalDeviceSubgroupSizeControlFeatures& getSubgroupSizeControlFeatures() const
+  {
+    return subgroupSizeControlFeatures;
+  }
+  // Only available if hasRayTracing()
+  AccelerationStructureManager& getAccelerationStructures();
   DescriptorSetLayoutCache& getDescriptorSetLayouts();
+  PipelineLayoutCache& getPipelineLayouts();
   DynamicDescriptorPool& getDescriptorPool();
   PersistentDescriptorPool& getPersistentDescriptorPool();
   ResourceStates& getResourceTracker();
+  DeletionQueue& getDeletionQueue();
   GpuWorkCount& getMainWorkCount() { return mainWorkStream; }
   const GpuWorkCount& getMainWorkCount() const { return mainWorkStream; }
 
@@ -79,15 +103,26 @@ private:
 
   std::unique_ptr<VmaAllocator_T, void (*)(VmaAllocator)> vmaAllocator{nullptr, nullptr};
 
+  // Objects that may still be used by in-flight frames. Declared before the managers that
+  // retire objects into it, so it is destroyed after them, but before the allocator and device.
+  std::unique_ptr<DeletionQueue> deletionQueue;
+
   std::unique_ptr<DescriptorSetLayoutCache> descriptorSetLayouts;
+  std::unique_ptr<PipelineLayoutCache> pipelineLayouts;
   std::unique_ptr<ShaderProgramManager> shaderPrograms;
+  std::unique_ptr<ShaderVariantManager> shaderVariants;
   std::unique_ptr<PipelineManager> pipelineManager;
+  std::unique_ptr<ShaderObjectManager> shaderObjectManager;
+  std::unique_ptr<AccelerationStructureManager> accelerationStructures;
   std::unique_ptr<DynamicDescriptorPool> perFrameDescriptorPool;
   std::unique_ptr<PersistentDescriptorPool> persistentDescriptorPool;
   std::unique_ptr<ResourceStates> resourceTracking;
   std::unique_ptr<void, void (*)(void*)> tracyCtx;
 
   bool shouldGenerateBarriersFlag;
+  bool meshShadersEnabled = false;
+  bool rayTracingEnabled = false;
+  vk::PhysicalDeviceSubgroupSizeControlFeatures subgroupSizeControlFeatures{};
 };
 
 GlobalContext& get_context();
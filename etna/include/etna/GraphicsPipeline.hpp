@@ -5,6 +5,7 @@
 #include <etna/Vulkan.hpp>
 #include <etna/VertexInput.hpp>
 #include <etna/PipelineBase.hpp>
+#include <etna/SpecializationConstants.hpp>
 
 
 namespace etna
@@ -115,6 +116,10 @@ public:
       vk::DynamicState::eViewport,
       vk::DynamicState::eScissor,
     };
+
+    // Values for specialization constants of all shader stages.
+    // Other combinations can be requested later with getVkPipeline(overrides).
+    SpecializationConstants specConstants = {};
   };
 };
 
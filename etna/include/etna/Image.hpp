@@ -3,9 +3,11 @@
 #define ETNA_IMAGE_HPP_INCLUDED
 
 #include <optional>
+#include <span>
 
 #include <etna/Vulkan.hpp>
 #include <etna/BindingItems.hpp>
+#include <etna/Forward.hpp>
 #include <vk_mem_alloc.h>
 
 
@@ -14,6 +16,8 @@ namespace etna
 
 class Image
 {
+  friend class ResourceStates;
+
 public:
   Image() = default;
 
@@ -72,10 +76,23 @@ public:
     // Additional flags, primary usage being allowing for creation of cube or array
     // views to array textures (for cube, specify 6 layers).
     vk::ImageCreateFlags flags = {};
+
+    // Queue families that access the image concurrently, which spares ownership
+    // transfers between them at some cost in speed. Only read during creation.
+    // Fewer than two families mean exclusive sharing.
+    std::span<const uint32_t> concurrentQueueFamilies = {};
   };
 
   Image(VmaAllocator alloc, CreateInfo info);
 
+  // Places the image at an offset into memory owned by someone else, e.g. shared with
+  // other images that are never used at the same time. The memory must outlive the image,
+  // and the memory-related fields of info are ignored.
+  Image(VmaAllocator alloc, VmaAllocation memory, vk::DeviceSize offset, CreateInfo info);
+
+  // Memory an image created with info needs, for placing it into memory allocated by hand
+  static vk::MemoryRequirements getMemoryRequirements(vk::Device device, const CreateInfo& info);
+
   Image(const Image&) = delete;
   Image& operator=(const Image&) = delete;
 
@@ -167,6 +184,7 @@ private:
   std::size_t layers;
   std::size_t mipLevels;
   vk::ImageCreateFlags creationFlags;
+  TrackedImageId trackingId = TrackedImageId::Invalid;
 };
 
 } // namespace etna
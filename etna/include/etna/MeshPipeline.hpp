@@ -0,0 +1,83 @@
+#pragma once
+#ifndef ETNA_MESH_PIPELINE_HPP_INCLUDED
+#define ETNA_MESH_PIPELINE_HPP_INCLUDED
+
+#include <array>
+
+#include <etna/Vulkan.hpp>
+#include <etna/PipelineBase.hpp>
+#include <etna/GraphicsPipeline.hpp>
+#include <etna/SpecializationConstants.hpp>
+
+
+namespace etna
+{
+
+class PipelineManager;
+
+// Graphics pipeline with task and mesh shaders (VK_EXT_mesh_shader) instead of vertex processing
+class MeshPipeline : public PipelineBase
+{
+  friend class PipelineManager;
+  MeshPipeline(PipelineManager* in_owner, PipelineId in_id, ShaderProgramId in_shader_program_id)
+    : PipelineBase(in_owner, in_id, in_shader_program_id)
+  {
+  }
+
+public:
+  // Use PipelineManager to create pipelines
+  MeshPipeline() = default;
+
+  // Same as in GraphicsPipeline::CreateInfo, except that there is no vertex input,
+  // input assembly or tessellation, as mesh shaders produce primitives themselves.
+  struct CreateInfo
+  {
+    vk::PipelineRasterizationStateCreateInfo rasterizationConfig = {
+      .polygonMode = vk::PolygonMode::eFill,
+      .cullMode = vk::CullModeFlagBits::eNone,
+      .frontFace = vk::FrontFace::eClockwise,
+      .lineWidth = 1.f,
+    };
+
+    vk::PipelineMultisampleStateCreateInfo multisampleConfig = {
+      .rasterizationSamples = vk::SampleCountFlagBits::e1,
+      .sampleShadingEnable = vk::False,
+      .minSampleShading = 0.f,
+    };
+
+    GraphicsPipeline::CreateInfo::Blending blendingConfig = {};
+
+    vk::PipelineDepthStencilStateCreateInfo depthConfig = {
+      .depthTestEnable = vk::True,
+      .depthWriteEnable = vk::True,
+      .depthCompareOp = vk::CompareOp::eLessOrEqual,
+      .maxDepthBounds = 1.f,
+    };
+
+    GraphicsPipeline::CreateInfo::FragmentShaderOutputDescription fragmentShaderOutput;
+
+    std::vector<vk::DynamicState> dynamicStates = {
+      vk::DynamicState::eViewport,
+      vk::DynamicState::eScissor,
+    };
+
+    SpecializationConstants specConstants = {};
+  };
+
+  // Workgroup size of the first stage, i.e. of the task shader if there is one.
+  // Overrides select the permutation bound with getVkPipeline(overrides).
+  std::array<uint32_t, 3> getWorkgroupSize(const SpecializationConstants& overrides = {}) const;
+
+  // Launches enough task (or mesh, if there is no task shader) workgroups
+  // to run at least one invocation per element of the problem
+  void drawMeshTasksThreads(
+    vk::CommandBuffer cmd,
+    uint32_t size_x,
+    uint32_t size_y = 1,
+    uint32_t size_z = 1,
+    const SpecializationConstants& overrides = {}) const;
+};
+
+} // namespace etna
+
+#endif // ETNA_MESH_PIPELINE_HPP_INCLUDED
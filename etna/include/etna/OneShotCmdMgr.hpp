@@ -26,6 +26,7 @@ public:
   };
 
   explicit OneShotCmdMgr(const Dependencies& deps);
+  ~OneShotCmdMgr();
 
   OneShotCmdMgr(const OneShotCmdMgr&) = delete;
   OneShotCmdMgr& operator=(const OneShotCmdMgr&) = delete;
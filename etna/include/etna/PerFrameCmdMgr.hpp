@@ -31,6 +31,7 @@ public:
   };
 
   explicit PerFrameCmdMgr(const Dependencies& deps);
+  ~PerFrameCmdMgr();
 
   /**
    * Acquires the command buffer to use this frame, waiting for
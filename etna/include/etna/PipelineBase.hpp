@@ -4,6 +4,7 @@
 
 #include <etna/Vulkan.hpp>
 #include <etna/Forward.hpp>
+#include <etna/SpecializationConstants.hpp>
 
 
 namespace etna
@@ -14,6 +15,9 @@ class PipelineBase
 public:
   vk::PipelineLayout getVkPipelineLayout() const;
   vk::Pipeline getVkPipeline() const;
+  // Permutation of this pipeline with some specialization constants overridden.
+  // Permutations are compiled on first use and cached until shaders are reloaded.
+  vk::Pipeline getVkPipeline(const SpecializationConstants& overrides) const;
 
   PipelineBase(const PipelineBase&) = delete;
   PipelineBase& operator=(const PipelineBase&) = delete;
@@ -26,6 +30,9 @@ protected:
   PipelineBase() = default;
   ~PipelineBase();
 
+  PipelineManager* getOwner() const { return owner; }
+  PipelineId getId() const { return id; }
+
 private:
   PipelineManager* owner{nullptr};
   PipelineId id{PipelineId::Invalid};
@@ -2,22 +2,31 @@
 #ifndef ETNA_PIPELINE_MANAGER_HPP_INCLUDED
 #define ETNA_PIPELINE_MANAGER_HPP_INCLUDED
 
+#include <algorithm>
+#include <optional>
+#include <span>
 #include <unordered_map>
 
 #include <etna/Vulkan.hpp>
 #include <etna/PipelineBase.hpp>
 #include <etna/GraphicsPipeline.hpp>
 #include <etna/ComputePipeline.hpp>
+#include <etna/MeshPipeline.hpp>
+#include <etna/RayTracingPipeline.hpp>
 
 
 namespace etna
 {
 
 struct ShaderProgramManager;
+class DeletionQueue;
 
 class PipelineManager
 {
   friend class PipelineBase;
+  friend class ComputePipeline;
+  friend class MeshPipeline;
+  friend class RayTracingPipeline;
 
 public:
   PipelineManager(vk::Device dev, ShaderProgramManager& shader_manager);
@@ -28,15 +37,39 @@ public:
   ComputePipeline createComputePipeline(
     const char* shader_program_name, ComputePipeline::CreateInfo info);
 
-  // TODO: createRaytracePipeline, createMeshletPipeline
+  // Requires InitParams::enableMeshShaders. The program must have a mesh shader
+  // and may have a task shader and a fragment shader.
+  MeshPipeline createMeshPipeline(const char* shader_program_name, MeshPipeline::CreateInfo info);
+
+  // Requires InitParams::enableRayTracing
+  RayTracingPipeline createRayTracingPipeline(
+    const char* shader_program_name, RayTracingPipeline::CreateInfo info);
 
   void recreate();
+  // Recreates pipelines of the given programs only, old pipelines are retired to deletion_queue
+  void recreate(std::span<ShaderProgramId const> programs, DeletionQueue& deletion_queue);
 
 private:
   void destroyPipeline(PipelineId id);
   vk::Pipeline getVkPipeline(PipelineId id) const;
+  vk::Pipeline getVkPipeline(PipelineId id, const SpecializationConstants& overrides);
   vk::PipelineLayout getVkPipelineLayout(ShaderProgramId id) const;
 
+  std::array<uint32_t, 3> getWorkgroupSize(
+    PipelineId id, const SpecializationConstants& overrides) const;
+
+  const ShaderBindingTable& getShaderBindingTable(
+    PipelineId id, const SpecializationConstants& overrides);
+  ShaderBindingTable createShaderBindingTable(PipelineId id, vk::Pipeline pipeline);
+  const vk::PhysicalDeviceRayTracingPipelinePropertiesKHR& getRayTracingProperties();
+
+  ShaderProgramId getPipelineProgram(PipelineId id) const;
+  // All constants the pipeline is specialized with once the overrides are applied,
+  // or nothing if the overrides do not change any of them
+  SpecializationConstants getPermutationConstants(
+    PipelineId id, const SpecializationConstants& overrides) const;
+  vk::UniquePipeline createPermutation(PipelineId id, const SpecializationConstants& constants);
+
 private:
   vk::Device device;
   ShaderProgramManager& shaderManager;
@@ -50,6 +83,18 @@ private:
     GraphicsPipeline::CreateInfo info;
   };
 
+  struct MeshParameters
+  {
+    ShaderProgramId shaderProgram;
+    MeshPipeline::CreateInfo info;
+  };
+
+  struct RayTracingParameters
+  {
+    ShaderProgramId shaderProgram;
+    RayTracingPipeline::CreateInfo info;
+  };
+
   struct ComputeParameters
   {
     ShaderProgramId shaderProgram;
@@ -58,6 +103,70 @@ private:
   std::unordered_map<PipelineId, vk::UniquePipeline> pipelines;
   std::unordered_multimap<PipelineId, ComputeParameters> computePipelineParameters;
   std::unordered_multimap<PipelineId, PipelineParameters> graphicsPipelineParameters;
+  std::unordered_multimap<PipelineId, MeshParameters> meshPipelineParameters;
+  std::unordered_multimap<PipelineId, RayTracingParameters> rayTracingPipelineParameters;
+
+  struct PermutationKey
+  {
+    PipelineId pipeline;
+    SpecializationConstants constants;
+
+    bool operator==(const PermutationKey&) const = default;
+  };
+
+  // Lookups use views of the constants, so a key is only built when a permutation is created
+  struct PermutationKeyView
+  {
+    PipelineId pipeline;
+    std::span<SpecializationConstants::Entry const> constants;
+  };
+
+  static PermutationKeyView asView(const PermutationKeyView& key) { return key; }
+  static PermutationKeyView asView(const PermutationKey& key)
+  {
+    return {key.pipeline, key.constants.getEntries()};
+  }
+
+  struct PermutationKeyHash
+  {
+    using is_transparent = void;
+
+    template <class Key>
+    std::size_t operator()(const Key& key) const
+    {
+      const auto view = asView(key);
+      const auto pipeline = static_cast<std::underlying_type_t<PipelineId>>(view.pipeline);
+      return SpecializationConstantsHash{}(view.constants) ^ std::hash<std::uint32_t>{}(pipeline);
+    }
+  };
+
+  struct PermutationKeyEqual
+  {
+    using is_transparent = void;
+
+    template <class First, class Second>
+    bool operator()(const First& first, const Second& second) const
+    {
+      const auto a = asView(first);
+      const auto b = asView(second);
+      return a.pipeline == b.pipeline && std::ranges::equal(a.constants, b.constants);
+    }
+  };
+
+  template <class T>
+  using PermutationMap =
+    std::unordered_map<PermutationKey, T, PermutationKeyHash, PermutationKeyEqual>;
+
+  // Keyed by all constants the permutation is specialized with, so that different
+  // override sets which amount to the same constants share a single pipeline
+  PermutationMap<vk::UniquePipeline> permutations;
+  // Keyed by the overrides passed to getVkPipeline, so that lookups do not merge them
+  // with the constants of the pipeline. Pipelines are owned by permutations or pipelines.
+  PermutationMap<vk::Pipeline> permutationsByOverrides;
+  // Keyed like permutations, base pipelines are keyed with empty constants
+  PermutationMap<ShaderBindingTable> shaderBindingTables;
+
+  std::optional<vk::PhysicalDeviceRayTracingPipelinePropertiesKHR> rayTracingProperties;
 };
 
 } // namespace etna
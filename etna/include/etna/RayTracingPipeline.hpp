@@ -0,0 +1,86 @@
+#pragma once
+#ifndef ETNA_RAY_TRACING_PIPELINE_HPP_INCLUDED
+#define ETNA_RAY_TRACING_PIPELINE_HPP_INCLUDED
+
+#include <optional>
+#include <vector>
+
+#include <etna/Vulkan.hpp>
+#include <etna/Buffer.hpp>
+#include <etna/PipelineBase.hpp>
+#include <etna/SpecializationConstants.hpp>
+
+
+namespace etna
+{
+
+class PipelineManager;
+
+/**
+ * Shader group handles of a ray tracing pipeline laid out for vkCmdTraceRaysKHR.
+ * Groups go in the order raygen, miss, hit, callable, each kind in the order
+ * its shaders were listed in the program (hit groups in CreateInfo::hitGroups order).
+ */
+struct ShaderBindingTable
+{
+  Buffer buffer;
+  // Every raygen shader needs a region of its own
+  std::vector<vk::StridedDeviceAddressRegionKHR> raygen;
+  vk::StridedDeviceAddressRegionKHR miss{};
+  vk::StridedDeviceAddressRegionKHR hit{};
+  vk::StridedDeviceAddressRegionKHR callable{};
+};
+
+class RayTracingPipeline : public PipelineBase
+{
+  friend class PipelineManager;
+  RayTracingPipeline(
+    PipelineManager* in_owner, PipelineId in_id, ShaderProgramId in_shader_program_id)
+    : PipelineBase(in_owner, in_id, in_shader_program_id)
+  {
+  }
+
+public:
+  // Use PipelineManager to create pipelines
+  RayTracingPipeline() = default;
+
+  // Shaders are referenced by their index in the list the program was loaded from.
+  // A group with an intersection shader is a procedural one, otherwise it is a triangle one.
+  struct HitGroup
+  {
+    std::optional<uint32_t> closestHit = std::nullopt;
+    std::optional<uint32_t> anyHit = std::nullopt;
+    std::optional<uint32_t> intersection = std::nullopt;
+  };
+
+  struct CreateInfo
+  {
+    // If empty, every closest hit shader of the program gets a triangle hit group of its own
+    std::vector<HitGroup> hitGroups = {};
+
+    // How deep traceRayEXT calls may nest, 1 means only raygen shaders trace rays
+    uint32_t maxRecursionDepth = 1;
+
+    // Other combinations can be requested later with getVkPipeline(overrides)
+    SpecializationConstants specConstants = {};
+  };
+
+  // The table is built on first use and rebuilt after shader reloads,
+  // so do not hold on to it across frames.
+  const ShaderBindingTable& getShaderBindingTable(
+    const SpecializationConstants& overrides = {}) const;
+
+  // Pass the same overrides the bound pipeline was fetched with, so that the shader
+  // binding table holds the group handles of that permutation
+  void traceRays(
+    vk::CommandBuffer cmd,
+    uint32_t width,
+    uint32_t height,
+    uint32_t depth = 1,
+    uint32_t raygen_index = 0,
+    const SpecializationConstants& overrides = {}) const;
+};
+
+} // namespace etna
+
+#endif // ETNA_RAY_TRACING_PIPELINE_HPP_INCLUDED
@@ -0,0 +1,140 @@
+#pragma once
+#ifndef ETNA_REFLECTION_TABLE_HPP_INCLUDED
+#define ETNA_REFLECTION_TABLE_HPP_INCLUDED
+
+#include <bit>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <etna/Vulkan.hpp>
+
+
+namespace etna
+{
+
+/**
+ * Hash of a name declared in a shader (a resource or a push constant member).
+ * Lookups by name only compare these hashes, so store them in constexpr
+ * variables to keep string processing out of hot paths entirely:
+ *   static constexpr ShaderNameHash ALBEDO{"albedoTex"};
+ */
+struct ShaderNameHash
+{
+  constexpr ShaderNameHash(std::string_view name)
+    : value{hash(name)}
+  {
+  }
+
+  constexpr ShaderNameHash(const char* name)
+    : ShaderNameHash{std::string_view{name}}
+  {
+  }
+
+  ShaderNameHash(const std::string& name)
+    : ShaderNameHash{std::string_view{name}}
+  {
+  }
+
+  bool operator==(const ShaderNameHash&) const = default;
+
+  // 0 is reserved for empty table slots
+  std::uint64_t value;
+
+private:
+  // FNV-1a
+  static constexpr std::uint64_t hash(std::string_view name)
+  {
+    std::uint64_t result = 0xcbf29ce484222325ull;
+    for (char c : name)
+    {
+      result ^= static_cast<std::uint8_t>(c);
+      result *= 0x100000001b3ull;
+    }
+    return result != 0 ? result : 1;
+  }
+};
+
+struct ShaderResourceInfo
+{
+  uint32_t set;
+  uint32_t binding;
+  vk::DescriptorType descriptorType;
+  uint32_t descriptorCount;
+
+  bool operator==(const ShaderResourceInfo&) const = default;
+};
+
+struct PushConstantMemberInfo
+{
+  uint32_t offset;
+  uint32_t size;
+
+  bool operator==(const PushConstantMemberInfo&) const = default;
+};
+
+/**
+ * Flat open-addressing hash table from shader names to reflection data.
+ * Built once when a program is (re)loaded, queried with a precomputed hash.
+ */
+template <class T>
+class ReflectionTable
+{
+public:
+  void build(const std::unordered_map<std::string, T>& entries)
+  {
+    slots.clear();
+    if (entries.empty())
+      return;
+
+    // Load factor of at most 1/2 guarantees short probe sequences and an empty slot
+    slots.resize(std::bit_ceil(entries.size() * 2));
+    std::vector<const std::string*> names(slots.size(), nullptr);
+
+    const std::size_t mask = slots.size() - 1;
+    for (const auto& [name, value] : entries)
+    {
+      const ShaderNameHash hash{name};
+      std::size_t i = hash.value & mask;
+      while (slots[i].hash != 0)
+      {
+        if (slots[i].hash == hash.value)
+          ETNA_PANIC("Shader names '{}' and '{}' have identical hashes", name, *names[i]);
+        i = (i + 1) & mask;
+      }
+      slots[i] = Slot{hash.value, value};
+      names[i] = &name;
+    }
+  }
+
+  const T* find(ShaderNameHash name) const
+  {
+    if (slots.empty())
+      return nullptr;
+
+    const std::size_t mask = slots.size() - 1;
+    for (std::size_t i = name.value & mask;; i = (i + 1) & mask)
+    {
+      if (slots[i].hash == name.value)
+        return &slots[i].value;
+      if (slots[i].hash == 0)
+        return nullptr;
+    }
+  }
+
+  void clear() { slots.clear(); }
+
+private:
+  struct Slot
+  {
+    std::uint64_t hash = 0;
+    T value{};
+  };
+
+  std::vector<Slot> slots;
+};
+
+} // namespace etna
+
+#endif // ETNA_REFLECTION_TABLE_HPP_INCLUDED
@@ -0,0 +1,237 @@
+#pragma once
+#ifndef ETNA_RENDER_GRAPH_HPP_INCLUDED
+#define ETNA_RENDER_GRAPH_HPP_INCLUDED
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <etna/Vulkan.hpp>
+#include <etna/Image.hpp>
+#include <etna/Buffer.hpp>
+#include <etna/Forward.hpp>
+#include <etna/GpuSharedResource.hpp>
+
+
+namespace etna
+{
+
+/**
+ * Frame graph which is built anew every frame. Passes declare which images and buffers
+ * they read and write, and the graph takes care of the rest:
+ *  - passes whose results are never used are culled,
+ *  - all barriers of a pass are placed with a single vkCmdPipelineBarrier2 right before it,
+ *  - transient images which are never alive at the same time share memory,
+ *  - load and store ops of attachments are picked from the lifetimes of their images.
+ * Passes run in the order they were added. A pass is kept if it has side effects,
+ * writes an imported resource or writes something read by another kept pass.
+ *
+ *   graph.reset();
+ *   auto albedo = graph.createImage({...});
+ *   graph.addPass("gbuffer", [&](auto& pass) { pass.colorAttachment(albedo, black); }, draw);
+ *   graph.addPass("shade", [&](auto& pass) { pass.sample(albedo).colorAttachment(out); }, shade);
+ *   graph.compile();
+ *   graph.execute(cmd);
+ */
+class RenderGraph
+{
+public:
+  class PassBuilder
+  {
+    friend class RenderGraph;
+    PassBuilder(RenderGraph& in_graph, std::size_t in_pass)
+      : graph{in_graph}
+      , pass{in_pass}
+    {
+    }
+
+  public:
+    PassBuilder& sample(
+      GraphImageId image,
+      vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eFragmentShader);
+    PassBuilder& readStorage(
+      GraphImageId image,
+      vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eComputeShader);
+    PassBuilder& writeStorage(
+      GraphImageId image,
+      vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eComputeShader);
+
+    // The attachment is cleared if a clear value is given. Otherwise its contents are
+    // loaded, unless the image is transient and nothing has written it yet.
+    PassBuilder& colorAttachment(
+      GraphImageId image, std::optional<vk::ClearColorValue> clear = std::nullopt);
+    // Attached as depth, stencil or both, depending on the aspects of the format
+    PassBuilder& depthAttachment(
+      GraphImageId image, std::optional<vk::ClearDepthStencilValue> clear = std::nullopt);
+
+    PassBuilder& read(
+      GraphImageId image,
+      vk::PipelineStageFlags2 stages,
+      vk::AccessFlags2 access,
+      vk::ImageLayout layout);
+    PassBuilder& write(
+      GraphImageId image,
+      vk::PipelineStageFlags2 stages,
+      vk::AccessFlags2 access,
+      vk::ImageLayout layout);
+    PassBuilder& read(
+      GraphBufferId buffer, vk::PipelineStageFlags2 stages, vk::AccessFlags2 access);
+    PassBuilder& write(
+      GraphBufferId buffer, vk::PipelineStageFlags2 stages, vk::AccessFlags2 access);
+
+    // Keeps the pass even if nothing uses what it writes, e.g. for readbacks
+    PassBuilder& sideEffect();
+
+  private:
+    RenderGraph& graph;
+    std::size_t pass;
+  };
+
+  // Attachments of the pass are already bound with vkCmdBeginRendering when it is called
+  using ExecuteFunc = std::function<void(vk::CommandBuffer, const RenderGraph&)>;
+
+  explicit RenderGraph(const GpuWorkCount& work_count);
+  // The GPU must be done with all frames that executed the graph
+  ~RenderGraph();
+
+  RenderGraph(const RenderGraph&) = delete;
+  RenderGraph& operator=(const RenderGraph&) = delete;
+
+  // Forgets all passes and resources, call it before building the graph of a new frame
+  void reset();
+
+  // Transient images only live during a single frame and start with undefined contents.
+  // The memory usage, allocation flags and concurrent queue families of info are ignored.
+  GraphImageId createImage(const Image::CreateInfo& info);
+
+  // Imported resources may be used outside the graph, so passes writing them are always kept
+  GraphImageId importImage(const Image& image);
+  GraphBufferId importBuffer(const Buffer& buffer);
+
+  // setup is called right away to declare the resources used by the pass
+  void addPass(
+    std::string name, const std::function<void(PassBuilder&)>& setup, ExecuteFunc execute);
+
+  // Culls passes, places transient images into memory and picks attachment ops.
+  // Memory of transient images is multi-buffered with GpuSharedResource,
+  // so call it after the work count moved on to the frame being recorded.
+  void compile();
+
+  // Records the passes together with their barriers
+  void execute(vk::CommandBuffer cmd);
+
+  // Transient images only exist after compile
+  const Image& getImage(GraphImageId id) const;
+  const Buffer& getBuffer(GraphBufferId id) const;
+
+  struct Stats
+  {
+    std::size_t passes = 0;
+    std::size_t culledPasses = 0;
+    // Memory taken by transient images, and how much they would take without sharing it
+    vk::DeviceSize transientMemory = 0;
+    vk::DeviceSize transientMemoryUnaliased = 0;
+  };
+  const Stats& getStats() const { return stats; }
+
+private:
+  struct ImageAccess
+  {
+    GraphImageId image;
+    vk::PipelineStageFlags2 stages;
+    vk::AccessFlags2 access;
+    vk::ImageLayout layout;
+    bool write;
+  };
+
+  struct BufferAccess
+  {
+    GraphBufferId buffer;
+    vk::PipelineStageFlags2 stages;
+    vk::AccessFlags2 access;
+    bool write;
+  };
+
+  struct Attachment
+  {
+    // Index into Pass::images, read access is added to it when the attachment is loaded
+    std::size_t access;
+    std::optional<vk::ClearColorValue> clearColor;
+    std::optional<vk::ClearDepthStencilValue> clearDepthStencil;
+    vk::AttachmentLoadOp loadOp = vk::AttachmentLoadOp::eLoad;
+    vk::AttachmentStoreOp storeOp = vk::AttachmentStoreOp::eStore;
+  };
+
+  struct Pass
+  {
+    std::string name;
+    std::vector<ImageAccess> images;
+    std::vector<BufferAccess> buffers;
+    std::vector<Attachment> colorAttachments;
+    std::optional<Attachment> depthAttachment;
+    ExecuteFunc execute;
+    bool sideEffect = false;
+    bool culled = false;
+    // Transient images whose contents are discarded before the pass
+    std::vector<GraphImageId> firstUses;
+  };
+
+  struct ImageResource
+  {
+    std::string name;
+    // Empty for imported images
+    std::optional<Image::CreateInfo> transientInfo;
+    // Set by compile for transient images
+    const Image* image = nullptr;
+
+    // Indices of the first and the last kept passes using the image
+    std::size_t firstUse = ~std::size_t{0};
+    std::size_t lastUse = 0;
+    vk::PipelineStageFlags2 lastStages = {};
+    vk::AccessFlags2 lastAccess = {};
+    // Last accesses to images which used the memory earlier in the frame
+    vk::PipelineStageFlags2 aliasStages = {};
+    vk::AccessFlags2 aliasAccess = {};
+  };
+
+  // Images are only recreated when the placement of transient images changes
+  struct Placement
+  {
+    vk::Extent3D extent;
+    vk::Format format;
+    vk::ImageUsageFlags usage;
+    vk::SampleCountFlagBits samples;
+    vk::ImageType type;
+    vk::ImageCreateFlags flags;
+    std::size_t layers;
+    std::size_t mipLevels;
+    vk::DeviceSize offset;
+    bool operator==(const Placement& other) const = default;
+  };
+
+  struct TransientMemory
+  {
+    VmaAllocation memory = nullptr;
+    vk::DeviceSize size = 0;
+    uint32_t memoryType = 0;
+    std::vector<Placement> placements;
+    std::vector<Image> images;
+  };
+
+  std::vector<Pass> passes;
+  std::vector<ImageResource> images;
+  std::vector<const Buffer*> buffers;
+  GpuSharedResource<TransientMemory> transientMemory;
+  Stats stats;
+  bool compiled = false;
+
+  void cullPasses();
+  void computeLifetimes();
+  void pickAttachmentOps();
+  void placeTransientImages();
+};
+
+} // namespace etna
+
+#endif // ETNA_RENDER_GRAPH_HPP_INCLUDED
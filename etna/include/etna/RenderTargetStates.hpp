@@ -17,11 +17,23 @@ class RenderTargetState
   static bool inScope;
 
 public:
+  // Mip levels and layers that an attachment view covers, only they change their layout.
+  // The default covers the whole image.
+  struct Subresources
+  {
+    uint32_t baseMip = 0;
+    uint32_t levelCount = vk::RemainingMipLevels;
+    uint32_t baseLayer = 0;
+    uint32_t layerCount = vk::RemainingArrayLayers;
+  };
+
   struct AttachmentParams
   {
     vk::Image image = {};
     vk::ImageView view = {};
     std::optional<vk::ImageAspectFlags> imageAspect{};
+    // Set this when rendering to a single mip level or layer, e.g. while sampling another one
+    Subresources subresources{};
     vk::AttachmentLoadOp loadOp = vk::AttachmentLoadOp::eClear;
     vk::AttachmentStoreOp storeOp = vk::AttachmentStoreOp::eStore;
     vk::ClearColorValue clearColorValue = std::array<float, 4>({0.0f, 0.0f, 0.0f, 1.0f});
@@ -34,6 +46,7 @@ public:
     vk::Image resolveImage = {};
     vk::ImageView resolveImageView = {};
     std::optional<vk::ImageAspectFlags> resolveImageAspect{};
+    Subresources resolveSubresources{};
     vk::ResolveModeFlagBits resolveMode = vk::ResolveModeFlagBits::eNone;
   };
 
@@ -0,0 +1,30 @@
+#pragma once
+#ifndef ETNA_SHADER_BUNDLE_HPP_INCLUDED
+#define ETNA_SHADER_BUNDLE_HPP_INCLUDED
+
+#include <filesystem>
+#include <span>
+
+
+namespace etna
+{
+
+/**
+ * \brief Packs SPIR-V modules into a single shader bundle file.
+ * Identical modules are stored once and reflection is computed up front,
+ * so loading shaders from a bundle is a single mmap with no reflection at all.
+ * Does not require etna to be initialized.
+ *
+ * \param output Path of the bundle file to write.
+ * \param shaders Paths to the SPIR-V files to pack.
+ * \param root Directory which shader paths are stored relative to. At runtime
+ * paths passed to create_program are resolved relative to InitParams::shaderBundleRoot.
+ */
+void pack_shader_bundle(
+  const std::filesystem::path& output,
+  std::span<std::filesystem::path const> shaders,
+  const std::filesystem::path& root);
+
+} // namespace etna
+
+#endif // ETNA_SHADER_BUNDLE_HPP_INCLUDED
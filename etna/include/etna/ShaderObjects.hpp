@@ -0,0 +1,133 @@
+#pragma once
+#ifndef ETNA_SHADER_OBJECTS_HPP_INCLUDED
+#define ETNA_SHADER_OBJECTS_HPP_INCLUDED
+
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include <etna/Vulkan.hpp>
+#include <etna/Forward.hpp>
+#include <etna/GraphicsPipeline.hpp>
+#include <etna/SpecializationConstants.hpp>
+
+
+namespace etna
+{
+
+class DeletionQueue;
+
+/**
+ * Shader program turned into VK_EXT_shader_object shaders. Binding it replaces
+ * binding a pipeline, all other state has to be set dynamically, see setGraphicsState.
+ */
+class ShaderObjectProgram
+{
+  friend class ShaderObjectManager;
+  ShaderObjectProgram(
+    ShaderObjectManager* in_owner, ShaderObjectProgramId in_id, ShaderProgramId in_program_id)
+    : owner{in_owner}
+    , id{in_id}
+    , shaderProgramId{in_program_id}
+  {
+  }
+
+public:
+  // Use ShaderObjectManager to create shader object programs
+  ShaderObjectProgram() = default;
+
+  struct CreateInfo
+  {
+    // Linked stages may be optimized together by the driver, just like in a pipeline.
+    // Unlinked ones are compiled separately, which is usually faster.
+    bool linkStages = true;
+    SpecializationConstants specConstants = {};
+  };
+
+  // Binds shaders of all program stages, other graphics stages are unbound
+  void bind(vk::CommandBuffer cmd) const;
+  vk::PipelineLayout getVkPipelineLayout() const;
+
+  /**
+   * Sets everything that a graphics pipeline created from state would have baked in.
+   * Only the state used by the stages of this program and the enabled device features is set.
+   * Viewports and scissors are not set, use setViewportWithCount and setScissorWithCount,
+   * which shader objects require instead of setViewport and setScissor.
+   * Fragment output formats, dynamic state list and sample shading are ignored.
+   */
+  void setGraphicsState(vk::CommandBuffer cmd, const GraphicsPipeline::CreateInfo& state) const;
+
+  ShaderObjectProgram(const ShaderObjectProgram&) = delete;
+  ShaderObjectProgram& operator=(const ShaderObjectProgram&) = delete;
+
+  ShaderObjectProgram(ShaderObjectProgram&&) noexcept;
+  ShaderObjectProgram& operator=(ShaderObjectProgram&&) noexcept;
+  ~ShaderObjectProgram();
+
+private:
+  ShaderObjectManager* owner{nullptr};
+  ShaderObjectProgramId id{ShaderObjectProgramId::Invalid};
+  ShaderProgramId shaderProgramId{ShaderProgramId::Invalid};
+};
+
+class ShaderObjectManager
+{
+  friend class ShaderObjectProgram;
+
+public:
+  // graphics_stages are the stages enabled on the device, unused ones are bound to null shaders.
+  // State gated by device features is only set when enabled_features have them on.
+  ShaderObjectManager(
+    vk::Device dev,
+    ShaderProgramManager& shader_manager,
+    vk::ShaderStageFlags graphics_stages,
+    const vk::PhysicalDeviceFeatures& enabled_features);
+
+  ShaderObjectProgram createProgram(
+    const char* shader_program_name, ShaderObjectProgram::CreateInfo info);
+
+  void recreate();
+  // Recreates shaders of the given programs only, old ones are retired to deletion_queue
+  void recreate(std::span<ShaderProgramId const> programs, DeletionQueue& deletion_queue);
+
+  ShaderObjectManager(const ShaderObjectManager&) = delete;
+  ShaderObjectManager& operator=(const ShaderObjectManager&) = delete;
+
+private:
+  struct Shaders
+  {
+    // Stages and shaders exactly as passed to bindShadersEXT, with nulls for unused stages
+    std::vector<vk::ShaderStageFlagBits> stages;
+    std::vector<vk::ShaderEXT> handles;
+    std::vector<vk::UniqueShaderEXT> owned;
+    // Stages which have shaders of the program bound to them
+    vk::ShaderStageFlags programStages;
+  };
+
+  struct Parameters
+  {
+    ShaderProgramId shaderProgram;
+    ShaderObjectProgram::CreateInfo info;
+  };
+
+  Shaders createShaders(const Parameters& params) const;
+  void bind(ShaderObjectProgramId id, vk::CommandBuffer cmd) const;
+  void setGraphicsState(
+    ShaderObjectProgramId id,
+    vk::CommandBuffer cmd,
+    const GraphicsPipeline::CreateInfo& state) const;
+  void destroyProgram(ShaderObjectProgramId id);
+
+  vk::Device device;
+  ShaderProgramManager& shaderManager;
+  vk::ShaderStageFlags graphicsStages;
+  vk::PhysicalDeviceFeatures features;
+
+  std::underlying_type_t<ShaderObjectProgramId> programIdCounter{0};
+  std::unordered_map<ShaderObjectProgramId, Parameters> parameters;
+  std::unordered_map<ShaderObjectProgramId, Shaders> shaders;
+};
+
+} // namespace etna
+
+#endif // ETNA_SHADER_OBJECTS_HPP_INCLUDED
@@ -7,39 +7,109 @@
 #include <vector>
 #include <unordered_map>
 #include <memory>
+#include <optional>
+#include <string>
 #include <filesystem>
 
 #include <etna/Vulkan.hpp>
 #include <etna/Forward.hpp>
 #include <etna/DescriptorSetLayout.hpp>
+#include <etna/ReflectionTable.hpp>
+#include <etna/SpecializationConstants.hpp>
 
 
 namespace etna
 {
 
-struct ShaderModule
+// Workgroup size declared by a compute shader
+struct WorkgroupSizeInfo
+{
+  std::array<uint32_t, 3> size{1, 1, 1};
+  // Dimensions declared with local_size_x_id and friends can be changed
+  // through these specialization constants, size holds their defaults then
+  std::array<std::optional<uint32_t>, 3> specConstantIds{};
+
+  bool operator==(const WorkgroupSizeInfo&) const = default;
+};
+
+// Everything etna learns about a shader module by reflecting its SPIR-V
+struct ShaderModuleReflection
+{
+  std::string entryPoint{};
+  vk::ShaderStageFlagBits stage{};
+  std::vector<std::pair<uint32_t, DescriptorSetInfo>> resources{}; /*set index - set resources*/
+  vk::PushConstantRange pushConst{};
+  std::vector<std::pair<std::string, ShaderResourceInfo>> namedResources{};
+  std::vector<std::pair<std::string, PushConstantMemberInfo>> pushConstMembers{};
+  // Names are empty for constants without debug info
+  std::vector<std::pair<std::string, SpecConstantInfo>> specConstants{};
+  // Only meaningful for compute shaders
+  WorkgroupSizeInfo workgroupSize{};
+};
+
+// Driver object and reflection of a SPIR-V blob. Modules with identical
+// contents share a single instance, no matter which paths they were loaded from.
+struct ShaderModuleData
+{
+  std::uint64_t contentHash;
+  vk::UniqueShaderModule vkModule;
+  ShaderModuleReflection reflection{};
+  // Shader objects are created from code rather than from vulkan modules, so it is only
+  // kept when they are enabled. Points into ownedCode or into the mapped shader bundle.
+  std::span<uint32_t const> code{};
+  std::vector<uint32_t> ownedCode{};
+};
+
+class ShaderReflectionCache;
+class ShaderBundle;
+class ShaderModuleCache;
+class ShaderOptimizer;
+
+// Where shader modules get their code and reflection from
+struct ShaderLoadContext
 {
-  ShaderModule(vk::Device device, std::filesystem::path shader_path);
+  vk::Device device;
+  ShaderReflectionCache* reflectionCache = nullptr;
+  // Modules found in the bundle are never read from disk
+  const ShaderBundle* bundle = nullptr;
+  // Deduplicates modules by content hash, may be used from several threads at once
+  ShaderModuleCache* moduleCache = nullptr;
+  // Optimizes code before vulkan modules are created, reflection always uses the original code
+  ShaderOptimizer* optimizer = nullptr;
+  // Keep code of modules in memory after vulkan modules are created, see ShaderModuleData::code
+  bool keepCode = false;
+};
 
-  void reload(vk::Device device);
+// spirv-opt passes that etna recommends for InitParams::shaderOptimizerPasses
+std::vector<std::string> default_spirv_optimizer_passes();
 
-  const auto& getResources() const { return resources; }
-  vk::ShaderModule getVkModule() const { return vkModule.get(); }
-  vk::ShaderStageFlagBits getStage() const { return stage; }
-  const std::string& getName() const { return entryPoint; }
-  vk::PushConstantRange getPushConst() const { return pushConst; }
+struct ShaderModule
+{
+  ShaderModule(const ShaderLoadContext& ctx, std::filesystem::path shader_path);
+
+  // Returns the replaced data, whose vulkan module might still be in use by the GPU
+  std::shared_ptr<const ShaderModuleData> reload(const ShaderLoadContext& ctx);
+
+  const auto& getResources() const { return data->reflection.resources; }
+  vk::ShaderModule getVkModule() const { return data->vkModule.get(); }
+  vk::ShaderStageFlagBits getStage() const { return data->reflection.stage; }
+  const std::string& getName() const { return data->reflection.entryPoint; }
+  const std::filesystem::path& getPath() const { return path; }
+  vk::PushConstantRange getPushConst() const { return data->reflection.pushConst; }
+  const auto& getNamedResources() const { return data->reflection.namedResources; }
+  const auto& getPushConstMembers() const { return data->reflection.pushConstMembers; }
+  const auto& getSpecConstants() const { return data->reflection.specConstants; }
+  const WorkgroupSizeInfo& getWorkgroupSize() const { return data->reflection.workgroupSize; }
+  std::uint64_t getContentHash() const { return data->contentHash; }
+  std::span<uint32_t const> getCode() const { return data->code; }
 
   ShaderModule(const ShaderModule& mod) = delete;
   ShaderModule& operator=(const ShaderModule& mod) = delete;
 
 private:
   std::filesystem::path path{};
-  std::string entryPoint{};
-  vk::ShaderStageFlagBits stage;
 
-  vk::UniqueShaderModule vkModule;
-  std::vector<std::pair<uint32_t, DescriptorSetInfo>> resources{}; /*set index - set resources*/
-  vk::PushConstantRange pushConst{};
+  std::shared_ptr<const ShaderModuleData> data;
   /*Todo: add vertex input info*/
 };
 
@@ -55,6 +125,21 @@ struct ShaderProgramInfo
   DescriptorLayoutId getDescriptorLayoutId(uint32_t set) const;
   const DescriptorSetInfo& getDescriptorSetInfo(uint32_t set) const;
 
+  // Lookups of resources and push constant members by their names in the shader source.
+  // Nested push constant members are named with dots, e.g. "params.color".
+  const ShaderResourceInfo* findResource(ShaderNameHash name) const;
+  const ShaderResourceInfo& getResource(ShaderNameHash name) const;
+  const PushConstantMemberInfo* findPushConstMember(ShaderNameHash name) const;
+
+  // Specialization constants declared by any of the program's modules
+  std::span<SpecConstantInfo const> getSpecConstants() const;
+  const SpecConstantInfo* findSpecConstant(uint32_t constant_id) const;
+  const SpecConstantInfo* findSpecConstant(ShaderNameHash name) const;
+
+  // Workgroup size declared by the compute shader, or by the task shader (the mesh shader
+  // if there is none) for mesh programs, {1, 1, 1} for other graphics programs
+  const WorkgroupSizeInfo& getWorkgroupSize() const;
+
 private:
   ShaderProgramInfo(const ShaderProgramManager& manager, ShaderProgramId prog_id)
     : mgr{manager}
@@ -68,13 +153,44 @@ private:
   friend ShaderProgramManager;
 };
 
+struct ShaderProgramCreateInfo
+{
+  const char* name;
+  std::vector<std::filesystem::path> shaders;
+};
+
+class ShaderFileWatcher;
+
 struct ShaderProgramManager
 {
-  ShaderProgramManager() {}
-  ~ShaderProgramManager() { clear(); }
+  struct CreateInfo
+  {
+    // If provided, reflection results are cached in this file between runs, keyed by
+    // SPIR-V contents, so that reflection is skipped for modules which did not change.
+    std::optional<std::filesystem::path> reflectionCachePath = std::nullopt;
+    // If provided, shader paths are first looked up in this shader bundle
+    // relative to bundleRoot, see pack_shader_bundle.
+    std::optional<std::filesystem::path> bundlePath = std::nullopt;
+    std::filesystem::path bundleRoot = {};
+    // Watch files of loaded modules for modifications, see reloadChangedModules
+    bool watchFiles = false;
+    // spirv-opt passes to run on modules, in command line syntax. Requires etna
+    // to be built with ETNA_SPIRV_OPTIMIZER, modules are used as is if empty.
+    std::vector<std::string> optimizerPasses = {};
+    // If provided, optimized modules are cached in this file between runs
+    std::optional<std::filesystem::path> optimizerCachePath = std::nullopt;
+    // Shader objects are created from code, getShaderObjectInfos requires it to be kept
+    bool keepCode = false;
+  };
+
+  explicit ShaderProgramManager(CreateInfo info);
+  ~ShaderProgramManager();
 
   ShaderProgramId loadProgram(
     const char* name, std::span<std::filesystem::path const> shaders_path);
+  // Loads modules for all programs in parallel, the resulting ids are the same
+  // as if loadProgram was called for every program sequentially.
+  std::vector<ShaderProgramId> loadPrograms(std::span<ShaderProgramCreateInfo const> infos);
   ShaderProgramId tryGetProgram(const char* name) const;
   ShaderProgramId getProgram(const char* name) const;
 
@@ -89,11 +205,20 @@ struct ShaderProgramManager
   }
 
   void reloadPrograms();
+
+  /**
+   * Reloads only the given modules and the programs using them. Replaced vulkan objects
+   * are retired through the global deletion queue, so the GPU does not have to be idle.
+   * \return Programs which were reloaded, their pipelines have to be recreated.
+   */
+  std::vector<ShaderProgramId> reloadModules(std::span<std::filesystem::path const> paths);
+  // Same as reloadModules for all module files modified since the last call
+  std::vector<ShaderProgramId> reloadChangedModules();
   void clear();
 
   vk::PipelineLayout getProgramLayout(ShaderProgramId id) const
   {
-    return getProgInternal(id).progLayout.get();
+    return getProgInternal(id).progLayout;
   }
   vk::DescriptorSetLayout getDescriptorLayout(ShaderProgramId id, uint32_t set) const;
 
@@ -107,6 +232,10 @@ struct ShaderProgramManager
 
   // for pipeline creation
   std::vector<vk::PipelineShaderStageCreateInfo> getShaderStages(ShaderProgramId id) const;
+  // for shader object creation, layouts and specialization are left to the caller
+  std::vector<vk::ShaderCreateInfoEXT> getShaderObjectInfos(ShaderProgramId id) const;
+  // Layouts of all sets up to the last used one, exactly as in the program's pipeline layout
+  std::vector<vk::DescriptorSetLayout> getDescriptorLayouts(ShaderProgramId id) const;
 
   ShaderProgramManager(const ShaderProgramManager&) = delete;
   ShaderProgramManager& operator=(const ShaderProgramManager&) = delete;
@@ -123,8 +252,17 @@ private:
 
   std::unordered_map<std::filesystem::path, uint32_t, PathHash> shaderModuleNames;
   std::vector<std::unique_ptr<ShaderModule>> shaderModules;
+  std::unique_ptr<ShaderReflectionCache> reflectionCache;
+  std::unique_ptr<ShaderBundle> bundle;
+  std::unique_ptr<ShaderModuleCache> moduleCache;
+  std::unique_ptr<ShaderOptimizer> optimizer;
+  std::unique_ptr<ShaderFileWatcher> fileWatcher;
+  bool keepCode;
+
+  ShaderLoadContext getLoadContext() const;
 
   uint32_t registerModule(std::filesystem::path path);
+  uint32_t addModule(std::filesystem::path path, std::unique_ptr<ShaderModule> module);
   const ShaderModule& getModule(uint32_t id) const { return *shaderModules.at(id); }
 
   struct ShaderProgramInternal
@@ -142,7 +280,17 @@ private:
     std::array<DescriptorLayoutId, MAX_PROGRAM_DESCRIPTORS> descriptorIds;
 
     vk::PushConstantRange pushConst{};
-    vk::UniquePipelineLayout progLayout;
+    // Owned by PipelineLayoutCache and shared between compatible programs
+    vk::PipelineLayout progLayout{};
+
+    ReflectionTable<ShaderResourceInfo> resourcesByName;
+    ReflectionTable<PushConstantMemberInfo> pushConstMembersByName;
+
+    // Sorted by constant id
+    std::vector<SpecConstantInfo> specConstants;
+    ReflectionTable<SpecConstantInfo> specConstantsByName;
+
+    WorkgroupSizeInfo workgroupSize;
 
     void reload(ShaderProgramManager& manager);
   };
@@ -150,6 +298,9 @@ private:
   std::unordered_map<std::string, ShaderProgramId> programNames;
   std::vector<std::unique_ptr<ShaderProgramInternal>> programs;
 
+  ShaderProgramId addProgram(const char* name, std::vector<uint32_t> module_ids);
+  void collectUnusedLayouts();
+
   const ShaderProgramInternal& getProgInternal(ShaderProgramId id) const
   {
     return *programs.at(static_cast<std::underlying_type_t<ShaderProgramId>>(id));
@@ -0,0 +1,127 @@
+#pragma once
+#ifndef ETNA_SHADER_VARIANTS_HPP_INCLUDED
+#define ETNA_SHADER_VARIANTS_HPP_INCLUDED
+
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <etna/Forward.hpp>
+#include <etna/ReflectionTable.hpp>
+#include <etna/SpecializationConstants.hpp>
+
+
+namespace etna
+{
+
+// Values of all keywords of a variant packed into a bitmask, see ShaderVariantManager::keywordBits
+using ShaderVariantMask = std::uint64_t;
+
+struct ShaderKeyword
+{
+  std::string name;
+  // 2 for boolean keywords, the number of alternatives for enum keywords
+  uint32_t valueCount = 2;
+  // If set, the value is passed to shaders through this specialization constant,
+  // otherwise every value selects different shader files.
+  std::optional<uint32_t> specConstantId = std::nullopt;
+};
+
+struct ShaderVariantsCreateInfo
+{
+  // Prefix for the names of programs created for variants
+  std::string name;
+  std::vector<ShaderKeyword> keywords;
+  // Returns shader files for a combination of values of file-selecting keywords,
+  // the argument is indexed the same way as keywords.
+  // Values of specialization constant keywords are always 0 here.
+  std::function<std::vector<std::filesystem::path>(std::span<uint32_t const> values)> shaders;
+};
+
+struct ShaderVariant
+{
+  ShaderProgramId program;
+  // Pass to pipeline CreateInfo or PipelineBase::getVkPipeline(overrides)
+  SpecializationConstants specConstants;
+};
+
+/**
+ * Resolves keyword combinations to shader programs. Programs are only
+ * created when a combination is requested for the first time, so variants
+ * that are never used never get loaded. Lookups of already resolved
+ * combinations are a single probe into a flat hash table.
+ */
+class ShaderVariantManager
+{
+public:
+  explicit ShaderVariantManager(ShaderProgramManager& shader_manager);
+
+  ShaderVariantsId declare(ShaderVariantsCreateInfo info);
+
+  // Bits to OR into a mask for a keyword value, precompute them outside of hot loops
+  ShaderVariantMask keywordBits(ShaderVariantsId id, ShaderNameHash keyword, uint32_t value) const;
+
+  const ShaderVariant& get(ShaderVariantsId id, ShaderVariantMask mask);
+
+  ShaderVariantManager(const ShaderVariantManager&) = delete;
+  ShaderVariantManager& operator=(const ShaderVariantManager&) = delete;
+
+private:
+  // Open addressing hash table from masks to indices
+  class MaskTable
+  {
+  public:
+    std::optional<uint32_t> find(ShaderVariantMask mask) const;
+    void insert(ShaderVariantMask mask, uint32_t value);
+
+  private:
+    struct Slot
+    {
+      // mask + 1, so that 0 marks an empty slot
+      std::uint64_t key = 0;
+      uint32_t value = 0;
+    };
+
+    std::vector<Slot> slots;
+    std::size_t count = 0;
+  };
+
+  struct KeywordLayout
+  {
+    uint32_t offset;
+    uint32_t bits;
+    uint32_t valueCount;
+    std::optional<uint32_t> specConstantId;
+  };
+
+  struct VariantSet
+  {
+    std::string name;
+    std::vector<KeywordLayout> keywords;
+    ReflectionTable<uint32_t> keywordsByName;
+    std::function<std::vector<std::filesystem::path>(std::span<uint32_t const>)> shaders;
+    // Bits of keywords that select shader files
+    ShaderVariantMask fileMask = 0;
+
+    MaskTable variantIndices;
+    // Deque keeps references returned from get() stable
+    std::deque<ShaderVariant> variants;
+    MaskTable programs;
+  };
+
+  ShaderProgramManager& shaderManager;
+  std::vector<std::unique_ptr<VariantSet>> sets;
+
+  VariantSet& getSet(ShaderVariantsId id);
+  const VariantSet& getSet(ShaderVariantsId id) const;
+};
+
+} // namespace etna
+
+#endif // ETNA_SHADER_VARIANTS_HPP_INCLUDED
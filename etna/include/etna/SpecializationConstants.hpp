@@ -0,0 +1,129 @@
+#pragma once
+#ifndef ETNA_SPECIALIZATION_CONSTANTS_HPP_INCLUDED
+#define ETNA_SPECIALIZATION_CONSTANTS_HPP_INCLUDED
+
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+#include <etna/Vulkan.hpp>
+
+
+namespace etna
+{
+
+// Only 32-bit scalar specialization constants are supported
+enum class SpecConstantType : std::uint32_t
+{
+  eBool,
+  eInt32,
+  eUint32,
+  eFloat32,
+};
+
+// Specialization constant declared in a shader
+struct SpecConstantInfo
+{
+  std::uint32_t id;
+  SpecConstantType type;
+  // Bit pattern of the default value
+  std::uint32_t defaultValue;
+
+  bool operator==(const SpecConstantInfo&) const = default;
+};
+
+template <class T>
+concept SpecConstantValue = std::same_as<T, bool> || std::same_as<T, std::int32_t> ||
+  std::same_as<T, std::uint32_t> || std::same_as<T, float>;
+
+/**
+ * Values of specialization constants to compile a pipeline with.
+ * Constants which are not set keep the defaults from the shader source.
+ *   etna::SpecializationConstants{}.set(0, true).set(1, 64u)
+ */
+class SpecializationConstants
+{
+public:
+  struct Entry
+  {
+    std::uint32_t id;
+    SpecConstantType type;
+    std::uint32_t value;
+
+    bool operator==(const Entry&) const = default;
+  };
+
+  template <SpecConstantValue T>
+  SpecializationConstants& set(std::uint32_t id, T value)
+  {
+    if constexpr (std::same_as<T, bool>)
+      return set(Entry{id, SpecConstantType::eBool, value ? vk::True : vk::False});
+    else if constexpr (std::same_as<T, std::int32_t>)
+      return set(Entry{id, SpecConstantType::eInt32, std::bit_cast<std::uint32_t>(value)});
+    else if constexpr (std::same_as<T, std::uint32_t>)
+      return set(Entry{id, SpecConstantType::eUint32, value});
+    else
+      return set(Entry{id, SpecConstantType::eFloat32, std::bit_cast<std::uint32_t>(value)});
+  }
+
+  SpecializationConstants& set(Entry entry)
+  {
+    auto it = std::ranges::lower_bound(entries, entry.id, {}, &Entry::id);
+    if (it != entries.end() && it->id == entry.id)
+      *it = entry;
+    else
+      entries.insert(it, entry);
+    return *this;
+  }
+
+  // Values from overrides take precedence over values from this object
+  SpecializationConstants overriddenBy(const SpecializationConstants& overrides) const
+  {
+    SpecializationConstants result = *this;
+    for (const auto& entry : overrides.entries)
+      result.set(entry);
+    return result;
+  }
+
+  const Entry* find(std::uint32_t id) const
+  {
+    auto it = std::ranges::lower_bound(entries, id, {}, &Entry::id);
+    return it != entries.end() && it->id == id ? &*it : nullptr;
+  }
+
+  // Entries are sorted by constant id
+  std::span<Entry const> getEntries() const { return entries; }
+  bool empty() const { return entries.empty(); }
+
+  bool operator==(const SpecializationConstants&) const = default;
+
+private:
+  std::vector<Entry> entries;
+};
+
+struct SpecializationConstantsHash
+{
+  std::size_t operator()(const SpecializationConstants& constants) const
+  {
+    return (*this)(constants.getEntries());
+  }
+
+  std::size_t operator()(std::span<SpecializationConstants::Entry const> entries) const
+  {
+    std::size_t result = 0;
+    for (const auto& entry : entries)
+    {
+      const std::uint64_t packed = (std::uint64_t{entry.id} << 32) | entry.value;
+      result ^= std::hash<std::uint64_t>{}(packed) + 0x9e3779b9 + (result << 6) + (result >> 2);
+    }
+    return result;
+  }
+};
+
+} // namespace etna
+
+#endif // ETNA_SPECIALIZATION_CONSTANTS_HPP_INCLUDED
@@ -34,6 +34,7 @@ public:
   };
 
   explicit Window(const Dependencies& deps, CreateInfo info);
+  ~Window();
 
   struct SwapchainImage
   {
@@ -129,6 +130,7 @@ private:
   };
 
   SwapchainData createSwapchain(const DesiredProperties& props) const;
+  void forgetSwapchainImages();
 
   std::uint32_t viewToIdx(vk::ImageView view);
 
@@ -0,0 +1,519 @@
+#include <etna/AccelerationStructure.hpp>
+
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+#include <etna/DeletionQueue.hpp>
+#include <etna/GlobalContext.hpp>
+
+#include "DebugUtils.hpp"
+
+
+namespace etna
+{
+
+// Scratch memory is usually needed in small amounts, except for the initial batch of BLAS builds
+static constexpr vk::DeviceSize SCRATCH_BUFFER_SIZE = 16 << 20;
+
+// Everything that might read an acceleration structure: builds, copies, queries and ray queries
+static constexpr vk::PipelineStageFlags2 READER_STAGES =
+  vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR |
+  vk::PipelineStageFlagBits2::eRayTracingShaderKHR | vk::PipelineStageFlagBits2::eComputeShader |
+  vk::PipelineStageFlagBits2::eFragmentShader;
+
+static constexpr vk::DeviceSize align_up(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+static void memory_barrier(
+  vk::CommandBuffer cmd,
+  vk::PipelineStageFlags2 src_stages,
+  vk::AccessFlags2 src_access,
+  vk::PipelineStageFlags2 dst_stages,
+  vk::AccessFlags2 dst_access)
+{
+  vk::MemoryBarrier2 barrier{
+    .srcStageMask = src_stages,
+    .srcAccessMask = src_access,
+    .dstStageMask = dst_stages,
+    .dstAccessMask = dst_access,
+  };
+  vk::DependencyInfo dependency{};
+  dependency.setMemoryBarriers(barrier);
+  cmd.pipelineBarrier2(dependency);
+}
+
+AccelerationStructure::AccelerationStructure(
+  vk::Device device,
+  vk::AccelerationStructureTypeKHR type,
+  vk::DeviceSize in_size,
+  std::string_view name)
+  : storage{get_context().createBuffer(Buffer::CreateInfo{
+      .size = in_size,
+      .bufferUsage = vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR |
+        vk::BufferUsageFlagBits::eShaderDeviceAddress,
+      .name = name,
+    })}
+  , size{in_size}
+{
+  handle = unwrap_vk_result(device.createAccelerationStructureKHRUnique(
+    vk::AccelerationStructureCreateInfoKHR{
+      .buffer = storage.get(),
+      .size = size,
+      .type = type,
+    }));
+  address = device.getAccelerationStructureAddressKHR(
+    vk::AccelerationStructureDeviceAddressInfoKHR{.accelerationStructure = handle.get()});
+  set_debug_name(handle.get(), name.data());
+}
+
+AccelerationStructureManager::AccelerationStructureManager(
+  vk::PhysicalDevice physical_device,
+  vk::Device dev,
+  const GpuWorkCount& work_count,
+  DeletionQueue& deletion_queue)
+  : device{dev}
+  , workCount{work_count}
+  , deletionQueue{deletion_queue}
+  , scratchAlignment{physical_device
+                       .getProperties2<
+                         vk::PhysicalDeviceProperties2,
+                         vk::PhysicalDeviceAccelerationStructurePropertiesKHR>()
+                       .get<vk::PhysicalDeviceAccelerationStructurePropertiesKHR>()
+                       .minAccelerationStructureScratchOffsetAlignment}
+  , scratch{work_count, std::in_place}
+{
+}
+
+BlasId AccelerationStructureManager::createBlas(BlasCreateInfo info)
+{
+  ETNA_VERIFYF(!info.geometries.empty(), "BLAS {} has no geometries", info.name);
+
+  const auto id = static_cast<BlasId>(blases.size());
+  blases.push_back(Blas{.name = info.name});
+  pendingBuilds.emplace_back(id, std::move(info));
+  return id;
+}
+
+void AccelerationStructureManager::destroyBlas(BlasId id)
+{
+  auto& slot = getBlasSlot(id);
+  std::erase_if(pendingBuilds, [id](const auto& pending) { return pending.first == id; });
+  if (slot.structure.has_value())
+    deletionQueue.retire(std::move(*slot.structure));
+  slot.structure.reset();
+}
+
+bool AccelerationStructureManager::isBlasBuilt(BlasId id) const
+{
+  return getBlasSlot(id).structure.has_value();
+}
+
+const AccelerationStructure& AccelerationStructureManager::getBlas(BlasId id) const
+{
+  const auto& slot = getBlasSlot(id);
+  ETNA_VERIFYF(slot.structure.has_value(), "BLAS {} is not built", slot.name);
+  return *slot.structure;
+}
+
+TlasId AccelerationStructureManager::createTlas(TlasCreateInfo info)
+{
+  ETNA_VERIFYF(info.maxInstances > 0, "TLAS {} can't hold any instances", info.name);
+
+  vk::AccelerationStructureGeometryKHR geometry{.geometryType = vk::GeometryTypeKHR::eInstances};
+  geometry.geometry.setInstances(
+    vk::AccelerationStructureGeometryInstancesDataKHR{.arrayOfPointers = vk::False});
+
+  vk::AccelerationStructureBuildGeometryInfoKHR buildInfo{
+    .type = vk::AccelerationStructureTypeKHR::eTopLevel,
+    .flags = info.flags,
+    .mode = vk::BuildAccelerationStructureModeKHR::eBuild,
+  };
+  buildInfo.setGeometries(geometry);
+
+  // Memory is allocated for the worst case once, so that the TLAS never has to be reallocated
+  const auto sizes = device.getAccelerationStructureBuildSizesKHR(
+    vk::AccelerationStructureBuildTypeKHR::eDevice, buildInfo, info.maxInstances);
+  const vk::DeviceSize instancesSize =
+    sizeof(vk::AccelerationStructureInstanceKHR) * info.maxInstances;
+
+  const auto id = static_cast<TlasId>(tlases.size());
+  tlases.emplace_back(new Tlas{
+    .info = info,
+    .structure = AccelerationStructure(
+      device,
+      vk::AccelerationStructureTypeKHR::eTopLevel,
+      sizes.accelerationStructureSize,
+      info.name),
+    .instances = GpuSharedResource<Buffer>(
+      workCount,
+      [instancesSize](std::size_t) {
+        return get_context().createBuffer(Buffer::CreateInfo{
+          .size = instancesSize,
+          .bufferUsage = vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR |
+            vk::BufferUsageFlagBits::eShaderDeviceAddress,
+          .memoryUsage = VMA_MEMORY_USAGE_AUTO,
+          .allocationCreate = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
+            VMA_ALLOCATION_CREATE_MAPPED_BIT,
+          .name = "tlas_instances",
+        });
+      }),
+    .buildScratchSize = sizes.buildScratchSize,
+    .updateScratchSize = sizes.updateScratchSize,
+  });
+  return id;
+}
+
+void AccelerationStructureManager::destroyTlas(TlasId id)
+{
+  getTlasSlot(id);
+  deletionQueue.retire(std::move(tlases[static_cast<std::underlying_type_t<TlasId>>(id)]));
+}
+
+const AccelerationStructure& AccelerationStructureManager::getTlas(TlasId id) const
+{
+  return getTlasSlot(id).structure;
+}
+
+void AccelerationStructureManager::build(vk::CommandBuffer cmd)
+{
+  ZoneScoped;
+  compactBuilt(cmd);
+  buildPending(cmd);
+}
+
+void AccelerationStructureManager::compactBuilt(vk::CommandBuffer cmd)
+{
+  const auto inflight = static_cast<std::uint64_t>(workCount.multiBufferingCount());
+
+  bool compacted = false;
+  std::erase_if(pendingCompactions, [&](PendingCompaction& pending) {
+    // Queries are reset by the same command buffer that writes them,
+    // so they may only be read once it is known to have finished
+    if (pending.batch + inflight > workCount.batchIndex())
+      return false;
+
+    const auto count = static_cast<uint32_t>(pending.blases.size());
+    const auto sizes = unwrap_vk_result(device.getQueryPoolResults<vk::DeviceSize>(
+      pending.queries.get(),
+      0,
+      count,
+      count * sizeof(vk::DeviceSize),
+      sizeof(vk::DeviceSize),
+      vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait));
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      auto& slot = getBlasSlot(pending.blases[i]);
+      // Destroyed while the sizes were being computed
+      if (!slot.structure.has_value())
+        continue;
+
+      AccelerationStructure compactedBlas(
+        device, vk::AccelerationStructureTypeKHR::eBottomLevel, sizes[i], slot.name);
+      cmd.copyAccelerationStructureKHR(vk::CopyAccelerationStructureInfoKHR{
+        .src = slot.structure->get(),
+        .dst = compactedBlas.get(),
+        .mode = vk::CopyAccelerationStructureModeKHR::eCompact,
+      });
+
+      compactionStats.compactedCount++;
+      compactionStats.sizeBefore += slot.structure->getSize();
+      compactionStats.sizeAfter += sizes[i];
+
+      deletionQueue.retire(std::move(*slot.structure));
+      slot.structure.emplace(std::move(compactedBlas));
+      compacted = true;
+    }
+    return true;
+  });
+
+  if (compacted)
+    memory_barrier(
+      cmd,
+      vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+      vk::AccessFlagBits2::eAccelerationStructureWriteKHR,
+      READER_STAGES,
+      vk::AccessFlagBits2::eAccelerationStructureReadKHR);
+}
+
+void AccelerationStructureManager::buildPending(vk::CommandBuffer cmd)
+{
+  if (pendingBuilds.empty())
+    return;
+
+  const std::size_t count = pendingBuilds.size();
+  std::vector<std::vector<vk::AccelerationStructureGeometryKHR>> geometries(count);
+  std::vector<std::vector<vk::AccelerationStructureBuildRangeInfoKHR>> ranges(count);
+  std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> buildInfos(count);
+  std::vector<const vk::AccelerationStructureBuildRangeInfoKHR*> rangePointers(count);
+  std::vector<BlasId> compactable;
+
+  for (std::size_t i = 0; i < count; ++i)
+  {
+    auto& [id, info] = pendingBuilds[i];
+
+    std::vector<uint32_t> primitiveCounts;
+    for (const auto& source : info.geometries)
+    {
+      auto& geometry = geometries[i].emplace_back();
+      if (const auto* triangles = std::get_if<BlasTriangles>(&source))
+      {
+        vk::AccelerationStructureGeometryTrianglesDataKHR data{
+          .vertexFormat = triangles->vertexFormat,
+          .vertexStride = triangles->vertexStride,
+          .maxVertex = triangles->maxVertex,
+          .indexType =
+            triangles->indexData != 0 ? triangles->indexType : vk::IndexType::eNoneKHR,
+        };
+        data.vertexData.deviceAddress = triangles->vertexData;
+        data.indexData.deviceAddress = triangles->indexData;
+        data.transformData.deviceAddress = triangles->transformData;
+
+        geometry.geometryType = vk::GeometryTypeKHR::eTriangles;
+        geometry.geometry.setTriangles(data);
+        geometry.flags = triangles->flags;
+        primitiveCounts.push_back(triangles->triangleCount);
+      }
+      else
+      {
+        const auto& aabbs = std::get<BlasAabbs>(source);
+        vk::AccelerationStructureGeometryAabbsDataKHR data{.stride = aabbs.stride};
+        data.data.deviceAddress = aabbs.data;
+
+        geometry.geometryType = vk::GeometryTypeKHR::eAabbs;
+        geometry.geometry.setAabbs(data);
+        geometry.flags = aabbs.flags;
+        primitiveCounts.push_back(aabbs.count);
+      }
+      ranges[i].push_back(
+        vk::AccelerationStructureBuildRangeInfoKHR{.primitiveCount = primitiveCounts.back()});
+    }
+
+    auto flags = info.flags;
+    if (info.allowCompaction)
+      flags |= vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction;
+
+    auto& buildInfo = buildInfos[i];
+    buildInfo = vk::AccelerationStructureBuildGeometryInfoKHR{
+      .type = vk::AccelerationStructureTypeKHR::eBottomLevel,
+      .flags = flags,
+      .mode = vk::BuildAccelerationStructureModeKHR::eBuild,
+    };
+    buildInfo.setGeometries(geometries[i]);
+
+    const auto sizes = device.getAccelerationStructureBuildSizesKHR(
+      vk::AccelerationStructureBuildTypeKHR::eDevice, buildInfo, primitiveCounts);
+
+    auto& slot = getBlasSlot(id);
+    slot.structure.emplace(
+      device,
+      vk::AccelerationStructureTypeKHR::eBottomLevel,
+      sizes.accelerationStructureSize,
+      slot.name);
+    buildInfo.dstAccelerationStructure = slot.structure->get();
+    buildInfo.scratchData.deviceAddress = allocateScratch(sizes.buildScratchSize);
+    rangePointers[i] = ranges[i].data();
+
+    if (info.allowCompaction)
+      compactable.push_back(id);
+  }
+
+  // Geometry is usually uploaded right before being built
+  memory_barrier(
+    cmd,
+    vk::PipelineStageFlagBits2::eAllTransfer | vk::PipelineStageFlagBits2::eComputeShader,
+    vk::AccessFlagBits2::eTransferWrite | vk::AccessFlagBits2::eShaderWrite,
+    vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+    vk::AccessFlagBits2::eShaderRead);
+
+  // A single command lets the driver build all BLASes in parallel
+  cmd.buildAccelerationStructuresKHR(buildInfos, rangePointers);
+
+  memory_barrier(
+    cmd,
+    vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+    vk::AccessFlagBits2::eAccelerationStructureWriteKHR,
+    READER_STAGES,
+    vk::AccessFlagBits2::eAccelerationStructureReadKHR);
+
+  if (!compactable.empty())
+  {
+    const auto queryCount = static_cast<uint32_t>(compactable.size());
+    auto queries = unwrap_vk_result(device.createQueryPoolUnique(vk::QueryPoolCreateInfo{
+      .queryType = vk::QueryType::eAccelerationStructureCompactedSizeKHR,
+      .queryCount = queryCount,
+    }));
+
+    std::vector<vk::AccelerationStructureKHR> handles;
+    handles.reserve(queryCount);
+    for (auto id : compactable)
+      handles.push_back(getBlasSlot(id).structure->get());
+
+    cmd.resetQueryPool(queries.get(), 0, queryCount);
+    cmd.writeAccelerationStructuresPropertiesKHR(
+      handles, vk::QueryType::eAccelerationStructureCompactedSizeKHR, queries.get(), 0);
+
+    pendingCompactions.push_back(PendingCompaction{
+      .batch = workCount.batchIndex(),
+      .queries = std::move(queries),
+      .blases = std::move(compactable),
+    });
+  }
+
+  pendingBuilds.clear();
+}
+
+void AccelerationStructureManager::buildTlas(
+  vk::CommandBuffer cmd, TlasId id, std::span<TlasInstance const> instances)
+{
+  ZoneScoped;
+
+  auto& tlas = getTlasSlot(id);
+  ETNA_VERIFYF(
+    instances.size() <= tlas.info.maxInstances,
+    "TLAS {} can hold {} instances, got {}",
+    tlas.info.name,
+    tlas.info.maxInstances,
+    instances.size());
+
+  auto& instanceBuffer = tlas.instances.get();
+  auto* dst = reinterpret_cast<vk::AccelerationStructureInstanceKHR*>(instanceBuffer.data());
+
+  std::vector<vk::DeviceAddress> blasAddresses;
+  blasAddresses.reserve(instances.size());
+  for (std::size_t i = 0; i < instances.size(); ++i)
+  {
+    const auto& instance = instances[i];
+    blasAddresses.push_back(getBlas(instance.blas).getDeviceAddress());
+
+    vk::AccelerationStructureInstanceKHR result{};
+    for (std::size_t row = 0; row < 3; ++row)
+      for (std::size_t column = 0; column < 4; ++column)
+        result.transform.matrix[row][column] = instance.transform[row * 4 + column];
+    result.instanceCustomIndex = instance.customIndex;
+    result.mask = instance.mask;
+    result.instanceShaderBindingTableRecordOffset = instance.shaderBindingTableOffset;
+    result.flags = static_cast<VkGeometryInstanceFlagsKHR>(instance.flags);
+    result.accelerationStructureReference = blasAddresses.back();
+    dst[i] = result;
+  }
+
+  // Refitting only moves bounding boxes around, so the instances have to stay the same
+  const bool refit = tlas.built &&
+    (tlas.info.flags & vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate) &&
+    tlas.refits < tlas.info.maxConsecutiveRefits && tlas.builtWith == blasAddresses;
+
+  vk::AccelerationStructureGeometryInstancesDataKHR instancesData{.arrayOfPointers = vk::False};
+  instancesData.data.deviceAddress = instanceBuffer.getDeviceAddress();
+  vk::AccelerationStructureGeometryKHR geometry{.geometryType = vk::GeometryTypeKHR::eInstances};
+  geometry.geometry.setInstances(instancesData);
+
+  vk::AccelerationStructureBuildGeometryInfoKHR buildInfo{
+    .type = vk::AccelerationStructureTypeKHR::eTopLevel,
+    .flags = tlas.info.flags,
+    .mode = refit ? vk::BuildAccelerationStructureModeKHR::eUpdate
+                  : vk::BuildAccelerationStructureModeKHR::eBuild,
+    .srcAccelerationStructure = refit ? tlas.structure.get() : vk::AccelerationStructureKHR{},
+    .dstAccelerationStructure = tlas.structure.get(),
+  };
+  buildInfo.setGeometries(geometry);
+  buildInfo.scratchData.deviceAddress =
+    allocateScratch(refit ? tlas.updateScratchSize : tlas.buildScratchSize);
+
+  const vk::AccelerationStructureBuildRangeInfoKHR range{
+    .primitiveCount = static_cast<uint32_t>(instances.size()),
+  };
+  const vk::AccelerationStructureBuildRangeInfoKHR* rangePointer = &range;
+
+  // Rays traced by the previous frame might still be reading the TLAS
+  memory_barrier(
+    cmd,
+    READER_STAGES,
+    vk::AccessFlagBits2::eAccelerationStructureReadKHR,
+    vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+    vk::AccessFlagBits2::eAccelerationStructureWriteKHR);
+
+  cmd.buildAccelerationStructuresKHR(buildInfo, rangePointer);
+
+  memory_barrier(
+    cmd,
+    vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+    vk::AccessFlagBits2::eAccelerationStructureWriteKHR,
+    READER_STAGES,
+    vk::AccessFlagBits2::eAccelerationStructureReadKHR);
+
+  tlas.refits = refit ? tlas.refits + 1 : 0;
+  tlas.builtWith = std::move(blasAddresses);
+  tlas.built = true;
+}
+
+vk::DeviceAddress AccelerationStructureManager::allocateScratch(vk::DeviceSize size)
+{
+  auto& arena = scratch.get();
+  if (arena.batch != workCount.batchIndex())
+  {
+    // The GPU is done with the frame that used this arena last time
+    arena.batch = workCount.batchIndex();
+    arena.current = 0;
+    arena.offset = 0;
+  }
+
+  for (;; ++arena.current, arena.offset = 0)
+  {
+    if (arena.current == arena.buffers.size())
+    {
+      const vk::DeviceSize bufferSize = std::max(SCRATCH_BUFFER_SIZE, size + scratchAlignment);
+      auto buffer = get_context().createBuffer(Buffer::CreateInfo{
+        .size = bufferSize,
+        .bufferUsage =
+          vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress,
+        .name = "acceleration_structure_scratch",
+      });
+      const vk::DeviceAddress address = buffer.getDeviceAddress();
+      arena.buffers.push_back(ScratchBuffer{std::move(buffer), bufferSize, address});
+    }
+
+    const auto& buffer = arena.buffers[arena.current];
+    const vk::DeviceSize start =
+      align_up(buffer.address + arena.offset, scratchAlignment) - buffer.address;
+    if (start + size <= buffer.size)
+    {
+      arena.offset = start + size;
+      return buffer.address + start;
+    }
+  }
+}
+
+AccelerationStructureManager::Blas& AccelerationStructureManager::getBlasSlot(BlasId id)
+{
+  const auto index = static_cast<std::underlying_type_t<BlasId>>(id);
+  ETNA_VERIFYF(index < blases.size(), "Invalid BLAS id {}", index);
+  return blases[index];
+}
+
+const AccelerationStructureManager::Blas& AccelerationStructureManager::getBlasSlot(
+  BlasId id) const
+{
+  const auto index = static_cast<std::underlying_type_t<BlasId>>(id);
+  ETNA_VERIFYF(index < blases.size(), "Invalid BLAS id {}", index);
+  return blases[index];
+}
+
+AccelerationStructureManager::Tlas& AccelerationStructureManager::getTlasSlot(TlasId id)
+{
+  const auto index = static_cast<std::underlying_type_t<TlasId>>(id);
+  ETNA_VERIFYF(index < tlases.size() && tlases[index] != nullptr, "Invalid TLAS id {}", index);
+  return *tlases[index];
+}
+
+const AccelerationStructureManager::Tlas& AccelerationStructureManager::getTlasSlot(
+  TlasId id) const
+{
+  const auto index = static_cast<std::underlying_type_t<TlasId>>(id);
+  ETNA_VERIFYF(index < tlases.size() && tlases[index] != nullptr, "Invalid TLAS id {}", index);
+  return *tlases[index];
+}
+
+} // namespace etna
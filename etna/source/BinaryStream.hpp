@@ -0,0 +1,105 @@
+#pragma once
+#ifndef ETNA_BINARY_STREAM_HPP_INCLUDED
+#define ETNA_BINARY_STREAM_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+
+namespace etna
+{
+
+// Helpers for etna's own binary formats. Native endianness, no alignment.
+class BinaryWriter
+{
+public:
+  explicit BinaryWriter(std::vector<std::byte>& output)
+    : out{output}
+  {
+  }
+
+  template <class T>
+    requires std::is_trivially_copyable_v<T>
+  void write(const T& value)
+  {
+    const auto* bytes = reinterpret_cast<const std::byte*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+  }
+
+  void write(std::string_view str)
+  {
+    write(static_cast<std::uint32_t>(str.size()));
+    writeBytes(std::as_bytes(std::span{str.data(), str.size()}));
+  }
+
+  void writeBytes(std::span<std::byte const> bytes)
+  {
+    out.insert(out.end(), bytes.begin(), bytes.end());
+  }
+
+  std::size_t size() const { return out.size(); }
+
+private:
+  std::vector<std::byte>& out;
+};
+
+/**
+ * Reads data written with BinaryWriter. Never reads out of bounds,
+ * instead the reader becomes failed and all subsequent reads return
+ * zeroes, so callers only need to check ok() once at the end.
+ */
+class BinaryReader
+{
+public:
+  explicit BinaryReader(std::span<std::byte const> input)
+    : in{input}
+  {
+  }
+
+  template <class T>
+    requires std::is_trivially_copyable_v<T>
+  T read()
+  {
+    T result{};
+    auto bytes = readBytes(sizeof(T));
+    if (!bytes.empty())
+      std::memcpy(&result, bytes.data(), sizeof(T));
+    return result;
+  }
+
+  std::string readString()
+  {
+    auto length = read<std::uint32_t>();
+    auto bytes = readBytes(length);
+    return std::string{reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+  }
+
+  std::span<std::byte const> readBytes(std::size_t count)
+  {
+    if (failed || in.size() - offset < count)
+    {
+      failed = true;
+      return {};
+    }
+    auto result = in.subspan(offset, count);
+    offset += count;
+    return result;
+  }
+
+  bool ok() const { return !failed; }
+  bool atEnd() const { return offset == in.size(); }
+
+private:
+  std::span<std::byte const> in;
+  std::size_t offset = 0;
+  bool failed = false;
+};
+
+} // namespace etna
+
+#endif // ETNA_BINARY_STREAM_HPP_INCLUDED
@@ -0,0 +1,153 @@
+#include "BlobCache.hpp"
+
+#include <fstream>
+#include <fmt/std.h>
+#include <spdlog/spdlog.h>
+
+#include "BinaryStream.hpp"
+
+
+namespace etna
+{
+
+BlobCache::BlobCache(
+  std::filesystem::path cache_path,
+  std::uint64_t cache_magic,
+  std::uint32_t cache_version,
+  std::string cache_description)
+  : path{std::move(cache_path)}
+  , magic{cache_magic}
+  , version{cache_version}
+  , description{std::move(cache_description)}
+{
+  mapFile();
+}
+
+BlobCache::~BlobCache()
+{
+  save();
+}
+
+void BlobCache::mapFile()
+{
+  mappedEntries.clear();
+  file = MappedFile{path};
+  if (file.empty())
+    return;
+
+  BinaryReader reader{file.data()};
+  const auto fileMagic = reader.read<std::uint64_t>();
+  const auto fileVersion = reader.read<std::uint32_t>();
+  const auto entryCount = reader.read<std::uint32_t>();
+  if (!reader.ok() || fileMagic != magic || fileVersion != version)
+  {
+    spdlog::warn("Ignoring {} {}, it is outdated or broken", description, path);
+    file.reset();
+    return;
+  }
+
+  mappedEntries.reserve(entryCount);
+  for (std::uint32_t i = 0; i < entryCount; i++)
+  {
+    const auto hash = reader.read<std::uint64_t>();
+    const auto size = reader.read<std::uint32_t>();
+    const auto payload = reader.readBytes(size);
+    if (!reader.ok())
+    {
+      spdlog::warn("The {} {} is truncated", description, path);
+      break;
+    }
+    mappedEntries.emplace(hash, payload);
+  }
+}
+
+std::optional<std::vector<std::byte>> BlobCache::find(std::uint64_t hash) const
+{
+  std::lock_guard lock{mutex};
+  if (auto it = newEntries.find(hash); it != newEntries.end())
+    return it->second;
+
+  if (auto it = mappedEntries.find(hash); it != mappedEntries.end())
+  {
+    usedEntries.insert(hash);
+    return std::vector<std::byte>{it->second.begin(), it->second.end()};
+  }
+
+  return std::nullopt;
+}
+
+void BlobCache::insert(std::uint64_t hash, std::vector<std::byte> payload)
+{
+  std::lock_guard lock{mutex};
+  if (mappedEntries.contains(hash))
+  {
+    usedEntries.insert(hash);
+    return;
+  }
+  newEntries.insert_or_assign(hash, std::move(payload));
+}
+
+void BlobCache::save()
+{
+  std::lock_guard lock{mutex};
+  // Used entries are always mapped ones, so the file only stays as is if every one was used
+  if (newEntries.empty() && usedEntries.size() == mappedEntries.size())
+    return;
+
+  std::vector<std::pair<std::uint64_t, std::span<std::byte const>>> keptEntries;
+  for (const auto hash : usedEntries)
+    if (auto it = mappedEntries.find(hash); it != mappedEntries.end())
+      keptEntries.emplace_back(hash, it->second);
+
+  std::vector<std::byte> contents;
+  BinaryWriter writer{contents};
+  writer.write(magic);
+  writer.write(version);
+  writer.write(static_cast<std::uint32_t>(keptEntries.size() + newEntries.size()));
+
+  auto writeEntry = [&writer](std::uint64_t hash, std::span<std::byte const> payload) {
+    writer.write(hash);
+    writer.write(static_cast<std::uint32_t>(payload.size()));
+    writer.writeBytes(payload);
+  };
+  for (const auto& [hash, payload] : keptEntries)
+    writeEntry(hash, payload);
+  for (const auto& [hash, payload] : newEntries)
+    writeEntry(hash, payload);
+
+  // Mapped entries point into the file we are about to replace
+  mappedEntries.clear();
+  file.reset();
+
+  // Write to a temporary file first so that a crash never leaves a broken cache behind
+  auto tmpPath = path;
+  tmpPath += ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(contents.data()), std::streamsize(contents.size()));
+    if (!out)
+    {
+      spdlog::warn("Failed to write {} {}", description, tmpPath);
+      mapFile();
+      return;
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmpPath, path, ec);
+  if (ec)
+  {
+    spdlog::warn("Failed to write {} {}: {}", description, path, ec.message());
+    mapFile();
+    return;
+  }
+
+  newEntries.clear();
+  mapFile();
+  usedEntries.clear();
+  // Everything that was just written has been used during this run
+  for (const auto& entry : mappedEntries)
+    usedEntries.insert(entry.first);
+}
+
+} // namespace etna
@@ -0,0 +1,70 @@
+#pragma once
+#ifndef ETNA_BLOB_CACHE_HPP_INCLUDED
+#define ETNA_BLOB_CACHE_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "MappedFile.hpp"
+
+
+namespace etna
+{
+
+/**
+ * On-disk map from 64-bit hashes to binary blobs.
+ * The cache file is memory-mapped on startup and rewritten when save() is called.
+ * Only entries that were looked up or inserted during this run are written,
+ * so entries of edited or deleted shaders do not pile up in the file forever.
+ * Files with a different magic or version are ignored. find() and insert()
+ * may be called concurrently.
+ */
+class BlobCache
+{
+public:
+  // description is only used in log messages
+  BlobCache(
+    std::filesystem::path cache_path,
+    std::uint64_t magic,
+    std::uint32_t version,
+    std::string description);
+  ~BlobCache();
+
+  std::optional<std::vector<std::byte>> find(std::uint64_t hash) const;
+  void insert(std::uint64_t hash, std::vector<std::byte> payload);
+
+  // Rewrites the cache file with the entries which were inserted or used since the cache
+  // was opened. Nothing is written if that would not change the file.
+  void save();
+
+  BlobCache(const BlobCache&) = delete;
+  BlobCache& operator=(const BlobCache&) = delete;
+
+private:
+  void mapFile();
+
+private:
+  std::filesystem::path path;
+  std::uint64_t magic;
+  std::uint32_t version;
+  std::string description;
+
+  mutable std::mutex mutex;
+  MappedFile file;
+  std::unordered_map<std::uint64_t, std::span<std::byte const>> mappedEntries;
+  std::unordered_map<std::uint64_t, std::vector<std::byte>> newEntries;
+  // Mapped entries which are kept by the next save
+  mutable std::unordered_set<std::uint64_t> usedEntries;
+};
+
+} // namespace etna
+
+#endif // ETNA_BLOB_CACHE_HPP_INCLUDED
@@ -142,11 +142,17 @@ void BlockingTransferHelper::uploadImage(
       {
         etna::set_state(
           cmdBuf,
-          dst.get(),
+          dst,
           vk::PipelineStageFlagBits2::eTransfer,
           vk::AccessFlagBits2::eTransferWrite,
           vk::ImageLayout::eTransferDstOptimal,
-          dst.getAspectMaskByFormat());
+          vk::ImageSubresourceRange{
+            .aspectMask = dst.getAspectMaskByFormat(),
+            .baseMipLevel = mip_level,
+            .levelCount = 1,
+            .baseArrayLayer = layer,
+            .layerCount = 1,
+          });
         etna::flush_barriers(cmdBuf);
       }
 
@@ -177,11 +183,17 @@ void BlockingTransferHelper::uploadImage(
       {
         etna::set_state(
           cmdBuf,
-          dst.get(),
+          dst,
           {},
           {},
           vk::ImageLayout::eShaderReadOnlyOptimal,
-          dst.getAspectMaskByFormat());
+          vk::ImageSubresourceRange{
+            .aspectMask = dst.getAspectMaskByFormat(),
+            .baseMipLevel = mip_level,
+            .levelCount = 1,
+            .baseArrayLayer = layer,
+            .layerCount = 1,
+          });
         etna::flush_barriers(cmdBuf);
       }
     }
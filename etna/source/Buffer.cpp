@@ -1,7 +1,10 @@
 #include <etna/Buffer.hpp>
 
 #include <etna/BindingItems.hpp>
+#include <etna/Etna.hpp>
+#include <etna/GlobalContext.hpp>
 #include "DebugUtils.hpp"
+#include "StateTracking.hpp"
 
 
 namespace etna
@@ -9,11 +12,16 @@ namespace etna
 
 Buffer::Buffer(VmaAllocator alloc, CreateInfo info)
   : allocator{alloc}
+  , size{info.size}
 {
+  const bool concurrent = info.concurrentQueueFamilies.size() > 1;
   vk::BufferCreateInfo bufInfo{
     .size = info.size,
     .usage = info.bufferUsage,
-    .sharingMode = vk::SharingMode::eExclusive,
+    .sharingMode = concurrent ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive,
+    .queueFamilyIndexCount =
+      concurrent ? static_cast<uint32_t>(info.concurrentQueueFamilies.size()) : 0,
+    .pQueueFamilyIndices = concurrent ? info.concurrentQueueFamilies.data() : nullptr,
   };
 
   VmaAllocationCreateInfo allocCreateInfo{
@@ -50,6 +58,10 @@ Buffer::Buffer(VmaAllocator alloc, CreateInfo info)
   ETNA_VERIFY(mapped == nullptr || info.allocationCreate & VMA_ALLOCATION_CREATE_MAPPED_BIT);
 
   etna::set_debug_name(buffer, info.name.data());
+
+  if (etna::is_initilized())
+    trackingId = etna::get_context().getResourceTracker().registerBuffer(
+      buffer, size, info.name, concurrent);
 }
 
 void Buffer::swap(Buffer& other)
@@ -57,7 +69,9 @@ void Buffer::swap(Buffer& other)
   std::swap(allocator, other.allocator);
   std::swap(allocation, other.allocation);
   std::swap(buffer, other.buffer);
+  std::swap(size, other.size);
   std::swap(mapped, other.mapped);
+  std::swap(trackingId, other.trackingId);
 }
 
 Buffer::Buffer(Buffer&& other) noexcept
@@ -89,10 +103,15 @@ void Buffer::reset()
   if (mapped != nullptr)
     unmap();
 
+  if (trackingId != TrackedBufferId::Invalid && etna::is_initilized())
+    etna::get_context().getResourceTracker().unregisterBuffer(buffer);
+  trackingId = TrackedBufferId::Invalid;
+
   vmaDestroyBuffer(allocator, VkBuffer(buffer), allocation);
   allocator = {};
   allocation = {};
   buffer = vk::Buffer{};
+  size = 0;
 }
 
 std::byte* Buffer::map()
@@ -117,6 +136,14 @@ void Buffer::unmap()
   mapped = nullptr;
 }
 
+vk::DeviceAddress Buffer::getDeviceAddress() const
+{
+  VmaAllocatorInfo allocatorInfo;
+  vmaGetAllocatorInfo(allocator, &allocatorInfo);
+  return vk::Device{allocatorInfo.device}.getBufferAddress(
+    vk::BufferDeviceAddressInfo{.buffer = buffer});
+}
+
 BufferBinding Buffer::genBinding(vk::DeviceSize offset, vk::DeviceSize range) const
 {
   return BufferBinding{this, vk::DescriptorBufferInfo{get(), offset, range}};
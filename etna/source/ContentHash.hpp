@@ -0,0 +1,108 @@
+#pragma once
+#ifndef ETNA_CONTENT_HASH_HPP_INCLUDED
+#define ETNA_CONTENT_HASH_HPP_INCLUDED
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+
+namespace etna
+{
+
+/**
+ * 64-bit content hash of a byte blob (XXH64 with a zero seed).
+ * Four independent accumulators process 32-byte stripes, which
+ * compilers happily vectorize, so hashing SPIR-V is mostly memory-bound.
+ */
+inline std::uint64_t hash_content(std::span<std::byte const> data)
+{
+  constexpr std::uint64_t P1 = 11400714785074694791ull;
+  constexpr std::uint64_t P2 = 14029467366897019727ull;
+  constexpr std::uint64_t P3 = 1609587929392839161ull;
+  constexpr std::uint64_t P4 = 9650029242287828579ull;
+  constexpr std::uint64_t P5 = 2870177450012600261ull;
+
+  auto read64 = [](const std::byte* p) {
+    std::uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  };
+  auto read32 = [](const std::byte* p) {
+    std::uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  };
+  auto round = [](std::uint64_t acc, std::uint64_t input) {
+    acc += input * P2;
+    acc = std::rotl(acc, 31);
+    return acc * P1;
+  };
+  auto mergeRound = [&round](std::uint64_t acc, std::uint64_t val) {
+    acc ^= round(0, val);
+    return acc * P1 + P4;
+  };
+
+  const std::byte* p = data.data();
+  const std::byte* const end = p + data.size();
+  std::uint64_t h;
+
+  if (data.size() >= 32)
+  {
+    std::uint64_t v1 = P1 + P2;
+    std::uint64_t v2 = P2;
+    std::uint64_t v3 = 0;
+    std::uint64_t v4 = 0 - P1;
+
+    for (; end - p >= 32; p += 32)
+    {
+      v1 = round(v1, read64(p));
+      v2 = round(v2, read64(p + 8));
+      v3 = round(v3, read64(p + 16));
+      v4 = round(v4, read64(p + 24));
+    }
+
+    h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+    h = mergeRound(h, v1);
+    h = mergeRound(h, v2);
+    h = mergeRound(h, v3);
+    h = mergeRound(h, v4);
+  }
+  else
+  {
+    h = P5;
+  }
+
+  h += static_cast<std::uint64_t>(data.size());
+
+  for (; end - p >= 8; p += 8)
+  {
+    h ^= round(0, read64(p));
+    h = std::rotl(h, 27) * P1 + P4;
+  }
+
+  if (end - p >= 4)
+  {
+    h ^= static_cast<std::uint64_t>(read32(p)) * P1;
+    h = std::rotl(h, 23) * P2 + P3;
+    p += 4;
+  }
+
+  for (; p < end; ++p)
+  {
+    h ^= static_cast<std::uint64_t>(*p) * P5;
+    h = std::rotl(h, 11) * P1;
+  }
+
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  h ^= h >> 32;
+  return h;
+}
+
+} // namespace etna
+
+#endif // ETNA_CONTENT_HASH_HPP_INCLUDED
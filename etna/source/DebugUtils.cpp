@@ -62,4 +62,10 @@ void set_debug_name(vk::Semaphore semaphore, const char* name)
   set_debug_name_base(semaphore, vk::ObjectType::eSemaphore, name);
 }
 
+void set_debug_name(vk::AccelerationStructureKHR acceleration_structure, const char* name)
+{
+  set_debug_name_base(
+    acceleration_structure, vk::ObjectType::eAccelerationStructureKHR, name);
+}
+
 } // namespace etna
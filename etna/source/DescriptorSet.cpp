@@ -23,6 +23,7 @@ static constexpr uint32_t NUM_RW_TEXTURES = 512;
 static constexpr uint32_t NUM_BUFFERS = 2048;
 static constexpr uint32_t NUM_RW_BUFFERS = 512;
 static constexpr uint32_t NUM_SAMPLERS = 128;
+static constexpr uint32_t NUM_ACCELERATION_STRUCTURES = 64;
 
 static constexpr std::array<vk::DescriptorPoolSize, 6> DEFAULT_POOL_SIZES{
   vk::DescriptorPoolSize{vk::DescriptorType::eUniformBuffer, NUM_BUFFERS},
@@ -32,6 +33,25 @@ static constexpr std::array<vk::DescriptorPoolSize, 6> DEFAULT_POOL_SIZES{
   vk::DescriptorPoolSize{vk::DescriptorType::eStorageImage, NUM_RW_TEXTURES},
   vk::DescriptorPoolSize{vk::DescriptorType::eCombinedImageSampler, NUM_TEXTURES}};
 
+// Acceleration structure descriptors can only be used when ray tracing is enabled
+static std::vector<vk::DescriptorPoolSize> get_pool_sizes(bool acceleration_structures)
+{
+  std::vector<vk::DescriptorPoolSize> result(DEFAULT_POOL_SIZES.begin(), DEFAULT_POOL_SIZES.end());
+  if (acceleration_structures)
+    result.push_back(vk::DescriptorPoolSize{
+      vk::DescriptorType::eAccelerationStructureKHR, NUM_ACCELERATION_STRUCTURES});
+  return result;
+}
+
+static vk::UniqueDescriptorPool create_descriptor_pool(
+  vk::Device dev, bool acceleration_structures)
+{
+  const auto poolSizes = get_pool_sizes(acceleration_structures);
+  vk::DescriptorPoolCreateInfo info{.maxSets = NUM_DESCRIPTORS};
+  info.setPoolSizes(poolSizes);
+  return unwrap_vk_result(dev.createDescriptorPoolUnique(info));
+}
+
 uint32_t get_num_descriptors_in_pool_for_type(vk::DescriptorType type)
 {
   for (const auto& size : DEFAULT_POOL_SIZES)
@@ -39,6 +59,8 @@ uint32_t get_num_descriptors_in_pool_for_type(vk::DescriptorType type)
     if (type == size.type)
       return size.descriptorCount;
   }
+  if (type == vk::DescriptorType::eAccelerationStructureKHR)
+    return NUM_ACCELERATION_STRUCTURES;
 
   // MSVC doesn't like me putting an assert here because it is unreachable,
   // guess it doesn't know about casts
@@ -90,15 +112,12 @@ static vk::DescriptorSet allocate_desciptor_set_from_pool(
   return vkSet;
 }
 
-DynamicDescriptorPool::DynamicDescriptorPool(vk::Device dev, const GpuWorkCount& work_count)
+DynamicDescriptorPool::DynamicDescriptorPool(
+  vk::Device dev, const GpuWorkCount& work_count, bool acceleration_structures)
   : vkDevice{dev}
   , workCount{work_count}
-  , pools{work_count, [dev](std::size_t) {
-            vk::DescriptorPoolCreateInfo info{
-              .maxSets = NUM_DESCRIPTORS,
-              .poolSizeCount = static_cast<std::uint32_t>(DEFAULT_POOL_SIZES.size()),
-              .pPoolSizes = DEFAULT_POOL_SIZES.data()};
-            return unwrap_vk_result(dev.createDescriptorPoolUnique(info));
+  , pools{work_count, [dev, acceleration_structures](std::size_t) {
+            return create_descriptor_pool(dev, acceleration_structures);
           }}
 {
 }
@@ -126,12 +145,9 @@ DescriptorSet DynamicDescriptorPool::allocateSet(
     workCount.batchIndex(), layout_id, vkSet, std::move(bindings), command_buffer, behavior};
 }
 
-PersistentDescriptorPool::PersistentDescriptorPool(vk::Device dev)
+PersistentDescriptorPool::PersistentDescriptorPool(vk::Device dev, bool acceleration_structures)
   : vkDevice{dev}
-  , pool{unwrap_vk_result(dev.createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo{
-      .maxSets = NUM_DESCRIPTORS,
-      .poolSizeCount = static_cast<std::uint32_t>(DEFAULT_POOL_SIZES.size()),
-      .pPoolSizes = DEFAULT_POOL_SIZES.data()}))}
+  , pool{create_descriptor_pool(dev, acceleration_structures)}
 {
 }
 
@@ -185,6 +201,22 @@ static void validate_descriptor_write(
       ETNA_PANIC("Descriptor write error: descriptor set doesn't have {} slot", binding.binding);
 
     const auto& bindingInfo = layoutInfo.getBinding(binding.binding);
+
+    const bool isAccelerationStructureRequired =
+      bindingInfo.descriptorType == vk::DescriptorType::eAccelerationStructureKHR;
+    const bool isAccelerationStructureBinding =
+      std::get_if<AccelerationStructureBinding>(&binding.resources) != nullptr;
+    if (isAccelerationStructureRequired || isAccelerationStructureBinding)
+    {
+      if (isAccelerationStructureRequired != isAccelerationStructureBinding)
+        ETNA_PANIC(
+          "Descriptor write error: slot {} acceleration structure {}",
+          binding.binding,
+          isAccelerationStructureRequired ? "required but not bound" : "bound but not required");
+      unboundResources[binding.binding] -= 1;
+      continue;
+    }
+
     bool isImageRequired = is_image_resource(bindingInfo.descriptorType);
     bool isImageBinding = std::get_if<ImageBinding>(&binding.resources) != nullptr;
     bool isSamplerBinding = std::get_if<SamplerBinding>(&binding.resources) != nullptr;
@@ -241,11 +273,14 @@ void write_set(
 
   uint32_t numBufferInfo = 0;
   uint32_t numImageInfo = 0;
+  uint32_t numAccelerationStructures = 0;
 
   for (auto& binding : bindings)
   {
     const auto& bindingInfo = layoutInfo.getBinding(binding.binding);
-    if (is_image_resource(bindingInfo.descriptorType))
+    if (bindingInfo.descriptorType == vk::DescriptorType::eAccelerationStructureKHR)
+      numAccelerationStructures++;
+    else if (is_image_resource(bindingInfo.descriptorType))
       numImageInfo++;
     else
       numBufferInfo++;
@@ -258,6 +293,11 @@ void write_set(
   numImageInfo = 0;
   numBufferInfo = 0;
 
+  std::vector<vk::AccelerationStructureKHR> accelerationStructures(numAccelerationStructures);
+  std::vector<vk::WriteDescriptorSetAccelerationStructureKHR> accelerationStructureInfos(
+    numAccelerationStructures);
+  numAccelerationStructures = 0;
+
   for (const auto& binding : bindings)
   {
     const auto& bindingInfo = layoutInfo.getBinding(binding.binding);
@@ -268,7 +308,15 @@ void write_set(
       .setDstArrayElement(binding.arrayElem)
       .setDescriptorType(bindingInfo.descriptorType);
 
-    if (is_image_resource(bindingInfo.descriptorType))
+    if (bindingInfo.descriptorType == vk::DescriptorType::eAccelerationStructureKHR)
+    {
+      const uint32_t i = numAccelerationStructures++;
+      accelerationStructures[i] =
+        std::get<AccelerationStructureBinding>(binding.resources).acceleration_structure;
+      accelerationStructureInfos[i].setAccelerationStructures(accelerationStructures[i]);
+      write.setPNext(&accelerationStructureInfos[i]);
+    }
+    else if (is_image_resource(bindingInfo.descriptorType))
     {
       const auto* imgMaybe = std::get_if<ImageBinding>(&binding.resources);
       const auto* smpMaybe = std::get_if<SamplerBinding>(&binding.resources);
@@ -299,7 +347,7 @@ template void write_set<PersistentDescriptorSet>(
 constexpr static vk::PipelineStageFlags2 shader_stage_to_pipeline_stage(
   vk::ShaderStageFlags shader_stages)
 {
-  constexpr uint32_t MAPPING_LENGTH = 6;
+  constexpr uint32_t MAPPING_LENGTH = 14;
   constexpr std::array<vk::ShaderStageFlagBits, MAPPING_LENGTH> SHADER_STAGES = {
     vk::ShaderStageFlagBits::eVertex,
     vk::ShaderStageFlagBits::eTessellationControl,
@@ -307,6 +355,14 @@ constexpr static vk::PipelineStageFlags2 shader_stage_to_pipeline_stage(
     vk::ShaderStageFlagBits::eGeometry,
     vk::ShaderStageFlagBits::eFragment,
     vk::ShaderStageFlagBits::eCompute,
+    vk::ShaderStageFlagBits::eTaskEXT,
+    vk::ShaderStageFlagBits::eMeshEXT,
+    vk::ShaderStageFlagBits::eRaygenKHR,
+    vk::ShaderStageFlagBits::eMissKHR,
+    vk::ShaderStageFlagBits::eClosestHitKHR,
+    vk::ShaderStageFlagBits::eAnyHitKHR,
+    vk::ShaderStageFlagBits::eIntersectionKHR,
+    vk::ShaderStageFlagBits::eCallableKHR,
   };
   constexpr std::array<vk::PipelineStageFlagBits2, MAPPING_LENGTH> PIPELINE_STAGES = {
     vk::PipelineStageFlagBits2::eVertexShader,
@@ -315,6 +371,14 @@ constexpr static vk::PipelineStageFlags2 shader_stage_to_pipeline_stage(
     vk::PipelineStageFlagBits2::eGeometryShader,
     vk::PipelineStageFlagBits2::eFragmentShader,
     vk::PipelineStageFlagBits2::eComputeShader,
+    vk::PipelineStageFlagBits2::eTaskShaderEXT,
+    vk::PipelineStageFlagBits2::eMeshShaderEXT,
+    vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+    vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+    vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+    vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+    vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
+    vk::PipelineStageFlagBits2::eRayTracingShaderKHR,
   };
 
   vk::PipelineStageFlags2 pipelineStages = vk::PipelineStageFlagBits2::eNone;
@@ -361,13 +425,15 @@ static void process_barriers_to_cmd_buf(
 
     auto& bindingInfo = layoutInfo.getBinding(binding.binding);
     const ImageBinding& imgData = std::get<ImageBinding>(binding.resources);
+    vk::ImageSubresourceRange range = imgData.subresource_range;
+    range.aspectMask = imgData.image->getAspectMaskByFormat();
     etna::set_state(
       cmd_buffer,
-      imgData.image->get(),
+      *imgData.image,
       shader_stage_to_pipeline_stage(bindingInfo.stageFlags),
       descriptor_type_to_access_flag(bindingInfo.descriptorType),
       imgData.descriptor_info.imageLayout,
-      imgData.image->getAspectMaskByFormat());
+      range);
   }
 }
 
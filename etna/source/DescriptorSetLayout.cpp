@@ -1,9 +1,11 @@
 #include <etna/DescriptorSetLayout.hpp>
 #include <etna/DescriptorSet.hpp>
 
+#include <unordered_set>
 #include <spirv_reflect.h>
 
 #include <etna/Assert.hpp>
+#include <etna/DeletionQueue.hpp>
 #include <vulkan/vulkan_enums.hpp>
 
 
@@ -42,6 +44,9 @@ void DescriptorSetInfo::addResource(
   bindings[binding.binding] = binding;
   bindingFlags[binding.binding] = flags;
 
+  if (flags & vk::DescriptorBindingFlagBits::eVariableDescriptorCount)
+    hasDynDescriptorArray = true;
+
   if (binding.binding + 1 > usedBindingsCap)
     usedBindingsCap = binding.binding + 1;
 
@@ -53,6 +58,7 @@ void DescriptorSetInfo::clear()
 {
   usedBindingsCap = 0;
   dynOffsets = 0;
+  hasDynDescriptorArray = false;
   usedBindings.reset();
   for (auto& binding : bindings)
     binding = vk::DescriptorSetLayoutBinding{};
@@ -225,7 +231,9 @@ std::size_t DescriptorSetLayoutHash::operator()(const DescriptorSetInfo& res) co
 DescriptorLayoutId DescriptorSetLayoutCache::registerLayout(
   vk::Device device, const DescriptorSetInfo& info)
 {
-  return get(device, info).first;
+  auto id = get(device, info).first;
+  pinned[id] = true;
+  return id;
 }
 
 std::pair<DescriptorLayoutId, vk::DescriptorSetLayout> DescriptorSetLayoutCache::get(
@@ -233,25 +241,124 @@ std::pair<DescriptorLayoutId, vk::DescriptorSetLayout> DescriptorSetLayoutCache:
 {
   auto it = map.find(info);
   if (it != map.end())
+  {
+    // The layout might have been garbage collected after a reload, but the id is still ours
+    if (!vkLayouts[it->second])
+      vkLayouts[it->second] = info.createVkLayout(device);
     return {it->second, vkLayouts[it->second]};
+  }
 
   DescriptorLayoutId id = static_cast<DescriptorLayoutId>(descriptors.size());
   map.insert({info, id});
   descriptors.push_back(info);
   vkLayouts.push_back(info.createVkLayout(device));
+  pinned.push_back(false);
   return {id, vkLayouts[id]};
 }
 
+void DescriptorSetLayoutCache::collectGarbage(
+  vk::Device device, std::span<DescriptorLayoutId const> alive_ids, DeletionQueue& deletion_queue)
+{
+  std::vector<bool> alive = pinned;
+  for (auto id : alive_ids)
+    alive.at(id) = true;
+
+  for (DescriptorLayoutId id = 0; id < vkLayouts.size(); ++id)
+  {
+    if (alive[id] || !vkLayouts[id])
+      continue;
+    deletion_queue.retire(vk::UniqueDescriptorSetLayout{vkLayouts[id], device});
+    vkLayouts[id] = vk::DescriptorSetLayout{};
+  }
+}
+
 void DescriptorSetLayoutCache::clear(vk::Device device)
 {
   for (auto layout : vkLayouts)
   {
-    device.destroyDescriptorSetLayout(layout);
+    if (layout)
+      device.destroyDescriptorSetLayout(layout);
   }
 
   map.clear();
   descriptors.clear();
   vkLayouts.clear();
+  pinned.clear();
+}
+
+std::size_t PipelineLayoutKeyHash::operator()(const PipelineLayoutKey& key) const
+{
+  size_t hash = 0;
+
+  hash_combine(hash, key.setLayoutCount);
+  for (uint32_t i = 0; i < key.setLayoutCount; i++)
+    hash_combine(hash, key.setLayouts[i]);
+
+  hash_combine(hash, key.pushConst.offset);
+  hash_combine(hash, key.pushConst.size);
+  hash_combine(hash, static_cast<uint32_t>(key.pushConst.stageFlags));
+
+  return hash;
+}
+
+vk::PipelineLayout PipelineLayoutCache::get(
+  vk::Device device,
+  const DescriptorSetLayoutCache& set_layouts,
+  std::span<DescriptorLayoutId const> set_layout_ids,
+  vk::PushConstantRange push_const)
+{
+  ETNA_VERIFY(set_layout_ids.size() <= MAX_PROGRAM_DESCRIPTORS);
+
+  PipelineLayoutKey key{
+    .setLayoutCount = static_cast<uint32_t>(set_layout_ids.size()),
+    .pushConst = push_const.size > 0 ? push_const : vk::PushConstantRange{},
+  };
+  std::copy(set_layout_ids.begin(), set_layout_ids.end(), key.setLayouts.begin());
+
+  auto it = map.find(key);
+  if (it != map.end())
+    return it->second;
+
+  std::vector<vk::DescriptorSetLayout> vkLayouts;
+  vkLayouts.reserve(set_layout_ids.size());
+  for (auto id : set_layout_ids)
+    vkLayouts.push_back(set_layouts.getVkLayout(id));
+
+  vk::PipelineLayoutCreateInfo info{};
+  info.setSetLayouts(vkLayouts);
+
+  if (key.pushConst.size > 0)
+  {
+    info.setPPushConstantRanges(&key.pushConst);
+    info.setPushConstantRangeCount(1u);
+  }
+
+  auto layout = unwrap_vk_result(device.createPipelineLayout(info));
+  map.emplace(key, layout);
+  return layout;
+}
+
+void PipelineLayoutCache::collectGarbage(
+  vk::Device device,
+  std::span<vk::PipelineLayout const> alive_layouts,
+  DeletionQueue& deletion_queue)
+{
+  std::unordered_set<vk::PipelineLayout> alive(alive_layouts.begin(), alive_layouts.end());
+
+  std::erase_if(map, [device, &alive, &deletion_queue](const auto& entry) {
+    if (alive.contains(entry.second))
+      return false;
+    deletion_queue.retire(vk::UniquePipelineLayout{entry.second, device});
+    return true;
+  });
+}
+
+void PipelineLayoutCache::clear(vk::Device device)
+{
+  for (auto& [key, layout] : map)
+    device.destroyPipelineLayout(layout);
+
+  map.clear();
 }
 
 } // namespace etna
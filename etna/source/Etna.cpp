@@ -5,7 +5,9 @@
 #include <vulkan/vulkan_format_traits.hpp>
 
 #include <etna/GlobalContext.hpp>
+#include <etna/DeletionQueue.hpp>
 #include <etna/PipelineManager.hpp>
+#include <etna/ShaderObjects.hpp>
 #include <vulkan/vulkan_structs.hpp>
 #include "StateTracking.hpp"
 #include "etna/Image.hpp"
@@ -35,6 +37,8 @@ void initialize(const InitParams& params)
 
 void shutdown()
 {
+  gContext->getDeletionQueue().flush();
+  gContext->getPipelineLayouts().clear(gContext->getDevice());
   gContext->getDescriptorSetLayouts().clear(gContext->getDevice());
   gContext.reset(nullptr);
 }
@@ -45,6 +49,17 @@ ShaderProgramId create_program(
   return gContext->getShaderManager().loadProgram(name, shaders_path);
 }
 
+std::vector<ShaderProgramId> create_programs(std::span<ShaderProgramCreateInfo const> programs)
+{
+  return gContext->getShaderManager().loadPrograms(programs);
+}
+
+std::vector<ShaderProgramId> create_programs(
+  std::initializer_list<ShaderProgramCreateInfo> programs)
+{
+  return create_programs(std::span{programs.begin(), programs.end()});
+}
+
 ShaderProgramId get_program_id(const char* name)
 {
   return gContext->getShaderManager().tryGetProgram(name);
@@ -52,12 +67,41 @@ ShaderProgramId get_program_id(const char* name)
 
 void reload_shaders()
 {
-  gContext->getDescriptorSetLayouts().clear(gContext->getDevice());
   gContext->getShaderManager().reloadPrograms();
   gContext->getPipelineManager().recreate();
+  if (gContext->hasShaderObjects())
+    gContext->getShaderObjectManager().recreate();
   gContext->getDescriptorPool().destroyAllocatedSets();
 }
 
+bool reload_changed_shaders()
+{
+  const auto reloadedPrograms = gContext->getShaderManager().reloadChangedModules();
+  if (reloadedPrograms.empty())
+    return false;
+
+  gContext->getPipelineManager().recreate(reloadedPrograms, gContext->getDeletionQueue());
+  if (gContext->hasShaderObjects())
+    gContext->getShaderObjectManager().recreate(reloadedPrograms, gContext->getDeletionQueue());
+  return true;
+}
+
+ShaderVariantsId declare_shader_variants(ShaderVariantsCreateInfo info)
+{
+  return gContext->getShaderVariants().declare(std::move(info));
+}
+
+ShaderVariantMask get_shader_keyword_bits(
+  ShaderVariantsId id, ShaderNameHash keyword, uint32_t value)
+{
+  return gContext->getShaderVariants().keywordBits(id, keyword, value);
+}
+
+const ShaderVariant& get_shader_variant(ShaderVariantsId id, ShaderVariantMask mask)
+{
+  return gContext->getShaderVariants().get(id, mask);
+}
+
 ShaderProgramInfo get_shader_program(ShaderProgramId id)
 {
   return gContext->getShaderManager().getProgramInfo(id);
@@ -114,11 +158,10 @@ Image create_image_from_bytes(Image::CreateInfo info, vk::CommandBuffer cmd_buf,
   auto image = gContext->createImage(info);
   etna::set_state(
     cmd_buf,
-    image.get(),
+    image,
     vk::PipelineStageFlagBits2::eTransfer,
     vk::AccessFlagBits2::eTransferWrite,
-    vk::ImageLayout::eTransferDstOptimal,
-    image.getAspectMaskByFormat());
+    vk::ImageLayout::eTransferDstOptimal);
   etna::flush_barriers(cmd_buf);
 
   vk::BufferImageCopy region{
@@ -158,6 +201,8 @@ void begin_frame()
 {
   // TODO: this is brittle. Maybe GpuWorkCount should have frame start calllbacks?
   gContext->getDescriptorPool().beginFrame();
+  gContext->getDeletionQueue().collect();
+  gContext->getResourceTracker().beginFrame();
 }
 
 void end_frame()
@@ -178,6 +223,56 @@ void set_state(
     com_buffer, image, pipeline_stage_flags, access_flags, layout, aspect_flags, force);
 }
 
+void set_state(
+  vk::CommandBuffer com_buffer,
+  vk::Image image,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout layout,
+  vk::ImageSubresourceRange range,
+  ForceSetState force)
+{
+  etna::get_context().getResourceTracker().setTextureState(
+    com_buffer, image, pipeline_stage_flags, access_flags, layout, range, force);
+}
+
+void set_state(
+  vk::CommandBuffer com_buffer,
+  const Image& image,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout layout,
+  ForceSetState force)
+{
+  set_state(
+    com_buffer,
+    image,
+    pipeline_stage_flags,
+    access_flags,
+    layout,
+    vk::ImageSubresourceRange{
+      .aspectMask = image.getAspectMaskByFormat(),
+      .baseMipLevel = 0,
+      .levelCount = vk::RemainingMipLevels,
+      .baseArrayLayer = 0,
+      .layerCount = vk::RemainingArrayLayers,
+    },
+    force);
+}
+
+void set_state(
+  vk::CommandBuffer com_buffer,
+  const Image& image,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout layout,
+  vk::ImageSubresourceRange range,
+  ForceSetState force)
+{
+  etna::get_context().getResourceTracker().setTextureState(
+    com_buffer, image, pipeline_stage_flags, access_flags, layout, range, force);
+}
+
 void set_state(
   vk::CommandBuffer com_buffer,
   vk::Buffer buffer,
@@ -189,6 +284,43 @@ void set_state(
     com_buffer, buffer, pipeline_stage_flags, access_flags, force);
 }
 
+void set_state(
+  vk::CommandBuffer com_buffer,
+  vk::Buffer buffer,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::DeviceSize offset,
+  vk::DeviceSize size,
+  ForceSetState force)
+{
+  etna::get_context().getResourceTracker().setBufferState(
+    com_buffer, buffer, pipeline_stage_flags, access_flags, offset, size, force);
+}
+
+void set_state(
+  vk::CommandBuffer com_buffer,
+  const Buffer& buffer,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  ForceSetState force)
+{
+  etna::get_context().getResourceTracker().setBufferState(
+    com_buffer, buffer, pipeline_stage_flags, access_flags, 0, vk::WholeSize, force);
+}
+
+void set_state(
+  vk::CommandBuffer com_buffer,
+  const Buffer& buffer,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::DeviceSize offset,
+  vk::DeviceSize size,
+  ForceSetState force)
+{
+  etna::get_context().getResourceTracker().setBufferState(
+    com_buffer, buffer, pipeline_stage_flags, access_flags, offset, size, force);
+}
+
 void finish_frame(vk::CommandBuffer com_buffer)
 {
   etna::get_context().getResourceTracker().flushBarriers(com_buffer);
@@ -199,4 +331,70 @@ void flush_barriers(vk::CommandBuffer com_buffer)
   etna::get_context().getResourceTracker().flushBarriers(com_buffer);
 }
 
+void release_state(
+  vk::CommandBuffer com_buffer,
+  vk::Image image,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout layout,
+  vk::ImageSubresourceRange range)
+{
+  etna::get_context().getResourceTracker().releaseTextureState(
+    com_buffer, image, pipeline_stage_flags, access_flags, layout, range);
+}
+
+void release_state(
+  vk::CommandBuffer com_buffer,
+  vk::Buffer buffer,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags)
+{
+  etna::get_context().getResourceTracker().releaseBufferState(
+    com_buffer, buffer, pipeline_stage_flags, access_flags);
+}
+
+void acquire_state(vk::CommandBuffer com_buffer, vk::Image image)
+{
+  etna::get_context().getResourceTracker().acquireTextureState(com_buffer, image);
+}
+
+void acquire_state(vk::CommandBuffer com_buffer, vk::Buffer buffer)
+{
+  etna::get_context().getResourceTracker().acquireBufferState(com_buffer, buffer);
+}
+
+TrackedResourceCounts get_tracked_resource_counts()
+{
+  const auto& tracker = etna::get_context().getResourceTracker();
+  return TrackedResourceCounts{
+    .images = tracker.trackedImageCount(),
+    .buffers = tracker.trackedBufferCount(),
+  };
+}
+
+vk::CommandBuffer resolve_states(CommandBufferStates& states)
+{
+  return etna::get_context().getResourceTracker().resolve(states);
+}
+
+void set_queue_family(vk::CommandBuffer com_buffer, uint32_t queue_family)
+{
+  etna::get_context().getResourceTracker().registerCommandBuffer(com_buffer, queue_family);
+}
+
+vk::CommandBuffer record_queue_releases(uint32_t queue_family)
+{
+  return etna::get_context().getResourceTracker().recordQueueReleases(queue_family);
+}
+
+const BarrierStats& get_barrier_stats()
+{
+  return etna::get_context().getResourceTracker().getLastFrameStats();
+}
+
+void capture_barrier_trace(std::filesystem::path path)
+{
+  etna::get_context().getResourceTracker().captureTrace(std::move(path));
+}
+
 } // namespace etna
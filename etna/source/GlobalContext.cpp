@@ -7,9 +7,13 @@
 #include <etna/Etna.hpp>
 #include <etna/DescriptorSetLayout.hpp>
 #include <etna/ShaderProgram.hpp>
+#include <etna/ShaderVariants.hpp>
 #include <etna/PipelineManager.hpp>
+#include <etna/ShaderObjects.hpp>
+#include <etna/AccelerationStructure.hpp>
 #include <etna/DescriptorSet.hpp>
 #include <etna/Assert.hpp>
+#include <etna/DeletionQueue.hpp>
 #include <etna/EtnaConfig.hpp>
 #include <etna/EtnaEngineConfig.hpp>
 #include <etna/Window.hpp>
@@ -88,6 +92,17 @@ static bool check_physical_device_supports_extensions(
 struct OptionalExtensionsFound
 {
   bool hasVkExtCalibratedTimestamps = false;
+  bool hasVkExtShaderObject = false;
+  bool hasVkExtMeshShader = false;
+  bool hasVkExtAccelerationStructure = false;
+  bool hasVkExtRayTracingPipeline = false;
+  bool hasVkExtDeferredHostOperations = false;
+
+  bool hasRayTracing() const
+  {
+    return hasVkExtAccelerationStructure && hasVkExtRayTracingPipeline &&
+      hasVkExtDeferredHostOperations;
+  }
 };
 
 static OptionalExtensionsFound collect_optional_extensions_to_use(vk::PhysicalDevice pdevice)
@@ -103,6 +118,36 @@ static OptionalExtensionsFound collect_optional_extensions_to_use(vk::PhysicalDe
       safe_view_of_array(ext.extensionName) ==
       std::string_view(vk::KHRCalibratedTimestampsExtensionName))
       result.hasVkExtCalibratedTimestamps = true;
+    else if (
+      safe_view_of_array(ext.extensionName) ==
+      std::string_view(vk::EXTShaderObjectExtensionName))
+      result.hasVkExtShaderObject = true;
+    else if (
+      safe_view_of_array(ext.extensionName) == std::string_view(vk::EXTMeshShaderExtensionName))
+      result.hasVkExtMeshShader = true;
+    else if (
+      safe_view_of_array(ext.extensionName) ==
+      std::string_view(vk::KHRAccelerationStructureExtensionName))
+      result.hasVkExtAccelerationStructure = true;
+    else if (
+      safe_view_of_array(ext.extensionName) ==
+      std::string_view(vk::KHRRayTracingPipelineExtensionName))
+      result.hasVkExtRayTracingPipeline = true;
+    else if (
+      safe_view_of_array(ext.extensionName) ==
+      std::string_view(vk::KHRDeferredHostOperationsExtensionName))
+      result.hasVkExtDeferredHostOperations = true;
+  }
+
+  // Devices may expose the extension without supporting both kinds of shaders,
+  // and task shader stages appear in every graphics descriptor set layout
+  if (result.hasVkExtMeshShader)
+  {
+    const auto features = pdevice.getFeatures2<
+      vk::PhysicalDeviceFeatures2,
+      vk::PhysicalDeviceMeshShaderFeaturesEXT>();
+    const auto& meshFeatures = features.get<vk::PhysicalDeviceMeshShaderFeaturesEXT>();
+    result.hasVkExtMeshShader = meshFeatures.taskShader && meshFeatures.meshShader;
   }
 
   return result;
@@ -200,6 +245,15 @@ static uint32_t get_queue_family_index(vk::PhysicalDevice pdevice, vk::QueueFlag
   ETNA_PANIC("Could not find a queue family that supports all requested flags!");
 }
 
+template <class T>
+static const T* find_feature_struct(const void* chain)
+{
+  for (auto* s = static_cast<const vk::BaseInStructure*>(chain); s != nullptr; s = s->pNext)
+    if (s->sType == T::structureType)
+      return reinterpret_cast<const T*>(s);
+  return nullptr;
+}
+
 static vk::UniqueDevice create_logical_device(
   vk::PhysicalDevice pdevice,
   uint32_t universal_queue_family,
@@ -230,6 +284,29 @@ static vk::UniqueDevice create_logical_device(
     .synchronization2 = vk::True,
   };
 
+  vk::PhysicalDeviceShaderObjectFeaturesEXT shaderObjectFeature{
+    .pNext = &sync2Feature,
+    .shaderObject = vk::True,
+  };
+
+  vk::PhysicalDeviceMeshShaderFeaturesEXT meshShaderFeature{
+    .taskShader = vk::True,
+    .meshShader = vk::True,
+  };
+
+  vk::PhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeature{
+    .accelerationStructure = vk::True,
+  };
+
+  vk::PhysicalDeviceRayTracingPipelineFeaturesKHR rayTracingPipelineFeature{
+    .pNext = &accelerationStructureFeature,
+    .rayTracingPipeline = vk::True,
+  };
+
+  vk::PhysicalDeviceBufferDeviceAddressFeatures bufferDeviceAddressFeature{
+    .bufferDeviceAddress = vk::True,
+  };
+
   std::vector<char const*> deviceExtensions(
     params.deviceExtensions.begin(), params.deviceExtensions.end());
 
@@ -238,6 +315,26 @@ static vk::UniqueDevice create_logical_device(
     deviceExtensions.push_back(vk::KHRCalibratedTimestampsExtensionName);
   }
 
+  const bool useShaderObjects = params.enableShaderObjects && optional_exts.hasVkExtShaderObject;
+  if (useShaderObjects)
+  {
+    deviceExtensions.push_back(vk::EXTShaderObjectExtensionName);
+  }
+
+  const bool useMeshShaders = params.enableMeshShaders && optional_exts.hasVkExtMeshShader;
+  if (useMeshShaders)
+  {
+    deviceExtensions.push_back(vk::EXTMeshShaderExtensionName);
+  }
+
+  const bool useRayTracing = params.enableRayTracing && optional_exts.hasRayTracing();
+  if (useRayTracing)
+  {
+    deviceExtensions.push_back(vk::KHRAccelerationStructureExtensionName);
+    deviceExtensions.push_back(vk::KHRRayTracingPipelineExtensionName);
+    deviceExtensions.push_back(vk::KHRDeferredHostOperationsExtensionName);
+  }
+
   // NOTE: These extensions are needed on MoltenVK to be set explicitly due to
   // it not fully supporting Vulkan 1.3 yet.
 #if defined(__APPLE__)
@@ -254,8 +351,47 @@ static vk::UniqueDevice create_logical_device(
   // extensions support. Now pNext has to point to a
   // PhysicalDeviceFeatures2 structure while the actual
   // pEnabledFeatures has to be nullptr.
+  void* features = &sync2Feature;
+  if (useShaderObjects)
+    features = &shaderObjectFeature;
+  if (useMeshShaders)
+  {
+    meshShaderFeature.pNext = features;
+    features = &meshShaderFeature;
+  }
+  if (useRayTracing)
+  {
+    accelerationStructureFeature.pNext = features;
+    features = &rayTracingPipelineFeature;
+
+    // Chaining the same feature struct twice is invalid, so the application's struct has
+    // to enable buffer device addresses itself. Acceleration structures and shader binding
+    // tables cannot work without them.
+    const void* userChain = params.features.pNext;
+    const auto* vulkan12 = find_feature_struct<vk::PhysicalDeviceVulkan12Features>(userChain);
+    const auto* addressFeatures =
+      find_feature_struct<vk::PhysicalDeviceBufferDeviceAddressFeatures>(userChain);
+    if (vulkan12 != nullptr)
+    {
+      ETNA_VERIFYF(
+        vulkan12->bufferDeviceAddress,
+        "Ray tracing requires VkPhysicalDeviceVulkan12Features::bufferDeviceAddress");
+    }
+    else if (addressFeatures != nullptr)
+    {
+      ETNA_VERIFYF(
+        addressFeatures->bufferDeviceAddress,
+        "Ray tracing requires VkPhysicalDeviceBufferDeviceAddressFeatures::bufferDeviceAddress");
+    }
+    else
+    {
+      bufferDeviceAddressFeature.pNext = features;
+      features = &bufferDeviceAddressFeature;
+    }
+  }
+
   vk::DeviceCreateInfo createInfo{};
-  createInfo.setPNext(&sync2Feature);
+  createInfo.setPNext(features);
   createInfo.setQueueCreateInfos(queueInfos);
   createInfo.setPEnabledExtensionNames(deviceExtensions);
 
@@ -346,13 +482,41 @@ GlobalContext::GlobalContext(const InitParams& params)
 
   universalQueue = vkDevice->getQueue(universalQueueFamilyIdx, 0);
 
+  meshShadersEnabled = params.enableMeshShaders && optionalExts.hasVkExtMeshShader;
+  if (params.enableMeshShaders && !meshShadersEnabled)
+    spdlog::warn(
+      "Mesh shaders are disabled, the device does not support VK_EXT_mesh_shader "
+      "with task and mesh shaders");
+
+  rayTracingEnabled = params.enableRayTracing && optionalExts.hasRayTracing();
+  if (params.enableRayTracing && !rayTracingEnabled)
+    spdlog::warn(
+      "Ray tracing is disabled, the device does not support VK_KHR_acceleration_structure, "
+      "VK_KHR_ray_tracing_pipeline or VK_KHR_deferred_host_operations");
+
+  // The features may be enabled either through the core 1.3 struct or the extension one
+  const void* userChain = params.features.pNext;
+  if (const auto* vulkan13 = find_feature_struct<vk::PhysicalDeviceVulkan13Features>(userChain))
+  {
+    subgroupSizeControlFeatures.subgroupSizeControl = vulkan13->subgroupSizeControl;
+    subgroupSizeControlFeatures.computeFullSubgroups = vulkan13->computeFullSubgroups;
+  }
+  else if (
+    const auto* subgroupControl =
+      find_feature_struct<vk::PhysicalDeviceSubgroupSizeControlFeatures>(userChain))
+  {
+    subgroupSizeControlFeatures.subgroupSizeControl = subgroupControl->subgroupSizeControl;
+    subgroupSizeControlFeatures.computeFullSubgroups = subgroupControl->computeFullSubgroups;
+  }
+
   {
     VmaVulkanFunctions functions{};
     functions.vkGetInstanceProcAddr = VULKAN_HPP_DEFAULT_DISPATCHER.vkGetInstanceProcAddr;
     functions.vkGetDeviceProcAddr = VULKAN_HPP_DEFAULT_DISPATCHER.vkGetDeviceProcAddr;
 
     VmaAllocatorCreateInfo allocInfo{
-      .flags = {},
+      // Acceleration structure builds and shader binding tables are addressed by pointers
+      .flags = rayTracingEnabled ? VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT : 0u,
       .physicalDevice = vkPhysDevice,
       .device = vkDevice.get(),
 
@@ -373,12 +537,47 @@ GlobalContext::GlobalContext(const InitParams& params)
     vmaAllocator = {allocator, &::vmaDestroyAllocator};
   }
 
+  deletionQueue = std::make_unique<DeletionQueue>(mainWorkStream);
   descriptorSetLayouts = std::make_unique<DescriptorSetLayoutCache>();
-  shaderPrograms = std::make_unique<ShaderProgramManager>();
+  pipelineLayouts = std::make_unique<PipelineLayoutCache>();
+  shaderPrograms = std::make_unique<ShaderProgramManager>(ShaderProgramManager::CreateInfo{
+    .reflectionCachePath = params.shaderReflectionCachePath,
+    .bundlePath = params.shaderBundlePath,
+    .bundleRoot = params.shaderBundleRoot,
+    .watchFiles = params.watchShaderFiles,
+    .optimizerPasses = params.shaderOptimizerPasses,
+    .optimizerCachePath = params.optimizedShaderCachePath,
+    .keepCode = params.enableShaderObjects && optionalExts.hasVkExtShaderObject,
+  });
+  shaderVariants = std::make_unique<ShaderVariantManager>(*shaderPrograms);
   pipelineManager = std::make_unique<PipelineManager>(vkDevice.get(), *shaderPrograms);
-  perFrameDescriptorPool = std::make_unique<DynamicDescriptorPool>(vkDevice.get(), mainWorkStream);
-  persistentDescriptorPool = std::make_unique<PersistentDescriptorPool>(vkDevice.get());
-  resourceTracking = std::make_unique<ResourceStates>();
+  if (params.enableShaderObjects && optionalExts.hasVkExtShaderObject)
+  {
+    vk::ShaderStageFlags graphicsStages =
+      vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+    if (params.features.features.tessellationShader)
+      graphicsStages |= vk::ShaderStageFlagBits::eTessellationControl |
+        vk::ShaderStageFlagBits::eTessellationEvaluation;
+    if (params.features.features.geometryShader)
+      graphicsStages |= vk::ShaderStageFlagBits::eGeometry;
+    if (meshShadersEnabled)
+      graphicsStages |= vk::ShaderStageFlagBits::eTaskEXT | vk::ShaderStageFlagBits::eMeshEXT;
+    shaderObjectManager = std::make_unique<ShaderObjectManager>(
+      vkDevice.get(), *shaderPrograms, graphicsStages, params.features.features);
+  }
+  else if (params.enableShaderObjects)
+  {
+    spdlog::warn("Shader objects are disabled, the device does not support VK_EXT_shader_object");
+  }
+  if (rayTracingEnabled)
+    accelerationStructures = std::make_unique<AccelerationStructureManager>(
+      vkPhysDevice, vkDevice.get(), mainWorkStream, *deletionQueue);
+  perFrameDescriptorPool =
+    std::make_unique<DynamicDescriptorPool>(vkDevice.get(), mainWorkStream, rayTracingEnabled);
+  persistentDescriptorPool =
+    std::make_unique<PersistentDescriptorPool>(vkDevice.get(), rayTracingEnabled);
+  resourceTracking = std::make_unique<ResourceStates>(
+    vkDevice.get(), mainWorkStream, universalQueueFamilyIdx, params.collectBarrierStats);
 
   auto tempPool =
     etna::unwrap_vk_result(vkDevice->createCommandPoolUnique(vk::CommandPoolCreateInfo{
@@ -467,6 +666,19 @@ ShaderProgramManager& GlobalContext::getShaderManager()
   return *shaderPrograms;
 }
 
+ShaderObjectManager& GlobalContext::getShaderObjectManager()
+{
+  ETNA_VERIFYF(
+    shaderObjectManager != nullptr,
+    "Shader objects are not available, see InitParams::enableShaderObjects");
+  return *shaderObjectManager;
+}
+
+ShaderVariantManager& GlobalContext::getShaderVariants()
+{
+  return *shaderVariants;
+}
+
 PipelineManager& GlobalContext::getPipelineManager()
 {
   return *pipelineManager;
@@ -477,6 +689,11 @@ DescriptorSetLayoutCache& GlobalContext::getDescriptorSetLayouts()
   return *descriptorSetLayouts;
 }
 
+PipelineLayoutCache& GlobalContext::getPipelineLayouts()
+{
+  return *pipelineLayouts;
+}
+
 DynamicDescriptorPool& GlobalContext::getDescriptorPool()
 {
   return *perFrameDescriptorPool;
@@ -492,6 +709,19 @@ ResourceStates& GlobalContext::getResourceTracker()
   return *resourceTracking;
 }
 
+AccelerationStructureManager& GlobalContext::getAccelerationStructures()
+{
+  ETNA_VERIFYF(
+    accelerationStructures != nullptr,
+    "Ray tracing is not enabled, see InitParams::enableRayTracing");
+  return *accelerationStructures;
+}
+
+DeletionQueue& GlobalContext::getDeletionQueue()
+{
+  return *deletionQueue;
+}
+
 GlobalContext::~GlobalContext() = default;
 
 
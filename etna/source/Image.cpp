@@ -1,12 +1,39 @@
 #include <etna/Image.hpp>
 
+#include <etna/Etna.hpp>
 #include <etna/GlobalContext.hpp>
 #include "DebugUtils.hpp"
+#include "StateTracking.hpp"
 
 
 namespace etna
 {
 
+static bool is_concurrent(const Image::CreateInfo& info)
+{
+  return info.concurrentQueueFamilies.size() > 1;
+}
+
+static vk::ImageCreateInfo make_image_create_info(const Image::CreateInfo& info)
+{
+  return vk::ImageCreateInfo{
+    .flags = info.flags,
+    .imageType = info.type,
+    .format = info.format,
+    .extent = info.extent,
+    .mipLevels = static_cast<uint32_t>(info.mipLevels),
+    .arrayLayers = static_cast<uint32_t>(info.layers),
+    .samples = info.samples,
+    .tiling = info.tiling,
+    .usage = info.imageUsage,
+    .sharingMode = is_concurrent(info) ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive,
+    .queueFamilyIndexCount =
+      is_concurrent(info) ? static_cast<uint32_t>(info.concurrentQueueFamilies.size()) : 0,
+    .pQueueFamilyIndices = is_concurrent(info) ? info.concurrentQueueFamilies.data() : nullptr,
+    .initialLayout = vk::ImageLayout::eUndefined,
+  };
+}
+
 Image::Image(VmaAllocator alloc, CreateInfo info)
   : allocator{alloc}
   , type{info.type}
@@ -17,19 +44,7 @@ Image::Image(VmaAllocator alloc, CreateInfo info)
   , mipLevels{info.mipLevels}
   , creationFlags{info.flags}
 {
-  vk::ImageCreateInfo imageInfo{
-    .flags = info.flags,
-    .imageType = type,
-    .format = format,
-    .extent = extent,
-    .mipLevels = static_cast<uint32_t>(info.mipLevels),
-    .arrayLayers = static_cast<uint32_t>(info.layers),
-    .samples = info.samples,
-    .tiling = info.tiling,
-    .usage = info.imageUsage,
-    .sharingMode = vk::SharingMode::eExclusive,
-    .initialLayout = vk::ImageLayout::eUndefined,
-  };
+  const vk::ImageCreateInfo imageInfo = make_image_create_info(info);
   VmaAllocationCreateInfo allocInfo{
     .flags = info.allocationCreate,
     .usage = info.memoryUsage,
@@ -57,6 +72,52 @@ Image::Image(VmaAllocator alloc, CreateInfo info)
     vk::to_string(static_cast<vk::Result>(retcode)));
   image = vk::Image(img);
   etna::set_debug_name(image, name.c_str());
+  if (etna::is_initilized())
+    trackingId = etna::get_context().getResourceTracker().registerImage(
+      image,
+      static_cast<uint32_t>(mipLevels),
+      static_cast<uint32_t>(layers),
+      name,
+      is_concurrent(info));
+}
+
+Image::Image(VmaAllocator alloc, VmaAllocation memory, vk::DeviceSize offset, CreateInfo info)
+  : allocator{alloc}
+  , type{info.type}
+  , format{info.format}
+  , name{info.name}
+  , extent{info.extent}
+  , layers{info.layers}
+  , mipLevels{info.mipLevels}
+  , creationFlags{info.flags}
+{
+  const vk::ImageCreateInfo imageInfo = make_image_create_info(info);
+  VkImage img;
+
+  // The allocation stays null, so vmaDestroyImage leaves the memory alone
+  auto retcode = vmaCreateAliasingImage2(
+    allocator, memory, offset, &static_cast<const VkImageCreateInfo&>(imageInfo), &img);
+  ETNA_VERIFYF(
+    retcode == VK_SUCCESS,
+    "Error {} occurred while trying to create an aliasing etna::Image!",
+    vk::to_string(static_cast<vk::Result>(retcode)));
+  image = vk::Image(img);
+  etna::set_debug_name(image, name.c_str());
+  if (etna::is_initilized())
+    trackingId = etna::get_context().getResourceTracker().registerImage(
+      image,
+      static_cast<uint32_t>(mipLevels),
+      static_cast<uint32_t>(layers),
+      name,
+      is_concurrent(info));
+}
+
+vk::MemoryRequirements Image::getMemoryRequirements(vk::Device device, const CreateInfo& info)
+{
+  const vk::ImageCreateInfo imageInfo = make_image_create_info(info);
+  return device
+    .getImageMemoryRequirements(vk::DeviceImageMemoryRequirements{.pCreateInfo = &imageInfo})
+    .memoryRequirements;
 }
 
 void Image::swap(Image& other)
@@ -72,6 +133,7 @@ void Image::swap(Image& other)
   std::swap(layers, other.layers);
   std::swap(mipLevels, other.mipLevels);
   std::swap(creationFlags, other.creationFlags);
+  std::swap(trackingId, other.trackingId);
 }
 
 Image::Image(Image&& other) noexcept
@@ -95,6 +157,10 @@ void Image::reset()
   if (!image)
     return;
 
+  if (trackingId != TrackedImageId::Invalid && etna::is_initilized())
+    etna::get_context().getResourceTracker().unregisterImage(image);
+  trackingId = TrackedImageId::Invalid;
+
   views.clear();
   vmaDestroyImage(allocator, VkImage(image), allocation);
   allocator = {};
@@ -178,7 +244,17 @@ vk::ImageView Image::getView(Image::ViewParams params) const
 
 ImageBinding Image::genBinding(vk::Sampler sampler, vk::ImageLayout layout, ViewParams params) const
 {
-  return ImageBinding{this, vk::DescriptorImageInfo{sampler, getView(params), layout}};
+  return ImageBinding{
+    this,
+    vk::DescriptorImageInfo{sampler, getView(params), layout},
+    vk::ImageSubresourceRange{
+      .aspectMask = params.aspectMask.value_or(getAspectMaskByFormat()),
+      .baseMipLevel = params.baseMip,
+      .levelCount = params.levelCount,
+      .baseArrayLayer = params.baseLayer,
+      .layerCount = params.layerCount,
+    },
+  };
 }
 
 } // namespace etna
@@ -0,0 +1,138 @@
+#include "MappedFile.hpp"
+
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace etna
+{
+
+#if defined(_WIN32)
+
+MappedFile::MappedFile(const std::filesystem::path& path)
+{
+  HANDLE file = CreateFileW(
+    path.c_str(),
+    GENERIC_READ,
+    FILE_SHARE_READ,
+    nullptr,
+    OPEN_EXISTING,
+    FILE_ATTRIBUTE_NORMAL,
+    nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return;
+
+  LARGE_INTEGER fileSize;
+  if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+  {
+    mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping != nullptr)
+    {
+      ptr = static_cast<const std::byte*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+      size = ptr != nullptr ? static_cast<std::size_t>(fileSize.QuadPart) : 0;
+    }
+  }
+
+  // The mapping keeps the file alive on its own
+  CloseHandle(file);
+}
+
+void MappedFile::reset()
+{
+  if (ptr != nullptr)
+    UnmapViewOfFile(ptr);
+  if (mapping != nullptr)
+    CloseHandle(mapping);
+  ptr = nullptr;
+  size = 0;
+  mapping = nullptr;
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+  : ptr{std::exchange(other.ptr, nullptr)}
+  , size{std::exchange(other.size, 0)}
+  , mapping{std::exchange(other.mapping, nullptr)}
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+  if (this == &other)
+    return *this;
+
+  reset();
+  ptr = std::exchange(other.ptr, nullptr);
+  size = std::exchange(other.size, 0);
+  mapping = std::exchange(other.mapping, nullptr);
+  return *this;
+}
+
+#else
+
+MappedFile::MappedFile(const std::filesystem::path& path)
+{
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+
+  struct stat st;
+  if (::fstat(fd, &st) == 0 && st.st_size > 0)
+  {
+    const auto fileSize = static_cast<std::size_t>(st.st_size);
+    void* addr = ::mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED)
+    {
+      ptr = static_cast<const std::byte*>(addr);
+      size = fileSize;
+    }
+  }
+
+  // The mapping keeps the file alive on its own
+  ::close(fd);
+}
+
+void MappedFile::reset()
+{
+  if (ptr != nullptr)
+    ::munmap(const_cast<std::byte*>(ptr), size); // NOLINT
+  ptr = nullptr;
+  size = 0;
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+  : ptr{std::exchange(other.ptr, nullptr)}
+  , size{std::exchange(other.size, 0)}
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+  if (this == &other)
+    return *this;
+
+  reset();
+  ptr = std::exchange(other.ptr, nullptr);
+  size = std::exchange(other.size, 0);
+  return *this;
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+  reset();
+}
+
+} // namespace etna
@@ -0,0 +1,45 @@
+#pragma once
+#ifndef ETNA_MAPPED_FILE_HPP_INCLUDED
+#define ETNA_MAPPED_FILE_HPP_INCLUDED
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+
+namespace etna
+{
+
+/**
+ * Read-only memory mapping of a whole file. Mapping a missing or
+ * empty file is not an error, it simply produces an empty view.
+ */
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  explicit MappedFile(const std::filesystem::path& path);
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+
+  ~MappedFile();
+  void reset();
+
+  std::span<std::byte const> data() const { return {ptr, size}; }
+  bool empty() const { return size == 0; }
+
+private:
+  const std::byte* ptr = nullptr;
+  std::size_t size = 0;
+#if defined(_WIN32)
+  void* mapping = nullptr;
+#endif
+};
+
+} // namespace etna
+
+#endif // ETNA_MAPPED_FILE_HPP_INCLUDED
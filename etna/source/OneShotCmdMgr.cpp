@@ -1,5 +1,9 @@
 #include <etna/OneShotCmdMgr.hpp>
 
+#include <etna/Etna.hpp>
+#include <etna/GlobalContext.hpp>
+#include "StateTracking.hpp"
+
 #include <tracy/Tracy.hpp>
 
 
@@ -21,6 +25,15 @@ OneShotCmdMgr::OneShotCmdMgr(const Dependencies& deps)
       }))[0])}
   , oneShotFinished{unwrap_vk_result(deps.device.createFenceUnique(vk::FenceCreateInfo{}))}
 {
+  if (etna::is_initilized())
+    etna::get_context().getResourceTracker().registerCommandBuffer(
+      commandBuffer.get(), deps.queueFamily);
+}
+
+OneShotCmdMgr::~OneShotCmdMgr()
+{
+  if (etna::is_initilized())
+    etna::get_context().getResourceTracker().unregisterCommandBuffer(commandBuffer.get());
 }
 
 vk::CommandBuffer OneShotCmdMgr::start()
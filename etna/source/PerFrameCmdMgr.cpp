@@ -1,5 +1,9 @@
 #include <etna/PerFrameCmdMgr.hpp>
 
+#include <etna/Etna.hpp>
+#include <etna/GlobalContext.hpp>
+#include "StateTracking.hpp"
+
 #include <tracy/Tracy.hpp>
 
 
@@ -25,6 +29,21 @@ PerFrameCmdMgr::PerFrameCmdMgr(const Dependencies &deps)
   };
   auto bufsVec = unwrap_vk_result(deps.device.allocateCommandBuffersUnique(cbInfo));
   buffers.emplace(deps.workCount, [&bufsVec](std::size_t i) { return std::move(bufsVec[i]); });
+
+  // Resources used on another queue family than the last time change owners
+  if (etna::is_initilized())
+    buffers->iterate([&deps](const vk::UniqueCommandBuffer& buffer) {
+      etna::get_context().getResourceTracker().registerCommandBuffer(
+        buffer.get(), deps.queueFamily);
+    });
+}
+
+PerFrameCmdMgr::~PerFrameCmdMgr()
+{
+  if (etna::is_initilized() && buffers.has_value())
+    buffers->iterate([](const vk::UniqueCommandBuffer& buffer) {
+      etna::get_context().getResourceTracker().unregisterCommandBuffer(buffer.get());
+    });
 }
 
 vk::CommandBuffer PerFrameCmdMgr::acquireNext()
@@ -234,11 +234,17 @@ bool PerFrameTransferHelper::uploadImageSync(
 
   etna::set_state(
     cmd_buf,
-    dst.get(),
+    dst,
     vk::PipelineStageFlagBits2::eTransfer,
     vk::AccessFlagBits2::eTransferWrite,
     vk::ImageLayout::eTransferDstOptimal,
-    dst.getAspectMaskByFormat());
+    vk::ImageSubresourceRange{
+      .aspectMask = dst.getAspectMaskByFormat(),
+      .baseMipLevel = mip_level,
+      .levelCount = 1,
+      .baseArrayLayer = layer,
+      .layerCount = 1,
+    });
   etna::flush_barriers(cmd_buf);
 
   uploadImageRect(
@@ -374,11 +380,17 @@ bool PerFrameTransferHelper::progressImageUploadAsync(
   {
     etna::set_state(
       cmd_buf,
-      state.dst->get(),
+      *state.dst,
       vk::PipelineStageFlagBits2::eTransfer,
       vk::AccessFlagBits2::eTransferWrite,
       vk::ImageLayout::eTransferDstOptimal,
-      state.dst->getAspectMaskByFormat());
+      vk::ImageSubresourceRange{
+        .aspectMask = state.dst->getAspectMaskByFormat(),
+        .baseMipLevel = state.mipLevel,
+        .levelCount = 1,
+        .baseArrayLayer = state.layer,
+        .layerCount = 1,
+      });
     etna::flush_barriers(cmd_buf);
   }
 
@@ -49,9 +49,78 @@ vk::Pipeline PipelineBase::getVkPipeline() const
   return owner->getVkPipeline(id);
 }
 
+vk::Pipeline PipelineBase::getVkPipeline(const SpecializationConstants& overrides) const
+{
+  return owner->getVkPipeline(id, overrides);
+}
+
 vk::PipelineLayout PipelineBase::getVkPipelineLayout() const
 {
   return owner->getVkPipelineLayout(shaderProgramId);
 }
 
+std::array<uint32_t, 3> ComputePipeline::getWorkgroupSize(
+  const SpecializationConstants& overrides) const
+{
+  return getOwner()->getWorkgroupSize(getId(), overrides);
+}
+
+void ComputePipeline::dispatchThreads(
+  vk::CommandBuffer cmd,
+  uint32_t size_x,
+  uint32_t size_y,
+  uint32_t size_z,
+  const SpecializationConstants& overrides) const
+{
+  const auto groupSize = getWorkgroupSize(overrides);
+  cmd.dispatch(
+    (size_x + groupSize[0] - 1) / groupSize[0],
+    (size_y + groupSize[1] - 1) / groupSize[1],
+    (size_z + groupSize[2] - 1) / groupSize[2]);
+}
+
+const ShaderBindingTable& RayTracingPipeline::getShaderBindingTable(
+  const SpecializationConstants& overrides) const
+{
+  return getOwner()->getShaderBindingTable(getId(), overrides);
+}
+
+void RayTracingPipeline::traceRays(
+  vk::CommandBuffer cmd,
+  uint32_t width,
+  uint32_t height,
+  uint32_t depth,
+  uint32_t raygen_index,
+  const SpecializationConstants& overrides) const
+{
+  const auto& table = getShaderBindingTable(overrides);
+  ETNA_VERIFYF(
+    raygen_index < table.raygen.size(),
+    "Raygen shader #{} requested, but the pipeline has only {}",
+    raygen_index,
+    table.raygen.size());
+  cmd.traceRaysKHR(
+    table.raygen[raygen_index], table.miss, table.hit, table.callable, width, height, depth);
+}
+
+std::array<uint32_t, 3> MeshPipeline::getWorkgroupSize(
+  const SpecializationConstants& overrides) const
+{
+  return getOwner()->getWorkgroupSize(getId(), overrides);
+}
+
+void MeshPipeline::drawMeshTasksThreads(
+  vk::CommandBuffer cmd,
+  uint32_t size_x,
+  uint32_t size_y,
+  uint32_t size_z,
+  const SpecializationConstants& overrides) const
+{
+  const auto groupSize = getWorkgroupSize(overrides);
+  cmd.drawMeshTasksEXT(
+    (size_x + groupSize[0] - 1) / groupSize[0],
+    (size_y + groupSize[1] - 1) / groupSize[1],
+    (size_z + groupSize[2] - 1) / groupSize[2]);
+}
+
 } // namespace etna
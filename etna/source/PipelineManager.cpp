@@ -1,18 +1,132 @@
 #include <etna/PipelineManager.hpp>
 
+#include <algorithm>
+#include <bit>
+#include <cstring>
 #include <span>
 #include <vector>
 
 #include <etna/Assert.hpp>
+#include <etna/DeletionQueue.hpp>
+#include <etna/GlobalContext.hpp>
 #include <etna/ShaderProgram.hpp>
 #include <etna/VulkanFormatter.hpp>
 
+#include "SpecializationData.hpp"
+
 namespace etna
 {
 
+// Specialization constants of a compute pipeline including the ones controlling workgroup size
+static SpecializationConstants resolve_compute_spec_constants(
+  const ShaderProgramInfo& program, const ComputePipeline::CreateInfo& info)
+{
+  SpecializationConstants result = info.specConstants;
+  if (!info.workgroupSize.has_value())
+    return result;
+
+  const auto& declared = program.getWorkgroupSize();
+  for (std::size_t dim = 0; dim < 3; ++dim)
+  {
+    const uint32_t size = (*info.workgroupSize)[dim];
+    if (declared.specConstantIds[dim].has_value())
+      result.set(*declared.specConstantIds[dim], size);
+    else
+      ETNA_VERIFYF(
+        size == declared.size[dim],
+        "Workgroup size #{} is declared as a constant {} in the shader and can't be changed to {}",
+        dim,
+        declared.size[dim],
+        size);
+  }
+  return result;
+}
+
+// Workgroup size of the first stage of a program specialized with the given constants
+static std::array<uint32_t, 3> resolve_workgroup_size(
+  const ShaderProgramInfo& program, const SpecializationConstants& constants)
+{
+  const auto& declared = program.getWorkgroupSize();
+  std::array<uint32_t, 3> result = declared.size;
+  for (std::size_t dim = 0; dim < 3; ++dim)
+    if (declared.specConstantIds[dim].has_value())
+      if (const auto* entry = constants.find(*declared.specConstantIds[dim]))
+        result[dim] = entry->value;
+  return result;
+}
+
+// Both options are checked against the features enabled on the device and its limits,
+// since the pipeline is rejected by the driver otherwise
+static void validate_subgroup_control(
+  const ComputePipeline::CreateInfo& info, uint32_t workgroup_size_x)
+{
+  if (!info.requiredSubgroupSize.has_value() && !info.requireFullSubgroups)
+    return;
+
+  const auto& features = get_context().getSubgroupSizeControlFeatures();
+  const auto properties = get_context()
+                            .getPhysicalDevice()
+                            .getProperties2<
+                              vk::PhysicalDeviceProperties2,
+                              vk::PhysicalDeviceSubgroupSizeControlProperties>()
+                            .get<vk::PhysicalDeviceSubgroupSizeControlProperties>();
+
+  if (info.requiredSubgroupSize.has_value())
+  {
+    const uint32_t subgroupSize = *info.requiredSubgroupSize;
+    ETNA_VERIFYF(
+      features.subgroupSizeControl,
+      "Required subgroup size needs the subgroupSizeControl feature to be enabled in "
+      "InitParams::features");
+    ETNA_VERIFYF(
+      properties.requiredSubgroupSizeStages & vk::ShaderStageFlagBits::eCompute,
+      "The device can't require subgroup sizes of compute shaders");
+    ETNA_VERIFYF(
+      std::has_single_bit(subgroupSize),
+      "Required subgroup size must be a power of two, got {}",
+      subgroupSize);
+    ETNA_VERIFYF(
+      subgroupSize >= properties.minSubgroupSize && subgroupSize <= properties.maxSubgroupSize,
+      "Required subgroup size {} is outside of the supported range [{}, {}]",
+      subgroupSize,
+      properties.minSubgroupSize,
+      properties.maxSubgroupSize);
+  }
+
+  if (!info.requireFullSubgroups)
+    return;
+
+  ETNA_VERIFYF(
+    features.computeFullSubgroups,
+    "Requiring full subgroups needs the computeFullSubgroups feature to be enabled in "
+    "InitParams::features");
+  // Without a required size the driver may pick any size up to the maximum
+  const uint32_t subgroupSize = info.requiredSubgroupSize.value_or(properties.maxSubgroupSize);
+  ETNA_VERIFYF(
+    workgroup_size_x % subgroupSize == 0,
+    "Workgroup X size {} is not a multiple of the subgroup size {}",
+    workgroup_size_x,
+    subgroupSize);
+}
+
 static vk::UniquePipeline createComputePipelineInternal(
-  vk::Device device, vk::PipelineLayout layout, const vk::PipelineShaderStageCreateInfo stage)
+  vk::Device device,
+  vk::PipelineLayout layout,
+  vk::PipelineShaderStageCreateInfo stage,
+  const ComputePipeline::CreateInfo& info,
+  const SpecializationConstants& constants)
 {
+  SpecializationData specialization{constants};
+  specialization.apply(stage);
+
+  vk::PipelineShaderStageRequiredSubgroupSizeCreateInfo subgroupSize{
+    .requiredSubgroupSize = info.requiredSubgroupSize.value_or(0),
+  };
+  if (info.requiredSubgroupSize.has_value())
+    stage.pNext = &subgroupSize;
+  if (info.requireFullSubgroups)
+    stage.flags |= vk::PipelineShaderStageCreateFlagBits::eRequireFullSubgroups;
+
   vk::ComputePipelineCreateInfo pipelineInfo{.layout = layout};
   pipelineInfo.setStage(stage);
 
@@ -20,11 +134,61 @@ static vk::UniquePipeline createComputePipelineInternal(
 }
 
 
+// Creates a pipeline from the state shared by graphics and mesh pipelines, vertex processing
+// state is only present for graphics ones.
+template <class CreateInfo>
+static vk::UniquePipeline create_rasterization_pipeline(
+  vk::Device device,
+  vk::PipelineLayout layout,
+  std::vector<vk::PipelineShaderStageCreateInfo> stages,
+  const CreateInfo& info,
+  const SpecializationConstants& constants,
+  vk::GraphicsPipelineCreateInfo pipeline_info)
+{
+  SpecializationData specialization{constants};
+  for (auto& stage : stages)
+    specialization.apply(stage);
+
+  vk::PipelineViewportStateCreateInfo viewportState{
+    .viewportCount = 1,
+    .scissorCount = 1,
+  };
+
+  vk::PipelineColorBlendStateCreateInfo blendState{
+    .logicOpEnable = static_cast<vk::Bool32>(info.blendingConfig.logicOpEnable),
+    .logicOp = info.blendingConfig.logicOp,
+  };
+  blendState.setAttachments(info.blendingConfig.attachments);
+  blendState.blendConstants = info.blendingConfig.blendConstants;
+
+  vk::PipelineDynamicStateCreateInfo dynamicState{};
+  dynamicState.setDynamicStates(info.dynamicStates);
+
+  vk::PipelineRenderingCreateInfo rendering{
+    .depthAttachmentFormat = info.fragmentShaderOutput.depthAttachmentFormat,
+    .stencilAttachmentFormat = info.fragmentShaderOutput.stencilAttachmentFormat,
+  };
+  rendering.setColorAttachmentFormats(info.fragmentShaderOutput.colorAttachmentFormats);
+
+  pipeline_info.pNext = &rendering;
+  pipeline_info.pViewportState = &viewportState;
+  pipeline_info.pRasterizationState = &info.rasterizationConfig;
+  pipeline_info.pMultisampleState = &info.multisampleConfig;
+  pipeline_info.pDepthStencilState = &info.depthConfig;
+  pipeline_info.pColorBlendState = &blendState;
+  pipeline_info.pDynamicState = &dynamicState;
+  pipeline_info.layout = layout;
+  pipeline_info.setStages(stages);
+
+  return unwrap_vk_result(device.createGraphicsPipelineUnique(nullptr, pipeline_info));
+}
+
 static vk::UniquePipeline create_graphics_pipeline_internal(
   vk::Device device,
   vk::PipelineLayout layout,
-  std::span<const vk::PipelineShaderStageCreateInfo> stages,
-  const GraphicsPipeline::CreateInfo& info)
+  std::vector<vk::PipelineShaderStageCreateInfo> stages,
+  const GraphicsPipeline::CreateInfo& info,
+  const SpecializationConstants& constants)
 {
   std::vector<vk::VertexInputAttributeDescription> vertexAttribures;
   std::vector<vk::VertexInputBindingDescription> vertexBindings;
@@ -58,44 +222,129 @@ static vk::UniquePipeline create_graphics_pipeline_internal(
   vertexInput.setVertexAttributeDescriptions(vertexAttribures);
   vertexInput.setVertexBindingDescriptions(vertexBindings);
 
+  return create_rasterization_pipeline(
+    device,
+    layout,
+    std::move(stages),
+    info,
+    constants,
+    vk::GraphicsPipelineCreateInfo{
+      .pVertexInputState = &vertexInput,
+      .pInputAssemblyState = &info.inputAssemblyConfig,
+      .pTessellationState = &info.tessellationConfig,
+    });
+}
 
-  vk::PipelineViewportStateCreateInfo viewportState{
-    .viewportCount = 1,
-    .scissorCount = 1,
+static vk::UniquePipeline create_mesh_pipeline_internal(
+  vk::Device device,
+  vk::PipelineLayout layout,
+  std::vector<vk::PipelineShaderStageCreateInfo> stages,
+  const MeshPipeline::CreateInfo& info,
+  const SpecializationConstants& constants)
+{
+  // Mesh shaders assemble primitives themselves, so there is no vertex processing state
+  return create_rasterization_pipeline(
+    device, layout, std::move(stages), info, constants, vk::GraphicsPipelineCreateInfo{});
+}
+
+// Shader groups in the order they are laid out in a shader binding table
+struct RayTracingGroups
+{
+  std::vector<vk::RayTracingShaderGroupCreateInfoKHR> groups;
+  uint32_t raygenCount = 0;
+  uint32_t missCount = 0;
+  uint32_t hitCount = 0;
+  uint32_t callableCount = 0;
+};
+
+static RayTracingGroups make_ray_tracing_groups(
+  std::span<vk::PipelineShaderStageCreateInfo const> stages,
+  const RayTracingPipeline::CreateInfo& info)
+{
+  RayTracingGroups result;
+
+  auto addGeneralGroups = [&](vk::ShaderStageFlagBits stage) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < stages.size(); ++i)
+    {
+      if (stages[i].stage != stage)
+        continue;
+      result.groups.push_back(vk::RayTracingShaderGroupCreateInfoKHR{
+        .type = vk::RayTracingShaderGroupTypeKHR::eGeneral,
+        .generalShader = i,
+        .closestHitShader = vk::ShaderUnusedKHR,
+        .anyHitShader = vk::ShaderUnusedKHR,
+        .intersectionShader = vk::ShaderUnusedKHR,
+      });
+      ++count;
+    }
+    return count;
   };
 
-  vk::PipelineColorBlendStateCreateInfo blendState{
-    .logicOpEnable = static_cast<vk::Bool32>(info.blendingConfig.logicOpEnable),
-    .logicOp = info.blendingConfig.logicOp,
+  auto shaderIndex = [stages](
+                       const std::optional<uint32_t>& index, vk::ShaderStageFlagBits stage) {
+    if (!index.has_value())
+      return vk::ShaderUnusedKHR;
+    ETNA_VERIFYF(
+      *index < stages.size() && stages[*index].stage == stage,
+      "Hit group shader #{} is not a {} shader",
+      *index,
+      vk::to_string(stage));
+    return *index;
   };
-  blendState.setAttachments(info.blendingConfig.attachments);
-  blendState.blendConstants = info.blendingConfig.blendConstants;
 
-  vk::PipelineDynamicStateCreateInfo dynamicState{};
-  dynamicState.setDynamicStates(info.dynamicStates);
+  result.raygenCount = addGeneralGroups(vk::ShaderStageFlagBits::eRaygenKHR);
+  result.missCount = addGeneralGroups(vk::ShaderStageFlagBits::eMissKHR);
+
+  std::vector<RayTracingPipeline::HitGroup> hitGroups = info.hitGroups;
+  if (hitGroups.empty())
+    for (uint32_t i = 0; i < stages.size(); ++i)
+      if (stages[i].stage == vk::ShaderStageFlagBits::eClosestHitKHR)
+        hitGroups.push_back(RayTracingPipeline::HitGroup{.closestHit = i});
+
+  for (const auto& group : hitGroups)
+    result.groups.push_back(vk::RayTracingShaderGroupCreateInfoKHR{
+      .type = group.intersection.has_value()
+        ? vk::RayTracingShaderGroupTypeKHR::eProceduralHitGroup
+        : vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup,
+      .generalShader = vk::ShaderUnusedKHR,
+      .closestHitShader = shaderIndex(group.closestHit, vk::ShaderStageFlagBits::eClosestHitKHR),
+      .anyHitShader = shaderIndex(group.anyHit, vk::ShaderStageFlagBits::eAnyHitKHR),
+      .intersectionShader =
+        shaderIndex(group.intersection, vk::ShaderStageFlagBits::eIntersectionKHR),
+    });
+  result.hitCount = static_cast<uint32_t>(hitGroups.size());
+
+  result.callableCount = addGeneralGroups(vk::ShaderStageFlagBits::eCallableKHR);
+  return result;
+}
 
-  vk::PipelineRenderingCreateInfo rendering{
-    .depthAttachmentFormat = info.fragmentShaderOutput.depthAttachmentFormat,
-    .stencilAttachmentFormat = info.fragmentShaderOutput.stencilAttachmentFormat,
-  };
-  rendering.setColorAttachmentFormats(info.fragmentShaderOutput.colorAttachmentFormats);
+static vk::UniquePipeline create_ray_tracing_pipeline_internal(
+  vk::Device device,
+  vk::PipelineLayout layout,
+  std::vector<vk::PipelineShaderStageCreateInfo> stages,
+  const RayTracingPipeline::CreateInfo& info,
+  const SpecializationConstants& constants)
+{
+  SpecializationData specialization{constants};
+  for (auto& stage : stages)
+    specialization.apply(stage);
+
+  const auto groups = make_ray_tracing_groups(stages, info);
 
-  vk::GraphicsPipelineCreateInfo pipelineInfo{
-    .pNext = &rendering,
-    .pVertexInputState = &vertexInput,
-    .pInputAssemblyState = &info.inputAssemblyConfig,
-    .pTessellationState = &info.tessellationConfig,
-    .pViewportState = &viewportState,
-    .pRasterizationState = &info.rasterizationConfig,
-    .pMultisampleState = &info.multisampleConfig,
-    .pDepthStencilState = &info.depthConfig,
-    .pColorBlendState = &blendState,
-    .pDynamicState = &dynamicState,
+  vk::RayTracingPipelineCreateInfoKHR pipelineInfo{
+    .maxPipelineRayRecursionDepth = info.maxRecursionDepth,
     .layout = layout,
   };
   pipelineInfo.setStages(stages);
+  pipelineInfo.setGroups(groups.groups);
 
-  return unwrap_vk_result(device.createGraphicsPipelineUnique(nullptr, pipelineInfo));
+  return unwrap_vk_result(device.createRayTracingPipelineKHRUnique(nullptr, nullptr, pipelineInfo));
+}
+
+static constexpr vk::DeviceSize align_up(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
 }
 
 PipelineManager::PipelineManager(vk::Device dev, ShaderProgramManager& shader_manager)
@@ -117,9 +366,15 @@ ComputePipeline PipelineManager::createComputePipeline(
     "Incorrect shader program, expected 1 stage for ComputePipeline, but got {}!",
     shaderStages.size());
 
+  const auto programInfo = shaderManager.getProgramInfo(progId);
+  const auto specConstants = resolve_compute_spec_constants(programInfo, info);
+  validate_spec_constants(programInfo, specConstants);
+  validate_subgroup_control(info, resolve_workgroup_size(programInfo, specConstants)[0]);
+
   pipelines.emplace(
     pipelineId,
-    createComputePipelineInternal(device, shaderManager.getProgramLayout(progId), shaderStages[0]));
+    createComputePipelineInternal(
+      device, shaderManager.getProgramLayout(progId), shaderStages[0], info, specConstants));
   computePipelineParameters.emplace(pipelineId, ComputeParameters{progId, std::move(info)});
 
   return ComputePipeline(this, pipelineId, progId);
@@ -166,10 +421,16 @@ GraphicsPipeline PipelineManager::createGraphicsPipeline(
   const PipelineId pipelineId = static_cast<PipelineId>(pipelineIdCounter++);
   const ShaderProgramId progId = shaderManager.getProgram(shader_program_name);
 
+  validate_spec_constants(shaderManager.getProgramInfo(progId), info.specConstants);
+
   pipelines.emplace(
     pipelineId,
     create_graphics_pipeline_internal(
-      device, shaderManager.getProgramLayout(progId), shaderManager.getShaderStages(progId), info));
+      device,
+      shaderManager.getProgramLayout(progId),
+      shaderManager.getShaderStages(progId),
+      info,
+      info.specConstants));
   graphicsPipelineParameters.emplace(pipelineId, PipelineParameters{progId, std::move(info)});
 
   GraphicsPipeline pipeline(this, pipelineId, progId);
@@ -177,9 +438,76 @@ GraphicsPipeline PipelineManager::createGraphicsPipeline(
   return pipeline;
 }
 
+MeshPipeline PipelineManager::createMeshPipeline(
+  const char* shader_program_name, MeshPipeline::CreateInfo info)
+{
+  ETNA_VERIFYF(
+    get_context().hasMeshShaders(),
+    "Mesh shaders are not available, see InitParams::enableMeshShaders");
+
+  const PipelineId pipelineId = static_cast<PipelineId>(pipelineIdCounter++);
+  const ShaderProgramId progId = shaderManager.getProgram(shader_program_name);
+  const std::vector<vk::PipelineShaderStageCreateInfo> shaderStages =
+    shaderManager.getShaderStages(progId);
+
+  ETNA_VERIFYF(
+    std::ranges::any_of(
+      shaderStages,
+      [](const auto& stage) { return stage.stage == vk::ShaderStageFlagBits::eMeshEXT; }),
+    "Incorrect shader program {}, MeshPipeline requires a mesh shader",
+    shader_program_name);
+
+  validate_spec_constants(shaderManager.getProgramInfo(progId), info.specConstants);
+
+  pipelines.emplace(
+    pipelineId,
+    create_mesh_pipeline_internal(
+      device, shaderManager.getProgramLayout(progId), shaderStages, info, info.specConstants));
+  meshPipelineParameters.emplace(pipelineId, MeshParameters{progId, std::move(info)});
+
+  return MeshPipeline(this, pipelineId, progId);
+}
+
+RayTracingPipeline PipelineManager::createRayTracingPipeline(
+  const char* shader_program_name, RayTracingPipeline::CreateInfo info)
+{
+  const PipelineId pipelineId = static_cast<PipelineId>(pipelineIdCounter++);
+  const ShaderProgramId progId = shaderManager.getProgram(shader_program_name);
+  const std::vector<vk::PipelineShaderStageCreateInfo> shaderStages =
+    shaderManager.getShaderStages(progId);
+
+  ETNA_VERIFYF(
+    std::ranges::any_of(
+      shaderStages,
+      [](const auto& stage) { return stage.stage == vk::ShaderStageFlagBits::eRaygenKHR; }),
+    "Incorrect shader program {}, RayTracingPipeline requires a raygen shader",
+    shader_program_name);
+
+  const uint32_t maxRecursionDepth = getRayTracingProperties().maxRayRecursionDepth;
+  ETNA_VERIFYF(
+    info.maxRecursionDepth <= maxRecursionDepth,
+    "Ray recursion depth {} exceeds the device limit of {}",
+    info.maxRecursionDepth,
+    maxRecursionDepth);
+
+  validate_spec_constants(shaderManager.getProgramInfo(progId), info.specConstants);
+
+  pipelines.emplace(
+    pipelineId,
+    create_ray_tracing_pipeline_internal(
+      device, shaderManager.getProgramLayout(progId), shaderStages, info, info.specConstants));
+  rayTracingPipelineParameters.emplace(
+    pipelineId, RayTracingParameters{progId, std::move(info)});
+
+  return RayTracingPipeline(this, pipelineId, progId);
+}
+
 void PipelineManager::recreate()
 {
   pipelines.clear();
+  permutations.clear();
+  permutationsByOverrides.clear();
+  shaderBindingTables.clear();
   for (const auto& [id, params] : graphicsPipelineParameters)
     pipelines.emplace(
       id,
@@ -187,14 +515,109 @@ void PipelineManager::recreate()
         device,
         shaderManager.getProgramLayout(params.shaderProgram),
         shaderManager.getShaderStages(params.shaderProgram),
-        params.info));
+        params.info,
+        params.info.specConstants));
+  for (const auto& [id, params] : meshPipelineParameters)
+    pipelines.emplace(
+      id,
+      create_mesh_pipeline_internal(
+        device,
+        shaderManager.getProgramLayout(params.shaderProgram),
+        shaderManager.getShaderStages(params.shaderProgram),
+        params.info,
+        params.info.specConstants));
+  for (const auto& [id, params] : rayTracingPipelineParameters)
+    pipelines.emplace(
+      id,
+      create_ray_tracing_pipeline_internal(
+        device,
+        shaderManager.getProgramLayout(params.shaderProgram),
+        shaderManager.getShaderStages(params.shaderProgram),
+        params.info,
+        params.info.specConstants));
   for (const auto& [id, params] : computePipelineParameters)
     pipelines.emplace(
       id,
       createComputePipelineInternal(
         device,
         shaderManager.getProgramLayout(params.shaderProgram),
-        shaderManager.getShaderStages(params.shaderProgram)[0]));
+        shaderManager.getShaderStages(params.shaderProgram)[0],
+        params.info,
+        resolve_compute_spec_constants(
+          shaderManager.getProgramInfo(params.shaderProgram), params.info)));
+}
+
+void PipelineManager::recreate(
+  std::span<ShaderProgramId const> programs, DeletionQueue& deletion_queue)
+{
+  auto isAffected = [programs](ShaderProgramId id) {
+    return std::ranges::find(programs, id) != programs.end();
+  };
+
+  auto replacePipeline = [this, &deletion_queue](PipelineId id, vk::UniquePipeline pipeline) {
+    auto& slot = pipelines.at(id);
+    deletion_queue.retire(std::move(slot));
+    slot = std::move(pipeline);
+  };
+
+  for (const auto& [id, params] : graphicsPipelineParameters)
+    if (isAffected(params.shaderProgram))
+      replacePipeline(
+        id,
+        create_graphics_pipeline_internal(
+          device,
+          shaderManager.getProgramLayout(params.shaderProgram),
+          shaderManager.getShaderStages(params.shaderProgram),
+          params.info,
+          params.info.specConstants));
+  for (const auto& [id, params] : meshPipelineParameters)
+    if (isAffected(params.shaderProgram))
+      replacePipeline(
+        id,
+        create_mesh_pipeline_internal(
+          device,
+          shaderManager.getProgramLayout(params.shaderProgram),
+          shaderManager.getShaderStages(params.shaderProgram),
+          params.info,
+          params.info.specConstants));
+  for (const auto& [id, params] : rayTracingPipelineParameters)
+    if (isAffected(params.shaderProgram))
+      replacePipeline(
+        id,
+        create_ray_tracing_pipeline_internal(
+          device,
+          shaderManager.getProgramLayout(params.shaderProgram),
+          shaderManager.getShaderStages(params.shaderProgram),
+          params.info,
+          params.info.specConstants));
+  for (const auto& [id, params] : computePipelineParameters)
+    if (isAffected(params.shaderProgram))
+      replacePipeline(
+        id,
+        createComputePipelineInternal(
+          device,
+          shaderManager.getProgramLayout(params.shaderProgram),
+          shaderManager.getShaderStages(params.shaderProgram)[0],
+          params.info,
+          resolve_compute_spec_constants(
+            shaderManager.getProgramInfo(params.shaderProgram), params.info)));
+
+  // Permutations and shader binding tables are recreated lazily on next use
+  std::erase_if(permutations, [&](auto& entry) {
+    if (!isAffected(getPipelineProgram(entry.first.pipeline)))
+      return false;
+    deletion_queue.retire(std::move(entry.second));
+    return true;
+  });
+  std::erase_if(permutationsByOverrides, [&](const auto& entry) {
+    return isAffected(getPipelineProgram(entry.first.pipeline));
+  });
+  std::erase_if(shaderBindingTables, [&](auto& entry) {
+    if (!isAffected(getPipelineProgram(entry.first.pipeline)))
+      return false;
+    deletion_queue.retire(std::move(entry.second.buffer));
+    return true;
+  });
 }
 
 void PipelineManager::destroyPipeline(PipelineId id)
@@ -204,6 +627,14 @@ void PipelineManager::destroyPipeline(PipelineId id)
 
   pipelines.erase(id);
   graphicsPipelineParameters.erase(id);
+  meshPipelineParameters.erase(id);
+  rayTracingPipelineParameters.erase(id);
+  computePipelineParameters.erase(id);
+  std::erase_if(permutations, [id](const auto& entry) { return entry.first.pipeline == id; });
+  std::erase_if(
+    permutationsByOverrides, [id](const auto& entry) { return entry.first.pipeline == id; });
+  std::erase_if(
+    shaderBindingTables, [id](const auto& entry) { return entry.first.pipeline == id; });
 }
 
 vk::Pipeline PipelineManager::getVkPipeline(PipelineId id) const
@@ -212,6 +643,249 @@ vk::Pipeline PipelineManager::getVkPipeline(PipelineId id) const
   return pipelines.find(id)->second.get();
 }
 
+vk::Pipeline PipelineManager::getVkPipeline(
+  PipelineId id, const SpecializationConstants& overrides)
+{
+  ETNA_VERIFY(id != PipelineId::Invalid);
+  if (overrides.empty())
+    return getVkPipeline(id);
+
+  if (auto it = permutationsByOverrides.find(PermutationKeyView{id, overrides.getEntries()});
+      it != permutationsByOverrides.end())
+    return it->second;
+
+  auto constants = getPermutationConstants(id, overrides);
+  vk::Pipeline pipeline;
+  if (constants.empty())
+    pipeline = getVkPipeline(id);
+  else if (auto it = permutations.find(PermutationKeyView{id, constants.getEntries()});
+           it != permutations.end())
+    pipeline = it->second.get();
+  else
+  {
+    auto created = createPermutation(id, constants);
+    pipeline = created.get();
+    permutations.emplace(PermutationKey{id, std::move(constants)}, std::move(created));
+  }
+
+  permutationsByOverrides.emplace(PermutationKey{id, overrides}, pipeline);
+  return pipeline;
+}
+
+ShaderProgramId PipelineManager::getPipelineProgram(PipelineId id) const
+{
+  if (auto it = graphicsPipelineParameters.find(id); it != graphicsPipelineParameters.end())
+    return it->second.shaderProgram;
+  if (auto it = meshPipelineParameters.find(id); it != meshPipelineParameters.end())
+    return it->second.shaderProgram;
+  if (auto it = rayTracingPipelineParameters.find(id); it != rayTracingPipelineParameters.end())
+    return it->second.shaderProgram;
+  if (auto it = computePipelineParameters.find(id); it != computePipelineParameters.end())
+    return it->second.shaderProgram;
+  ETNA_PANIC("Pipeline {} does not exist", static_cast<std::underlying_type_t<PipelineId>>(id));
+}
+
+SpecializationConstants PipelineManager::getPermutationConstants(
+  PipelineId id, const SpecializationConstants& overrides) const
+{
+  const ShaderProgramId progId = getPipelineProgram(id);
+  const auto programInfo = shaderManager.getProgramInfo(progId);
+  validate_spec_constants(programInfo, overrides);
+
+  SpecializationConstants base;
+  if (auto it = graphicsPipelineParameters.find(id); it != graphicsPipelineParameters.end())
+    base = it->second.info.specConstants;
+  else if (auto meshIt = meshPipelineParameters.find(id); meshIt != meshPipelineParameters.end())
+    base = meshIt->second.info.specConstants;
+  else if (auto rtIt = rayTracingPipelineParameters.find(id);
+           rtIt != rayTracingPipelineParameters.end())
+    base = rtIt->second.info.specConstants;
+  else
+    base =
+      resolve_compute_spec_constants(programInfo, computePipelineParameters.find(id)->second.info);
+
+  auto result = base.overriddenBy(overrides);
+  if (result == base)
+    return {};
+  return result;
+}
+
+vk::UniquePipeline PipelineManager::createPermutation(
+  PipelineId id, const SpecializationConstants& constants)
+{
+  const ShaderProgramId progId = getPipelineProgram(id);
+
+  if (auto it = graphicsPipelineParameters.find(id); it != graphicsPipelineParameters.end())
+    return create_graphics_pipeline_internal(
+      device,
+      shaderManager.getProgramLayout(progId),
+      shaderManager.getShaderStages(progId),
+      it->second.info,
+      constants);
+
+  if (auto it = meshPipelineParameters.find(id); it != meshPipelineParameters.end())
+    return create_mesh_pipeline_internal(
+      device,
+      shaderManager.getProgramLayout(progId),
+      shaderManager.getShaderStages(progId),
+      it->second.info,
+      constants);
+
+  if (auto it = rayTracingPipelineParameters.find(id); it != rayTracingPipelineParameters.end())
+    return create_ray_tracing_pipeline_internal(
+      device,
+      shaderManager.getProgramLayout(progId),
+      shaderManager.getShaderStages(progId),
+      it->second.info,
+      constants);
+
+  const auto& params = computePipelineParameters.find(id)->second;
+  // Overrides may change the workgroup size, which full subgroups depend on
+  validate_subgroup_control(
+    params.info, resolve_workgroup_size(shaderManager.getProgramInfo(progId), constants)[0]);
+  return createComputePipelineInternal(
+    device,
+    shaderManager.getProgramLayout(progId),
+    shaderManager.getShaderStages(progId)[0],
+    params.info,
+    constants);
+}
+
+std::array<uint32_t, 3> PipelineManager::getWorkgroupSize(
+  PipelineId id, const SpecializationConstants& overrides) const
+{
+  ShaderProgramId progId = ShaderProgramId::Invalid;
+  SpecializationConstants specConstants;
+  if (auto it = computePipelineParameters.find(id); it != computePipelineParameters.end())
+  {
+    progId = it->second.shaderProgram;
+    specConstants =
+      resolve_compute_spec_constants(shaderManager.getProgramInfo(progId), it->second.info);
+  }
+  else if (auto meshIt = meshPipelineParameters.find(id); meshIt != meshPipelineParameters.end())
+  {
+    progId = meshIt->second.shaderProgram;
+    specConstants = meshIt->second.info.specConstants;
+  }
+  else
+  {
+    ETNA_PANIC(
+      "Pipeline {} is neither a compute nor a mesh pipeline",
+      static_cast<std::underlying_type_t<PipelineId>>(id));
+  }
+
+  return resolve_workgroup_size(
+    shaderManager.getProgramInfo(progId), specConstants.overriddenBy(overrides));
+}
+
+const ShaderBindingTable& PipelineManager::getShaderBindingTable(
+  PipelineId id, const SpecializationConstants& overrides)
+{
+  const vk::Pipeline pipeline = getVkPipeline(id, overrides);
+  auto constants = overrides.empty() ? SpecializationConstants{}
+                                     : getPermutationConstants(id, overrides);
+  auto it = shaderBindingTables.find(PermutationKeyView{id, constants.getEntries()});
+  if (it != shaderBindingTables.end())
+    return it->second;
+
+  auto table = createShaderBindingTable(id, pipeline);
+  return shaderBindingTables.emplace(PermutationKey{id, std::move(constants)}, std::move(table))
+    .first->second;
+}
+
+ShaderBindingTable PipelineManager::createShaderBindingTable(PipelineId id, vk::Pipeline pipeline)
+{
+  auto it = rayTracingPipelineParameters.find(id);
+  ETNA_VERIFYF(
+    it != rayTracingPipelineParameters.end(),
+    "Pipeline {} is not a ray tracing pipeline",
+    static_cast<std::underlying_type_t<PipelineId>>(id));
+
+  const auto& props = getRayTracingProperties();
+  const auto groups = make_ray_tracing_groups(
+    shaderManager.getShaderStages(it->second.shaderProgram), it->second.info);
+  const auto groupCount = static_cast<uint32_t>(groups.groups.size());
+
+  // Every region has to start at a multiple of the base alignment,
+  // records within a region are spaced by the handle alignment.
+  const vk::DeviceSize handleSize = props.shaderGroupHandleSize;
+  const vk::DeviceSize stride = align_up(handleSize, props.shaderGroupHandleAlignment);
+  const vk::DeviceSize baseAlignment = props.shaderGroupBaseAlignment;
+
+  std::vector<vk::DeviceSize> groupOffsets;
+  groupOffsets.reserve(groupCount);
+  vk::DeviceSize offset = 0;
+  auto placeRegion = [&](uint32_t count) {
+    const vk::DeviceSize start = offset;
+    for (uint32_t i = 0; i < count; ++i)
+      groupOffsets.push_back(start + i * stride);
+    offset = align_up(start + count * stride, baseAlignment);
+    return start;
+  };
+
+  std::vector<vk::DeviceSize> raygenOffsets;
+  for (uint32_t i = 0; i < groups.raygenCount; ++i)
+    raygenOffsets.push_back(placeRegion(1));
+  const vk::DeviceSize missOffset = placeRegion(groups.missCount);
+  const vk::DeviceSize hitOffset = placeRegion(groups.hitCount);
+  const vk::DeviceSize callableOffset = placeRegion(groups.callableCount);
+
+  ShaderBindingTable result{
+    // Allocations are not necessarily aligned to shaderGroupBaseAlignment, leave room to fix that
+    .buffer = get_context().createBuffer(Buffer::CreateInfo{
+      .size = offset + baseAlignment,
+      .bufferUsage = vk::BufferUsageFlagBits::eShaderBindingTableKHR |
+        vk::BufferUsageFlagBits::eShaderDeviceAddress,
+      .memoryUsage = VMA_MEMORY_USAGE_AUTO,
+      .allocationCreate =
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+      .name = "shader_binding_table",
+    }),
+  };
+
+  const vk::DeviceAddress bufferAddress = result.buffer.getDeviceAddress();
+  const vk::DeviceAddress base = align_up(bufferAddress, baseAlignment);
+  std::byte* data = result.buffer.data() + (base - bufferAddress);
+
+  const auto handles = unwrap_vk_result(device.getRayTracingShaderGroupHandlesKHR<std::byte>(
+    pipeline, 0, groupCount, groupCount * handleSize));
+  for (uint32_t i = 0; i < groupCount; ++i)
+    std::memcpy(data + groupOffsets[i], handles.data() + i * handleSize, handleSize);
+
+  auto region = [base, stride](vk::DeviceSize region_offset, uint32_t count) {
+    if (count == 0)
+      return vk::StridedDeviceAddressRegionKHR{};
+    return vk::StridedDeviceAddressRegionKHR{
+      .deviceAddress = base + region_offset,
+      .stride = stride,
+      .size = count * stride,
+    };
+  };
+
+  for (auto raygenOffset : raygenOffsets)
+    result.raygen.push_back(region(raygenOffset, 1));
+  result.miss = region(missOffset, groups.missCount);
+  result.hit = region(hitOffset, groups.hitCount);
+  result.callable = region(callableOffset, groups.callableCount);
+  return result;
+}
+
+const vk::PhysicalDeviceRayTracingPipelinePropertiesKHR& PipelineManager::
+  getRayTracingProperties()
+{
+  ETNA_VERIFYF(
+    get_context().hasRayTracing(),
+    "Ray tracing is not available, see InitParams::enableRayTracing");
+  if (!rayTracingProperties.has_value())
+    rayTracingProperties = get_context()
+                             .getPhysicalDevice()
+                             .getProperties2<
+                               vk::PhysicalDeviceProperties2,
+                               vk::PhysicalDeviceRayTracingPipelinePropertiesKHR>()
+                             .get<vk::PhysicalDeviceRayTracingPipelinePropertiesKHR>();
+  return *rayTracingProperties;
+}
+
 vk::PipelineLayout PipelineManager::getVkPipelineLayout(ShaderProgramId id) const
 {
   ETNA_VERIFY(id != ShaderProgramId::Invalid);
@@ -0,0 +1,587 @@
+#include <etna/RenderGraph.hpp>
+
+#include <algorithm>
+
+#include <tracy/Tracy.hpp>
+
+#include <etna/GlobalContext.hpp>
+#include <etna/RenderTargetStates.hpp>
+#include "StateTracking.hpp"
+
+
+namespace etna
+{
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::sample(
+  GraphImageId image, vk::PipelineStageFlags2 stages)
+{
+  return read(
+    image,
+    stages,
+    vk::AccessFlagBits2::eShaderSampledRead,
+    vk::ImageLayout::eShaderReadOnlyOptimal);
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::readStorage(
+  GraphImageId image, vk::PipelineStageFlags2 stages)
+{
+  return read(image, stages, vk::AccessFlagBits2::eShaderStorageRead, vk::ImageLayout::eGeneral);
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::writeStorage(
+  GraphImageId image, vk::PipelineStageFlags2 stages)
+{
+  return write(image, stages, vk::AccessFlagBits2::eShaderStorageWrite, vk::ImageLayout::eGeneral);
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::colorAttachment(
+  GraphImageId image, std::optional<vk::ClearColorValue> clear)
+{
+  auto& info = graph.passes[pass];
+  write(
+    image,
+    vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+    vk::AccessFlagBits2::eColorAttachmentWrite,
+    vk::ImageLayout::eColorAttachmentOptimal);
+  info.colorAttachments.push_back(Attachment{
+    .access = info.images.size() - 1,
+    .clearColor = clear,
+    .clearDepthStencil = std::nullopt,
+  });
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::depthAttachment(
+  GraphImageId image, std::optional<vk::ClearDepthStencilValue> clear)
+{
+  auto& info = graph.passes[pass];
+  ETNA_VERIFYF(!info.depthAttachment.has_value(), "Pass '{}' has two depth attachments", info.name);
+  write(
+    image,
+    vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+      vk::PipelineStageFlagBits2::eLateFragmentTests,
+    vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+    vk::ImageLayout::eDepthStencilAttachmentOptimal);
+  info.depthAttachment = Attachment{
+    .access = info.images.size() - 1,
+    .clearColor = std::nullopt,
+    .clearDepthStencil = clear,
+  };
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::read(
+  GraphImageId image,
+  vk::PipelineStageFlags2 stages,
+  vk::AccessFlags2 access,
+  vk::ImageLayout layout)
+{
+  graph.passes[pass].images.push_back(ImageAccess{
+    .image = image,
+    .stages = stages,
+    .access = access,
+    .layout = layout,
+    .write = false,
+  });
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::write(
+  GraphImageId image,
+  vk::PipelineStageFlags2 stages,
+  vk::AccessFlags2 access,
+  vk::ImageLayout layout)
+{
+  graph.passes[pass].images.push_back(ImageAccess{
+    .image = image,
+    .stages = stages,
+    .access = access,
+    .layout = layout,
+    .write = true,
+  });
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::read(
+  GraphBufferId buffer, vk::PipelineStageFlags2 stages, vk::AccessFlags2 access)
+{
+  graph.passes[pass].buffers.push_back(BufferAccess{
+    .buffer = buffer,
+    .stages = stages,
+    .access = access,
+    .write = false,
+  });
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::write(
+  GraphBufferId buffer, vk::PipelineStageFlags2 stages, vk::AccessFlags2 access)
+{
+  graph.passes[pass].buffers.push_back(BufferAccess{
+    .buffer = buffer,
+    .stages = stages,
+    .access = access,
+    .write = true,
+  });
+  return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::sideEffect()
+{
+  graph.passes[pass].sideEffect = true;
+  return *this;
+}
+
+RenderGraph::RenderGraph(const GpuWorkCount& work_count)
+  : transientMemory{work_count, std::in_place}
+{
+}
+
+RenderGraph::~RenderGraph()
+{
+  const VmaAllocator allocator = get_context().getAllocator();
+  transientMemory.iterate([allocator](TransientMemory& memory) {
+    // Images have to go before the memory they live in
+    memory.images.clear();
+    if (memory.memory != nullptr)
+      vmaFreeMemory(allocator, memory.memory);
+  });
+}
+
+void RenderGraph::reset()
+{
+  passes.clear();
+  images.clear();
+  buffers.clear();
+  stats = {};
+  compiled = false;
+}
+
+GraphImageId RenderGraph::createImage(const Image::CreateInfo& info)
+{
+  ETNA_VERIFYF(
+    info.tiling == vk::ImageTiling::eOptimal,
+    "Transient image '{}' must use optimal tiling to share memory with other images",
+    info.name);
+  // The span of queue families would not outlive the call
+  auto transientInfo = info;
+  transientInfo.concurrentQueueFamilies = {};
+  images.push_back(ImageResource{
+    .name = std::string(info.name),
+    .transientInfo = transientInfo,
+  });
+  return static_cast<GraphImageId>(images.size() - 1);
+}
+
+GraphImageId RenderGraph::importImage(const Image& image)
+{
+  images.push_back(ImageResource{
+    .name = std::string(image.getName()),
+    .transientInfo = std::nullopt,
+    .image = &image,
+  });
+  return static_cast<GraphImageId>(images.size() - 1);
+}
+
+GraphBufferId RenderGraph::importBuffer(const Buffer& buffer)
+{
+  buffers.push_back(&buffer);
+  return static_cast<GraphBufferId>(buffers.size() - 1);
+}
+
+void RenderGraph::addPass(
+  std::string name, const std::function<void(PassBuilder&)>& setup, ExecuteFunc execute)
+{
+  ETNA_VERIFYF(!compiled, "Cannot add pass '{}' to a compiled graph, reset it first", name);
+  passes.push_back(Pass{
+    .name = std::move(name),
+    .execute = std::move(execute),
+  });
+  PassBuilder builder(*this, passes.size() - 1);
+  setup(builder);
+}
+
+const Image& RenderGraph::getImage(GraphImageId id) const
+{
+  const auto& resource = images[static_cast<uint32_t>(id)];
+  ETNA_VERIFYF(
+    resource.image != nullptr,
+    "Image '{}' is not available, it is either unused or the graph was not compiled",
+    resource.name);
+  return *resource.image;
+}
+
+const Buffer& RenderGraph::getBuffer(GraphBufferId id) const
+{
+  return *buffers[static_cast<uint32_t>(id)];
+}
+
+void RenderGraph::compile()
+{
+  ZoneScoped;
+
+  ETNA_VERIFYF(!compiled, "The graph is already compiled, reset it first");
+  cullPasses();
+  computeLifetimes();
+  pickAttachmentOps();
+  placeTransientImages();
+  compiled = true;
+}
+
+// Goes from the last pass to the first one, so every pass is visited after all of its readers
+void RenderGraph::cullPasses()
+{
+  std::vector<bool> imagesNeeded(images.size(), false);
+  for (std::size_t i = passes.size(); i-- > 0;)
+  {
+    auto& pass = passes[i];
+    bool needed = pass.sideEffect;
+    for (const auto& access : pass.images)
+    {
+      const auto& resource = images[static_cast<uint32_t>(access.image)];
+      needed |= access.write &&
+        (!resource.transientInfo.has_value() || imagesNeeded[static_cast<uint32_t>(access.image)]);
+    }
+    // All buffers are imported
+    for (const auto& access : pass.buffers)
+      needed |= access.write;
+
+    pass.culled = !needed;
+    if (pass.culled)
+      continue;
+
+    for (const auto& access : pass.images)
+      if (!access.write)
+        imagesNeeded[static_cast<uint32_t>(access.image)] = true;
+    // Attachments which are not cleared may be loaded
+    for (const auto& attachment : pass.colorAttachments)
+      if (!attachment.clearColor.has_value())
+        imagesNeeded[static_cast<uint32_t>(pass.images[attachment.access].image)] = true;
+    if (pass.depthAttachment.has_value() && !pass.depthAttachment->clearDepthStencil.has_value())
+      imagesNeeded[static_cast<uint32_t>(pass.images[pass.depthAttachment->access].image)] = true;
+  }
+
+  stats.passes = passes.size();
+  stats.culledPasses =
+    static_cast<std::size_t>(std::ranges::count_if(passes, [](const Pass& pass) {
+      return pass.culled;
+    }));
+}
+
+void RenderGraph::computeLifetimes()
+{
+  for (std::size_t i = 0; i < passes.size(); ++i)
+  {
+    auto& pass = passes[i];
+    if (pass.culled)
+      continue;
+    for (const auto& access : pass.images)
+    {
+      auto& resource = images[static_cast<uint32_t>(access.image)];
+      if (resource.firstUse == ~std::size_t{0})
+      {
+        resource.firstUse = i;
+        if (resource.transientInfo.has_value())
+          pass.firstUses.push_back(access.image);
+      }
+      if (resource.lastUse != i)
+      {
+        resource.lastStages = {};
+        resource.lastAccess = {};
+      }
+      resource.lastUse = i;
+      resource.lastStages |= access.stages;
+      resource.lastAccess |= access.access;
+    }
+  }
+}
+
+// Transient images have nothing to load before their first use and nothing to store after
+// their last one. Imported images are used outside the graph, so they are always kept.
+void RenderGraph::pickAttachmentOps()
+{
+  for (std::size_t i = 0; i < passes.size(); ++i)
+  {
+    auto& pass = passes[i];
+    if (pass.culled)
+      continue;
+
+    auto pickOps = [&](Attachment& attachment, vk::AccessFlags2 read_access) {
+      auto& access = pass.images[attachment.access];
+      const auto& resource = images[static_cast<uint32_t>(access.image)];
+      const bool transient = resource.transientInfo.has_value();
+      if (attachment.clearColor.has_value() || attachment.clearDepthStencil.has_value())
+        attachment.loadOp = vk::AttachmentLoadOp::eClear;
+      else if (transient && resource.firstUse == i)
+        attachment.loadOp = vk::AttachmentLoadOp::eDontCare;
+      else
+        attachment.loadOp = vk::AttachmentLoadOp::eLoad;
+      attachment.storeOp = transient && resource.lastUse == i ? vk::AttachmentStoreOp::eDontCare
+                                                              : vk::AttachmentStoreOp::eStore;
+      if (attachment.loadOp == vk::AttachmentLoadOp::eLoad)
+        access.access |= read_access;
+    };
+
+    for (auto& attachment : pass.colorAttachments)
+      pickOps(attachment, vk::AccessFlagBits2::eColorAttachmentRead);
+    if (pass.depthAttachment.has_value())
+      pickOps(*pass.depthAttachment, vk::AccessFlagBits2::eDepthStencilAttachmentRead);
+  }
+}
+
+static vk::DeviceSize align_up(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// Images are placed from the largest to the smallest at the lowest offset where they do not
+// overlap with images alive at the same time, which is what most frame graphs do.
+void RenderGraph::placeTransientImages()
+{
+  const vk::Device device = get_context().getDevice();
+
+  struct Request
+  {
+    GraphImageId id;
+    vk::MemoryRequirements requirements;
+    vk::DeviceSize offset = 0;
+  };
+  std::vector<Request> requests;
+  for (std::size_t i = 0; i < images.size(); ++i)
+  {
+    auto& resource = images[i];
+    if (!resource.transientInfo.has_value())
+      continue;
+    resource.image = nullptr;
+    if (resource.firstUse == ~std::size_t{0})
+      continue;
+    requests.push_back(Request{
+      .id = static_cast<GraphImageId>(i),
+      .requirements = Image::getMemoryRequirements(device, *resource.transientInfo),
+    });
+  }
+  std::ranges::stable_sort(requests, std::greater{}, [](const Request& request) {
+    return request.requirements.size;
+  });
+
+  vk::DeviceSize heapSize = 0;
+  vk::DeviceSize heapAlignment = 1;
+  uint32_t memoryTypeBits = ~uint32_t{0};
+  std::vector<std::pair<vk::DeviceSize, vk::DeviceSize>> busy;
+  for (std::size_t i = 0; i < requests.size(); ++i)
+  {
+    auto& request = requests[i];
+    auto& resource = images[static_cast<uint32_t>(request.id)];
+    const auto& requirements = request.requirements;
+
+    busy.clear();
+    for (std::size_t j = 0; j < i; ++j)
+    {
+      const auto& other = images[static_cast<uint32_t>(requests[j].id)];
+      if (other.firstUse <= resource.lastUse && resource.firstUse <= other.lastUse)
+        busy.emplace_back(requests[j].offset, requests[j].offset + requests[j].requirements.size);
+    }
+    std::ranges::sort(busy);
+
+    vk::DeviceSize offset = 0;
+    for (const auto& [begin, end] : busy)
+    {
+      if (align_up(offset, requirements.alignment) + requirements.size <= begin)
+        break;
+      offset = std::max(offset, end);
+    }
+    request.offset = align_up(offset, requirements.alignment);
+
+    heapSize = std::max(heapSize, request.offset + requirements.size);
+    heapAlignment = std::max(heapAlignment, requirements.alignment);
+    memoryTypeBits &= requirements.memoryTypeBits;
+    stats.transientMemoryUnaliased += requirements.size;
+  }
+  ETNA_VERIFYF(
+    requests.empty() || memoryTypeBits != 0,
+    "Transient images of the render graph cannot share a single memory type");
+  stats.transientMemory = heapSize;
+
+  // Images used the memory before if they overlap with the image and died before it was born
+  for (const auto& request : requests)
+  {
+    auto& resource = images[static_cast<uint32_t>(request.id)];
+    for (const auto& other : requests)
+    {
+      const auto& previous = images[static_cast<uint32_t>(other.id)];
+      const bool overlaps = other.offset < request.offset + request.requirements.size &&
+        request.offset < other.offset + other.requirements.size;
+      if (overlaps && previous.lastUse < resource.firstUse)
+      {
+        resource.aliasStages |= previous.lastStages;
+        resource.aliasAccess |= previous.lastAccess;
+      }
+    }
+  }
+
+  std::vector<Placement> placements;
+  placements.reserve(requests.size());
+  for (const auto& request : requests)
+  {
+    const auto& info = *images[static_cast<uint32_t>(request.id)].transientInfo;
+    placements.push_back(Placement{
+      .extent = info.extent,
+      .format = info.format,
+      .usage = info.imageUsage,
+      .samples = info.samples,
+      .type = info.type,
+      .flags = info.flags,
+      .layers = info.layers,
+      .mipLevels = info.mipLevels,
+      .offset = request.offset,
+    });
+  }
+
+  // The GPU is done with the previous frame that used this memory
+  auto& memory = transientMemory.get();
+  const VmaAllocator allocator = get_context().getAllocator();
+  if (memory.placements != placements || memory.images.size() != requests.size())
+  {
+    memory.images.clear();
+    memory.placements.clear();
+    if (memory.size < heapSize || !(memoryTypeBits & (1u << memory.memoryType)))
+    {
+      if (memory.memory != nullptr)
+        vmaFreeMemory(allocator, memory.memory);
+      memory = TransientMemory{};
+
+      const VkMemoryRequirements heapRequirements{
+        .size = heapSize,
+        .alignment = heapAlignment,
+        .memoryTypeBits = memoryTypeBits,
+      };
+      const VmaAllocationCreateInfo allocInfo{
+        .flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT,
+        .usage = VMA_MEMORY_USAGE_UNKNOWN,
+        .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        .preferredFlags = 0,
+        .memoryTypeBits = 0,
+        .pool = nullptr,
+        .pUserData = nullptr,
+        .priority = 0.f,
+      };
+      VmaAllocationInfo allocationInfo;
+      auto retcode = vmaAllocateMemory(
+        allocator, &heapRequirements, &allocInfo, &memory.memory, &allocationInfo);
+      ETNA_VERIFYF(
+        retcode == VK_SUCCESS,
+        "Error {} occurred while trying to allocate {} bytes for transient images!",
+        vk::to_string(static_cast<vk::Result>(retcode)),
+        heapSize);
+      memory.size = heapSize;
+      memory.memoryType = allocationInfo.memoryType;
+    }
+
+    for (std::size_t i = 0; i < requests.size(); ++i)
+    {
+      const auto& resource = images[static_cast<uint32_t>(requests[i].id)];
+      auto info = *resource.transientInfo;
+      info.name = resource.name;
+      memory.images.emplace_back(allocator, memory.memory, requests[i].offset, info);
+    }
+    memory.placements = std::move(placements);
+  }
+
+  for (std::size_t i = 0; i < requests.size(); ++i)
+    images[static_cast<uint32_t>(requests[i].id)].image = &memory.images[i];
+}
+
+void RenderGraph::execute(vk::CommandBuffer cmd)
+{
+  ZoneScoped;
+
+  ETNA_VERIFYF(compiled, "RenderGraph::compile must be called before execute");
+  auto& tracker = get_context().getResourceTracker();
+
+  auto wholeImage = [](const Image& image) {
+    return vk::ImageSubresourceRange{
+      .aspectMask = image.getAspectMaskByFormat(),
+      .baseMipLevel = 0,
+      .levelCount = vk::RemainingMipLevels,
+      .baseArrayLayer = 0,
+      .layerCount = vk::RemainingArrayLayers,
+    };
+  };
+
+  for (auto& pass : passes)
+  {
+    if (pass.culled)
+      continue;
+
+    for (GraphImageId id : pass.firstUses)
+    {
+      const auto& resource = images[static_cast<uint32_t>(id)];
+      tracker.discardTextureContents(*resource.image, resource.aliasStages, resource.aliasAccess);
+    }
+    for (const auto& access : pass.images)
+    {
+      const Image& image = getImage(access.image);
+      tracker.setTextureState(
+        cmd, image, access.stages, access.access, access.layout, wholeImage(image));
+    }
+    for (const auto& access : pass.buffers)
+      tracker.setBufferState(
+        cmd, getBuffer(access.buffer), access.stages, access.access, 0, vk::WholeSize);
+    tracker.flushBarriers(cmd);
+
+    if (pass.colorAttachments.empty() && !pass.depthAttachment.has_value())
+    {
+      pass.execute(cmd, *this);
+      continue;
+    }
+
+    vk::Extent3D extent{};
+    std::vector<RenderTargetState::AttachmentParams> colorAttachments;
+    for (const auto& attachment : pass.colorAttachments)
+    {
+      const Image& image = getImage(pass.images[attachment.access].image);
+      extent = image.getExtent();
+      colorAttachments.push_back(RenderTargetState::AttachmentParams{
+        .image = image.get(),
+        .view = image.getView({}),
+        .loadOp = attachment.loadOp,
+        .storeOp = attachment.storeOp,
+        .clearColorValue = attachment.clearColor.value_or(vk::ClearColorValue{}),
+      });
+    }
+
+    RenderTargetState::AttachmentParams depthAttachment{};
+    RenderTargetState::AttachmentParams stencilAttachment{};
+    if (pass.depthAttachment.has_value())
+    {
+      const auto& attachment = *pass.depthAttachment;
+      const Image& image = getImage(pass.images[attachment.access].image);
+      extent = image.getExtent();
+      const RenderTargetState::AttachmentParams params{
+        .image = image.get(),
+        .view = image.getView({}),
+        .loadOp = attachment.loadOp,
+        .storeOp = attachment.storeOp,
+        .clearDepthStencilValue =
+          attachment.clearDepthStencil.value_or(vk::ClearDepthStencilValue{1.0f, 0}),
+      };
+      const vk::ImageAspectFlags aspects = image.getAspectMaskByFormat();
+      if (aspects & vk::ImageAspectFlagBits::eDepth)
+        depthAttachment = params;
+      if (aspects & vk::ImageAspectFlagBits::eStencil)
+        stencilAttachment = params;
+    }
+
+    // Barriers for the attachments were placed above already
+    RenderTargetState renderTarget(
+      cmd,
+      vk::Rect2D{.offset = {0, 0}, .extent = {extent.width, extent.height}},
+      colorAttachments,
+      depthAttachment,
+      stencilAttachment,
+      BarrierBehavior::eSuppressBarriers);
+    pass.execute(cmd, *this);
+  }
+}
+
+} // namespace etna
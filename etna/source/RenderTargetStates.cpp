@@ -9,6 +9,18 @@ namespace etna
 
 bool RenderTargetState::inScope = false;
 
+static vk::ImageSubresourceRange make_attachment_range(
+  vk::ImageAspectFlags aspect, const RenderTargetState::Subresources& subresources)
+{
+  return vk::ImageSubresourceRange{
+    .aspectMask = aspect,
+    .baseMipLevel = subresources.baseMip,
+    .levelCount = subresources.levelCount,
+    .baseArrayLayer = subresources.baseLayer,
+    .layerCount = subresources.layerCount,
+  };
+}
+
 RenderTargetState::RenderTargetState(
   vk::CommandBuffer cmd_buff,
   vk::Rect2D rect,
@@ -33,6 +45,9 @@ RenderTargetState::RenderTargetState(
   commandBuffer.setViewport(0, {viewport});
   commandBuffer.setScissor(0, {rect});
 
+  auto& tracker = etna::get_context().getResourceTracker();
+  const bool placeBarriers = etna::get_context().shouldGenerateBarriersWhen(behavior);
+
   std::vector<vk::RenderingAttachmentInfo> attachmentInfos(color_attachments.size());
   for (uint32_t i = 0; i < color_attachments.size(); ++i)
   {
@@ -42,16 +57,20 @@ RenderTargetState::RenderTargetState(
     attachmentInfos[i].storeOp = color_attachments[i].storeOp;
     attachmentInfos[i].clearValue = color_attachments[i].clearColorValue;
 
-    etna::get_context().getResourceTracker().setColorTarget(
-      commandBuffer, color_attachments[i].image, behavior);
+    if (placeBarriers)
+      tracker.setColorTarget(
+        commandBuffer,
+        color_attachments[i].image,
+        make_attachment_range(vk::ImageAspectFlagBits::eColor, color_attachments[i].subresources));
 
     if (color_attachments[i].resolveImage)
     {
-      etna::get_context().getResourceTracker().setResolveTarget(
-        commandBuffer,
-        color_attachments[i].resolveImage,
-        vk::ImageAspectFlagBits::eColor,
-        behavior);
+      if (placeBarriers)
+        tracker.setResolveTarget(
+          commandBuffer,
+          color_attachments[i].resolveImage,
+          make_attachment_range(
+            vk::ImageAspectFlagBits::eColor, color_attachments[i].resolveSubresources));
 
       attachmentInfos[i].resolveImageLayout = vk::ImageLayout::eGeneral;
       attachmentInfos[i].resolveImageView = color_attachments[i].resolveImageView;
@@ -86,61 +105,66 @@ RenderTargetState::RenderTargetState(
     ETNA_VERIFYF(
       depth_attachment.view == stencil_attachment.view,
       "depth and stencil attachments must be created from the same image");
-    etna::get_context().getResourceTracker().setDepthStencilTarget(
-      commandBuffer,
-      depth_attachment.image,
-      vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil,
-      behavior);
+    const vk::ImageAspectFlags aspects =
+      vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+    if (placeBarriers)
+      tracker.setDepthStencilTarget(
+        commandBuffer,
+        depth_attachment.image,
+        make_attachment_range(aspects, depth_attachment.subresources));
 
-    if (depth_attachment.resolveImage && stencil_attachment.resolveImage)
+    if (depth_attachment.resolveImage && stencil_attachment.resolveImage && placeBarriers)
     {
-      etna::get_context().getResourceTracker().setResolveTarget(
+      tracker.setResolveTarget(
         commandBuffer,
         depth_attachment.resolveImage,
-        vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil,
-        behavior);
+        make_attachment_range(aspects, depth_attachment.resolveSubresources));
     }
   }
   else
   {
-    if (depth_attachment.image)
+    if (depth_attachment.image && placeBarriers)
     {
-      etna::get_context().getResourceTracker().setDepthStencilTarget(
+      tracker.setDepthStencilTarget(
         commandBuffer,
         depth_attachment.image,
-        depth_attachment.imageAspect.value_or(vk::ImageAspectFlagBits::eDepth),
-        behavior);
+        make_attachment_range(
+          depth_attachment.imageAspect.value_or(vk::ImageAspectFlagBits::eDepth),
+          depth_attachment.subresources));
 
       if (depth_attachment.resolveImage)
       {
-        etna::get_context().getResourceTracker().setResolveTarget(
+        tracker.setResolveTarget(
           commandBuffer,
           depth_attachment.resolveImage,
-          depth_attachment.resolveImageAspect.value_or(vk::ImageAspectFlagBits::eDepth),
-          behavior);
+          make_attachment_range(
+            depth_attachment.resolveImageAspect.value_or(vk::ImageAspectFlagBits::eDepth),
+            depth_attachment.resolveSubresources));
       }
     }
 
-    if (stencil_attachment.image)
+    if (stencil_attachment.image && placeBarriers)
     {
-      etna::get_context().getResourceTracker().setDepthStencilTarget(
+      tracker.setDepthStencilTarget(
         commandBuffer,
         stencil_attachment.image,
-        stencil_attachment.imageAspect.value_or(vk::ImageAspectFlagBits::eStencil),
-        behavior);
+        make_attachment_range(
+          stencil_attachment.imageAspect.value_or(vk::ImageAspectFlagBits::eStencil),
+          stencil_attachment.subresources));
 
       if (stencil_attachment.resolveImage)
       {
-        etna::get_context().getResourceTracker().setResolveTarget(
+        tracker.setResolveTarget(
           commandBuffer,
           stencil_attachment.resolveImage,
-          stencil_attachment.resolveImageAspect.value_or(vk::ImageAspectFlagBits::eStencil),
-          behavior);
+          make_attachment_range(
+            stencil_attachment.resolveImageAspect.value_or(vk::ImageAspectFlagBits::eStencil),
+            stencil_attachment.resolveSubresources));
       }
     }
   }
 
-  etna::get_context().getResourceTracker().flushBarriers(commandBuffer);
+  tracker.flushBarriers(commandBuffer);
 
   vk::RenderingInfo renderInfo{
     .renderArea = rect,
@@ -0,0 +1,170 @@
+#include <etna/ShaderBundle.hpp>
+
+#include <fstream>
+#include <unordered_map>
+#include <fmt/std.h>
+
+#include <etna/Assert.hpp>
+
+#include "BinaryStream.hpp"
+#include "ContentHash.hpp"
+#include "ShaderBundleFile.hpp"
+#include "ShaderReflectionCache.hpp"
+
+
+namespace etna
+{
+
+std::string make_shader_bundle_key(
+  const std::filesystem::path& shader_path, const std::filesystem::path& root)
+{
+  auto relative = root.empty() ? shader_path : shader_path.lexically_relative(root);
+  // Paths that can not be made relative to the root are stored as is
+  if (relative.empty())
+    relative = shader_path;
+  return relative.lexically_normal().generic_string();
+}
+
+ShaderBundle::ShaderBundle(const std::filesystem::path& bundle_path, std::filesystem::path root_dir)
+  : file{bundle_path}
+  , root{std::move(root_dir)}
+{
+  ETNA_VERIFYF(!file.empty(), "Failed to open shader bundle {}", bundle_path);
+
+  BinaryReader reader{file.data()};
+  const auto magic = reader.read<std::uint64_t>();
+  const auto version = reader.read<std::uint32_t>();
+  const auto blobCount = reader.read<std::uint32_t>();
+  const auto pathCount = reader.read<std::uint32_t>();
+  const auto dataOffset = reader.read<std::uint64_t>();
+  ETNA_VERIFYF(
+    reader.ok() && magic == SHADER_BUNDLE_MAGIC && version == SHADER_BUNDLE_VERSION,
+    "Shader bundle {} is broken or was packed by an incompatible etna version",
+    bundle_path);
+  ETNA_VERIFYF(dataOffset <= file.data().size(), "Shader bundle {} is truncated", bundle_path);
+
+  const auto data = file.data().subspan(dataOffset);
+  auto dataRange = [&data](std::uint64_t offset, std::uint64_t size) {
+    if (offset > data.size() || size > data.size() - offset)
+      return std::span<std::byte const>{};
+    return data.subspan(offset, size);
+  };
+
+  modules.reserve(blobCount);
+  for (std::uint32_t i = 0; i < blobCount; i++)
+  {
+    const auto hash = reader.read<std::uint64_t>();
+    const auto codeOffset = reader.read<std::uint64_t>();
+    const auto codeSize = reader.read<std::uint64_t>();
+    const auto reflOffset = reader.read<std::uint64_t>();
+    const auto reflSize = reader.read<std::uint64_t>();
+
+    Module& mod = modules.emplace_back(Module{
+      .contentHash = hash,
+      .code = dataRange(codeOffset, codeSize),
+      .reflection = dataRange(reflOffset, reflSize),
+    });
+    ETNA_VERIFYF(
+      reader.ok() && !mod.code.empty() && mod.code.size() % 4 == 0 && codeOffset % 4 == 0 &&
+        mod.reflection.size() == reflSize,
+      "Shader bundle {} is broken",
+      bundle_path);
+  }
+
+  pathIndex.reserve(pathCount);
+  for (std::uint32_t i = 0; i < pathCount; i++)
+  {
+    auto key = reader.readString();
+    const auto blobIndex = reader.read<std::uint32_t>();
+    ETNA_VERIFYF(reader.ok() && blobIndex < blobCount, "Shader bundle {} is broken", bundle_path);
+    pathIndex.emplace(std::move(key), blobIndex);
+  }
+}
+
+const ShaderBundle::Module* ShaderBundle::find(const std::filesystem::path& shader_path) const
+{
+  auto it = pathIndex.find(make_shader_bundle_key(shader_path, root));
+  if (it == pathIndex.end())
+    return nullptr;
+  return &modules[it->second];
+}
+
+void pack_shader_bundle(
+  const std::filesystem::path& output,
+  std::span<std::filesystem::path const> shaders,
+  const std::filesystem::path& root)
+{
+  std::vector<std::byte> blobTable;
+  std::vector<std::byte> pathTable;
+  std::vector<std::byte> data;
+  BinaryWriter blobWriter{blobTable};
+  BinaryWriter pathWriter{pathTable};
+  BinaryWriter dataWriter{data};
+
+  std::unordered_map<std::uint64_t, std::uint32_t> blobByHash;
+  std::unordered_map<std::string, std::uint32_t> blobByPath;
+
+  for (const auto& shaderPath : shaders)
+  {
+    auto key = make_shader_bundle_key(shaderPath, root);
+    if (blobByPath.contains(key))
+      continue;
+
+    MappedFile spirv{shaderPath};
+    ETNA_VERIFYF(!spirv.empty(), "Failed to open file {}", shaderPath);
+    ETNA_VERIFYF(spirv.data().size() % 4 == 0, "SPIRV {} broken", shaderPath);
+
+    const auto hash = hash_content(spirv.data());
+    auto [it, inserted] =
+      blobByHash.try_emplace(hash, static_cast<std::uint32_t>(blobByHash.size()));
+    if (inserted)
+    {
+      const auto code = spirv.data();
+      const auto reflection = reflect_spirv(
+        std::span{reinterpret_cast<const char*>(code.data()), code.size()}, shaderPath);
+
+      // vkCreateShaderModule wants the code to be aligned to 4 bytes
+      data.resize((data.size() + 3) & ~std::size_t{3});
+      const auto codeOffset = static_cast<std::uint64_t>(data.size());
+      dataWriter.writeBytes(code);
+      const auto reflOffset = static_cast<std::uint64_t>(data.size());
+      serialize_reflection(dataWriter, reflection);
+
+      blobWriter.write(hash);
+      blobWriter.write(codeOffset);
+      blobWriter.write(static_cast<std::uint64_t>(code.size()));
+      blobWriter.write(reflOffset);
+      blobWriter.write(static_cast<std::uint64_t>(data.size() - reflOffset));
+    }
+
+    pathWriter.write(std::string_view{key});
+    pathWriter.write(it->second);
+    blobByPath.emplace(std::move(key), it->second);
+  }
+
+  std::vector<std::byte> contents;
+  BinaryWriter writer{contents};
+  writer.write(SHADER_BUNDLE_MAGIC);
+  writer.write(SHADER_BUNDLE_VERSION);
+  writer.write(static_cast<std::uint32_t>(blobByHash.size()));
+  writer.write(static_cast<std::uint32_t>(blobByPath.size()));
+
+  // Mapped files are page aligned, so aligning the data section keeps the code aligned too
+  const std::size_t tablesEnd =
+    contents.size() + sizeof(std::uint64_t) + blobTable.size() + pathTable.size();
+  const std::uint64_t dataOffset = (tablesEnd + 3) & ~std::size_t{3};
+  writer.write(dataOffset);
+  writer.writeBytes(blobTable);
+  writer.writeBytes(pathTable);
+  contents.resize(dataOffset);
+  writer.writeBytes(data);
+
+  std::ofstream out(output, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char*>(contents.data()), std::streamsize(contents.size()));
+  ETNA_VERIFYF(out.good(), "Failed to write shader bundle {}", output);
+
+  spdlog::info(
+    "Packed {} shaders ({} unique modules) into {}", blobByPath.size(), blobByHash.size(), output);
+}
+
+} // namespace etna
@@ -0,0 +1,66 @@
+#pragma once
+#ifndef ETNA_SHADER_BUNDLE_FILE_HPP_INCLUDED
+#define ETNA_SHADER_BUNDLE_FILE_HPP_INCLUDED
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "MappedFile.hpp"
+
+
+namespace etna
+{
+
+/**
+ * Layout of a shader bundle file, all integers are in native endianness:
+ *   header:      magic u64, version u32, blob count u32, path count u32, data offset u64
+ *   blob table:  content hash u64, code offset u64, code size u64,
+ *                reflection offset u64, reflection size u64
+ *   path table:  path string (u32 length + chars), blob index u32
+ *   data:        SPIR-V code (4-byte aligned) and serialized reflection
+ * Offsets in the blob table are relative to the start of the data section.
+ */
+inline constexpr std::uint64_t SHADER_BUNDLE_MAGIC = 0x4E4248534E544500ull; // "\0ETNSHBN"
+// Bump this whenever the format or the contents of ShaderModuleReflection change
+inline constexpr std::uint32_t SHADER_BUNDLE_VERSION = 3;
+
+// Paths are stored relative to the bundle root in a normalized, platform independent form
+std::string make_shader_bundle_key(
+  const std::filesystem::path& shader_path, const std::filesystem::path& root);
+
+/**
+ * Read-only view of a memory-mapped shader bundle. Module code and
+ * reflection are never copied out of the mapping until they are used.
+ */
+class ShaderBundle
+{
+public:
+  struct Module
+  {
+    std::uint64_t contentHash;
+    std::span<std::byte const> code;
+    std::span<std::byte const> reflection;
+  };
+
+  ShaderBundle(const std::filesystem::path& bundle_path, std::filesystem::path root);
+
+  const Module* find(const std::filesystem::path& shader_path) const;
+  std::size_t moduleCount() const { return modules.size(); }
+
+  ShaderBundle(const ShaderBundle&) = delete;
+  ShaderBundle& operator=(const ShaderBundle&) = delete;
+
+private:
+  MappedFile file;
+  std::filesystem::path root;
+  std::vector<Module> modules;
+  std::unordered_map<std::string, std::uint32_t> pathIndex;
+};
+
+} // namespace etna
+
+#endif // ETNA_SHADER_BUNDLE_FILE_HPP_INCLUDED
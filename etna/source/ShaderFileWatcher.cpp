@@ -0,0 +1,119 @@
+#include "ShaderFileWatcher.hpp"
+
+#include <unordered_set>
+#include <fmt/std.h>
+#include <spdlog/spdlog.h>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <cstring>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+
+namespace etna
+{
+
+#if defined(__linux__)
+
+static constexpr uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MOVED_TO;
+
+ShaderFileWatcher::ShaderFileWatcher()
+  : inotifyFd{inotify_init1(IN_NONBLOCK | IN_CLOEXEC)}
+{
+  if (inotifyFd < 0)
+    spdlog::warn("Failed to initialize inotify, shaders are not watched: {}", std::strerror(errno));
+}
+
+ShaderFileWatcher::~ShaderFileWatcher()
+{
+  if (inotifyFd >= 0)
+    close(inotifyFd);
+}
+
+void ShaderFileWatcher::watch(const std::filesystem::path& path)
+{
+  if (inotifyFd < 0)
+    return;
+
+  auto absolute = std::filesystem::absolute(path).lexically_normal();
+  auto dir = absolute.parent_path();
+  if (!dirWatches.contains(dir))
+  {
+    const int wd = inotify_add_watch(inotifyFd, dir.c_str(), WATCH_MASK);
+    if (wd < 0)
+    {
+      spdlog::warn("Failed to watch shader directory {}: {}", dir, std::strerror(errno));
+      return;
+    }
+    dirWatches.emplace(dir, wd);
+    watchedDirs.emplace(wd, dir);
+  }
+
+  files[std::move(absolute)].push_back(path);
+}
+
+std::vector<std::filesystem::path> ShaderFileWatcher::pollChanges()
+{
+  std::vector<std::filesystem::path> result;
+  if (inotifyFd < 0)
+    return result;
+
+  std::unordered_set<std::filesystem::path, PathHash> changed;
+  alignas(inotify_event) char buffer[4096];
+  for (;;)
+  {
+    const ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+    if (length <= 0)
+      break;
+
+    for (ssize_t offset = 0; offset < length;)
+    {
+      const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+      offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+      auto dir = watchedDirs.find(event->wd);
+      if (event->len == 0 || dir == watchedDirs.end())
+        continue;
+
+      auto file = files.find(dir->second / event->name);
+      if (file != files.end() && changed.insert(file->first).second)
+        result.insert(result.end(), file->second.begin(), file->second.end());
+    }
+  }
+
+  return result;
+}
+
+#else
+
+ShaderFileWatcher::ShaderFileWatcher() = default;
+ShaderFileWatcher::~ShaderFileWatcher() = default;
+
+void ShaderFileWatcher::watch(const std::filesystem::path& path)
+{
+  std::error_code ec;
+  auto time = std::filesystem::last_write_time(path, ec);
+  files.push_back(WatchedFile{path, ec ? std::filesystem::file_time_type{} : time});
+}
+
+std::vector<std::filesystem::path> ShaderFileWatcher::pollChanges()
+{
+  std::vector<std::filesystem::path> result;
+  for (auto& file : files)
+  {
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(file.path, ec);
+    // The file might be in the middle of being replaced, try again next time
+    if (ec || time == file.lastWriteTime)
+      continue;
+    file.lastWriteTime = time;
+    result.push_back(file.path);
+  }
+  return result;
+}
+
+#endif
+
+} // namespace etna
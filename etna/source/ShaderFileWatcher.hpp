@@ -0,0 +1,61 @@
+#pragma once
+#ifndef ETNA_SHADER_FILE_WATCHER_HPP_INCLUDED
+#define ETNA_SHADER_FILE_WATCHER_HPP_INCLUDED
+
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+
+
+namespace etna
+{
+
+/**
+ * Tracks modifications of shader files. On Linux inotify is used, so polling
+ * is a single non-blocking read. Elsewhere modification times of all watched
+ * files are compared on every poll.
+ */
+class ShaderFileWatcher
+{
+public:
+  ShaderFileWatcher();
+  ~ShaderFileWatcher();
+
+  void watch(const std::filesystem::path& path);
+
+  // Returns watched paths (exactly as they were passed to watch) modified since the last call
+  std::vector<std::filesystem::path> pollChanges();
+
+  ShaderFileWatcher(const ShaderFileWatcher&) = delete;
+  ShaderFileWatcher& operator=(const ShaderFileWatcher&) = delete;
+
+private:
+  struct PathHash
+  {
+    std::size_t operator()(const std::filesystem::path& p) const noexcept
+    {
+      return std::filesystem::hash_value(p);
+    }
+  };
+
+#if defined(__linux__)
+  int inotifyFd = -1;
+  // Directories are watched instead of files, as compilers and editors
+  // often replace files by renaming a temporary one over them.
+  std::unordered_map<std::filesystem::path, int, PathHash> dirWatches;
+  std::unordered_map<int, std::filesystem::path> watchedDirs;
+  // Absolute normalized path -> paths as they were registered
+  std::unordered_map<std::filesystem::path, std::vector<std::filesystem::path>, PathHash> files;
+#else
+  struct WatchedFile
+  {
+    std::filesystem::path path;
+    std::filesystem::file_time_type lastWriteTime;
+  };
+  std::vector<WatchedFile> files;
+#endif
+};
+
+} // namespace etna
+
+#endif // ETNA_SHADER_FILE_WATCHER_HPP_INCLUDED
@@ -0,0 +1,368 @@
+#include <etna/ShaderObjects.hpp>
+
+#include <algorithm>
+#include <utility>
+
+#include <etna/Assert.hpp>
+#include <etna/DeletionQueue.hpp>
+#include <etna/ShaderProgram.hpp>
+
+#include "SpecializationData.hpp"
+
+
+namespace etna
+{
+
+ShaderObjectProgram::ShaderObjectProgram(ShaderObjectProgram&& other) noexcept
+  : owner{other.owner}
+  , id{std::exchange(other.id, ShaderObjectProgramId::Invalid)}
+  , shaderProgramId{std::exchange(other.shaderProgramId, ShaderProgramId::Invalid)}
+{
+}
+
+ShaderObjectProgram& ShaderObjectProgram::operator=(ShaderObjectProgram&& other) noexcept
+{
+  if (&other == this)
+    return *this;
+
+  if (owner != nullptr)
+    owner->destroyProgram(id);
+  owner = other.owner;
+  id = std::exchange(other.id, ShaderObjectProgramId::Invalid);
+  shaderProgramId = std::exchange(other.shaderProgramId, ShaderProgramId::Invalid);
+
+  return *this;
+}
+
+ShaderObjectProgram::~ShaderObjectProgram()
+{
+  if (owner != nullptr)
+    owner->destroyProgram(id);
+}
+
+void ShaderObjectProgram::bind(vk::CommandBuffer cmd) const
+{
+  owner->bind(id, cmd);
+}
+
+vk::PipelineLayout ShaderObjectProgram::getVkPipelineLayout() const
+{
+  return owner->shaderManager.getProgramLayout(shaderProgramId);
+}
+
+void ShaderObjectProgram::setGraphicsState(
+  vk::CommandBuffer cmd, const GraphicsPipeline::CreateInfo& state) const
+{
+  owner->setGraphicsState(id, cmd, state);
+}
+
+// Position of the stage in a graphics pipeline, unlike its bit which puts task and mesh last
+static uint32_t pipeline_order(vk::ShaderStageFlagBits stage)
+{
+  switch (stage)
+  {
+  case vk::ShaderStageFlagBits::eTaskEXT:
+    return 0;
+  case vk::ShaderStageFlagBits::eMeshEXT:
+    return 1;
+  default:
+    return static_cast<uint32_t>(stage) << 2;
+  }
+}
+
+// Stages that may follow the given one in a graphics pipeline
+static vk::ShaderStageFlags possible_next_stages(vk::ShaderStageFlagBits stage)
+{
+  switch (stage)
+  {
+  case vk::ShaderStageFlagBits::eVertex:
+    return vk::ShaderStageFlagBits::eTessellationControl | vk::ShaderStageFlagBits::eGeometry |
+      vk::ShaderStageFlagBits::eFragment;
+  case vk::ShaderStageFlagBits::eTessellationControl:
+    return vk::ShaderStageFlagBits::eTessellationEvaluation;
+  case vk::ShaderStageFlagBits::eTessellationEvaluation:
+    return vk::ShaderStageFlagBits::eGeometry | vk::ShaderStageFlagBits::eFragment;
+  case vk::ShaderStageFlagBits::eGeometry:
+    return vk::ShaderStageFlagBits::eFragment;
+  case vk::ShaderStageFlagBits::eTaskEXT:
+    return vk::ShaderStageFlagBits::eMeshEXT;
+  case vk::ShaderStageFlagBits::eMeshEXT:
+    return vk::ShaderStageFlagBits::eFragment;
+  default:
+    return {};
+  }
+}
+
+ShaderObjectManager::ShaderObjectManager(
+  vk::Device dev,
+  ShaderProgramManager& shader_manager,
+  vk::ShaderStageFlags graphics_stages,
+  const vk::PhysicalDeviceFeatures& enabled_features)
+  : device{dev}
+  , shaderManager{shader_manager}
+  , graphicsStages{graphics_stages}
+  , features{enabled_features}
+{
+}
+
+ShaderObjectProgram ShaderObjectManager::createProgram(
+  const char* shader_program_name, ShaderObjectProgram::CreateInfo info)
+{
+  const ShaderObjectProgramId id = static_cast<ShaderObjectProgramId>(programIdCounter++);
+  const ShaderProgramId progId = shaderManager.getProgram(shader_program_name);
+
+  validate_spec_constants(shaderManager.getProgramInfo(progId), info.specConstants);
+
+  Parameters params{progId, std::move(info)};
+  shaders.emplace(id, createShaders(params));
+  parameters.emplace(id, std::move(params));
+
+  return ShaderObjectProgram(this, id, progId);
+}
+
+ShaderObjectManager::Shaders ShaderObjectManager::createShaders(const Parameters& params) const
+{
+  std::vector<vk::ShaderCreateInfoEXT> infos =
+    shaderManager.getShaderObjectInfos(params.shaderProgram);
+  const std::vector<vk::DescriptorSetLayout> setLayouts =
+    shaderManager.getDescriptorLayouts(params.shaderProgram);
+  const vk::PushConstantRange pushConst =
+    shaderManager.getProgramInfo(params.shaderProgram).getPushConst();
+  SpecializationData specialization{params.info.specConstants};
+
+  // Stages have to be listed in pipeline order to find out which stage follows which
+  std::ranges::sort(
+    infos, {}, [](const vk::ShaderCreateInfoEXT& info) { return pipeline_order(info.stage); });
+
+  const bool isCompute = infos.size() == 1 && infos[0].stage == vk::ShaderStageFlagBits::eCompute;
+  const bool link = params.info.linkStages && infos.size() > 1;
+  const bool hasTaskShader = std::ranges::any_of(infos, [](const vk::ShaderCreateInfoEXT& info) {
+    return info.stage == vk::ShaderStageFlagBits::eTaskEXT;
+  });
+
+  for (std::size_t i = 0; i < infos.size(); ++i)
+  {
+    auto& info = infos[i];
+    if (link)
+    {
+      info.flags = vk::ShaderCreateFlagBitsEXT::eLinkStage;
+      info.nextStage = i + 1 < infos.size() ? vk::ShaderStageFlags{infos[i + 1].stage}
+                                            : vk::ShaderStageFlags{};
+    }
+    else
+    {
+      info.nextStage = possible_next_stages(info.stage) & graphicsStages;
+    }
+    if (info.stage == vk::ShaderStageFlagBits::eMeshEXT && !hasTaskShader)
+      info.flags |= vk::ShaderCreateFlagBitsEXT::eNoTaskShader;
+    info.setSetLayouts(setLayouts);
+    if (pushConst.size > 0)
+      info.setPushConstantRanges(pushConst);
+    specialization.apply(info);
+  }
+
+  auto created = unwrap_vk_result(device.createShadersEXT(infos));
+
+  Shaders result;
+  for (std::size_t i = 0; i < infos.size(); ++i)
+  {
+    result.stages.push_back(infos[i].stage);
+    result.handles.push_back(created[i]);
+    result.owned.emplace_back(created[i], device);
+    result.programStages |= infos[i].stage;
+  }
+
+  // Every graphics stage that the device supports has to have something bound to it
+  if (!isCompute)
+  {
+    for (auto stage :
+         {vk::ShaderStageFlagBits::eVertex,
+          vk::ShaderStageFlagBits::eTessellationControl,
+          vk::ShaderStageFlagBits::eTessellationEvaluation,
+          vk::ShaderStageFlagBits::eGeometry,
+          vk::ShaderStageFlagBits::eTaskEXT,
+          vk::ShaderStageFlagBits::eMeshEXT,
+          vk::ShaderStageFlagBits::eFragment})
+    {
+      const bool used = std::ranges::find(result.stages, stage) != result.stages.end();
+      if (used || !(stage & graphicsStages))
+        continue;
+      result.stages.push_back(stage);
+      result.handles.push_back(vk::ShaderEXT{});
+    }
+  }
+
+  return result;
+}
+
+void ShaderObjectManager::bind(ShaderObjectProgramId id, vk::CommandBuffer cmd) const
+{
+  ETNA_VERIFY(id != ShaderObjectProgramId::Invalid);
+  const auto& bound = shaders.find(id)->second;
+  cmd.bindShadersEXT(bound.stages, bound.handles);
+}
+
+void ShaderObjectManager::recreate()
+{
+  shaders.clear();
+  for (const auto& [id, params] : parameters)
+    shaders.emplace(id, createShaders(params));
+}
+
+void ShaderObjectManager::recreate(
+  std::span<ShaderProgramId const> programs, DeletionQueue& deletion_queue)
+{
+  for (const auto& [id, params] : parameters)
+  {
+    if (std::ranges::find(programs, params.shaderProgram) == programs.end())
+      continue;
+
+    auto& slot = shaders.at(id);
+    for (auto& shader : slot.owned)
+      deletion_queue.retire(std::move(shader));
+    slot = createShaders(params);
+  }
+}
+
+void ShaderObjectManager::destroyProgram(ShaderObjectProgramId id)
+{
+  if (id == ShaderObjectProgramId::Invalid)
+    return;
+
+  shaders.erase(id);
+  parameters.erase(id);
+}
+
+static void set_vertex_input(vk::CommandBuffer cmd, const VertexShaderInputDescription& input)
+{
+  std::vector<vk::VertexInputBindingDescription2EXT> vertexBindings;
+  std::vector<vk::VertexInputAttributeDescription2EXT> vertexAttributes;
+  for (uint32_t i = 0; i < input.bindings.size(); i++)
+  {
+    const auto& bindingDesc = input.bindings[i];
+    if (!bindingDesc.has_value())
+      continue;
+
+    vertexBindings.push_back(vk::VertexInputBindingDescription2EXT{
+      .binding = i,
+      .stride = bindingDesc->byteStreamDescription.stride,
+      .inputRate = bindingDesc->inputRate,
+      .divisor = 1,
+    });
+
+    for (uint32_t j = 0; j < bindingDesc->attributeMapping.size(); ++j)
+    {
+      const auto& attr =
+        bindingDesc->byteStreamDescription.attributes[bindingDesc->attributeMapping[j]];
+      vertexAttributes.push_back(vk::VertexInputAttributeDescription2EXT{
+        .location = j,
+        .binding = i,
+        .format = attr.format,
+        .offset = attr.offset,
+      });
+    }
+  }
+  cmd.setVertexInputEXT(vertexBindings, vertexAttributes);
+}
+
+void ShaderObjectManager::setGraphicsState(
+  ShaderObjectProgramId id, vk::CommandBuffer cmd, const GraphicsPipeline::CreateInfo& state) const
+{
+  ETNA_VERIFY(id != ShaderObjectProgramId::Invalid);
+  const vk::ShaderStageFlags stages = shaders.find(id)->second.programStages;
+
+  // Vertex input and assembly state is only read when a vertex shader is bound
+  if (stages & vk::ShaderStageFlagBits::eVertex)
+  {
+    set_vertex_input(cmd, state.vertexShaderInput);
+    const auto& assembly = state.inputAssemblyConfig;
+    cmd.setPrimitiveTopology(assembly.topology);
+    cmd.setPrimitiveRestartEnable(assembly.primitiveRestartEnable);
+  }
+  if (stages & vk::ShaderStageFlagBits::eTessellationControl)
+    cmd.setPatchControlPointsEXT(state.tessellationConfig.patchControlPoints);
+  if (stages & vk::ShaderStageFlagBits::eTessellationEvaluation)
+    cmd.setTessellationDomainOriginEXT(vk::TessellationDomainOrigin::eUpperLeft);
+
+  const auto& raster = state.rasterizationConfig;
+  cmd.setRasterizerDiscardEnable(raster.rasterizerDiscardEnable);
+  if (features.depthClamp)
+    cmd.setDepthClampEnableEXT(raster.depthClampEnable);
+  cmd.setPolygonModeEXT(raster.polygonMode);
+  cmd.setCullMode(raster.cullMode);
+  cmd.setFrontFace(raster.frontFace);
+  cmd.setLineWidth(raster.lineWidth);
+  cmd.setDepthBiasEnable(raster.depthBiasEnable);
+  cmd.setDepthBias(
+    raster.depthBiasConstantFactor, raster.depthBiasClamp, raster.depthBiasSlopeFactor);
+  // Nothing past rasterization is read when it is discarded
+  if (raster.rasterizerDiscardEnable)
+    return;
+
+  const auto& multisample = state.multisampleConfig;
+  const auto samples = static_cast<uint32_t>(multisample.rasterizationSamples);
+  std::vector<vk::SampleMask> sampleMask((samples + 31) / 32, ~vk::SampleMask{0});
+  if (multisample.pSampleMask != nullptr)
+    std::copy_n(multisample.pSampleMask, sampleMask.size(), sampleMask.begin());
+  cmd.setRasterizationSamplesEXT(multisample.rasterizationSamples);
+  cmd.setSampleMaskEXT(multisample.rasterizationSamples, sampleMask);
+  cmd.setAlphaToCoverageEnableEXT(multisample.alphaToCoverageEnable);
+  if (features.alphaToOne)
+    cmd.setAlphaToOneEnableEXT(multisample.alphaToOneEnable);
+
+  const auto& depth = state.depthConfig;
+  cmd.setDepthTestEnable(depth.depthTestEnable);
+  cmd.setDepthWriteEnable(depth.depthWriteEnable);
+  cmd.setDepthCompareOp(depth.depthCompareOp);
+  if (features.depthBounds)
+  {
+    cmd.setDepthBoundsTestEnable(depth.depthBoundsTestEnable);
+    cmd.setDepthBounds(depth.minDepthBounds, depth.maxDepthBounds);
+  }
+  cmd.setStencilTestEnable(depth.stencilTestEnable);
+  for (auto [face, ops] :
+       {std::pair{vk::StencilFaceFlagBits::eFront, depth.front},
+        std::pair{vk::StencilFaceFlagBits::eBack, depth.back}})
+  {
+    cmd.setStencilOp(face, ops.failOp, ops.passOp, ops.depthFailOp, ops.compareOp);
+    cmd.setStencilCompareMask(face, ops.compareMask);
+    cmd.setStencilWriteMask(face, ops.writeMask);
+    cmd.setStencilReference(face, ops.reference);
+  }
+
+  // Blending state is only read when a fragment shader is bound
+  if (!(stages & vk::ShaderStageFlagBits::eFragment))
+    return;
+  const auto& blending = state.blendingConfig;
+  if (features.logicOp)
+  {
+    cmd.setLogicOpEnableEXT(blending.logicOpEnable);
+    if (blending.logicOpEnable)
+      cmd.setLogicOpEXT(blending.logicOp);
+  }
+  cmd.setBlendConstants(blending.blendConstants.data());
+  if (!blending.attachments.empty())
+  {
+    std::vector<vk::Bool32> blendEnables;
+    std::vector<vk::ColorBlendEquationEXT> equations;
+    std::vector<vk::ColorComponentFlags> writeMasks;
+    for (const auto& attachment : blending.attachments)
+    {
+      blendEnables.push_back(attachment.blendEnable);
+      equations.push_back(vk::ColorBlendEquationEXT{
+        .srcColorBlendFactor = attachment.srcColorBlendFactor,
+        .dstColorBlendFactor = attachment.dstColorBlendFactor,
+        .colorBlendOp = attachment.colorBlendOp,
+        .srcAlphaBlendFactor = attachment.srcAlphaBlendFactor,
+        .dstAlphaBlendFactor = attachment.dstAlphaBlendFactor,
+        .alphaBlendOp = attachment.alphaBlendOp,
+      });
+      writeMasks.push_back(attachment.colorWriteMask);
+    }
+    cmd.setColorBlendEnableEXT(0, blendEnables);
+    cmd.setColorBlendEquationEXT(0, equations);
+    cmd.setColorWriteMaskEXT(0, writeMasks);
+  }
+}
+
+} // namespace etna
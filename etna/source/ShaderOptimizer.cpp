@@ -0,0 +1,127 @@
+#include "ShaderOptimizer.hpp"
+
+#include <array>
+#include <cstring>
+#include <fmt/ranges.h>
+#include <fmt/std.h>
+#include <spdlog/spdlog.h>
+#include <tracy/Tracy.hpp>
+
+#if ETNA_SPIRV_OPTIMIZER
+#include <spirv-tools/optimizer.hpp>
+#endif
+
+#include <etna/Assert.hpp>
+#include <etna/ShaderProgram.hpp>
+
+#include "ContentHash.hpp"
+
+
+namespace etna
+{
+
+static constexpr std::uint64_t CACHE_MAGIC = 0x4F56495053414E54ull; // "TNASPIVO"
+static constexpr std::uint32_t CACHE_VERSION = 1;
+
+std::vector<std::string> default_spirv_optimizer_passes()
+{
+  // Roughly spirv-opt -O without the passes that take long but rarely help
+  // drivers, which run their own optimizers anyway. Debug info is stripped,
+  // etna reflects the original code, so resource names are not lost.
+  return {
+    "--inline-entry-points-exhaustive",
+    "--eliminate-dead-functions",
+    "--private-to-local",
+    "--scalar-replacement=100",
+    "--eliminate-local-single-block",
+    "--eliminate-local-single-store",
+    "--eliminate-local-multi-store",
+    "--ccp",
+    "--simplify-instructions",
+    "--eliminate-dead-branches",
+    "--merge-blocks",
+    "--eliminate-dead-code-aggressive",
+    "--strip-debug",
+  };
+}
+
+ShaderOptimizer::ShaderOptimizer(
+  std::vector<std::string> in_passes, std::optional<std::filesystem::path> cache_path)
+  : passes{std::move(in_passes)}
+{
+  std::string joined;
+  for (const auto& pass : passes)
+    joined.append(pass).push_back('\n');
+  passesHash = hash_content(std::as_bytes(std::span{joined}));
+
+#if ETNA_SPIRV_OPTIMIZER
+  spvtools::Optimizer optimizer{SPV_ENV_VULKAN_1_3};
+  ETNA_VERIFYF(
+    optimizer.RegisterPassesFromFlags(passes),
+    "Invalid SPIR-V optimizer passes: {}",
+    fmt::join(passes, " "));
+
+  if (cache_path.has_value())
+    cache = std::make_unique<BlobCache>(
+      std::move(*cache_path), CACHE_MAGIC, CACHE_VERSION, "optimized shader cache");
+#else
+  (void)cache_path;
+  spdlog::warn("etna was built without ETNA_SPIRV_OPTIMIZER, shaders will not be optimized");
+#endif
+}
+
+std::vector<uint32_t> ShaderOptimizer::optimize(
+  std::span<uint32_t const> code,
+  [[maybe_unused]] std::uint64_t content_hash,
+  [[maybe_unused]] const std::filesystem::path& path)
+{
+#if ETNA_SPIRV_OPTIMIZER
+  const std::array<std::uint64_t, 2> keyParts{content_hash, passesHash};
+  const std::uint64_t key = hash_content(std::as_bytes(std::span{keyParts}));
+
+  if (cache != nullptr)
+  {
+    if (auto cached = cache->find(key); cached.has_value() && cached->size() % 4 == 0)
+    {
+      std::vector<uint32_t> result(cached->size() / sizeof(uint32_t));
+      std::memcpy(result.data(), cached->data(), cached->size());
+      return result;
+    }
+  }
+
+  ZoneScopedN("optimizeSpirv");
+
+  spvtools::Optimizer optimizer{SPV_ENV_VULKAN_1_3};
+  optimizer.SetMessageConsumer(
+    [&path](spv_message_level_t level, const char*, const spv_position_t&, const char* message) {
+      if (level <= SPV_MSG_ERROR)
+        spdlog::warn("SPIR-V optimizer, {}: {}", path, message);
+    });
+  optimizer.RegisterPassesFromFlags(passes);
+
+  std::vector<uint32_t> result;
+  if (!optimizer.Run(code.data(), code.size(), &result))
+  {
+    spdlog::warn("Failed to optimize {}, using it as is", path);
+    return {code.begin(), code.end()};
+  }
+
+  if (cache != nullptr)
+  {
+    const auto bytes = std::as_bytes(std::span{result});
+    cache->insert(key, std::vector<std::byte>{bytes.begin(), bytes.end()});
+  }
+
+  return result;
+#else
+  return {code.begin(), code.end()};
+#endif
+}
+
+void ShaderOptimizer::save()
+{
+  if (cache != nullptr)
+    cache->save();
+}
+
+} // namespace etna
@@ -0,0 +1,49 @@
+#pragma once
+#ifndef ETNA_SHADER_OPTIMIZER_HPP_INCLUDED
+#define ETNA_SHADER_OPTIMIZER_HPP_INCLUDED
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "BlobCache.hpp"
+
+
+namespace etna
+{
+
+/**
+ * Runs spirv-opt passes over shader modules before they are handed to the driver.
+ * Results are cached on disk keyed by the module contents and the pass list, so
+ * the optimizer only runs for modules that changed since the previous run.
+ * optimize() may be called concurrently from shader loading threads.
+ */
+class ShaderOptimizer
+{
+public:
+  // passes use spirv-opt command line syntax, e.g. "--eliminate-dead-code-aggressive"
+  ShaderOptimizer(
+    std::vector<std::string> passes, std::optional<std::filesystem::path> cache_path);
+
+  // Returns the code unchanged if optimization fails or is not compiled in
+  std::vector<uint32_t> optimize(
+    std::span<uint32_t const> code, std::uint64_t content_hash, const std::filesystem::path& path);
+
+  void save();
+
+  ShaderOptimizer(const ShaderOptimizer&) = delete;
+  ShaderOptimizer& operator=(const ShaderOptimizer&) = delete;
+
+private:
+  std::vector<std::string> passes;
+  std::uint64_t passesHash;
+  std::unique_ptr<BlobCache> cache;
+};
+
+} // namespace etna
+
+#endif // ETNA_SHADER_OPTIMIZER_HPP_INCLUDED
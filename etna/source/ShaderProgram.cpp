@@ -1,19 +1,33 @@
 #include <etna/ShaderProgram.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
 #include <spirv_reflect.h>
 #include <fmt/std.h>
+#include <tracy/Tracy.hpp>
 
 #include <etna/GlobalContext.hpp>
+#include <etna/DeletionQueue.hpp>
+
+#include "ContentHash.hpp"
+#include "ShaderBundleFile.hpp"
+#include "ShaderFileWatcher.hpp"
+#include "ShaderOptimizer.hpp"
+#include "ShaderReflectionCache.hpp"
 
 
 namespace etna
 {
 
-ShaderModule::ShaderModule(vk::Device device, std::filesystem::path shader_path)
+ShaderModule::ShaderModule(const ShaderLoadContext& ctx, std::filesystem::path shader_path)
   : path{shader_path}
 {
-  reload(device);
+  reload(ctx);
 }
 
 static std::vector<char> read_file(std::filesystem::path filename)
@@ -48,19 +62,185 @@ struct SpvModDeleter
 #define ETNA_SPV_REFLECT_VERIFY(res, path)                                                         \
   ETNA_VERIFYF((res) == SPV_REFLECT_RESULT_SUCCESS, "SPIR-V parse error in {}", (path))
 
-void ShaderModule::reload(vk::Device device)
+static std::string_view get_binding_name(const SpvReflectDescriptorBinding& binding)
 {
-  vkModule = {};
+  if (binding.name != nullptr && *binding.name != '\0')
+    return binding.name;
+  // Anonymous uniform/storage blocks are only known by their block type name
+  if (binding.type_description != nullptr && binding.type_description->type_name != nullptr)
+    return binding.type_description->type_name;
+  return {};
+}
 
-  auto code = read_file(path);
-  vk::ShaderModuleCreateInfo info{};
-  info.setPCode(reinterpret_cast<const uint32_t*>(code.data()));
-  info.setCodeSize(code.size());
+static void collect_push_const_members(
+  const SpvReflectBlockVariable& block,
+  const std::string& prefix,
+  std::vector<std::pair<std::string, PushConstantMemberInfo>>& out)
+{
+  for (uint32_t i = 0; i < block.member_count; i++)
+  {
+    const auto& member = block.members[i];
+    if (member.name == nullptr || *member.name == '\0')
+      continue;
 
-  if (code.size() % 4 != 0)
-    ETNA_PANIC("SPIRV {} broken", path);
+    std::string name = prefix.empty() ? member.name : prefix + "." + member.name;
+    collect_push_const_members(member, name, out);
+    out.emplace_back(std::move(name), PushConstantMemberInfo{member.absolute_offset, member.size});
+  }
+}
+
+// SPIRV-Reflect does not know about specialization constants and LocalSizeId in all
+// SDK versions we support, but finding them only requires a single pass over the code.
+static void reflect_constants(std::span<char const> code, ShaderModuleReflection& result)
+{
+  constexpr uint32_t OP_NAME = 5;
+  constexpr uint32_t OP_EXECUTION_MODE = 16;
+  constexpr uint32_t OP_TYPE_BOOL = 20;
+  constexpr uint32_t OP_TYPE_INT = 21;
+  constexpr uint32_t OP_TYPE_FLOAT = 22;
+  constexpr uint32_t OP_CONSTANT = 43;
+  constexpr uint32_t OP_CONSTANT_COMPOSITE = 44;
+  constexpr uint32_t OP_SPEC_CONSTANT_TRUE = 48;
+  constexpr uint32_t OP_SPEC_CONSTANT_FALSE = 49;
+  constexpr uint32_t OP_SPEC_CONSTANT = 50;
+  constexpr uint32_t OP_SPEC_CONSTANT_COMPOSITE = 51;
+  constexpr uint32_t OP_DECORATE = 71;
+  constexpr uint32_t OP_EXECUTION_MODE_ID = 331;
+  constexpr uint32_t DECORATION_SPEC_ID = 1;
+  constexpr uint32_t DECORATION_BUILT_IN = 11;
+  constexpr uint32_t BUILT_IN_WORKGROUP_SIZE = 25;
+  constexpr uint32_t EXECUTION_MODE_LOCAL_SIZE = 17;
+  constexpr uint32_t EXECUTION_MODE_LOCAL_SIZE_ID = 38;
+  constexpr std::size_t HEADER_WORDS = 5;
+
+  std::vector<uint32_t> words(code.size() / sizeof(uint32_t));
+  std::memcpy(words.data(), code.data(), words.size() * sizeof(uint32_t));
+
+  std::unordered_map<uint32_t, SpecConstantType> types;
+  std::unordered_map<uint32_t, uint32_t> specIds;
+  std::unordered_map<uint32_t, std::string> names;
+  struct Constant
+  {
+    uint32_t resultId;
+    uint32_t typeId;
+    uint32_t value;
+  };
+  std::vector<Constant> constants;
+  // Values of 32-bit scalar constants and defaults of specialization constants
+  std::unordered_map<uint32_t, uint32_t> constantValues;
+  std::unordered_map<uint32_t, std::array<uint32_t, 3>> composites;
+  std::optional<uint32_t> workgroupSizeBuiltIn;
+  std::optional<std::array<uint32_t, 3>> localSizeIds;
+
+  for (std::size_t i = HEADER_WORDS; i < words.size();)
+  {
+    const uint32_t opcode = words[i] & 0xFFFFu;
+    const uint32_t wordCount = words[i] >> 16;
+    if (wordCount == 0 || i + wordCount > words.size())
+      break;
+    const std::span<uint32_t const> ins{words.data() + i, wordCount};
+    i += wordCount;
+
+    switch (opcode)
+    {
+    case OP_NAME:
+      if (wordCount > 2)
+      {
+        const std::string_view chars{
+          reinterpret_cast<const char*>(ins.data() + 2), (wordCount - 2) * sizeof(uint32_t)};
+        names[ins[1]] = std::string{chars.substr(0, chars.find('\0'))};
+      }
+      break;
+    case OP_EXECUTION_MODE:
+      if (wordCount > 5 && ins[2] == EXECUTION_MODE_LOCAL_SIZE)
+        result.workgroupSize.size = {ins[3], ins[4], ins[5]};
+      break;
+    case OP_EXECUTION_MODE_ID:
+      if (wordCount > 5 && ins[2] == EXECUTION_MODE_LOCAL_SIZE_ID)
+        localSizeIds = {ins[3], ins[4], ins[5]};
+      break;
+    case OP_DECORATE:
+      if (wordCount > 3 && ins[2] == DECORATION_SPEC_ID)
+        specIds[ins[1]] = ins[3];
+      else if (wordCount > 3 && ins[2] == DECORATION_BUILT_IN && ins[3] == BUILT_IN_WORKGROUP_SIZE)
+        workgroupSizeBuiltIn = ins[1];
+      break;
+    case OP_TYPE_BOOL:
+      types[ins[1]] = SpecConstantType::eBool;
+      break;
+    case OP_TYPE_INT:
+      if (wordCount > 3 && ins[2] == 32)
+        types[ins[1]] = ins[3] != 0 ? SpecConstantType::eInt32 : SpecConstantType::eUint32;
+      break;
+    case OP_TYPE_FLOAT:
+      if (wordCount > 2 && ins[2] == 32)
+        types[ins[1]] = SpecConstantType::eFloat32;
+      break;
+    case OP_CONSTANT:
+      if (wordCount > 3)
+        constantValues[ins[2]] = ins[3];
+      break;
+    case OP_CONSTANT_COMPOSITE:
+    case OP_SPEC_CONSTANT_COMPOSITE:
+      if (wordCount == 6)
+        composites[ins[2]] = {ins[3], ins[4], ins[5]};
+      break;
+    case OP_SPEC_CONSTANT_TRUE:
+    case OP_SPEC_CONSTANT_FALSE:
+      constants.push_back({ins[2], ins[1], opcode == OP_SPEC_CONSTANT_TRUE ? 1u : 0u});
+      break;
+    case OP_SPEC_CONSTANT:
+      if (wordCount > 3)
+      {
+        constants.push_back({ins[2], ins[1], ins[3]});
+        constantValues[ins[2]] = ins[3];
+      }
+      break;
+    default:
+      break;
+    }
+  }
 
-  vkModule = unwrap_vk_result(device.createShaderModuleUnique(info));
+  for (const auto& constant : constants)
+  {
+    auto specId = specIds.find(constant.resultId);
+    auto type = types.find(constant.typeId);
+    // Constants without SpecId are not externally settable, 64-bit ones are not supported
+    if (specId == specIds.end() || type == types.end())
+      continue;
+
+    auto name = names.find(constant.resultId);
+    result.specConstants.emplace_back(
+      name != names.end() ? name->second : std::string{},
+      SpecConstantInfo{
+        .id = specId->second,
+        .type = type->second,
+        .defaultValue = constant.value,
+      });
+  }
+
+  // The WorkgroupSize built-in takes precedence over the LocalSize execution modes
+  if (workgroupSizeBuiltIn.has_value())
+    if (auto it = composites.find(*workgroupSizeBuiltIn); it != composites.end())
+      localSizeIds = it->second;
+
+  if (localSizeIds.has_value())
+  {
+    for (std::size_t dim = 0; dim < 3; ++dim)
+    {
+      const uint32_t id = (*localSizeIds)[dim];
+      if (auto value = constantValues.find(id); value != constantValues.end())
+        result.workgroupSize.size[dim] = value->second;
+      if (auto specId = specIds.find(id); specId != specIds.end())
+        result.workgroupSize.specConstantIds[dim] = specId->second;
+    }
+  }
+}
+
+ShaderModuleReflection reflect_spirv(
+  std::span<char const> code, const std::filesystem::path& path)
+{
+  ShaderModuleReflection result;
 
   std::unique_ptr<SpvReflectShaderModule, SpvModDeleter> spvModule;
   spvModule.reset(new SpvReflectShaderModule{});
@@ -68,10 +248,8 @@ void ShaderModule::reload(vk::Device device)
   ETNA_SPV_REFLECT_VERIFY(
     spvReflectCreateShaderModule(code.size(), code.data(), spvModule.get()), path);
 
-  stage = static_cast<vk::ShaderStageFlagBits>(spvModule->shader_stage);
-  entryPoint = spvModule->entry_point_name;
-
-  resources.clear();
+  result.stage = static_cast<vk::ShaderStageFlagBits>(spvModule->shader_stage);
+  result.entryPoint = spvModule->entry_point_name;
 
   uint32_t count = 0;
   ETNA_SPV_REFLECT_VERIFY(
@@ -81,14 +259,33 @@ void ShaderModule::reload(vk::Device device)
   ETNA_SPV_REFLECT_VERIFY(
     spvReflectEnumerateDescriptorSets(spvModule.get(), &count, sets.data()), path);
 
-  resources.reserve(sets.size());
+  result.resources.reserve(sets.size());
 
   for (auto pSet : sets)
   {
     DescriptorSetInfo dsInfo;
     dsInfo.clear();
-    dsInfo.parseShader(stage, *pSet);
-    resources.push_back({pSet->set, dsInfo});
+    dsInfo.parseShader(result.stage, *pSet);
+
+    for (uint32_t i = 0; i < pSet->binding_count; i++)
+    {
+      const auto& spvBinding = *pSet->bindings[i];
+      auto name = get_binding_name(spvBinding);
+      if (name.empty())
+        continue;
+
+      const auto& binding = dsInfo.getBinding(spvBinding.binding);
+      result.namedResources.emplace_back(
+        std::string{name},
+        ShaderResourceInfo{
+          .set = pSet->set,
+          .binding = spvBinding.binding,
+          .descriptorType = binding.descriptorType,
+          .descriptorCount = binding.descriptorCount,
+        });
+    }
+
+    result.resources.push_back({pSet->set, dsInfo});
   }
 
   if (spvModule->push_constant_block_count == 1)
@@ -98,20 +295,162 @@ void ShaderModule::reload(vk::Device device)
     {
       ETNA_PANIC("SPIRV {} parse error: PushConst offset is not zero", path);
     }
-    pushConst.stageFlags = stage;
-    pushConst.offset = 0u;
-    pushConst.size = blk.size;
+    result.pushConst.stageFlags = result.stage;
+    result.pushConst.offset = 0u;
+    result.pushConst.size = blk.size;
+    collect_push_const_members(blk, "", result.pushConstMembers);
   }
   else if (spvModule->push_constant_block_count > 1)
   {
     ETNA_PANIC("SPIRV {} parse error: only 1 push_const block per shader supported", path);
   }
-  else
+
+  reflect_constants(code, result);
+
+  return result;
+}
+
+static std::vector<uint32_t> copy_code(std::span<std::byte const> code)
+{
+  std::vector<uint32_t> words(code.size() / sizeof(uint32_t));
+  std::memcpy(words.data(), code.data(), words.size() * sizeof(uint32_t));
+  return words;
+}
+
+static vk::UniqueShaderModule create_vk_module(
+  vk::Device device, std::span<std::byte const> code, const std::filesystem::path& path)
+{
+  if (code.size() % 4 != 0)
+    ETNA_PANIC("SPIRV {} broken", path);
+
+  vk::ShaderModuleCreateInfo info{};
+  info.setPCode(reinterpret_cast<const uint32_t*>(code.data()));
+  info.setCodeSize(code.size());
+  return unwrap_vk_result(device.createShaderModuleUnique(info));
+}
+
+// Reflection is always done on the original code, the vulkan module may be optimized.
+// Code which outlives the module, like the mapped bundle, is kept without a copy.
+static std::shared_ptr<const ShaderModuleData> create_module_data(
+  const ShaderLoadContext& ctx,
+  std::uint64_t content_hash,
+  ShaderModuleReflection reflection,
+  std::span<uint32_t const> code,
+  bool code_outlives_module,
+  const std::filesystem::path& path)
+{
+  std::vector<uint32_t> optimized;
+  if (ctx.optimizer != nullptr)
+  {
+    optimized = ctx.optimizer->optimize(code, content_hash, path);
+    code = optimized;
+  }
+
+  auto result = std::make_shared<ShaderModuleData>(ShaderModuleData{
+    .contentHash = content_hash,
+    .vkModule = create_vk_module(ctx.device, std::as_bytes(code), path),
+    .reflection = std::move(reflection),
+  });
+  if (ctx.keepCode)
+  {
+    if (!optimized.empty())
+      result->ownedCode = std::move(optimized);
+    else if (!code_outlives_module)
+      result->ownedCode.assign(code.begin(), code.end());
+    result->code = result->ownedCode.empty() ? code : std::span{result->ownedCode};
+  }
+  return result;
+}
+
+/**
+ * Content hash -> data of currently alive modules. Entries are weak, so the data
+ * is destroyed as soon as the last module using it is reloaded or cleared.
+ */
+class ShaderModuleCache
+{
+public:
+  template <class F>
+  std::shared_ptr<const ShaderModuleData> getOrCreate(std::uint64_t content_hash, F&& create)
   {
-    pushConst.size = 0u;
-    pushConst.offset = 0u;
-    pushConst.stageFlags = vk::ShaderStageFlags{};
+    {
+      std::lock_guard lock{mutex};
+      if (auto it = entries.find(content_hash); it != entries.end())
+        if (auto existing = it->second.lock())
+          return existing;
+    }
+
+    // Creation is done without the lock, so that different modules are created in parallel.
+    // If another thread created the same module in the meantime, its result is used.
+    std::shared_ptr<const ShaderModuleData> created = create();
+
+    std::lock_guard lock{mutex};
+    if (auto it = entries.find(content_hash); it != entries.end())
+      if (auto existing = it->second.lock())
+        return existing;
+    // Modules of reloaded or destroyed programs expire, a miss is rare enough to sweep them
+    std::erase_if(entries, [](const auto& entry) { return entry.second.expired(); });
+    entries.insert_or_assign(content_hash, created);
+    return created;
   }
+
+private:
+  std::mutex mutex;
+  std::unordered_map<std::uint64_t, std::weak_ptr<const ShaderModuleData>> entries;
+};
+
+template <class F>
+static std::shared_ptr<const ShaderModuleData> get_module_data(
+  const ShaderLoadContext& ctx, std::uint64_t content_hash, F&& create)
+{
+  if (ctx.moduleCache != nullptr)
+    return ctx.moduleCache->getOrCreate(content_hash, std::forward<F>(create));
+  return create();
+}
+
+std::shared_ptr<const ShaderModuleData> ShaderModule::reload(const ShaderLoadContext& ctx)
+{
+  auto oldData = std::move(data);
+
+  if (ctx.bundle != nullptr)
+  {
+    if (const auto* bundled = ctx.bundle->find(path))
+    {
+      data = get_module_data(ctx, bundled->contentHash, [&]() {
+        BinaryReader reader{bundled->reflection};
+        auto bundledReflection = deserialize_reflection(reader);
+        ETNA_VERIFYF(
+          bundledReflection.has_value(), "Broken reflection of {} in shader bundle", path);
+        // The bundle keeps code 4-byte aligned and stays mapped while modules are alive
+        const std::span code{
+          reinterpret_cast<const uint32_t*>(bundled->code.data()),
+          bundled->code.size() / sizeof(uint32_t)};
+        return create_module_data(
+          ctx, bundled->contentHash, std::move(*bundledReflection), code, true, path);
+      });
+      return oldData;
+    }
+  }
+
+  auto code = read_file(path);
+  const auto contentHash = hash_content(std::as_bytes(std::span{code}));
+
+  data = get_module_data(ctx, contentHash, [&]() {
+    std::optional<ShaderModuleReflection> reflection;
+    if (ctx.reflectionCache != nullptr)
+      reflection = ctx.reflectionCache->find(contentHash);
+
+    if (!reflection.has_value())
+    {
+      reflection = reflect_spirv(code, path);
+      if (ctx.reflectionCache != nullptr)
+        ctx.reflectionCache->insert(contentHash, *reflection);
+    }
+
+    const auto words = copy_code(std::as_bytes(std::span{code}));
+    return create_module_data(ctx, contentHash, std::move(*reflection), words, false, path);
+  });
+
+  return oldData;
 }
 
 uint32_t ShaderProgramManager::registerModule(std::filesystem::path path)
@@ -120,19 +459,35 @@ uint32_t ShaderProgramManager::registerModule(std::filesystem::path path)
   if (it != shaderModuleNames.end())
     return it->second;
 
-  uint32_t modId = static_cast<uint32_t>(shaderModules.size());
   std::unique_ptr<ShaderModule> newMod;
-  newMod.reset(new ShaderModule{get_context().getDevice(), path});
-  shaderModules.push_back(std::move(newMod));
+  newMod.reset(new ShaderModule{getLoadContext(), path});
+  return addModule(std::move(path), std::move(newMod));
+}
+
+uint32_t ShaderProgramManager::addModule(
+  std::filesystem::path path, std::unique_ptr<ShaderModule> module)
+{
+  uint32_t modId = static_cast<uint32_t>(shaderModules.size());
+  shaderModules.push_back(std::move(module));
+  if (fileWatcher != nullptr)
+    fileWatcher->watch(path);
+  shaderModuleNames.emplace(std::move(path), modId);
   return modId;
 }
 
 static void validate_program_shaders(
   const std::string& name, const std::vector<vk::ShaderStageFlagBits>& stages)
 {
-  auto supportedShaders = vk::ShaderStageFlagBits::eVertex |
+  const auto vertexProcessingShaders = vk::ShaderStageFlagBits::eVertex |
     vk::ShaderStageFlagBits::eTessellationControl |
-    vk::ShaderStageFlagBits::eTessellationEvaluation | vk::ShaderStageFlagBits::eGeometry |
+    vk::ShaderStageFlagBits::eTessellationEvaluation | vk::ShaderStageFlagBits::eGeometry;
+  const auto meshShaders = vk::ShaderStageFlagBits::eTaskEXT | vk::ShaderStageFlagBits::eMeshEXT;
+  // Ray tracing programs may have any number of shaders of every stage
+  const auto rayTracingShaders = vk::ShaderStageFlagBits::eRaygenKHR |
+    vk::ShaderStageFlagBits::eMissKHR | vk::ShaderStageFlagBits::eClosestHitKHR |
+    vk::ShaderStageFlagBits::eAnyHitKHR | vk::ShaderStageFlagBits::eIntersectionKHR |
+    vk::ShaderStageFlagBits::eCallableKHR;
+  const auto supportedShaders = vertexProcessingShaders | meshShaders | rayTracingShaders |
     vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute;
 
   bool isComputePipeline = false;
@@ -148,7 +503,7 @@ static void validate_program_shaders(
         vk::to_string(stage));
     }
 
-    if (stage & usageMask)
+    if ((stage & usageMask) && !(stage & rayTracingShaders))
     {
       ETNA_PANIC(
         "Shader program {} creating error, multiple usage of {} shader stage",
@@ -164,6 +519,33 @@ static void validate_program_shaders(
   {
     ETNA_PANIC("Shader program {} creating error, usage of compute shader with other stages", name);
   }
+
+  if ((usageMask & meshShaders) && (usageMask & vertexProcessingShaders))
+  {
+    ETNA_PANIC(
+      "Shader program {} creating error, mesh shading stages can't be mixed with vertex processing",
+      name);
+  }
+
+  if ((usageMask & rayTracingShaders) && (usageMask & ~rayTracingShaders))
+  {
+    ETNA_PANIC(
+      "Shader program {} creating error, ray tracing stages can't be mixed with other stages",
+      name);
+  }
+
+  if ((usageMask & rayTracingShaders) && !(usageMask & vk::ShaderStageFlagBits::eRaygenKHR))
+  {
+    ETNA_PANIC(
+      "Shader program {} creating error, ray tracing program without a raygen shader", name);
+  }
+
+  if (
+    (usageMask & vk::ShaderStageFlagBits::eTaskEXT) &&
+    !(usageMask & vk::ShaderStageFlagBits::eMeshEXT))
+  {
+    ETNA_PANIC("Shader program {} creating error, task shader without a mesh shader", name);
+  }
 }
 
 ShaderProgramId ShaderProgramManager::loadProgram(
@@ -173,20 +555,79 @@ ShaderProgramId ShaderProgramManager::loadProgram(
     ETNA_PANIC("Shader program {} redefenition", name);
 
   std::vector<uint32_t> moduleIds;
-  std::vector<vk::ShaderStageFlagBits> stages;
   for (const auto& path : shaders_path)
+    moduleIds.push_back(registerModule(path));
+
+  return addProgram(name, std::move(moduleIds));
+}
+
+std::vector<ShaderProgramId> ShaderProgramManager::loadPrograms(
+  std::span<ShaderProgramCreateInfo const> infos)
+{
+  // Collect modules that have to be loaded in a deterministic order
+  std::vector<std::filesystem::path> newPaths;
+  std::unordered_set<std::string_view> batchNames;
   {
-    auto id = registerModule(path);
-    auto stage = getModule(id).getStage();
+    std::unordered_set<std::filesystem::path, PathHash> seenPaths;
+    for (const auto& info : infos)
+    {
+      if (programNames.contains(info.name) || !batchNames.emplace(info.name).second)
+        ETNA_PANIC("Shader program {} redefenition", info.name);
+
+      for (const auto& path : info.shaders)
+        if (!shaderModuleNames.contains(path) && seenPaths.insert(path).second)
+          newPaths.push_back(path);
+    }
+  }
+
+  // File IO, hashing, reflection and driver-side module creation are
+  // independent for every module, so they are spread over worker threads.
+  std::vector<std::unique_ptr<ShaderModule>> newModules(newPaths.size());
+  {
+    ZoneScopedN("loadShaderModules");
+
+    const ShaderLoadContext ctx = getLoadContext();
+    std::atomic<std::size_t> nextModule{0};
+    auto worker = [&]() {
+      for (auto i = nextModule++; i < newPaths.size(); i = nextModule++)
+        newModules[i].reset(new ShaderModule{ctx, newPaths[i]});
+    };
+
+    const std::size_t threadCount = std::min<std::size_t>(
+      std::max(std::thread::hardware_concurrency(), 1u), newPaths.size());
+    std::vector<std::jthread> workers;
+    for (std::size_t i = 1; i < threadCount; ++i)
+      workers.emplace_back(worker);
+    worker();
+  }
 
-    moduleIds.push_back(id);
-    stages.push_back(stage);
+  // Ids are assigned on this thread only, exactly like sequential create_program calls would
+  for (std::size_t i = 0; i < newPaths.size(); ++i)
+    addModule(std::move(newPaths[i]), std::move(newModules[i]));
+
+  std::vector<ShaderProgramId> result;
+  result.reserve(infos.size());
+  for (const auto& info : infos)
+  {
+    std::vector<uint32_t> moduleIds;
+    for (const auto& path : info.shaders)
+      moduleIds.push_back(shaderModuleNames.at(path));
+    result.push_back(addProgram(info.name, std::move(moduleIds)));
   }
+  return result;
+}
+
+ShaderProgramId ShaderProgramManager::addProgram(
+  const char* name, std::vector<uint32_t> module_ids)
+{
+  std::vector<vk::ShaderStageFlagBits> stages;
+  for (auto id : module_ids)
+    stages.push_back(getModule(id).getStage());
 
   validate_program_shaders(name, stages);
 
   ShaderProgramId progId = static_cast<ShaderProgramId>(programs.size());
-  programs.emplace_back(new ShaderProgramInternal{name, std::move(moduleIds)});
+  programs.emplace_back(new ShaderProgramInternal{name, std::move(module_ids)});
   programs[static_cast<std::underlying_type_t<ShaderProgramId>>(progId)]->reload(*this);
   programNames[name] = progId;
   return progId;
@@ -210,19 +651,37 @@ ShaderProgramId ShaderProgramManager::getProgram(const char* name) const
 
 void ShaderProgramManager::ShaderProgramInternal::reload(ShaderProgramManager& manager)
 {
-  progLayout = {};
+  progLayout = vk::PipelineLayout{};
   usedDescriptors = {};
   pushConst = vk::PushConstantRange{};
 
   std::array<DescriptorSetInfo, MAX_PROGRAM_DESCRIPTORS> dstDescriptors;
+  // Module that declared each binding first, for error messages
+  std::array<std::array<const ShaderModule*, MAX_DESCRIPTOR_BINDINGS>, MAX_PROGRAM_DESCRIPTORS>
+    bindingModules{};
   auto& descriptorLayoutCache = get_context().getDescriptorSetLayouts();
 
+  std::unordered_map<std::string, ShaderResourceInfo> namedResources;
+  std::unordered_map<std::string, PushConstantMemberInfo> namedPushConstMembers;
+  std::unordered_map<std::string, SpecConstantInfo> namedSpecConstants;
+  specConstants.clear();
+  workgroupSize = {};
+  bool hasTaskShader = false;
+
   uint32_t usedDescriptorSetRange = 0;
 
   for (auto id : moduleIds)
   {
     auto& shaderMod = manager.getModule(id);
 
+    // Only the first stage is dispatched, so a task shader takes precedence over a mesh one
+    const auto stage = shaderMod.getStage();
+    if (stage == vk::ShaderStageFlagBits::eCompute || stage == vk::ShaderStageFlagBits::eTaskEXT)
+      workgroupSize = shaderMod.getWorkgroupSize();
+    else if (stage == vk::ShaderStageFlagBits::eMeshEXT && !hasTaskShader)
+      workgroupSize = shaderMod.getWorkgroupSize();
+    hasTaskShader |= stage == vk::ShaderStageFlagBits::eTaskEXT;
+
     if (shaderMod.getPushConst().size > 0) // merge push constants
     {
       auto modPushConst = shaderMod.getPushConst();
@@ -239,7 +698,7 @@ void ShaderProgramManager::ShaderProgramInternal::reload(ShaderProgramManager& m
           name,
           pushConst.size,
           modPushConst.size,
-          shaderMod.getName());
+          shaderMod.getPath());
         pushConst.stageFlags |= modPushConst.stageFlags;
       }
     }
@@ -254,49 +713,222 @@ void ShaderProgramManager::ShaderProgramInternal::reload(ShaderProgramManager& m
           desc.first,
           MAX_PROGRAM_DESCRIPTORS);
 
+      for (uint32_t binding = 0; binding < MAX_DESCRIPTOR_BINDINGS; binding++)
+      {
+        if (!desc.second.isBindingUsed(binding))
+          continue;
+        auto& declaredBy = bindingModules[desc.first][binding];
+        if (declaredBy == nullptr)
+        {
+          declaredBy = &shaderMod;
+          continue;
+        }
+        const auto& existing = dstDescriptors[desc.first].getBinding(binding);
+        const auto& declared = desc.second.getBinding(binding);
+        if (
+          existing.descriptorType != declared.descriptorType ||
+          existing.descriptorCount != declared.descriptorCount)
+          ETNA_PANIC(
+            "ShaderProgram {}: set {} binding {} is {} x{} in module {} but {} x{} in module {}",
+            name,
+            desc.first,
+            binding,
+            vk::to_string(existing.descriptorType),
+            existing.descriptorCount,
+            declaredBy->getPath(),
+            vk::to_string(declared.descriptorType),
+            declared.descriptorCount,
+            shaderMod.getPath());
+      }
+
       usedDescriptors.set(desc.first);
       dstDescriptors[desc.first].merge(desc.second);
 
       usedDescriptorSetRange = std::max(desc.first + 1, usedDescriptorSetRange);
     }
+
+    for (const auto& [resName, res] : shaderMod.getNamedResources()) // merge name tables
+    {
+      auto [it, inserted] = namedResources.emplace(resName, res);
+      if (!inserted && (it->second.set != res.set || it->second.binding != res.binding))
+        ETNA_PANIC(
+          "ShaderProgram {}: resource '{}' is bound to set {} binding {} in one module "
+          "but to set {} binding {} in module {}",
+          name,
+          resName,
+          it->second.set,
+          it->second.binding,
+          res.set,
+          res.binding,
+          shaderMod.getPath());
+    }
+
+    for (const auto& [memberName, member] : shaderMod.getPushConstMembers())
+    {
+      auto [it, inserted] = namedPushConstMembers.emplace(memberName, member);
+      if (!inserted && it->second != member)
+        ETNA_PANIC(
+          "ShaderProgram {}: push constant member '{}' has different layouts in different "
+          "modules, see module {}",
+          name,
+          memberName,
+          shaderMod.getPath());
+    }
+
+    for (const auto& [constName, constant] : shaderMod.getSpecConstants())
+    {
+      auto it = std::ranges::lower_bound(specConstants, constant.id, {}, &SpecConstantInfo::id);
+      if (it == specConstants.end() || it->id != constant.id)
+        specConstants.insert(it, constant);
+      else if (it->type != constant.type)
+        ETNA_PANIC(
+          "ShaderProgram {}: specialization constant #{} has different types in different "
+          "modules, see module {}",
+          name,
+          constant.id,
+          shaderMod.getPath());
+
+      if (!constName.empty())
+        namedSpecConstants.emplace(constName, constant);
+    }
   }
 
+  resourcesByName.build(namedResources);
+  pushConstMembersByName.build(namedPushConstMembers);
+  specConstantsByName.build(namedSpecConstants);
+
   static constexpr DescriptorSetInfo NULL_DSET_INFO{};
 
-  std::vector<vk::DescriptorSetLayout> vkLayouts;
+  std::vector<DescriptorLayoutId> setLayoutIds;
 
   for (uint32_t i = 0; i < usedDescriptorSetRange; i++)
   {
     const DescriptorSetInfo& dsetInfo =
       usedDescriptors.test(i) ? dstDescriptors[i] : NULL_DSET_INFO;
-    auto res = descriptorLayoutCache.get(get_context().getDevice(), dsetInfo);
-    descriptorIds[i] = res.first;
-    vkLayouts.push_back(res.second);
+    descriptorIds[i] = descriptorLayoutCache.get(get_context().getDevice(), dsetInfo).first;
+    setLayoutIds.push_back(descriptorIds[i]);
   }
 
-  vk::PipelineLayoutCreateInfo info{};
-  info.setSetLayouts(vkLayouts);
+  progLayout = get_context().getPipelineLayouts().get(
+    get_context().getDevice(), descriptorLayoutCache, setLayoutIds, pushConst);
+}
 
-  if (pushConst.size > 0)
+void ShaderProgramManager::reloadPrograms()
+{
+  const ShaderLoadContext ctx = getLoadContext();
+  for (auto& mod : shaderModules)
   {
-    info.setPPushConstantRanges(&pushConst);
-    info.setPushConstantRangeCount(1u);
+    mod->reload(ctx);
   }
 
-  progLayout = unwrap_vk_result(get_context().getDevice().createPipelineLayoutUnique(info));
+  for (auto& progPtr : programs)
+    progPtr->reload(*this);
+
+  collectUnusedLayouts();
 }
 
-void ShaderProgramManager::reloadPrograms()
+std::vector<ShaderProgramId> ShaderProgramManager::reloadModules(
+  std::span<std::filesystem::path const> paths)
 {
-  for (auto& mod : shaderModules)
+  auto& deletionQueue = get_context().getDeletionQueue();
+  const ShaderLoadContext ctx = getLoadContext();
+
+  std::vector<bool> moduleChanged(shaderModules.size(), false);
+  for (const auto& path : paths)
   {
-    mod->reload(get_context().getDevice());
+    auto it = shaderModuleNames.find(path);
+    if (it == shaderModuleNames.end() || moduleChanged[it->second])
+      continue;
+
+    spdlog::info("Reloading shader {}", path);
+    deletionQueue.retire(shaderModules[it->second]->reload(ctx));
+    moduleChanged[it->second] = true;
   }
 
+  std::vector<ShaderProgramId> reloaded;
+  for (std::size_t i = 0; i < programs.size(); ++i)
+  {
+    auto& prog = *programs[i];
+    if (std::ranges::none_of(prog.moduleIds, [&](uint32_t id) { return moduleChanged[id]; }))
+      continue;
+
+    prog.reload(*this);
+    reloaded.push_back(static_cast<ShaderProgramId>(i));
+  }
+
+  if (!reloaded.empty())
+    collectUnusedLayouts();
+
+  return reloaded;
+}
+
+std::vector<ShaderProgramId> ShaderProgramManager::reloadChangedModules()
+{
+  if (fileWatcher == nullptr)
+    return {};
+  const auto changed = fileWatcher->pollChanges();
+  return reloadModules(changed);
+}
+
+void ShaderProgramManager::collectUnusedLayouts()
+{
+  // Programs whose reflection did not change get the very same layout ids back,
+  // so only the layouts that nobody references anymore have to be destroyed.
+  std::vector<DescriptorLayoutId> aliveLayouts;
+  std::vector<vk::PipelineLayout> alivePipelineLayouts;
   for (auto& progPtr : programs)
   {
-    progPtr->reload(*this);
+    // Gaps below the last used set are filled with the empty layout, which has to stay alive
+    uint32_t setCount = 0;
+    for (uint32_t set = 0; set < MAX_PROGRAM_DESCRIPTORS; ++set)
+      if (progPtr->usedDescriptors.test(set))
+        setCount = set + 1;
+    for (uint32_t set = 0; set < setCount; ++set)
+      aliveLayouts.push_back(progPtr->descriptorIds[set]);
+    alivePipelineLayouts.push_back(progPtr->progLayout);
+  }
+
+  auto& ctx = get_context();
+  ctx.getPipelineLayouts().collectGarbage(
+    ctx.getDevice(), alivePipelineLayouts, ctx.getDeletionQueue());
+  ctx.getDescriptorSetLayouts().collectGarbage(
+    ctx.getDevice(), aliveLayouts, ctx.getDeletionQueue());
+}
+
+ShaderProgramManager::ShaderProgramManager(CreateInfo info)
+  : moduleCache{std::make_unique<ShaderModuleCache>()}
+  , keepCode{info.keepCode}
+{
+  if (info.reflectionCachePath.has_value())
+    reflectionCache = std::make_unique<ShaderReflectionCache>(std::move(*info.reflectionCachePath));
+  if (info.bundlePath.has_value())
+  {
+    bundle = std::make_unique<ShaderBundle>(*info.bundlePath, std::move(info.bundleRoot));
+    spdlog::info(
+      "Loaded shader bundle {} with {} modules", *info.bundlePath, bundle->moduleCount());
   }
+  if (info.watchFiles)
+    fileWatcher = std::make_unique<ShaderFileWatcher>();
+  if (!info.optimizerPasses.empty())
+    optimizer = std::make_unique<ShaderOptimizer>(
+      std::move(info.optimizerPasses), std::move(info.optimizerCachePath));
+}
+
+ShaderLoadContext ShaderProgramManager::getLoadContext() const
+{
+  return ShaderLoadContext{
+    .device = get_context().getDevice(),
+    .reflectionCache = reflectionCache.get(),
+    .bundle = bundle.get(),
+    .moduleCache = moduleCache.get(),
+    .optimizer = optimizer.get(),
+    .keepCode = keepCode,
+  };
+}
+
+ShaderProgramManager::~ShaderProgramManager()
+{
+  clear();
 }
 
 void ShaderProgramManager::clear()
@@ -305,6 +937,11 @@ void ShaderProgramManager::clear()
   programs.clear();
   shaderModuleNames.clear();
   shaderModules.clear();
+
+  if (reflectionCache != nullptr)
+    reflectionCache->save();
+  if (optimizer != nullptr)
+    optimizer->save();
 }
 
 std::vector<vk::PipelineShaderStageCreateInfo> ShaderProgramManager::getShaderStages(
@@ -327,6 +964,48 @@ std::vector<vk::PipelineShaderStageCreateInfo> ShaderProgramManager::getShaderSt
   return stages;
 }
 
+std::vector<vk::ShaderCreateInfoEXT> ShaderProgramManager::getShaderObjectInfos(
+  ShaderProgramId id) const
+{
+  ETNA_VERIFYF(keepCode, "Shader code was not kept, see CreateInfo::keepCode");
+  auto& prog = getProgInternal(id);
+
+  std::vector<vk::ShaderCreateInfoEXT> infos;
+  infos.reserve(prog.moduleIds.size());
+
+  for (auto modId : prog.moduleIds)
+  {
+    const auto& shaderMod = getModule(modId);
+    const auto code = shaderMod.getCode();
+    infos.push_back(vk::ShaderCreateInfoEXT{
+      .stage = shaderMod.getStage(),
+      .codeType = vk::ShaderCodeTypeEXT::eSpirv,
+      .codeSize = code.size_bytes(),
+      .pCode = code.data(),
+      .pName = shaderMod.getName().c_str(),
+    });
+  }
+  return infos;
+}
+
+std::vector<vk::DescriptorSetLayout> ShaderProgramManager::getDescriptorLayouts(
+  ShaderProgramId id) const
+{
+  auto& prog = getProgInternal(id);
+  auto& layoutCache = get_context().getDescriptorSetLayouts();
+
+  uint32_t setCount = 0;
+  for (uint32_t set = 0; set < MAX_PROGRAM_DESCRIPTORS; ++set)
+    if (prog.usedDescriptors.test(set))
+      setCount = set + 1;
+
+  std::vector<vk::DescriptorSetLayout> layouts;
+  layouts.reserve(setCount);
+  for (uint32_t set = 0; set < setCount; ++set)
+    layouts.push_back(layoutCache.getVkLayout(prog.descriptorIds[set]));
+  return layouts;
+}
+
 vk::DescriptorSetLayout ShaderProgramManager::getDescriptorLayout(
   ShaderProgramId id, uint32_t set) const
 {
@@ -343,7 +1022,7 @@ vk::PushConstantRange ShaderProgramInfo::getPushConst() const
 vk::PipelineLayout ShaderProgramInfo::getPipelineLayout() const
 {
   auto& prog = mgr.getProgInternal(id);
-  return prog.progLayout.get();
+  return prog.progLayout;
 }
 
 bool ShaderProgramInfo::isDescriptorSetUsed(uint32_t set) const
@@ -368,4 +1047,47 @@ const DescriptorSetInfo& ShaderProgramInfo::getDescriptorSetInfo(uint32_t set) c
   return get_context().getDescriptorSetLayouts().getLayoutInfo(getDescriptorLayoutId(set));
 }
 
+const ShaderResourceInfo* ShaderProgramInfo::findResource(ShaderNameHash name) const
+{
+  return mgr.getProgInternal(id).resourcesByName.find(name);
+}
+
+const ShaderResourceInfo& ShaderProgramInfo::getResource(ShaderNameHash name) const
+{
+  const auto* result = findResource(name);
+  if (result == nullptr)
+    ETNA_PANIC(
+      "ShaderProgram {} has no resource with name hash {:#x}",
+      mgr.getProgInternal(id).name,
+      name.value);
+  return *result;
+}
+
+const PushConstantMemberInfo* ShaderProgramInfo::findPushConstMember(ShaderNameHash name) const
+{
+  return mgr.getProgInternal(id).pushConstMembersByName.find(name);
+}
+
+std::span<SpecConstantInfo const> ShaderProgramInfo::getSpecConstants() const
+{
+  return mgr.getProgInternal(id).specConstants;
+}
+
+const SpecConstantInfo* ShaderProgramInfo::findSpecConstant(uint32_t constant_id) const
+{
+  const auto& constants = mgr.getProgInternal(id).specConstants;
+  auto it = std::ranges::lower_bound(constants, constant_id, {}, &SpecConstantInfo::id);
+  return it != constants.end() && it->id == constant_id ? &*it : nullptr;
+}
+
+const SpecConstantInfo* ShaderProgramInfo::findSpecConstant(ShaderNameHash name) const
+{
+  return mgr.getProgInternal(id).specConstantsByName.find(name);
+}
+
+const WorkgroupSizeInfo& ShaderProgramInfo::getWorkgroupSize() const
+{
+  return mgr.getProgInternal(id).workgroupSize;
+}
+
 } // namespace etna
@@ -0,0 +1,200 @@
+#include "ShaderReflectionCache.hpp"
+
+
+namespace etna
+{
+
+static constexpr std::uint64_t CACHE_MAGIC = 0x434C4652414E5445ull; // "ETNARFLC"
+// Bump this whenever the contents of ShaderModuleReflection change
+static constexpr std::uint32_t CACHE_VERSION = 3;
+
+static constexpr std::uint32_t NO_SPEC_CONSTANT = ~std::uint32_t{0};
+
+static void serialize_set_info(BinaryWriter& writer, const DescriptorSetInfo& info)
+{
+  uint32_t bindingCount = 0;
+  for (uint32_t binding = 0; binding < MAX_DESCRIPTOR_BINDINGS; binding++)
+    bindingCount += info.isBindingUsed(binding) ? 1 : 0;
+
+  writer.write(bindingCount);
+  for (uint32_t binding = 0; binding < MAX_DESCRIPTOR_BINDINGS; binding++)
+  {
+    if (!info.isBindingUsed(binding))
+      continue;
+    const auto& vkBinding = info.getBinding(binding);
+    writer.write(vkBinding.binding);
+    writer.write(static_cast<uint32_t>(vkBinding.descriptorType));
+    writer.write(vkBinding.descriptorCount);
+    writer.write(static_cast<uint32_t>(vkBinding.stageFlags));
+    writer.write(static_cast<uint32_t>(info.getBindingFlags(binding)));
+  }
+}
+
+static bool deserialize_set_info(BinaryReader& reader, DescriptorSetInfo& info)
+{
+  info.clear();
+  const auto bindingCount = reader.read<uint32_t>();
+  if (bindingCount > MAX_DESCRIPTOR_BINDINGS)
+    return false;
+
+  for (uint32_t i = 0; i < bindingCount; i++)
+  {
+    vk::DescriptorSetLayoutBinding binding{
+      .binding = reader.read<uint32_t>(),
+      .descriptorType = static_cast<vk::DescriptorType>(reader.read<uint32_t>()),
+      .descriptorCount = reader.read<uint32_t>(),
+      .stageFlags = static_cast<vk::ShaderStageFlags>(reader.read<uint32_t>()),
+    };
+    const auto flags = static_cast<vk::DescriptorBindingFlags>(reader.read<uint32_t>());
+    if (!reader.ok() || binding.binding >= MAX_DESCRIPTOR_BINDINGS)
+      return false;
+    info.addResource(binding, flags);
+  }
+
+  return reader.ok();
+}
+
+void serialize_reflection(BinaryWriter& writer, const ShaderModuleReflection& reflection)
+{
+  writer.write(std::string_view{reflection.entryPoint});
+  writer.write(static_cast<uint32_t>(reflection.stage));
+
+  writer.write(static_cast<uint32_t>(reflection.resources.size()));
+  for (const auto& [set, setInfo] : reflection.resources)
+  {
+    writer.write(set);
+    serialize_set_info(writer, setInfo);
+  }
+
+  writer.write(static_cast<uint32_t>(reflection.pushConst.stageFlags));
+  writer.write(reflection.pushConst.offset);
+  writer.write(reflection.pushConst.size);
+
+  writer.write(static_cast<uint32_t>(reflection.namedResources.size()));
+  for (const auto& [name, res] : reflection.namedResources)
+  {
+    writer.write(std::string_view{name});
+    writer.write(res.set);
+    writer.write(res.binding);
+    writer.write(static_cast<uint32_t>(res.descriptorType));
+    writer.write(res.descriptorCount);
+  }
+
+  writer.write(static_cast<uint32_t>(reflection.pushConstMembers.size()));
+  for (const auto& [name, member] : reflection.pushConstMembers)
+  {
+    writer.write(std::string_view{name});
+    writer.write(member.offset);
+    writer.write(member.size);
+  }
+
+  writer.write(static_cast<uint32_t>(reflection.specConstants.size()));
+  for (const auto& [name, constant] : reflection.specConstants)
+  {
+    writer.write(std::string_view{name});
+    writer.write(constant.id);
+    writer.write(static_cast<uint32_t>(constant.type));
+    writer.write(constant.defaultValue);
+  }
+
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    writer.write(reflection.workgroupSize.size[i]);
+    writer.write(reflection.workgroupSize.specConstantIds[i].value_or(NO_SPEC_CONSTANT));
+  }
+}
+
+std::optional<ShaderModuleReflection> deserialize_reflection(BinaryReader& reader)
+{
+  ShaderModuleReflection result;
+
+  result.entryPoint = reader.readString();
+  result.stage = static_cast<vk::ShaderStageFlagBits>(reader.read<uint32_t>());
+
+  const auto setCount = reader.read<uint32_t>();
+  if (setCount > MAX_PROGRAM_DESCRIPTORS)
+    return std::nullopt;
+  for (uint32_t i = 0; i < setCount; i++)
+  {
+    auto& [set, setInfo] = result.resources.emplace_back();
+    set = reader.read<uint32_t>();
+    if (!deserialize_set_info(reader, setInfo))
+      return std::nullopt;
+  }
+
+  result.pushConst.stageFlags = static_cast<vk::ShaderStageFlags>(reader.read<uint32_t>());
+  result.pushConst.offset = reader.read<uint32_t>();
+  result.pushConst.size = reader.read<uint32_t>();
+
+  const auto namedResourceCount = reader.read<uint32_t>();
+  for (uint32_t i = 0; i < namedResourceCount && reader.ok(); i++)
+  {
+    auto& [name, res] = result.namedResources.emplace_back();
+    name = reader.readString();
+    res.set = reader.read<uint32_t>();
+    res.binding = reader.read<uint32_t>();
+    res.descriptorType = static_cast<vk::DescriptorType>(reader.read<uint32_t>());
+    res.descriptorCount = reader.read<uint32_t>();
+  }
+
+  const auto pushConstMemberCount = reader.read<uint32_t>();
+  for (uint32_t i = 0; i < pushConstMemberCount && reader.ok(); i++)
+  {
+    auto& [name, member] = result.pushConstMembers.emplace_back();
+    name = reader.readString();
+    member.offset = reader.read<uint32_t>();
+    member.size = reader.read<uint32_t>();
+  }
+
+  const auto specConstantCount = reader.read<uint32_t>();
+  for (uint32_t i = 0; i < specConstantCount && reader.ok(); i++)
+  {
+    auto& [name, constant] = result.specConstants.emplace_back();
+    name = reader.readString();
+    constant.id = reader.read<uint32_t>();
+    constant.type = static_cast<SpecConstantType>(reader.read<uint32_t>());
+    constant.defaultValue = reader.read<uint32_t>();
+  }
+
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    result.workgroupSize.size[i] = reader.read<uint32_t>();
+    if (const auto specId = reader.read<uint32_t>(); specId != NO_SPEC_CONSTANT)
+      result.workgroupSize.specConstantIds[i] = specId;
+  }
+
+  if (!reader.ok())
+    return std::nullopt;
+  return result;
+}
+
+ShaderReflectionCache::ShaderReflectionCache(std::filesystem::path cache_path)
+  : cache{std::move(cache_path), CACHE_MAGIC, CACHE_VERSION, "shader reflection cache"}
+{
+}
+
+std::optional<ShaderModuleReflection> ShaderReflectionCache::find(std::uint64_t content_hash) const
+{
+  auto payload = cache.find(content_hash);
+  if (!payload.has_value())
+    return std::nullopt;
+
+  BinaryReader reader{*payload};
+  return deserialize_reflection(reader);
+}
+
+void ShaderReflectionCache::insert(
+  std::uint64_t content_hash, const ShaderModuleReflection& reflection)
+{
+  std::vector<std::byte> payload;
+  BinaryWriter writer{payload};
+  serialize_reflection(writer, reflection);
+  cache.insert(content_hash, std::move(payload));
+}
+
+void ShaderReflectionCache::save()
+{
+  cache.save();
+}
+
+} // namespace etna
@@ -0,0 +1,47 @@
+#pragma once
+#ifndef ETNA_SHADER_REFLECTION_CACHE_HPP_INCLUDED
+#define ETNA_SHADER_REFLECTION_CACHE_HPP_INCLUDED
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include <etna/ShaderProgram.hpp>
+
+#include "BinaryStream.hpp"
+#include "BlobCache.hpp"
+
+
+namespace etna
+{
+
+// Panics if the SPIR-V code is broken or uses unsupported features
+ShaderModuleReflection reflect_spirv(std::span<char const> code, const std::filesystem::path& path);
+
+void serialize_reflection(BinaryWriter& writer, const ShaderModuleReflection& reflection);
+std::optional<ShaderModuleReflection> deserialize_reflection(BinaryReader& reader);
+
+/**
+ * On-disk cache of SPIR-V reflection results keyed by a hash of module contents.
+ * find() and insert() may be called concurrently from shader loading threads.
+ */
+class ShaderReflectionCache
+{
+public:
+  explicit ShaderReflectionCache(std::filesystem::path cache_path);
+
+  std::optional<ShaderModuleReflection> find(std::uint64_t content_hash) const;
+  void insert(std::uint64_t content_hash, const ShaderModuleReflection& reflection);
+
+  // Writes the cache file if new entries were inserted since the last save
+  void save();
+
+private:
+  BlobCache cache;
+};
+
+} // namespace etna
+
+#endif // ETNA_SHADER_REFLECTION_CACHE_HPP_INCLUDED
@@ -0,0 +1,221 @@
+#include <etna/ShaderVariants.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <unordered_map>
+#include <fmt/format.h>
+
+#include <etna/Assert.hpp>
+#include <etna/ShaderProgram.hpp>
+
+
+namespace etna
+{
+
+static std::size_t hash_mask(ShaderVariantMask mask)
+{
+  // Masks are mostly small numbers, mix the bits so that they spread over the table
+  mask ^= mask >> 33;
+  mask *= 0xff51afd7ed558ccdull;
+  mask ^= mask >> 33;
+  return static_cast<std::size_t>(mask);
+}
+
+std::optional<uint32_t> ShaderVariantManager::MaskTable::find(ShaderVariantMask mask) const
+{
+  if (slots.empty())
+    return std::nullopt;
+
+  const std::size_t tableMask = slots.size() - 1;
+  for (std::size_t i = hash_mask(mask) & tableMask;; i = (i + 1) & tableMask)
+  {
+    if (slots[i].key == mask + 1)
+      return slots[i].value;
+    if (slots[i].key == 0)
+      return std::nullopt;
+  }
+}
+
+void ShaderVariantManager::MaskTable::insert(ShaderVariantMask mask, uint32_t value)
+{
+  // Keep the load factor at most 1/2
+  if ((count + 1) * 2 > slots.size())
+  {
+    auto oldSlots = std::move(slots);
+    slots.assign(std::max<std::size_t>(16, oldSlots.size() * 2), Slot{});
+    count = 0;
+    for (const auto& slot : oldSlots)
+      if (slot.key != 0)
+        insert(slot.key - 1, slot.value);
+  }
+
+  const std::size_t tableMask = slots.size() - 1;
+  std::size_t i = hash_mask(mask) & tableMask;
+  while (slots[i].key != 0 && slots[i].key != mask + 1)
+    i = (i + 1) & tableMask;
+
+  if (slots[i].key == 0)
+    ++count;
+  slots[i] = Slot{mask + 1, value};
+}
+
+ShaderVariantManager::ShaderVariantManager(ShaderProgramManager& shader_manager)
+  : shaderManager{shader_manager}
+{
+}
+
+ShaderVariantsId ShaderVariantManager::declare(ShaderVariantsCreateInfo info)
+{
+  ETNA_VERIFYF(info.shaders, "Shader variants {} have no shader files callback", info.name);
+
+  auto set = std::make_unique<VariantSet>();
+  set->name = std::move(info.name);
+  set->shaders = std::move(info.shaders);
+
+  uint32_t offset = 0;
+  std::unordered_map<std::string, uint32_t> keywordIndices;
+  for (const auto& keyword : info.keywords)
+  {
+    ETNA_VERIFYF(
+      keyword.valueCount >= 2,
+      "Keyword {} of shader variants {} must have at least 2 values",
+      keyword.name,
+      set->name);
+
+    const uint32_t bits = static_cast<uint32_t>(std::bit_width(keyword.valueCount - 1));
+    if (!keyword.specConstantId.has_value())
+      set->fileMask |= ((ShaderVariantMask{1} << bits) - 1) << offset;
+
+    keywordIndices.emplace(keyword.name, static_cast<uint32_t>(set->keywords.size()));
+    set->keywords.push_back(KeywordLayout{
+      .offset = offset,
+      .bits = bits,
+      .valueCount = keyword.valueCount,
+      .specConstantId = keyword.specConstantId,
+    });
+    offset += bits;
+  }
+
+  // MaskTable stores masks incremented by one, so they must never be all ones
+  ETNA_VERIFYF(
+    offset < 64, "Shader variants {} have too many keywords ({} bits)", set->name, offset);
+  ETNA_VERIFYF(
+    keywordIndices.size() == info.keywords.size(),
+    "Shader variants {} have duplicate keywords",
+    set->name);
+  set->keywordsByName.build(keywordIndices);
+
+  sets.push_back(std::move(set));
+  return static_cast<ShaderVariantsId>(sets.size() - 1);
+}
+
+ShaderVariantMask ShaderVariantManager::keywordBits(
+  ShaderVariantsId id, ShaderNameHash keyword, uint32_t value) const
+{
+  const auto& set = getSet(id);
+  const auto* index = set.keywordsByName.find(keyword);
+  ETNA_VERIFYF(index != nullptr, "Shader variants {} have no such keyword", set.name);
+
+  const auto& layout = set.keywords[*index];
+  ETNA_VERIFYF(
+    value < layout.valueCount,
+    "Keyword #{} of shader variants {} has only {} values, got {}",
+    *index,
+    set.name,
+    layout.valueCount,
+    value);
+  return ShaderVariantMask{value} << layout.offset;
+}
+
+const ShaderVariant& ShaderVariantManager::get(ShaderVariantsId id, ShaderVariantMask mask)
+{
+  auto& set = getSet(id);
+  if (auto index = set.variantIndices.find(mask))
+    return set.variants[*index];
+
+  std::vector<uint32_t> values(set.keywords.size());
+  std::vector<uint32_t> fileValues(set.keywords.size(), 0);
+  ShaderVariantMask knownBits = 0;
+  for (std::size_t i = 0; i < set.keywords.size(); ++i)
+  {
+    const auto& layout = set.keywords[i];
+    const ShaderVariantMask keywordMask = (ShaderVariantMask{1} << layout.bits) - 1;
+    values[i] = static_cast<uint32_t>((mask >> layout.offset) & keywordMask);
+    knownBits |= keywordMask << layout.offset;
+
+    ETNA_VERIFYF(
+      values[i] < layout.valueCount,
+      "Invalid mask {:#x} for shader variants {}: keyword #{} has value {}",
+      mask,
+      set.name,
+      i,
+      values[i]);
+
+    if (!layout.specConstantId.has_value())
+      fileValues[i] = values[i];
+  }
+  ETNA_VERIFYF(
+    (mask & ~knownBits) == 0, "Invalid mask {:#x} for shader variants {}", mask, set.name);
+
+  // Variants which only differ in specialization constants share a program
+  const ShaderVariantMask fileMask = mask & set.fileMask;
+  ShaderProgramId program;
+  if (auto programIndex = set.programs.find(fileMask))
+  {
+    program = static_cast<ShaderProgramId>(*programIndex);
+  }
+  else
+  {
+    const auto programName = fmt::format("{}#{:x}", set.name, fileMask);
+    const auto shaders = set.shaders(fileValues);
+    program = shaderManager.loadProgram(programName.c_str(), shaders);
+    set.programs.insert(fileMask, static_cast<std::underlying_type_t<ShaderProgramId>>(program));
+  }
+
+  // Keyword values are converted to whatever type the shaders declared
+  const auto programInfo = shaderManager.getProgramInfo(program);
+  SpecializationConstants specConstants;
+  for (std::size_t i = 0; i < set.keywords.size(); ++i)
+  {
+    const auto& constantId = set.keywords[i].specConstantId;
+    if (!constantId.has_value())
+      continue;
+
+    const auto* declared = programInfo.findSpecConstant(*constantId);
+    const auto type = declared != nullptr ? declared->type : SpecConstantType::eUint32;
+    switch (type)
+    {
+    case SpecConstantType::eBool:
+      specConstants.set(*constantId, values[i] != 0);
+      break;
+    case SpecConstantType::eInt32:
+      specConstants.set(*constantId, static_cast<int32_t>(values[i]));
+      break;
+    case SpecConstantType::eUint32:
+      specConstants.set(*constantId, values[i]);
+      break;
+    case SpecConstantType::eFloat32:
+      specConstants.set(*constantId, static_cast<float>(values[i]));
+      break;
+    }
+  }
+
+  set.variantIndices.insert(mask, static_cast<uint32_t>(set.variants.size()));
+  return set.variants.emplace_back(ShaderVariant{program, std::move(specConstants)});
+}
+
+ShaderVariantManager::VariantSet& ShaderVariantManager::getSet(ShaderVariantsId id)
+{
+  const auto index = static_cast<std::underlying_type_t<ShaderVariantsId>>(id);
+  ETNA_VERIFYF(index < sets.size(), "Invalid shader variants id {}", index);
+  return *sets[index];
+}
+
+const ShaderVariantManager::VariantSet& ShaderVariantManager::getSet(ShaderVariantsId id) const
+{
+  const auto index = static_cast<std::underlying_type_t<ShaderVariantsId>>(id);
+  ETNA_VERIFYF(index < sets.size(), "Invalid shader variants id {}", index);
+  return *sets[index];
+}
+
+} // namespace etna
@@ -0,0 +1,69 @@
+#pragma once
+#ifndef ETNA_SPECIALIZATION_DATA_HPP_INCLUDED
+#define ETNA_SPECIALIZATION_DATA_HPP_INCLUDED
+
+#include <vector>
+#include <spdlog/spdlog.h>
+
+#include <etna/Vulkan.hpp>
+#include <etna/ShaderProgram.hpp>
+#include <etna/SpecializationConstants.hpp>
+
+
+namespace etna
+{
+
+// Keeps vk::SpecializationInfo contents alive during pipeline or shader object creation
+struct SpecializationData
+{
+  explicit SpecializationData(const SpecializationConstants& constants)
+  {
+    for (const auto& entry : constants.getEntries())
+    {
+      mapEntries.push_back(vk::SpecializationMapEntry{
+        .constantID = entry.id,
+        .offset = static_cast<uint32_t>(values.size() * sizeof(uint32_t)),
+        .size = sizeof(uint32_t),
+      });
+      values.push_back(entry.value);
+    }
+    info.setMapEntries(mapEntries);
+    info.setData<uint32_t>(values);
+  }
+
+  // Constants which are not used by a stage are ignored, so all stages share the info
+  template <class StageInfo>
+  void apply(StageInfo& stage) const
+  {
+    if (!mapEntries.empty())
+      stage.pSpecializationInfo = &info;
+  }
+
+  SpecializationData(const SpecializationData&) = delete;
+  SpecializationData& operator=(const SpecializationData&) = delete;
+
+  std::vector<vk::SpecializationMapEntry> mapEntries;
+  std::vector<uint32_t> values;
+  vk::SpecializationInfo info{};
+};
+
+inline void validate_spec_constants(
+  const ShaderProgramInfo& program, const SpecializationConstants& constants)
+{
+  for (const auto& entry : constants.getEntries())
+  {
+    const auto* declared = program.findSpecConstant(entry.id);
+    if (declared == nullptr)
+      spdlog::warn(
+        "Specialization constant #{} is not declared in any shader of the program", entry.id);
+    else
+      ETNA_VERIFYF(
+        declared->type == entry.type,
+        "Specialization constant #{} was set with a value of a wrong type",
+        entry.id);
+  }
+}
+
+} // namespace etna
+
+#endif // ETNA_SPECIALIZATION_DATA_HPP_INCLUDED
@@ -1,44 +1,422 @@
 #include "StateTracking.hpp"
 #include "etna/GlobalContext.hpp"
+#include "etna/Assert.hpp"
+#include "etna/Image.hpp"
+#include "etna/Buffer.hpp"
 
 #include <bit>
+#include <fstream>
+#include <unordered_set>
+
+#include <fmt/ranges.h>
+#include <fmt/std.h>
+#include <spdlog/spdlog.h>
+#include <tracy/Tracy.hpp>
 
 
 namespace etna
 {
 
+constexpr vk::AccessFlags2 WRITE_ACCESS = vk::AccessFlagBits2::eShaderWrite |
+  vk::AccessFlagBits2::eShaderStorageWrite | vk::AccessFlagBits2::eColorAttachmentWrite |
+  vk::AccessFlagBits2::eDepthStencilAttachmentWrite | vk::AccessFlagBits2::eTransferWrite |
+  vk::AccessFlagBits2::eHostWrite | vk::AccessFlagBits2::eMemoryWrite |
+  vk::AccessFlagBits2::eAccelerationStructureWriteKHR;
+
+static bool is_visible(
+  const ResourceStates::AccessState& state, vk::PipelineStageFlags2 stages, vk::AccessFlags2 access)
+{
+  return std::ranges::any_of(state.visibleReads, [&](const ResourceStates::VisibleRead& read) {
+    return (stages & ~read.stages) == vk::PipelineStageFlags2{} &&
+      (access & ~read.access) == vk::AccessFlags2{};
+  });
+}
+
+void ResourceStates::addVisibleRead(
+  AccessState& state, vk::PipelineStageFlags2 stages, vk::AccessFlags2 access)
+{
+  state.readStages |= stages;
+  state.readAccess |= access;
+  if (is_visible(state, stages, access))
+    return;
+  for (auto& read : state.visibleReads)
+  {
+    if (read.stages == stages || !read.stages)
+    {
+      read.stages = stages;
+      read.access |= access;
+      return;
+    }
+  }
+  // Forgetting an older read only costs a barrier the next time it happens
+  state.visibleReads.back() = VisibleRead{stages, access};
+}
+
+// Reads only wait for the last write, and only if they have not been made to see it already.
+// Writes and layout transitions wait for the reads since the last write, or the write itself.
+std::optional<ResourceStates::BarrierSource> ResourceStates::applyAccess(
+  AccessState& state,
+  vk::PipelineStageFlags2 stages,
+  vk::AccessFlags2 access,
+  bool layout_transition,
+  ForceSetState force)
+{
+  const bool forced = force == ForceSetState::eTrue;
+  if (!layout_transition && !(access & WRITE_ACCESS))
+  {
+    const bool written = state.writeStages || state.writeAccess;
+    const bool seen = is_visible(state, stages, access);
+    addVisibleRead(state, stages, access);
+    if (!forced && (!written || seen))
+      return std::nullopt;
+    return BarrierSource{state.writeStages, state.writeAccess};
+  }
+
+  // Reads after the write have been synchronized with it, so waiting for them is enough
+  const BarrierSource source = state.readStages
+    ? BarrierSource{state.readStages, {}}
+    : BarrierSource{state.writeStages, state.writeAccess};
+  if (access & WRITE_ACCESS)
+  {
+    state = AccessState{.writeStages = stages, .writeAccess = access};
+  }
+  else
+  {
+    // A transition into a read-only layout is visible to the reads it was placed for,
+    // other stages only have to wait for it to happen
+    state = AccessState{.writeStages = stages};
+    addVisibleRead(state, stages, access);
+  }
+  if (!forced && !layout_transition && !source.stages && !source.access)
+    return std::nullopt;
+  return source;
+}
+
+ResourceStates::ResourceStates(
+  vk::Device dev, const GpuWorkCount& work_count, uint32_t queue_family, bool collect_stats)
+  : device{dev}
+  , workCount{work_count}
+  , defaultQueueFamily{queue_family}
+  , eventPools{work_count, std::in_place}
+  , collectStats{collect_stats}
+{
+}
+
+ResourceStates::~ResourceStates()
+{
+  // The application may exit during the captured frame, a partial trace is still useful
+  if (tracePath.has_value())
+    writeTrace();
+}
+
+TrackedImageId ResourceStates::allocateImageSlot()
+{
+  if (freeImageIds.empty())
+  {
+    images.emplace_back();
+    return static_cast<TrackedImageId>(images.size() - 1);
+  }
+  const TrackedImageId id = freeImageIds.back();
+  freeImageIds.pop_back();
+  return id;
+}
+
+TrackedBufferId ResourceStates::allocateBufferSlot()
+{
+  if (freeBufferIds.empty())
+  {
+    buffers.emplace_back();
+    return static_cast<TrackedBufferId>(buffers.size() - 1);
+  }
+  const TrackedBufferId id = freeBufferIds.back();
+  freeBufferIds.pop_back();
+  return id;
+}
+
+TrackedImageId ResourceStates::registerImage(
+  vk::Image image, uint32_t mip_levels, uint32_t layers, std::string_view name, bool concurrent)
+{
+  HandleType resHandle = std::bit_cast<HandleType>(static_cast<VkImage>(image));
+  auto [it, inserted] = imageIds.try_emplace(resHandle, TrackedImageId::Invalid);
+  if (inserted)
+    it->second = allocateImageSlot();
+  images[static_cast<uint32_t>(it->second)] = ImageState{
+    .mipLevels = mip_levels,
+    .layers = layers,
+    .subresources = StateRuns<TextureState>(uint64_t{mip_levels} * layers),
+    .concurrent = concurrent,
+    .name = std::string(name),
+  };
+  return it->second;
+}
+
+TrackedBufferId ResourceStates::registerBuffer(
+  vk::Buffer buffer, vk::DeviceSize size, std::string_view name, bool concurrent)
+{
+  HandleType resHandle = std::bit_cast<HandleType>(static_cast<VkBuffer>(buffer));
+  auto [it, inserted] = bufferIds.try_emplace(resHandle, TrackedBufferId::Invalid);
+  if (inserted)
+    it->second = allocateBufferSlot();
+  buffers[static_cast<uint32_t>(it->second)] = BufferRanges{
+    .size = size,
+    .ranges = StateRuns<BufferState>(std::max<vk::DeviceSize>(size, 1)),
+    .concurrent = concurrent,
+    .name = std::string(name),
+  };
+  return it->second;
+}
+
+void ResourceStates::unregisterImage(vk::Image image)
+{
+  HandleType resHandle = std::bit_cast<HandleType>(static_cast<VkImage>(image));
+  auto it = imageIds.find(resHandle);
+  if (it == imageIds.end())
+    return;
+  // Release the memory taken by the runs right away, the slot may stay free for a while
+  images[static_cast<uint32_t>(it->second)] = ImageState{};
+  freeImageIds.push_back(it->second);
+  imageIds.erase(it);
+  imageReleases.erase(resHandle);
+  const auto sameImage = [image](const auto& barrier) { return barrier.image == image; };
+  std::erase_if(imgBarriersToFlush, sameImage);
+  for (auto& entry : queueReleases)
+    std::erase_if(entry.second.imageBarriers, sameImage);
+}
+
+void ResourceStates::unregisterBuffer(vk::Buffer buffer)
+{
+  HandleType resHandle = std::bit_cast<HandleType>(static_cast<VkBuffer>(buffer));
+  auto it = bufferIds.find(resHandle);
+  if (it == bufferIds.end())
+    return;
+  buffers[static_cast<uint32_t>(it->second)] = BufferRanges{};
+  freeBufferIds.push_back(it->second);
+  bufferIds.erase(it);
+  bufferReleases.erase(resHandle);
+  const auto sameBuffer = [buffer](const auto& barrier) { return barrier.buffer == buffer; };
+  std::erase_if(bufBarriersToFlush, sameBuffer);
+  for (auto& entry : queueReleases)
+    std::erase_if(entry.second.bufferBarriers, sameBuffer);
+}
+
+void ResourceStates::registerCommandBuffer(vk::CommandBuffer com_buffer, uint32_t queue_family)
+{
+  commandBufferFamilies.insert_or_assign(
+    std::bit_cast<HandleType>(static_cast<VkCommandBuffer>(com_buffer)), queue_family);
+}
+
+void ResourceStates::unregisterCommandBuffer(vk::CommandBuffer com_buffer)
+{
+  commandBufferFamilies.erase(std::bit_cast<HandleType>(static_cast<VkCommandBuffer>(com_buffer)));
+}
+
+uint32_t ResourceStates::getQueueFamily(vk::CommandBuffer com_buffer) const
+{
+  auto it =
+    commandBufferFamilies.find(std::bit_cast<HandleType>(static_cast<VkCommandBuffer>(com_buffer)));
+  return it != commandBufferFamilies.end() ? it->second : defaultQueueFamily;
+}
+
+ResourceStates::ImageState& ResourceStates::getImageState(vk::Image image)
+{
+  HandleType resHandle = std::bit_cast<HandleType>(static_cast<VkImage>(image));
+  auto [it, inserted] = imageIds.try_emplace(resHandle, TrackedImageId::Invalid);
+  if (inserted)
+    it->second = allocateImageSlot();
+  return images[static_cast<uint32_t>(it->second)];
+}
+
+ResourceStates::BufferRanges& ResourceStates::getBufferState(vk::Buffer buffer)
+{
+  HandleType resHandle = std::bit_cast<HandleType>(static_cast<VkBuffer>(buffer));
+  auto [it, inserted] = bufferIds.try_emplace(resHandle, TrackedBufferId::Invalid);
+  if (inserted)
+    it->second = allocateBufferSlot();
+  return buffers[static_cast<uint32_t>(it->second)];
+}
+
+void ResourceStates::setBufferState(
+  vk::CommandBuffer com_buffer,
+  vk::Buffer buffer,
+  vk::PipelineStageFlags2 pipeline_stage_flag,
+  vk::AccessFlags2 access_flags,
+  ForceSetState force)
+{
+  setBufferState(com_buffer, buffer, pipeline_stage_flag, access_flags, 0, vk::WholeSize, force);
+}
+
 void ResourceStates::setBufferState(
   vk::CommandBuffer com_buffer,
   vk::Buffer buffer,
   vk::PipelineStageFlags2 pipeline_stage_flag,
   vk::AccessFlags2 access_flags,
+  vk::DeviceSize offset,
+  vk::DeviceSize size,
   ForceSetState force)
 {
-  HandleType resHandle = std::bit_cast<HandleType>(static_cast<VkBuffer>(buffer));
-  if (currentStates.count(resHandle) == 0)
-  {
-    currentStates.emplace(resHandle, BufferState{.owner = com_buffer});
-  }
-  BufferState newState{
-    .piplineStageFlags = pipeline_stage_flag,
-    .accessFlags = access_flags,
-    .owner = com_buffer,
-  };
-  auto& oldState = std::get<1>(currentStates.at(resHandle));
-  if (force == ForceSetState::eFalse && newState == oldState)
-    return;
-  bufBarriersToFlush.push_back(vk::BufferMemoryBarrier2{
-    .srcStageMask = oldState.piplineStageFlags,
-    .srcAccessMask = oldState.accessFlags,
-    .dstStageMask = newState.piplineStageFlags,
-    .dstAccessMask = newState.accessFlags,
-    .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
-    .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
-    .buffer = buffer,
-    .offset = 0,
-    .size = VK_WHOLE_SIZE,
-  });
-  oldState = newState;
+  transitionBuffer(
+    getBufferState(buffer),
+    buffer,
+    pipeline_stage_flag,
+    access_flags,
+    offset,
+    size,
+    getQueueFamily(com_buffer),
+    force);
+}
+
+void ResourceStates::setBufferState(
+  vk::CommandBuffer com_buffer,
+  const Buffer& buffer,
+  vk::PipelineStageFlags2 pipeline_stage_flag,
+  vk::AccessFlags2 access_flags,
+  vk::DeviceSize offset,
+  vk::DeviceSize size,
+  ForceSetState force)
+{
+  setBufferState(
+    com_buffer,
+    buffer.trackingId,
+    buffer.get(),
+    pipeline_stage_flag,
+    access_flags,
+    offset,
+    size,
+    force);
+}
+
+void ResourceStates::setBufferState(
+  vk::CommandBuffer com_buffer,
+  TrackedBufferId id,
+  vk::Buffer buffer,
+  vk::PipelineStageFlags2 pipeline_stage_flag,
+  vk::AccessFlags2 access_flags,
+  vk::DeviceSize offset,
+  vk::DeviceSize size,
+  ForceSetState force)
+{
+  auto& state =
+    id != TrackedBufferId::Invalid ? buffers[static_cast<uint32_t>(id)] : getBufferState(buffer);
+  transitionBuffer(
+    state,
+    buffer,
+    pipeline_stage_flag,
+    access_flags,
+    offset,
+    size,
+    getQueueFamily(com_buffer),
+    force);
+}
+
+// Contents owned by one queue family are only visible to another one after the first
+// releases them and the second acquires them. Concurrent resources are never owned.
+static bool needs_ownership_transfer(uint32_t owner, uint32_t queue_family)
+{
+  return owner != vk::QueueFamilyIgnored && owner != queue_family;
+}
+
+// Converts a range of bytes into the runs it covers, clamped to the buffer
+static std::pair<vk::DeviceSize, vk::DeviceSize> buffer_runs(
+  vk::DeviceSize buffer_size, vk::DeviceSize offset, vk::DeviceSize size)
+{
+  if (buffer_size == 0)
+    return {0, 1};
+  offset = std::min(offset, buffer_size);
+  const vk::DeviceSize end =
+    size == vk::WholeSize || size > buffer_size - offset ? buffer_size : offset + size;
+  return {offset, end};
+}
+
+// Inverse of buffer_runs, gives the offset and the size of the bytes covered by the runs
+static std::pair<vk::DeviceSize, vk::DeviceSize> buffer_bytes(
+  vk::DeviceSize buffer_size, vk::DeviceSize begin, vk::DeviceSize end)
+{
+  if (buffer_size == 0)
+    return {0, vk::WholeSize};
+  return {begin, end - begin};
+}
+
+void ResourceStates::transitionBuffer(
+  BufferRanges& state,
+  vk::Buffer buffer,
+  vk::PipelineStageFlags2 pipeline_stage_flag,
+  vk::AccessFlags2 access_flags,
+  vk::DeviceSize offset,
+  vk::DeviceSize size,
+  uint32_t queue_family,
+  ForceSetState force)
+{
+  ETNA_VERIFYF(
+    !state.released,
+    "Buffer was released with etna::release_state, acquire it with etna::acquire_state first");
+
+  const auto [runsBegin, runsEnd] = buffer_runs(state.size, offset, size);
+
+  state.ranges.update(
+    runsBegin,
+    runsEnd,
+    [&](vk::DeviceSize begin, vk::DeviceSize end, BufferState& range_state) {
+      const uint32_t owner = range_state.queueFamily;
+      range_state.queueFamily = state.concurrent ? vk::QueueFamilyIgnored : queue_family;
+      const auto [rangeOffset, rangeSize] = buffer_bytes(state.size, begin, end);
+
+      if (needs_ownership_transfer(owner, queue_family))
+      {
+        // The acquire makes the contents visible on the new queue much like a write does
+        const auto source = applyAccess(
+          range_state.access, pipeline_stage_flag, access_flags, true, ForceSetState::eTrue);
+        queueReleases[owner].bufferBarriers.push_back(vk::BufferMemoryBarrier2{
+          .srcStageMask = source->stages,
+          .srcAccessMask = source->access,
+          .srcQueueFamilyIndex = owner,
+          .dstQueueFamilyIndex = queue_family,
+          .buffer = buffer,
+          .offset = rangeOffset,
+          .size = rangeSize,
+        });
+        bufBarriersToFlush.push_back(vk::BufferMemoryBarrier2{
+          .dstStageMask = pipeline_stage_flag,
+          .dstAccessMask = access_flags,
+          .srcQueueFamilyIndex = owner,
+          .dstQueueFamilyIndex = queue_family,
+          .buffer = buffer,
+          .offset = rangeOffset,
+          .size = rangeSize,
+        });
+        return;
+      }
+
+      const auto source =
+        applyAccess(range_state.access, pipeline_stage_flag, access_flags, false, force);
+      if (!source.has_value())
+        return;
+      bufBarriersToFlush.push_back(vk::BufferMemoryBarrier2{
+        .srcStageMask = source->stages,
+        .srcAccessMask = source->access,
+        .dstStageMask = pipeline_stage_flag,
+        .dstAccessMask = access_flags,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .buffer = buffer,
+        .offset = rangeOffset,
+        .size = rangeSize,
+      });
+    });
+}
+
+void ResourceStates::discardTextureContents(
+  const Image& image, vk::PipelineStageFlags2 src_stages, vk::AccessFlags2 src_access)
+{
+  auto& state = image.trackingId != TrackedImageId::Invalid
+    ? images[static_cast<uint32_t>(image.trackingId)]
+    : getImageState(image.get());
+  ETNA_VERIFYF(!state.released, "Cannot discard an image released with etna::release_state");
+  state.subresources = StateRuns<TextureState>(
+    state.subresources.size(),
+    TextureState{
+      .access = {.writeStages = src_stages, .writeAccess = src_access},
+      .layout = vk::ImageLayout::eUndefined,
+    });
 }
 
 void ResourceStates::setExternalTextureState(
@@ -48,14 +426,18 @@ void ResourceStates::setExternalTextureState(
   vk::ImageLayout layout)
 {
   HandleType resHandle = std::bit_cast<HandleType>(static_cast<VkImage>(image));
-  currentStates.emplace(
-    resHandle,
-    TextureState{
-      .piplineStageFlags = pipeline_stage_flag,
-      .accessFlags = access_flags,
-      .layout = layout,
-      .owner = {},
-    });
+  auto [it, inserted] = imageIds.try_emplace(resHandle, TrackedImageId::Invalid);
+  if (!inserted)
+    return;
+  it->second = allocateImageSlot();
+  images[static_cast<uint32_t>(it->second)] = ImageState{
+    .subresources = StateRuns<TextureState>(
+      1,
+      TextureState{
+        .access = {.writeStages = pipeline_stage_flag, .writeAccess = access_flags},
+        .layout = layout,
+      }),
+  };
 }
 
 void ResourceStates::setTextureState(
@@ -67,40 +449,271 @@ void ResourceStates::setTextureState(
   vk::ImageAspectFlags aspect_flags,
   ForceSetState force)
 {
-  HandleType resHandle = std::bit_cast<HandleType>(static_cast<VkImage>(image));
-  if (currentStates.count(resHandle) == 0)
+  setTextureState(
+    com_buffer,
+    image,
+    pipeline_stage_flag,
+    access_flags,
+    layout,
+    vk::ImageSubresourceRange{
+      .aspectMask = aspect_flags,
+      .baseMipLevel = 0,
+      .levelCount = vk::RemainingMipLevels,
+      .baseArrayLayer = 0,
+      .layerCount = vk::RemainingArrayLayers,
+    },
+    force);
+}
+
+// Resolves VK_REMAINING_* counts, images unknown to the tracker are treated as a single subresource
+static std::pair<uint32_t, uint32_t> resolve_subresources(
+  uint32_t base, uint32_t count, uint32_t total)
+{
+  if (total == 1)
+    return {0, 1};
+  if (count == vk::RemainingMipLevels)
+    count = total - std::min(base, total);
+  ETNA_ASSERTF(
+    base < total && count > 0 && base + count <= total,
+    "Subresource range [{}, {}) does not fit into {} mip levels or layers",
+    base,
+    base + count,
+    total);
+  return {base, count};
+}
+
+// Splits a range of subresource indices into rectangles of mips and layers
+template <class F>
+static void for_each_subresource_rect(uint32_t layers, uint64_t begin, uint64_t end, F&& func)
+{
+  while (begin < end)
+  {
+    const auto mip = static_cast<uint32_t>(begin / layers);
+    const auto layer = static_cast<uint32_t>(begin % layers);
+    if (layer != 0 || end - begin < layers)
+    {
+      const auto count = static_cast<uint32_t>(std::min<uint64_t>(layers - layer, end - begin));
+      func(mip, 1u, layer, count);
+      begin += count;
+    }
+    else
+    {
+      const auto mipCount = static_cast<uint32_t>((end - begin) / layers);
+      func(mip, mipCount, 0u, layers);
+      begin += uint64_t{mipCount} * layers;
+    }
+  }
+}
+
+// Whole mips are contiguous in the numbering, otherwise every mip is updated separately
+template <class T, class F>
+static void update_subresources(
+  StateRuns<T>& subresources,
+  uint32_t layers,
+  std::pair<uint32_t, uint32_t> mips_range,
+  std::pair<uint32_t, uint32_t> layers_range,
+  F&& visit)
+{
+  const auto [baseMip, mipCount] = mips_range;
+  const auto [baseLayer, layerCount] = layers_range;
+  const uint64_t layersPerMip = layers;
+  if (layerCount == layers)
+  {
+    subresources.update(baseMip * layersPerMip, (baseMip + mipCount) * layersPerMip, visit);
+  }
+  else
   {
-    currentStates.emplace(resHandle, TextureState{.owner = com_buffer});
+    for (uint32_t mip = baseMip; mip < baseMip + mipCount; ++mip)
+      subresources.update(
+        mip * layersPerMip + baseLayer, mip * layersPerMip + baseLayer + layerCount, visit);
   }
-  TextureState newState{
-    .piplineStageFlags = pipeline_stage_flag,
-    .accessFlags = access_flags,
-    .layout = layout,
-    .owner = com_buffer,
+}
+
+// Whole dimensions are spelled as VK_REMAINING_* so that unknown images are covered
+static vk::ImageSubresourceRange make_subresource_range(
+  vk::ImageAspectFlags aspects,
+  uint32_t mip_levels,
+  uint32_t layers,
+  uint32_t mip,
+  uint32_t mips,
+  uint32_t layer,
+  uint32_t layer_count)
+{
+  return vk::ImageSubresourceRange{
+    .aspectMask = aspects,
+    .baseMipLevel = mip,
+    .levelCount = mips == mip_levels ? vk::RemainingMipLevels : mips,
+    .baseArrayLayer = layer,
+    .layerCount = layer_count == layers ? vk::RemainingArrayLayers : layer_count,
   };
-  auto& oldState = std::get<0>(currentStates.at(resHandle));
-  if (force == ForceSetState::eFalse && newState == oldState)
-    return;
-  imgBarriersToFlush.push_back(vk::ImageMemoryBarrier2{
-    .srcStageMask = oldState.piplineStageFlags,
-    .srcAccessMask = oldState.accessFlags,
-    .dstStageMask = newState.piplineStageFlags,
-    .dstAccessMask = newState.accessFlags,
-    .oldLayout = oldState.layout,
-    .newLayout = newState.layout,
-    .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
-    .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
-    .image = image,
-    .subresourceRange =
+}
+
+static void push_image_barriers(
+  std::vector<vk::ImageMemoryBarrier2>& barriers,
+  vk::Image image,
+  uint32_t mip_levels,
+  uint32_t layers,
+  uint64_t begin,
+  uint64_t end,
+  ResourceStates::BarrierSource source,
+  vk::PipelineStageFlags2 pipeline_stage_flag,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout old_layout,
+  vk::ImageLayout layout,
+  vk::ImageAspectFlags aspects,
+  uint32_t src_queue_family = vk::QueueFamilyIgnored,
+  uint32_t dst_queue_family = vk::QueueFamilyIgnored)
+{
+  for_each_subresource_rect(
+    layers, begin, end, [&](uint32_t mip, uint32_t mips, uint32_t layer, uint32_t layer_count) {
+      barriers.push_back(vk::ImageMemoryBarrier2{
+        .srcStageMask = source.stages,
+        .srcAccessMask = source.access,
+        .dstStageMask = pipeline_stage_flag,
+        .dstAccessMask = access_flags,
+        .oldLayout = old_layout,
+        .newLayout = layout,
+        .srcQueueFamilyIndex = src_queue_family,
+        .dstQueueFamilyIndex = dst_queue_family,
+        .image = image,
+        .subresourceRange =
+          make_subresource_range(aspects, mip_levels, layers, mip, mips, layer, layer_count),
+      });
+    });
+}
+
+void ResourceStates::setTextureState(
+  vk::CommandBuffer com_buffer,
+  vk::Image image,
+  vk::PipelineStageFlags2 pipeline_stage_flag,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout layout,
+  vk::ImageSubresourceRange range,
+  ForceSetState force)
+{
+  transitionImage(
+    getImageState(image),
+    image,
+    pipeline_stage_flag,
+    access_flags,
+    layout,
+    range,
+    getQueueFamily(com_buffer),
+    force);
+}
+
+void ResourceStates::setTextureState(
+  vk::CommandBuffer com_buffer,
+  const Image& image,
+  vk::PipelineStageFlags2 pipeline_stage_flag,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout layout,
+  vk::ImageSubresourceRange range,
+  ForceSetState force)
+{
+  auto& state = image.trackingId != TrackedImageId::Invalid
+    ? images[static_cast<uint32_t>(image.trackingId)]
+    : getImageState(image.get());
+  transitionImage(
+    state,
+    image.get(),
+    pipeline_stage_flag,
+    access_flags,
+    layout,
+    range,
+    getQueueFamily(com_buffer),
+    force);
+}
+
+void ResourceStates::transitionImage(
+  ImageState& image_state,
+  vk::Image image,
+  vk::PipelineStageFlags2 pipeline_stage_flag,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout layout,
+  vk::ImageSubresourceRange range,
+  uint32_t queue_family,
+  ForceSetState force)
+{
+
+  ETNA_VERIFYF(
+    !image_state.released,
+    "Image was released with etna::release_state, acquire it with etna::acquire_state first");
+
+  const auto mips =
+    resolve_subresources(range.baseMipLevel, range.levelCount, image_state.mipLevels);
+  const auto layers =
+    resolve_subresources(range.baseArrayLayer, range.layerCount, image_state.layers);
+
+  update_subresources(
+    image_state.subresources,
+    image_state.layers,
+    mips,
+    layers,
+    [&](uint64_t begin, uint64_t end, TextureState& state) {
+      const vk::ImageLayout oldLayout = state.layout;
+      const uint32_t owner = state.queueFamily;
+      state.queueFamily = image_state.concurrent ? vk::QueueFamilyIgnored : queue_family;
+
+      // Undefined contents are not worth keeping, so the new queue simply takes them over
+      if (needs_ownership_transfer(owner, queue_family) && oldLayout != vk::ImageLayout::eUndefined)
       {
-        .aspectMask = aspect_flags,
-        .baseMipLevel = 0,
-        .levelCount = vk::RemainingMipLevels,
-        .baseArrayLayer = 0,
-        .layerCount = vk::RemainingArrayLayers,
-      },
-  });
-  oldState = newState;
+        // Both halves have to specify the same layout transition, it happens only once
+        const auto source =
+          applyAccess(state.access, pipeline_stage_flag, access_flags, true, ForceSetState::eTrue);
+        state.layout = layout;
+        push_image_barriers(
+          queueReleases[owner].imageBarriers,
+          image,
+          image_state.mipLevels,
+          image_state.layers,
+          begin,
+          end,
+          *source,
+          {},
+          {},
+          oldLayout,
+          layout,
+          range.aspectMask,
+          owner,
+          queue_family);
+        push_image_barriers(
+          imgBarriersToFlush,
+          image,
+          image_state.mipLevels,
+          image_state.layers,
+          begin,
+          end,
+          BarrierSource{},
+          pipeline_stage_flag,
+          access_flags,
+          oldLayout,
+          layout,
+          range.aspectMask,
+          owner,
+          queue_family);
+        return;
+      }
+
+      const auto source =
+        applyAccess(state.access, pipeline_stage_flag, access_flags, oldLayout != layout, force);
+      state.layout = layout;
+      if (!source.has_value())
+        return;
+      push_image_barriers(
+        imgBarriersToFlush,
+        image,
+        image_state.mipLevels,
+        image_state.layers,
+        begin,
+        end,
+        *source,
+        pipeline_stage_flag,
+        access_flags,
+        oldLayout,
+        layout,
+        range.aspectMask);
+    });
 }
 
 void ResourceStates::flushBarriers(vk::CommandBuffer com_buf)
@@ -115,60 +728,852 @@ void ResourceStates::flushBarriers(vk::CommandBuffer com_buf)
     .pImageMemoryBarriers = imgBarriersToFlush.data(),
   };
   com_buf.pipelineBarrier2(depInfo);
+  recordBarriers(false, imgBarriersToFlush, bufBarriersToFlush);
   imgBarriersToFlush.clear();
   bufBarriersToFlush.clear();
 }
 
-void ResourceStates::setColorTarget(
-  vk::CommandBuffer com_buffer, vk::Image image, BarrierBehavior behavior)
+void ResourceStates::recycleEventPool()
 {
-  if (get_context().shouldGenerateBarriersWhen(behavior))
+  auto& pool = eventPools.get();
+  if (pool.batch == workCount.batchIndex())
+    return;
+  // Every release takes an event, so releases of other frames with the same batch index
+  // as a pool that was never used cannot be mistaken for its own
+  if (pool.used == 0)
   {
-    setTextureState(
-      com_buffer,
-      image,
-      vk::PipelineStageFlagBits2::eColorAttachmentOutput,
-      vk::AccessFlagBits2::eColorAttachmentWrite,
-      vk::ImageLayout::eColorAttachmentOptimal,
-      vk::ImageAspectFlagBits::eColor);
+    pool.batch = workCount.batchIndex();
+    return;
   }
+
+  // The GPU is done with the frame that used this pool last time. Releases from that frame
+  // which were never acquired are dropped, and the next use of such a resource waits on all
+  // prior work instead of the event.
+  const AccessState fullBarrier{
+    .writeStages = vk::PipelineStageFlagBits2::eAllCommands,
+    .writeAccess = vk::AccessFlagBits2::eMemoryWrite,
+  };
+  std::erase_if(imageReleases, [&](const auto& entry) {
+    if (entry.second.batch != pool.batch)
+      return false;
+    const auto image = vk::Image(std::bit_cast<VkImage>(entry.first));
+    spdlog::warn(
+      "{} was released on frame {} and never acquired", getResourceName(image), pool.batch);
+    auto& state = getImageState(image);
+    state.released = false;
+    state.subresources.update(
+      0, state.subresources.size(), [&](uint64_t, uint64_t, TextureState& subresource) {
+        subresource.access = fullBarrier;
+      });
+    return true;
+  });
+  std::erase_if(bufferReleases, [&](const auto& entry) {
+    if (entry.second.batch != pool.batch)
+      return false;
+    const auto buffer = vk::Buffer(std::bit_cast<VkBuffer>(entry.first));
+    spdlog::warn(
+      "{} was released on frame {} and never acquired", getResourceName(buffer), pool.batch);
+    auto& state = getBufferState(buffer);
+    state.released = false;
+    state.ranges.update(0, state.ranges.size(), [&](uint64_t, uint64_t, BufferState& range) {
+      range.access = fullBarrier;
+    });
+    return true;
+  });
+  for (std::size_t i = 0; i < pool.used; ++i)
+    ETNA_CHECK_VK_RESULT(device.resetEvent(pool.events[i].get()));
+  pool.batch = workCount.batchIndex();
+  pool.used = 0;
 }
 
-void ResourceStates::setDepthStencilTarget(
+vk::Event ResourceStates::allocateEvent()
+{
+  recycleEventPool();
+  auto& pool = eventPools.get();
+  if (pool.used == pool.events.size())
+    pool.events.push_back(unwrap_vk_result(device.createEventUnique(vk::EventCreateInfo{})));
+  return pool.events[pool.used++].get();
+}
+
+ResourceStates::SplitBarrier ResourceStates::release(
+  vk::CommandBuffer com_buffer, std::size_t first_image_barrier, std::size_t first_buffer_barrier)
+{
+  SplitBarrier result{
+    .event = {},
+    .batch = workCount.batchIndex(),
+    .imageBarriers = std::vector<vk::ImageMemoryBarrier2>(
+      imgBarriersToFlush.begin() + first_image_barrier, imgBarriersToFlush.end()),
+    .bufferBarriers = std::vector<vk::BufferMemoryBarrier2>(
+      bufBarriersToFlush.begin() + first_buffer_barrier, bufBarriersToFlush.end()),
+  };
+  imgBarriersToFlush.resize(first_image_barrier);
+  bufBarriersToFlush.resize(first_buffer_barrier);
+  if (result.imageBarriers.empty() && result.bufferBarriers.empty())
+    return result;
+
+  // Acquiring ownership has to wait for the release on another queue, not for an event
+  const auto transfersOwnership = [](const auto& barrier) {
+    return barrier.srcQueueFamilyIndex != barrier.dstQueueFamilyIndex;
+  };
+  ETNA_VERIFYF(
+    std::ranges::none_of(result.imageBarriers, transfersOwnership) &&
+      std::ranges::none_of(result.bufferBarriers, transfersOwnership),
+    "Split barriers cannot transfer resources between queue families, use etna::set_state");
+
+  result.event = allocateEvent();
+  com_buffer.setEvent2(
+    result.event,
+    vk::DependencyInfo{
+      .bufferMemoryBarrierCount = static_cast<uint32_t>(result.bufferBarriers.size()),
+      .pBufferMemoryBarriers = result.bufferBarriers.data(),
+      .imageMemoryBarrierCount = static_cast<uint32_t>(result.imageBarriers.size()),
+      .pImageMemoryBarriers = result.imageBarriers.data(),
+    });
+  recordBarriers(true, result.imageBarriers, result.bufferBarriers);
+  return result;
+}
+
+void ResourceStates::acquire(vk::CommandBuffer com_buffer, const SplitBarrier& barrier)
+{
+  // The dependency info has to match the one the event was set with
+  const vk::DependencyInfo depInfo{
+    .bufferMemoryBarrierCount = static_cast<uint32_t>(barrier.bufferBarriers.size()),
+    .pBufferMemoryBarriers = barrier.bufferBarriers.data(),
+    .imageMemoryBarrierCount = static_cast<uint32_t>(barrier.imageBarriers.size()),
+    .pImageMemoryBarriers = barrier.imageBarriers.data(),
+  };
+  com_buffer.waitEvents2(1, &barrier.event, &depInfo);
+}
+
+void ResourceStates::releaseTextureState(
   vk::CommandBuffer com_buffer,
   vk::Image image,
-  vk::ImageAspectFlags aspect_flags,
-  BarrierBehavior behavior)
+  vk::PipelineStageFlags2 pipeline_stage_flag,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout layout,
+  vk::ImageSubresourceRange range)
+{
+  auto& state = getImageState(image);
+  const std::size_t firstImageBarrier = imgBarriersToFlush.size();
+  const std::size_t firstBufferBarrier = bufBarriersToFlush.size();
+  transitionImage(
+    state,
+    image,
+    pipeline_stage_flag,
+    access_flags,
+    layout,
+    range,
+    getQueueFamily(com_buffer),
+    ForceSetState::eFalse);
+
+  auto barrier = release(com_buffer, firstImageBarrier, firstBufferBarrier);
+  if (!barrier.event)
+    return;
+  state.released = true;
+  imageReleases.insert_or_assign(
+    std::bit_cast<HandleType>(static_cast<VkImage>(image)), std::move(barrier));
+}
+
+void ResourceStates::releaseBufferState(
+  vk::CommandBuffer com_buffer,
+  vk::Buffer buffer,
+  vk::PipelineStageFlags2 pipeline_stage_flag,
+  vk::AccessFlags2 access_flags)
+{
+  auto& state = getBufferState(buffer);
+  const std::size_t firstImageBarrier = imgBarriersToFlush.size();
+  const std::size_t firstBufferBarrier = bufBarriersToFlush.size();
+  transitionBuffer(
+    state,
+    buffer,
+    pipeline_stage_flag,
+    access_flags,
+    0,
+    vk::WholeSize,
+    getQueueFamily(com_buffer),
+    ForceSetState::eFalse);
+
+  auto barrier = release(com_buffer, firstImageBarrier, firstBufferBarrier);
+  if (!barrier.event)
+    return;
+  state.released = true;
+  bufferReleases.insert_or_assign(
+    std::bit_cast<HandleType>(static_cast<VkBuffer>(buffer)), std::move(barrier));
+}
+
+void ResourceStates::acquireTextureState(vk::CommandBuffer com_buffer, vk::Image image)
+{
+  // Nothing is recorded when the release did not need a barrier
+  auto it = imageReleases.find(std::bit_cast<HandleType>(static_cast<VkImage>(image)));
+  if (it == imageReleases.end())
+    return;
+  acquire(com_buffer, it->second);
+  getImageState(image).released = false;
+  imageReleases.erase(it);
+}
+
+void ResourceStates::acquireBufferState(vk::CommandBuffer com_buffer, vk::Buffer buffer)
+{
+  auto it = bufferReleases.find(std::bit_cast<HandleType>(static_cast<VkBuffer>(buffer)));
+  if (it == bufferReleases.end())
+    return;
+  acquire(com_buffer, it->second);
+  getBufferState(buffer).released = false;
+  bufferReleases.erase(it);
+}
+
+std::string ResourceStates::getResourceName(vk::Image image) const
+{
+  auto it = imageIds.find(std::bit_cast<HandleType>(static_cast<VkImage>(image)));
+  if (it != imageIds.end() && !images[static_cast<uint32_t>(it->second)].name.empty())
+    return images[static_cast<uint32_t>(it->second)].name;
+  return fmt::format("VkImage {:#x}", std::bit_cast<HandleType>(static_cast<VkImage>(image)));
+}
+
+std::string ResourceStates::getResourceName(vk::Buffer buffer) const
+{
+  auto it = bufferIds.find(std::bit_cast<HandleType>(static_cast<VkBuffer>(buffer)));
+  if (it != bufferIds.end() && !buffers[static_cast<uint32_t>(it->second)].name.empty())
+    return buffers[static_cast<uint32_t>(it->second)].name;
+  return fmt::format("VkBuffer {:#x}", std::bit_cast<HandleType>(static_cast<VkBuffer>(buffer)));
+}
+
+static std::string escape_json(std::string_view str)
 {
-  if (get_context().shouldGenerateBarriersWhen(behavior))
+  std::string result;
+  result.reserve(str.size());
+  for (char c : str)
   {
-    setTextureState(
-      com_buffer,
-      image,
-      vk::PipelineStageFlagBits2::eEarlyFragmentTests |
-        vk::PipelineStageFlagBits2::eLateFragmentTests,
-      vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
-      vk::ImageLayout::eDepthStencilAttachmentOptimal,
-      aspect_flags);
+    if (c == '"' || c == '\\')
+      result += '\\';
+    if (static_cast<unsigned char>(c) < 0x20)
+      result += fmt::format("\\u{:04x}", static_cast<int>(c));
+    else
+      result += c;
   }
+  return result;
 }
 
-void ResourceStates::setResolveTarget(
-  vk::CommandBuffer com_buffer,
+// Barriers without writes on either side are not needed for memory visibility. They
+// are still needed to wait for a transition into a read-only layout in other stages.
+static bool is_avoidable(
+  vk::AccessFlags2 src_access, vk::AccessFlags2 dst_access, bool layout_transition)
+{
+  return !layout_transition && !(src_access & WRITE_ACCESS) && !(dst_access & WRITE_ACCESS);
+}
+
+void ResourceStates::beginFrame()
+{
+  recycleEventPool();
+  if (frameStats.frame != workCount.batchIndex())
+    finishFrameStats();
+}
+
+void ResourceStates::recordBarriers(
+  bool split,
+  std::span<vk::ImageMemoryBarrier2 const> image_barriers,
+  std::span<vk::BufferMemoryBarrier2 const> buffer_barriers)
+{
+  // Applications which do not call begin_frame still get their frames told apart
+  if (frameStats.frame != workCount.batchIndex())
+    finishFrameStats();
+
+  const auto count = static_cast<uint32_t>(image_barriers.size() + buffer_barriers.size());
+  if (split)
+    ++frameStats.splitBarriers;
+  else
+    ++frameStats.flushes;
+  frameStats.maxBarriersPerFlush = std::max(frameStats.maxBarriersPerFlush, count);
+  frameStats.imageBarriers += static_cast<uint32_t>(image_barriers.size());
+  frameStats.bufferBarriers += static_cast<uint32_t>(buffer_barriers.size());
+
+  for (const auto& barrier : image_barriers)
+    if (is_avoidable(
+          barrier.srcAccessMask, barrier.dstAccessMask, barrier.oldLayout != barrier.newLayout))
+      ++frameStats.avoidableBarriers;
+  for (const auto& barrier : buffer_barriers)
+    if (is_avoidable(barrier.srcAccessMask, barrier.dstAccessMask, false))
+      ++frameStats.avoidableBarriers;
+
+  // Everything below looks up names and allocates, which is too slow to always do
+  const bool tracing = tracePath.has_value();
+  if (!collectStats && !tracing)
+    return;
+
+  std::unordered_set<HandleType> seen;
+  std::vector<std::string> traced;
+  // Returns whether the resource already had a barrier in this command
+  auto account = [&](HandleType handle, const std::string& name) {
+    if (collectStats)
+      ++frameStats.byResource[name];
+    if (seen.insert(handle).second)
+      return false;
+    ++frameStats.mergeableBarriers;
+    return true;
+  };
+
+  for (const auto& barrier : image_barriers)
+  {
+    const bool transition = barrier.oldLayout != barrier.newLayout;
+    if (collectStats && transition)
+      ++frameStats.byLayoutTransition[fmt::format(
+        "{} -> {}", vk::to_string(barrier.oldLayout), vk::to_string(barrier.newLayout))];
+    const auto name = getResourceName(barrier.image);
+    const bool mergeable =
+      account(std::bit_cast<HandleType>(static_cast<VkImage>(barrier.image)), name);
+    if (!tracing)
+      continue;
+    // Counts of VK_REMAINING_MIP_LEVELS and VK_REMAINING_ARRAY_LAYERS are written as -1
+    const auto& range = barrier.subresourceRange;
+    traced.push_back(fmt::format(
+      "{{\"resource\": \"{}\", \"type\": \"image\", \"srcStages\": \"{}\", "
+      "\"srcAccess\": \"{}\", \"dstStages\": \"{}\", \"dstAccess\": \"{}\", "
+      "\"oldLayout\": \"{}\", \"newLayout\": \"{}\", \"aspects\": \"{}\", "
+      "\"mips\": [{}, {}], \"layers\": [{}, {}], \"avoidable\": {}, \"mergeable\": {}}}",
+      escape_json(name),
+      vk::to_string(barrier.srcStageMask),
+      vk::to_string(barrier.srcAccessMask),
+      vk::to_string(barrier.dstStageMask),
+      vk::to_string(barrier.dstAccessMask),
+      vk::to_string(barrier.oldLayout),
+      vk::to_string(barrier.newLayout),
+      vk::to_string(range.aspectMask),
+      range.baseMipLevel,
+      static_cast<int32_t>(range.levelCount),
+      range.baseArrayLayer,
+      static_cast<int32_t>(range.layerCount),
+      is_avoidable(barrier.srcAccessMask, barrier.dstAccessMask, transition),
+      mergeable));
+  }
+  for (const auto& barrier : buffer_barriers)
+  {
+    const auto name = getResourceName(barrier.buffer);
+    const bool mergeable =
+      account(std::bit_cast<HandleType>(static_cast<VkBuffer>(barrier.buffer)), name);
+    if (!tracing)
+      continue;
+    // VK_WHOLE_SIZE is written as -1
+    traced.push_back(fmt::format(
+      "{{\"resource\": \"{}\", \"type\": \"buffer\", \"srcStages\": \"{}\", "
+      "\"srcAccess\": \"{}\", \"dstStages\": \"{}\", \"dstAccess\": \"{}\", "
+      "\"offset\": {}, \"size\": {}, \"avoidable\": {}, \"mergeable\": {}}}",
+      escape_json(name),
+      vk::to_string(barrier.srcStageMask),
+      vk::to_string(barrier.srcAccessMask),
+      vk::to_string(barrier.dstStageMask),
+      vk::to_string(barrier.dstAccessMask),
+      barrier.offset,
+      static_cast<int64_t>(barrier.size),
+      is_avoidable(barrier.srcAccessMask, barrier.dstAccessMask, false),
+      mergeable));
+  }
+
+  if (tracing)
+    traceCommands.push_back(fmt::format(
+      "    {{\"command\": \"{}\", \"barriers\": [\n      {}\n    ]}}",
+      split ? "vkCmdSetEvent2" : "vkCmdPipelineBarrier2",
+      fmt::join(traced, ",\n      ")));
+}
+
+void ResourceStates::finishFrameStats()
+{
+  TracyPlot("Barriers", static_cast<int64_t>(frameStats.imageBarriers + frameStats.bufferBarriers));
+  TracyPlot("Barrier flushes", static_cast<int64_t>(frameStats.flushes));
+  TracyPlot("Avoidable barriers", static_cast<int64_t>(frameStats.avoidableBarriers));
+  TracyPlot("Mergeable barriers", static_cast<int64_t>(frameStats.mergeableBarriers));
+
+  if (tracePath.has_value())
+  {
+    writeTrace();
+    tracePath.reset();
+    traceCommands.clear();
+  }
+
+  lastFrameStats = std::move(frameStats);
+  frameStats = BarrierStats{.frame = workCount.batchIndex()};
+
+  if (traceRequest.has_value())
+  {
+    tracePath = std::move(traceRequest);
+    traceRequest.reset();
+  }
+}
+
+void ResourceStates::writeTrace() const
+{
+  std::ofstream out(*tracePath, std::ios::trunc);
+  out << fmt::format(
+    "{{\n  \"frame\": {},\n  \"commands\": [\n{}\n  ]\n}}\n",
+    frameStats.frame,
+    fmt::join(traceCommands, ",\n"));
+  if (!out)
+    spdlog::warn("Failed to write barrier trace {}", *tracePath);
+  else
+    spdlog::info("Barrier trace of frame {} written to {}", frameStats.frame, *tracePath);
+}
+
+void ResourceStates::captureTrace(std::filesystem::path path)
+{
+  traceRequest = std::move(path);
+}
+
+vk::CommandBuffer ResourceStates::allocatePrologue(uint32_t queue_family)
+{
+  auto it = prologuePools.find(queue_family);
+  if (it == prologuePools.end())
+  {
+    auto createPool = [this, queue_family](std::size_t) {
+      return ProloguePool{
+        .pool = unwrap_vk_result(device.createCommandPoolUnique(vk::CommandPoolCreateInfo{
+          .flags = vk::CommandPoolCreateFlagBits::eTransient,
+          .queueFamilyIndex = queue_family,
+        })),
+      };
+    };
+    it = prologuePools.try_emplace(queue_family, workCount, createPool).first;
+  }
+
+  auto& pool = it->second.get();
+  if (pool.batch != workCount.batchIndex())
+  {
+    // The GPU is done with the frame that used this pool last time
+    ETNA_CHECK_VK_RESULT(device.resetCommandPool(pool.pool.get()));
+    pool.batch = workCount.batchIndex();
+    pool.used = 0;
+  }
+
+  if (pool.used == pool.buffers.size())
+    pool.buffers.push_back(std::move(
+      unwrap_vk_result(device.allocateCommandBuffersUnique(vk::CommandBufferAllocateInfo{
+        .commandPool = pool.pool.get(),
+        .level = vk::CommandBufferLevel::ePrimary,
+        .commandBufferCount = 1,
+      }))[0]));
+  return pool.buffers[pool.used++].get();
+}
+
+vk::CommandBuffer ResourceStates::recordQueueReleases(uint32_t queue_family)
+{
+  auto it = queueReleases.find(queue_family);
+  if (it == queueReleases.end())
+    return {};
+  const QueueReleases releases = std::move(it->second);
+  queueReleases.erase(it);
+  if (releases.imageBarriers.empty() && releases.bufferBarriers.empty())
+    return {};
+
+  const vk::CommandBuffer cmd = allocatePrologue(queue_family);
+  ETNA_CHECK_VK_RESULT(cmd.begin(vk::CommandBufferBeginInfo{
+    .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+  }));
+  cmd.pipelineBarrier2(vk::DependencyInfo{
+    .bufferMemoryBarrierCount = static_cast<uint32_t>(releases.bufferBarriers.size()),
+    .pBufferMemoryBarriers = releases.bufferBarriers.data(),
+    .imageMemoryBarrierCount = static_cast<uint32_t>(releases.imageBarriers.size()),
+    .pImageMemoryBarriers = releases.imageBarriers.data(),
+  });
+  recordBarriers(false, releases.imageBarriers, releases.bufferBarriers);
+  ETNA_CHECK_VK_RESULT(cmd.end());
+  return cmd;
+}
+
+vk::CommandBuffer ResourceStates::resolve(CommandBufferStates& states)
+{
+  auto& local = *states.impl;
+  const uint32_t queueFamily = getQueueFamily(local.commandBuffer);
+  ETNA_VERIFYF(
+    local.imgBarriersToFlush.empty() && local.bufBarriersToFlush.empty(),
+    "Barriers of CommandBufferStates have to be flushed before resolving them");
+
+  // Barriers queued for the command buffer being recorded on this thread must stay there
+  auto pendingImageBarriers = std::exchange(imgBarriersToFlush, {});
+  auto pendingBufferBarriers = std::exchange(bufBarriersToFlush, {});
+
+  // Read-only uses only add readers to the global state, which happens in the transition
+  // itself. Otherwise the state the command buffer left the resource in replaces it.
+  for (const auto& [handle, localImage] : local.images)
+  {
+    const auto image = vk::Image(std::bit_cast<VkImage>(handle));
+    auto& state = getImageState(image);
+    localImage.subresources.forEach([&](uint64_t begin, uint64_t end, const auto& local_state) {
+      if (!local_state.firstUse.has_value())
+        return;
+      const auto& firstUse = *local_state.firstUse;
+      for_each_subresource_rect(
+        localImage.layers,
+        begin,
+        end,
+        [&](uint32_t mip, uint32_t mips, uint32_t layer, uint32_t layer_count) {
+          const auto range = make_subresource_range(
+            localImage.aspects,
+            localImage.mipLevels,
+            localImage.layers,
+            mip,
+            mips,
+            layer,
+            layer_count);
+          transitionImage(
+            state,
+            image,
+            firstUse.stages,
+            firstUse.access,
+            firstUse.layout,
+            range,
+            queueFamily,
+            ForceSetState::eFalse);
+          if (local_state.readOnly)
+            return;
+          // Ownership was settled by the transition, the local state knows nothing about it
+          update_subresources(
+            state.subresources,
+            state.layers,
+            resolve_subresources(range.baseMipLevel, range.levelCount, state.mipLevels),
+            resolve_subresources(range.baseArrayLayer, range.layerCount, state.layers),
+            [&](uint64_t, uint64_t, TextureState& global_state) {
+              const uint32_t owner = global_state.queueFamily;
+              global_state = local_state.state;
+              global_state.queueFamily = owner;
+            });
+        });
+    });
+  }
+
+  for (const auto& [handle, localBuffer] : local.buffers)
+  {
+    const auto buffer = vk::Buffer(std::bit_cast<VkBuffer>(handle));
+    auto& state = getBufferState(buffer);
+    const vk::DeviceSize localSize = localBuffer.size;
+    localBuffer.ranges.forEach([&](uint64_t begin, uint64_t end, const auto& local_state) {
+      if (!local_state.firstUse.has_value())
+        return;
+      // The sizes known to the local and the global trackers may differ
+      const auto [offset, size] = buffer_bytes(localSize, begin, end);
+      transitionBuffer(
+        state,
+        buffer,
+        local_state.firstUse->stages,
+        local_state.firstUse->access,
+        offset,
+        size,
+        queueFamily,
+        ForceSetState::eFalse);
+      if (local_state.readOnly)
+        return;
+      const auto [runsBegin, runsEnd] = buffer_runs(state.size, offset, size);
+      state.ranges.update(runsBegin, runsEnd, [&](uint64_t, uint64_t, BufferState& global_state) {
+        const uint32_t owner = global_state.queueFamily;
+        global_state = local_state.state;
+        global_state.queueFamily = owner;
+      });
+    });
+  }
+
+  vk::CommandBuffer prologue{};
+  if (!imgBarriersToFlush.empty() || !bufBarriersToFlush.empty())
+  {
+    prologue = allocatePrologue(queueFamily);
+    ETNA_CHECK_VK_RESULT(prologue.begin(vk::CommandBufferBeginInfo{
+      .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+    }));
+    flushBarriers(prologue);
+    ETNA_CHECK_VK_RESULT(prologue.end());
+  }
+
+  imgBarriersToFlush = std::move(pendingImageBarriers);
+  bufBarriersToFlush = std::move(pendingBufferBarriers);
+  local.images.clear();
+  local.buffers.clear();
+  return prologue;
+}
+
+// The prologue synchronizes the first use with everything before the command buffer
+static ResourceStates::AccessState first_access_state(
+  vk::PipelineStageFlags2 stages, vk::AccessFlags2 access)
+{
+  if (access & WRITE_ACCESS)
+    return {.writeStages = stages, .writeAccess = access};
+  ResourceStates::AccessState result;
+  ResourceStates::addVisibleRead(result, stages, access);
+  return result;
+}
+
+void CommandBufferStates::Impl::transitionImage(
   vk::Image image,
-  vk::ImageAspectFlags aspect_flags,
-  BarrierBehavior behavior)
+  uint32_t mip_levels,
+  uint32_t layers,
+  vk::PipelineStageFlags2 pipeline_stage_flag,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout layout,
+  vk::ImageSubresourceRange range)
 {
-  if (get_context().shouldGenerateBarriersWhen(behavior))
+  auto [it, inserted] =
+    images.try_emplace(std::bit_cast<HandleType>(static_cast<VkImage>(image)));
+  auto& local = it->second;
+  if (inserted)
   {
-    setTextureState(
-      com_buffer,
-      image,
-      vk::PipelineStageFlagBits2::eResolve,
-      vk::AccessFlagBits2::eTransferWrite,
-      vk::ImageLayout::eGeneral,
-      aspect_flags);
+    local.mipLevels = mip_levels;
+    local.layers = layers;
+    local.subresources =
+      StateRuns<LocalState<ResourceStates::TextureState>>(uint64_t{mip_levels} * layers);
   }
+  local.aspects |= range.aspectMask;
+
+  const bool read = !(access_flags & WRITE_ACCESS);
+  update_subresources(
+    local.subresources,
+    local.layers,
+    resolve_subresources(range.baseMipLevel, range.levelCount, local.mipLevels),
+    resolve_subresources(range.baseArrayLayer, range.layerCount, local.layers),
+    [&](uint64_t begin, uint64_t end, LocalState<ResourceStates::TextureState>& state) {
+      if (!state.firstUse.has_value())
+      {
+        state.firstUse = FirstUse{pipeline_stage_flag, access_flags, layout};
+        state.readOnly = read;
+        state.state.layout = layout;
+        state.state.access = first_access_state(pipeline_stage_flag, access_flags);
+        return;
+      }
+      // The prologue makes the previous contents visible to all reads of the first use at once
+      if (state.readOnly && read && layout == state.firstUse->layout)
+      {
+        state.firstUse->stages |= pipeline_stage_flag;
+        state.firstUse->access |= access_flags;
+        ResourceStates::addVisibleRead(state.state.access, pipeline_stage_flag, access_flags);
+        return;
+      }
+
+      state.readOnly = false;
+      const vk::ImageLayout oldLayout = state.state.layout;
+      const auto source = ResourceStates::applyAccess(
+        state.state.access,
+        pipeline_stage_flag,
+        access_flags,
+        oldLayout != layout,
+        ForceSetState::eFalse);
+      state.state.layout = layout;
+      if (!source.has_value())
+        return;
+      push_image_barriers(
+        imgBarriersToFlush,
+        image,
+        local.mipLevels,
+        local.layers,
+        begin,
+        end,
+        *source,
+        pipeline_stage_flag,
+        access_flags,
+        oldLayout,
+        layout,
+        range.aspectMask);
+    });
+}
+
+CommandBufferStates::CommandBufferStates(vk::CommandBuffer cmd)
+  : impl{std::make_unique<Impl>()}
+{
+  impl->commandBuffer = cmd;
+}
+
+CommandBufferStates::~CommandBufferStates() = default;
+CommandBufferStates::CommandBufferStates(CommandBufferStates&&) noexcept = default;
+CommandBufferStates& CommandBufferStates::operator=(CommandBufferStates&&) noexcept = default;
+
+vk::CommandBuffer CommandBufferStates::getCommandBuffer() const
+{
+  return impl->commandBuffer;
+}
+
+void CommandBufferStates::setState(
+  const Image& image,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout layout)
+{
+  setState(
+    image,
+    pipeline_stage_flags,
+    access_flags,
+    layout,
+    vk::ImageSubresourceRange{
+      .aspectMask = image.getAspectMaskByFormat(),
+      .baseMipLevel = 0,
+      .levelCount = vk::RemainingMipLevels,
+      .baseArrayLayer = 0,
+      .layerCount = vk::RemainingArrayLayers,
+    });
+}
+
+void CommandBufferStates::setState(
+  const Image& image,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout layout,
+  vk::ImageSubresourceRange range)
+{
+  impl->transitionImage(
+    image.get(),
+    static_cast<uint32_t>(image.getMipLevelCount()),
+    static_cast<uint32_t>(image.getLayerCount()),
+    pipeline_stage_flags,
+    access_flags,
+    layout,
+    range);
+}
+
+void CommandBufferStates::setState(
+  vk::Image image,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::ImageLayout layout,
+  vk::ImageAspectFlags aspect_flags)
+{
+  impl->transitionImage(
+    image,
+    1,
+    1,
+    pipeline_stage_flags,
+    access_flags,
+    layout,
+    vk::ImageSubresourceRange{
+      .aspectMask = aspect_flags,
+      .baseMipLevel = 0,
+      .levelCount = vk::RemainingMipLevels,
+      .baseArrayLayer = 0,
+      .layerCount = vk::RemainingArrayLayers,
+    });
+}
+
+void CommandBufferStates::setState(
+  vk::Buffer buffer,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::DeviceSize offset,
+  vk::DeviceSize size)
+{
+  impl->transitionBuffer(buffer, 0, pipeline_stage_flags, access_flags, offset, size);
+}
+
+void CommandBufferStates::setState(
+  const Buffer& buffer,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::DeviceSize offset,
+  vk::DeviceSize size)
+{
+  impl->transitionBuffer(
+    buffer.get(), buffer.getSize(), pipeline_stage_flags, access_flags, offset, size);
+}
+
+void CommandBufferStates::Impl::transitionBuffer(
+  vk::Buffer buffer,
+  vk::DeviceSize buffer_size,
+  vk::PipelineStageFlags2 pipeline_stage_flags,
+  vk::AccessFlags2 access_flags,
+  vk::DeviceSize offset,
+  vk::DeviceSize size)
+{
+  // The size is only taken into account on the first use of the buffer
+  auto [it, inserted] =
+    buffers.try_emplace(std::bit_cast<HandleType>(static_cast<VkBuffer>(buffer)));
+  auto& local = it->second;
+  if (inserted && buffer_size != 0)
+  {
+    local.size = buffer_size;
+    local.ranges = StateRuns<LocalState<ResourceStates::BufferState>>(buffer_size);
+  }
+  const auto [runsBegin, runsEnd] = buffer_runs(local.size, offset, size);
+  const bool read = !(access_flags & WRITE_ACCESS);
+
+  local.ranges.update(
+    runsBegin,
+    runsEnd,
+    [&](vk::DeviceSize begin, vk::DeviceSize end, auto& state) {
+      if (!state.firstUse.has_value())
+      {
+        state.firstUse = FirstUse{pipeline_stage_flags, access_flags, {}};
+        state.readOnly = read;
+        state.state.access = first_access_state(pipeline_stage_flags, access_flags);
+        return;
+      }
+      if (state.readOnly && read)
+      {
+        state.firstUse->stages |= pipeline_stage_flags;
+        state.firstUse->access |= access_flags;
+        ResourceStates::addVisibleRead(state.state.access, pipeline_stage_flags, access_flags);
+        return;
+      }
+
+      state.readOnly = false;
+      const auto source = ResourceStates::applyAccess(
+        state.state.access, pipeline_stage_flags, access_flags, false, ForceSetState::eFalse);
+      if (!source.has_value())
+        return;
+      const auto [rangeOffset, rangeSize] = buffer_bytes(local.size, begin, end);
+      bufBarriersToFlush.push_back(vk::BufferMemoryBarrier2{
+        .srcStageMask = source->stages,
+        .srcAccessMask = source->access,
+        .dstStageMask = pipeline_stage_flags,
+        .dstAccessMask = access_flags,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .buffer = buffer,
+        .offset = rangeOffset,
+        .size = rangeSize,
+      });
+    });
+}
+
+void CommandBufferStates::flushBarriers()
+{
+  if (impl->imgBarriersToFlush.empty() && impl->bufBarriersToFlush.empty())
+    return;
+  impl->commandBuffer.pipelineBarrier2(vk::DependencyInfo{
+    .dependencyFlags = vk::DependencyFlagBits::eByRegion,
+    .bufferMemoryBarrierCount = static_cast<uint32_t>(impl->bufBarriersToFlush.size()),
+    .pBufferMemoryBarriers = impl->bufBarriersToFlush.data(),
+    .imageMemoryBarrierCount = static_cast<uint32_t>(impl->imgBarriersToFlush.size()),
+    .pImageMemoryBarriers = impl->imgBarriersToFlush.data(),
+  });
+  impl->imgBarriersToFlush.clear();
+  impl->bufBarriersToFlush.clear();
+}
+
+void ResourceStates::setColorTarget(
+  vk::CommandBuffer com_buffer, vk::Image image, vk::ImageSubresourceRange range)
+{
+  setTextureState(
+    com_buffer,
+    image,
+    vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+    vk::AccessFlagBits2::eColorAttachmentWrite,
+    vk::ImageLayout::eColorAttachmentOptimal,
+    range);
+}
+
+void ResourceStates::setDepthStencilTarget(
+  vk::CommandBuffer com_buffer, vk::Image image, vk::ImageSubresourceRange range)
+{
+  setTextureState(
+    com_buffer,
+    image,
+    vk::PipelineStageFlagBits2::eEarlyFragmentTests |
+      vk::PipelineStageFlagBits2::eLateFragmentTests,
+    vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+    vk::ImageLayout::eDepthStencilAttachmentOptimal,
+    range);
+}
+
+void ResourceStates::setResolveTarget(
+  vk::CommandBuffer com_buffer, vk::Image image, vk::ImageSubresourceRange range)
+{
+  setTextureState(
+    com_buffer,
+    image,
+    vk::PipelineStageFlagBits2::eResolve,
+    vk::AccessFlagBits2::eTransferWrite,
+    vk::ImageLayout::eGeneral,
+    range);
 }
 
 } // namespace etna
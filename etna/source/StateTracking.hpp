@@ -4,37 +4,367 @@
 
 #include "etna/Vulkan.hpp"
 #include "etna/BarrierBehavior.hpp"
+#include "etna/BarrierStats.hpp"
+#include "etna/CommandBufferStates.hpp"
+#include "etna/Forward.hpp"
+#include "etna/GpuSharedResource.hpp"
 
-#include <variant>
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
 #include <unordered_map>
 
 namespace etna
 {
+
+/**
+ * Piecewise constant map from [0, size) to states, stored as a sorted list of runs.
+ * Adjacent runs with equal states are merged, so a resource which is used uniformly
+ * always takes up a single run no matter how it was split before.
+ */
+template <class T>
+class StateRuns
+{
+public:
+  explicit StateRuns(uint64_t size = 1, T initial = {})
+    : runs{Run{size, std::move(initial)}}
+  {
+  }
+
+  // Calls visit(begin, end, state) for every run intersecting [begin, end), after splitting
+  // the runs at the range boundaries. The callback may change the state of the run.
+  template <class F>
+  void update(uint64_t begin, uint64_t end, F&& visit)
+  {
+    end = std::min(end, size());
+    if (begin >= end)
+      return;
+
+    const std::size_t first = split(begin);
+    const std::size_t last = split(end);
+    uint64_t runBegin = begin;
+    for (std::size_t i = first; i < last; ++i)
+    {
+      visit(runBegin, runs[i].end, runs[i].state);
+      runBegin = runs[i].end;
+    }
+    merge(first > 0 ? first - 1 : 0, std::min(last + 1, runs.size()));
+  }
+
+  // Calls visit(begin, end, state) for every run
+  template <class F>
+  void forEach(F&& visit) const
+  {
+    uint64_t begin = 0;
+    for (const auto& run : runs)
+    {
+      visit(begin, run.end, run.state);
+      begin = run.end;
+    }
+  }
+
+  uint64_t size() const { return runs.back().end; }
+  std::size_t runCount() const { return runs.size(); }
+
+private:
+  // Starts where the previous run ends
+  struct Run
+  {
+    uint64_t end;
+    T state;
+  };
+  std::vector<Run> runs;
+
+  // Returns the index of the run starting at offset, splitting the run containing it if needed
+  std::size_t split(uint64_t offset)
+  {
+    auto it = std::ranges::upper_bound(runs, offset, {}, &Run::end);
+    if (it == runs.end())
+      return runs.size();
+    const uint64_t begin = it == runs.begin() ? 0 : std::prev(it)->end;
+    const auto index = static_cast<std::size_t>(it - runs.begin());
+    if (begin == offset)
+      return index;
+    runs.insert(it, Run{offset, it->state});
+    return index + 1;
+  }
+
+  void merge(std::size_t from, std::size_t to)
+  {
+    std::size_t out = from;
+    for (std::size_t i = from + 1; i < to; ++i)
+    {
+      if (runs[i].state == runs[out].state)
+        runs[out].end = runs[i].end;
+      else
+        runs[++out] = std::move(runs[i]);
+    }
+    runs.erase(runs.begin() + out + 1, runs.begin() + to);
+  }
+};
+
+class Image;
+class Buffer;
+
 class ResourceStates
 {
+public:
   using HandleType = uint64_t;
+  // Reads of stages which were made to see the last write with these kinds of access
+  struct VisibleRead
+  {
+    vk::PipelineStageFlags2 stages = {};
+    vk::AccessFlags2 access = {};
+    bool operator==(const VisibleRead& other) const = default;
+  };
+  // The last write and all reads which were made to see it since then. Reads which are
+  // already covered by a barrier from the last write do not need another one.
+  struct AccessState
+  {
+    vk::PipelineStageFlags2 writeStages = {};
+    vk::AccessFlags2 writeAccess = {};
+    // Every read since the last write, the next write waits for all of them
+    vk::PipelineStageFlags2 readStages = {};
+    vk::AccessFlags2 readAccess = {};
+    // A barrier only makes its access visible to its own stages, so stages and access are
+    // remembered together. Only a few reads are, a forgotten one gets another barrier.
+    std::array<VisibleRead, 3> visibleReads = {};
+    bool operator==(const AccessState& other) const = default;
+  };
+  struct BarrierSource
+  {
+    vk::PipelineStageFlags2 stages;
+    vk::AccessFlags2 access;
+  };
+  // Queue family is the one whose queues own the contents of an exclusive resource,
+  // it is ignored while the contents are not owned by anyone or sharing is concurrent
   struct TextureState
   {
-    vk::PipelineStageFlags2 piplineStageFlags = {};
-    vk::AccessFlags2 accessFlags = {};
+    AccessState access;
     vk::ImageLayout layout = vk::ImageLayout::eUndefined;
-    vk::CommandBuffer owner = {};
+    uint32_t queueFamily = vk::QueueFamilyIgnored;
     bool operator==(const TextureState& other) const = default;
   };
   struct BufferState
   {
-    vk::PipelineStageFlags2 piplineStageFlags = {};
-    vk::AccessFlags2 accessFlags = {};
-    vk::CommandBuffer owner = {};
+    AccessState access;
+    uint32_t queueFamily = vk::QueueFamilyIgnored;
     bool operator==(const BufferState& other) const = default;
   };
 
-  using State = std::variant<TextureState, BufferState>;
-  std::unordered_map<HandleType, State> currentStates;
+  // Adds a read which was made to see the last write
+  static void addVisibleRead(
+    AccessState& state, vk::PipelineStageFlags2 stages, vk::AccessFlags2 access);
+
+  // Updates the state with a new access and returns the source scope of the barrier it needs
+  static std::optional<BarrierSource> applyAccess(
+    AccessState& state,
+    vk::PipelineStageFlags2 stages,
+    vk::AccessFlags2 access,
+    bool layout_transition,
+    ForceSetState force);
+
+private:
+  // Images unknown to the tracker are tracked as a single subresource
+  struct ImageState
+  {
+    uint32_t mipLevels = 1;
+    uint32_t layers = 1;
+    // Subresources are numbered mip-major, i.e. mip * layers + layer
+    StateRuns<TextureState> subresources;
+    // Released with a split barrier and not acquired yet
+    bool released = false;
+    // Created with concurrent sharing, so queues never transfer its ownership
+    bool concurrent = false;
+    // Only used for barrier statistics
+    std::string name;
+  };
+  // Runs cover the bytes of the buffer. Sizes of buffers unknown to the tracker are not
+  // known either, so such buffers are tracked as a single run covering the whole buffer.
+  struct BufferRanges
+  {
+    // Zero if unknown
+    vk::DeviceSize size = 0;
+    StateRuns<BufferState> ranges;
+    bool released = false;
+    bool concurrent = false;
+    std::string name;
+  };
+
+  // Barriers signaled by vkCmdSetEvent2 and waited on later with the same dependency info
+  struct SplitBarrier
+  {
+    vk::Event event;
+    std::uint64_t batch;
+    std::vector<vk::ImageMemoryBarrier2> imageBarriers;
+    std::vector<vk::BufferMemoryBarrier2> bufferBarriers;
+  };
+
+  // Events are reset from the host once the GPU is done with the frame that used them
+  struct EventPool
+  {
+    std::vector<vk::UniqueEvent> events;
+    std::size_t used = 0;
+    std::uint64_t batch = 0;
+  };
+
+  // Command buffers for barriers resolved from CommandBufferStates and for queue releases,
+  // reset once per frame
+  struct ProloguePool
+  {
+    vk::UniqueCommandPool pool;
+    std::vector<vk::UniqueCommandBuffer> buffers;
+    std::size_t used = 0;
+    std::uint64_t batch = 0;
+  };
+
+  // Release halves of ownership transfers, recorded on a queue of the family giving it away
+  struct QueueReleases
+  {
+    std::vector<vk::ImageMemoryBarrier2> imageBarriers;
+    std::vector<vk::BufferMemoryBarrier2> bufferBarriers;
+  };
+
+  // States are indexed by the ids given to images and buffers when they are created,
+  // raw handles passed to set_state are looked up in the maps.
+  std::vector<ImageState> images;
+  std::vector<BufferRanges> buffers;
+  std::unordered_map<HandleType, TrackedImageId> imageIds;
+  std::unordered_map<HandleType, TrackedBufferId> bufferIds;
+  // Slots of destroyed resources, reused by the next registered ones
+  std::vector<TrackedImageId> freeImageIds;
+  std::vector<TrackedBufferId> freeBufferIds;
+
+  vk::Device device;
+  const GpuWorkCount& workCount;
+  // Family of command buffers which were not registered with registerCommandBuffer
+  uint32_t defaultQueueFamily;
+  std::unordered_map<HandleType, uint32_t> commandBufferFamilies;
+  GpuSharedResource<EventPool> eventPools;
+  // Keyed by queue family, created on first use
+  std::unordered_map<uint32_t, GpuSharedResource<ProloguePool>> prologuePools;
+  std::unordered_map<uint32_t, QueueReleases> queueReleases;
+  std::unordered_map<HandleType, SplitBarrier> imageReleases;
+  std::unordered_map<HandleType, SplitBarrier> bufferReleases;
   std::vector<vk::ImageMemoryBarrier2> imgBarriersToFlush;
   std::vector<vk::BufferMemoryBarrier2> bufBarriersToFlush;
 
+  bool collectStats;
+  BarrierStats frameStats;
+  BarrierStats lastFrameStats;
+  // Requested trace starts with the next frame and is written when that frame is over
+  std::optional<std::filesystem::path> traceRequest;
+  std::optional<std::filesystem::path> tracePath;
+  // JSON objects of the commands recorded so far
+  std::vector<std::string> traceCommands;
+
+  ImageState& getImageState(vk::Image image);
+  BufferRanges& getBufferState(vk::Buffer buffer);
+  TrackedImageId allocateImageSlot();
+  TrackedBufferId allocateBufferSlot();
+  // Resets events of the current frame slot and reports releases from its previous use
+  // which were never acquired. Done by beginFrame, and by allocateEvent without it.
+  void recycleEventPool();
+  vk::Event allocateEvent();
+  vk::CommandBuffer allocatePrologue(uint32_t queue_family);
+  uint32_t getQueueFamily(vk::CommandBuffer com_buffer) const;
+  // Moves the barriers queued since the given positions into a split barrier
+  SplitBarrier release(
+    vk::CommandBuffer com_buffer,
+    std::size_t first_image_barrier,
+    std::size_t first_buffer_barrier);
+  static void acquire(vk::CommandBuffer com_buffer, const SplitBarrier& barrier);
+
+  // Accounts barriers of a single vkCmdPipelineBarrier2 or vkCmdSetEvent2 command
+  void recordBarriers(
+    bool split,
+    std::span<vk::ImageMemoryBarrier2 const> image_barriers,
+    std::span<vk::BufferMemoryBarrier2 const> buffer_barriers);
+  void finishFrameStats();
+  void writeTrace() const;
+  std::string getResourceName(vk::Image image) const;
+  std::string getResourceName(vk::Buffer buffer) const;
+
+  void transitionImage(
+    ImageState& image_state,
+    vk::Image image,
+    vk::PipelineStageFlags2 pipeline_stage_flag,
+    vk::AccessFlags2 access_flags,
+    vk::ImageLayout layout,
+    vk::ImageSubresourceRange range,
+    uint32_t queue_family,
+    ForceSetState force);
+
+  void transitionBuffer(
+    BufferRanges& state,
+    vk::Buffer buffer,
+    vk::PipelineStageFlags2 pipeline_stage_flag,
+    vk::AccessFlags2 access_flags,
+    vk::DeviceSize offset,
+    vk::DeviceSize size,
+    uint32_t queue_family,
+    ForceSetState force);
+
 public:
+  ResourceStates(
+    vk::Device dev, const GpuWorkCount& work_count, uint32_t queue_family, bool collect_stats);
+
+  // Writes the trace of the frame in progress, if one is being captured
+  ~ResourceStates();
+
+  ResourceStates(const ResourceStates&) = delete;
+  ResourceStates& operator=(const ResourceStates&) = delete;
+
+  // Called by begin_frame, finishes the stats and the trace of the previous frame
+  // and checks that resources released during the last use of the frame slot were acquired
+  void beginFrame();
+
+  // Lets the tracker follow the state of every mip level and layer of the image separately.
+  // Ownership of concurrent resources is never transferred between queue families.
+  TrackedImageId registerImage(
+    vk::Image image,
+    uint32_t mip_levels,
+    uint32_t layers,
+    std::string_view name,
+    bool concurrent = false);
+  TrackedBufferId registerBuffer(
+    vk::Buffer buffer, vk::DeviceSize size, std::string_view name, bool concurrent = false);
+
+  // Resources used in command buffers of another queue family change owners with
+  // a release and an acquire barrier. Unregistered command buffers are assumed to
+  // belong to the family the tracker was created for.
+  void registerCommandBuffer(vk::CommandBuffer com_buffer, uint32_t queue_family);
+  void unregisterCommandBuffer(vk::CommandBuffer com_buffer);
+
+  // Records the releases of resources acquired by other queue families since the last call.
+  // Returns a null handle if there are none, otherwise the command buffer has to be
+  // submitted on a queue of the family after the work that used the resources last
+  // and before the work acquiring them, which has to wait for it with a semaphore.
+  vk::CommandBuffer recordQueueReleases(uint32_t queue_family);
+
+  // Must be called when the resource is destroyed, as its handle may be reused by another one.
+  // Barriers for it that were not flushed yet are dropped.
+  void unregisterImage(vk::Image image);
+  void unregisterBuffer(vk::Buffer buffer);
+
+  std::size_t trackedImageCount() const { return imageIds.size(); }
+  std::size_t trackedBufferCount() const { return bufferIds.size(); }
+  // Barriers queued since the last flush
+  std::span<vk::ImageMemoryBarrier2 const> getPendingImageBarriers() const
+  {
+    return imgBarriersToFlush;
+  }
+
+  // Barriers of the previous frame, frames without any barriers are reported too
+  const BarrierStats& getLastFrameStats() const { return lastFrameStats; }
+  // Writes every barrier of the next frame into a JSON file once that frame is over
+  void captureTrace(std::filesystem::path path);
+
   void setBufferState(
     vk::CommandBuffer com_buffer,
     vk::Buffer buffer,
@@ -42,6 +372,43 @@ public:
     vk::AccessFlags2 access_flags,
     ForceSetState force = ForceSetState::eFalse);
 
+  // Only bytes [offset, offset + size) are synchronized, size may be VK_WHOLE_SIZE
+  void setBufferState(
+    vk::CommandBuffer com_buffer,
+    vk::Buffer buffer,
+    vk::PipelineStageFlags2 pipeline_stage_flag,
+    vk::AccessFlags2 access_flags,
+    vk::DeviceSize offset,
+    vk::DeviceSize size,
+    ForceSetState force = ForceSetState::eFalse);
+
+  // Same as above, but avoids looking the buffer up by its handle
+  void setBufferState(
+    vk::CommandBuffer com_buffer,
+    const Buffer& buffer,
+    vk::PipelineStageFlags2 pipeline_stage_flag,
+    vk::AccessFlags2 access_flags,
+    vk::DeviceSize offset,
+    vk::DeviceSize size,
+    ForceSetState force = ForceSetState::eFalse);
+
+  // Same as above for buffers registered with registerBuffer, an invalid id falls back
+  // to looking the handle up
+  void setBufferState(
+    vk::CommandBuffer com_buffer,
+    TrackedBufferId id,
+    vk::Buffer buffer,
+    vk::PipelineStageFlags2 pipeline_stage_flag,
+    vk::AccessFlags2 access_flags,
+    vk::DeviceSize offset,
+    vk::DeviceSize size,
+    ForceSetState force = ForceSetState::eFalse);
+
+  // Forgets the contents of the image: it goes back to the undefined layout, and its next use
+  // waits for the given accesses instead, e.g. made to another image sharing its memory.
+  void discardTextureContents(
+    const Image& image, vk::PipelineStageFlags2 src_stages, vk::AccessFlags2 src_access);
+
   void setExternalTextureState(
     vk::Image image,
     vk::PipelineStageFlags2 pipeline_stage_flag,
@@ -57,22 +424,125 @@ public:
     vk::ImageAspectFlags aspect_flags,
     ForceSetState force = ForceSetState::eFalse);
 
-  void setColorTarget(
+  // Only the mip levels and layers in the range are transitioned
+  void setTextureState(
     vk::CommandBuffer com_buffer,
     vk::Image image,
-    BarrierBehavior behavior = BarrierBehavior::eDefault);
+    vk::PipelineStageFlags2 pipeline_stage_flag,
+    vk::AccessFlags2 access_flags,
+    vk::ImageLayout layout,
+    vk::ImageSubresourceRange range,
+    ForceSetState force = ForceSetState::eFalse);
+
+  // Same as above, but avoids looking the image up by its handle
+  void setTextureState(
+    vk::CommandBuffer com_buffer,
+    const Image& image,
+    vk::PipelineStageFlags2 pipeline_stage_flag,
+    vk::AccessFlags2 access_flags,
+    vk::ImageLayout layout,
+    vk::ImageSubresourceRange range,
+    ForceSetState force = ForceSetState::eFalse);
+
+  // Only the subresources in the range are transitioned, other mip levels and layers
+  // of the image may be sampled while rendering to these ones
+  void setColorTarget(
+    vk::CommandBuffer com_buffer, vk::Image image, vk::ImageSubresourceRange range);
   void setDepthStencilTarget(
+    vk::CommandBuffer com_buffer, vk::Image image, vk::ImageSubresourceRange range);
+  void setResolveTarget(
+    vk::CommandBuffer com_buffer, vk::Image image, vk::ImageSubresourceRange range);
+
+  void flushBarriers(vk::CommandBuffer com_buf);
+
+  // Transitions the resource with vkCmdSetEvent2 right away instead of at the next flush,
+  // the matching acquire waits for the event. The resource must not be used in between.
+  void releaseTextureState(
     vk::CommandBuffer com_buffer,
     vk::Image image,
-    vk::ImageAspectFlags aspect_flags,
-    BarrierBehavior behavior = BarrierBehavior::eDefault);
-  void setResolveTarget(
+    vk::PipelineStageFlags2 pipeline_stage_flag,
+    vk::AccessFlags2 access_flags,
+    vk::ImageLayout layout,
+    vk::ImageSubresourceRange range);
+  void releaseBufferState(
     vk::CommandBuffer com_buffer,
+    vk::Buffer buffer,
+    vk::PipelineStageFlags2 pipeline_stage_flag,
+    vk::AccessFlags2 access_flags);
+
+  void acquireTextureState(vk::CommandBuffer com_buffer, vk::Image image);
+  void acquireBufferState(vk::CommandBuffer com_buffer, vk::Buffer buffer);
+
+  // Transitions resources into the states their first uses in the command buffer require,
+  // then takes over the states they were left in. Returns the recorded prologue command
+  // buffer to submit right before the resolved one, or a null handle if no barriers are needed.
+  vk::CommandBuffer resolve(CommandBufferStates& states);
+};
+
+// Only the first use of a resource in the command buffer is recorded as a requirement,
+// later uses are synchronized with it by barriers inside the command buffer itself.
+struct CommandBufferStates::Impl
+{
+  using HandleType = ResourceStates::HandleType;
+
+  // Layout is unused for buffers
+  struct FirstUse
+  {
+    vk::PipelineStageFlags2 stages;
+    vk::AccessFlags2 access;
+    vk::ImageLayout layout;
+    bool operator==(const FirstUse& other) const = default;
+  };
+
+  template <class T>
+  struct LocalState
+  {
+    // Empty if the command buffer does not use the subresource or range
+    std::optional<FirstUse> firstUse;
+    // Only read in the layout of the first use so far, so more reads extend the first use
+    bool readOnly = false;
+    T state;
+    bool operator==(const LocalState& other) const = default;
+  };
+
+  struct LocalImage
+  {
+    uint32_t mipLevels = 1;
+    uint32_t layers = 1;
+    vk::ImageAspectFlags aspects;
+    StateRuns<LocalState<ResourceStates::TextureState>> subresources;
+  };
+
+  // Sizes work the same way as in ResourceStates::BufferRanges
+  struct LocalBuffer
+  {
+    vk::DeviceSize size = 0;
+    StateRuns<LocalState<ResourceStates::BufferState>> ranges;
+  };
+
+  vk::CommandBuffer commandBuffer;
+  std::unordered_map<HandleType, LocalImage> images;
+  std::unordered_map<HandleType, LocalBuffer> buffers;
+  std::vector<vk::ImageMemoryBarrier2> imgBarriersToFlush;
+  std::vector<vk::BufferMemoryBarrier2> bufBarriersToFlush;
+
+  void transitionImage(
     vk::Image image,
-    vk::ImageAspectFlags aspect_flags,
-    BarrierBehavior behavior = BarrierBehavior::eDefault);
+    uint32_t mip_levels,
+    uint32_t layers,
+    vk::PipelineStageFlags2 pipeline_stage_flag,
+    vk::AccessFlags2 access_flags,
+    vk::ImageLayout layout,
+    vk::ImageSubresourceRange range);
 
-  void flushBarriers(vk::CommandBuffer com_buf);
+  // Buffer size is zero if unknown
+  void transitionBuffer(
+    vk::Buffer buffer,
+    vk::DeviceSize buffer_size,
+    vk::PipelineStageFlags2 pipeline_stage_flags,
+    vk::AccessFlags2 access_flags,
+    vk::DeviceSize offset,
+    vk::DeviceSize size);
 };
 
 } // namespace etna
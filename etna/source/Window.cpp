@@ -4,6 +4,7 @@
 #include <tracy/Tracy.hpp>
 
 #include <etna/VulkanFormatter.hpp>
+#include <etna/Etna.hpp>
 #include <etna/GlobalContext.hpp>
 
 #include "StateTracking.hpp"
@@ -84,6 +85,20 @@ Window::Window(const Dependencies& deps, CreateInfo info)
 {
 }
 
+Window::~Window()
+{
+  if (etna::is_initilized())
+    forgetSwapchainImages();
+}
+
+void Window::forgetSwapchainImages()
+{
+  // Handles of the old images may be reused by the next swapchain
+  auto& tracker = etna::get_context().getResourceTracker();
+  for (const auto& element : currentSwapchain.elements)
+    tracker.unregisterImage(element.image);
+}
+
 std::optional<Window::SwapchainImage> Window::acquireNext()
 {
   ZoneScoped;
@@ -171,7 +186,9 @@ bool Window::present(vk::Semaphore wait, vk::ImageView which)
 vk::Extent2D Window::recreateSwapchain(const DesiredProperties& props)
 {
   ETNA_VERIFY(props.resolution.width != 0 && props.resolution.height != 0);
-  currentSwapchain = createSwapchain(props);
+  auto newSwapchain = createSwapchain(props);
+  forgetSwapchainImages();
+  currentSwapchain = std::move(newSwapchain);
   swapchainInvalid = false;
 
   return currentSwapchain.extent;
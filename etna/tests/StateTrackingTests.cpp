@@ -0,0 +1,127 @@
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+
+#include <etna/GpuWorkCount.hpp>
+
+#include "StateTracking.hpp"
+
+
+// Nothing here reaches the GPU: barriers are inspected before they would be flushed,
+// so neither a device nor a command buffer is needed.
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                   \
+  do                                                                                       \
+  {                                                                                        \
+    if (!(condition))                                                                      \
+    {                                                                                      \
+      std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      ++failures;                                                                          \
+    }                                                                                      \
+  } while (false)
+
+static vk::ImageSubresourceRange mip_range(uint32_t mip)
+{
+  return vk::ImageSubresourceRange{
+    .aspectMask = vk::ImageAspectFlagBits::eColor,
+    .baseMipLevel = mip,
+    .levelCount = 1,
+    .baseArrayLayer = 0,
+    .layerCount = 1,
+  };
+}
+
+static bool touches_mip(const vk::ImageMemoryBarrier2& barrier, uint32_t mip)
+{
+  const auto& range = barrier.subresourceRange;
+  return range.baseMipLevel <= mip && mip < range.baseMipLevel + range.levelCount;
+}
+
+// Mip chain generation: each mip is rendered to while the previous one is sampled
+static void render_to_mip_while_sampling_another()
+{
+  etna::GpuWorkCount workCount{1};
+  etna::ResourceStates tracker{vk::Device{}, workCount, 0, false};
+  const auto image = vk::Image(std::bit_cast<VkImage>(std::uint64_t{1}));
+  const vk::CommandBuffer cmd{};
+  tracker.registerImage(image, 4, 1, "mip chain");
+
+  const auto sample = [&](uint32_t mip) {
+    tracker.setTextureState(
+      cmd,
+      image,
+      vk::PipelineStageFlagBits2::eFragmentShader,
+      vk::AccessFlagBits2::eShaderSampledRead,
+      vk::ImageLayout::eShaderReadOnlyOptimal,
+      mip_range(mip));
+  };
+
+  sample(0);
+  CHECK(tracker.getPendingImageBarriers().size() == 1);
+
+  tracker.setColorTarget(cmd, image, mip_range(1));
+  const auto barriers = tracker.getPendingImageBarriers();
+  CHECK(barriers.size() == 2);
+  CHECK(barriers.back().newLayout == vk::ImageLayout::eColorAttachmentOptimal);
+  CHECK(barriers.back().subresourceRange.baseMipLevel == 1);
+  CHECK(barriers.back().subresourceRange.levelCount == 1);
+
+  // The sampled mip keeps its layout while the next one is rendered to,
+  // so sampling it again needs no barrier at all
+  sample(0);
+  CHECK(tracker.getPendingImageBarriers().size() == 2);
+  for (const auto& barrier : tracker.getPendingImageBarriers())
+    if (touches_mip(barrier, 0))
+      CHECK(barrier.newLayout == vk::ImageLayout::eShaderReadOnlyOptimal);
+}
+
+// A barrier only makes its access visible to its own stages
+static void reads_are_visible_per_stage()
+{
+  etna::ResourceStates::AccessState state{
+    .writeStages = vk::PipelineStageFlagBits2::eTransfer,
+    .writeAccess = vk::AccessFlagBits2::eTransferWrite,
+  };
+  const auto needsBarrier = [&](vk::PipelineStageFlags2 stages, vk::AccessFlags2 access) {
+    return etna::ResourceStates::applyAccess(
+             state, stages, access, false, etna::ForceSetState::eFalse)
+      .has_value();
+  };
+  const auto fragment = vk::PipelineStageFlagBits2::eFragmentShader;
+  const auto compute = vk::PipelineStageFlagBits2::eComputeShader;
+  const auto sampled = vk::AccessFlagBits2::eShaderSampledRead;
+  const auto storage = vk::AccessFlagBits2::eShaderStorageRead;
+
+  CHECK(needsBarrier(fragment, sampled));
+  CHECK(!needsBarrier(fragment, sampled));
+  CHECK(needsBarrier(compute, storage));
+  // Neither of the barriers above made sampled reads visible to the compute stage
+  CHECK(needsBarrier(compute, sampled));
+  CHECK(!needsBarrier(compute, sampled));
+}
+
+// Transitions into a read-only layout are placed for the reads that follow
+static void transition_to_read_only_is_visible_to_its_reads()
+{
+  etna::ResourceStates::AccessState state{
+    .writeStages = vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+    .writeAccess = vk::AccessFlagBits2::eColorAttachmentWrite,
+  };
+  const auto stages = vk::PipelineStageFlags2{vk::PipelineStageFlagBits2::eFragmentShader};
+  const auto access = vk::AccessFlags2{vk::AccessFlagBits2::eShaderSampledRead};
+  const auto force = etna::ForceSetState::eFalse;
+  CHECK(etna::ResourceStates::applyAccess(state, stages, access, true, force).has_value());
+  CHECK(!etna::ResourceStates::applyAccess(state, stages, access, false, force).has_value());
+}
+
+int main()
+{
+  render_to_mip_while_sampling_another();
+  reads_are_visible_per_stage();
+  transition_to_read_only_is_visible_to_its_reads();
+  if (failures != 0)
+    std::fprintf(stderr, "%d checks failed\n", failures);
+  return failures == 0 ? 0 : 1;
+}
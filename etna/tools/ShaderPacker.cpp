@@ -0,0 +1,20 @@
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+
+#include <etna/ShaderBundle.hpp>
+
+
+// Usage: etna_shader_packer <output bundle> <root dir> <shader.spv>...
+int main(int argc, char** argv)
+{
+  if (argc < 4)
+  {
+    std::fprintf(stderr, "Usage: %s <output bundle> <root dir> <shader.spv>...\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<std::filesystem::path> shaders(argv + 3, argv + argc);
+  etna::pack_shader_bundle(argv[1], shaders, argv[2]);
+  return 0;
+}